@@ -35,13 +35,47 @@ extern "C"
 #endif
 
 struct FuncHooker;
+struct FuncHookerPending;
+struct FuncHookerGroup;
+
+#define FUNCHOOKER_PAUSE_BUCKETS 16
+
+#define FUNCHOOKER_MATCH_EXPORTED 1 //!< HookMatching only looks at exported functions.
+
+/*! \brief Called by HookMatching for each function it's about to hook.
+	\param[in]  funcName   - The function's name.
+	\param[in]  funcPtr    - The function's address.
+	\param[in]  context    - The context passed to HookMatching.
+	\param[out] trampoline - Set to where the hook's trampoline should be written. Starts off null.
+	\return The function to hook funcName with, or null to leave it alone.
+*/
+typedef void* (*FuncHookerInjectorFactory)(const char *funcName, const void *funcPtr, void *context, const void ***trampoline);
+
+/*! \brief How long threads were paused for while hooks were installed or removed.
+
+	<p>Each pause is timed from the moment threads start being paused to the moment they've
+	all been resumed. histogram[0] counts pauses under 1us,
+	histogram[i] counts pauses of at least 2^(i-1)us but under 2^i us, and the last bucket also
+	counts every longer pause.</p>
+*/
+struct FuncHookerPauseStats
+{
+	unsigned pauses;                              //!< Pauses taken.
+	unsigned overBudget;                          //!< Pauses which took longer than asked for.
+	double maxPauseMicroseconds;                  //!< Longest pause.
+	double totalPauseMicroseconds;                //!< All pauses added together.
+	unsigned histogram[FUNCHOOKER_PAUSE_BUCKETS]; //!< Pauses by length.
+};
 
 /*! \brief Creates a FuncHooker object to hook the FunctionPtr passed.
     \param[in] FunctionPtr  - A pointer to the function which you are hooking
 	\param[in] InjectionPtr - A pointer to the function which will hook FunctionPtr
 
-	Note: This only creates the function hooking object. InstallHook must be called for the 
-	actual hook to take place.
+	<p>Note: This only creates the function hooking object. InstallHook must be called for the 
+	actual hook to take place.</p>
+
+	<p>Function hooking objects may be created and destroyed from any number of threads at once.
+	No external locking is needed.</p>
 
 	\return A pointer to a function hooker object. Null on failure.
 */
@@ -65,6 +99,10 @@ FUNCHOOKER_DLLAPI FuncHooker* FUNCHOOKER_DLLCALL CreateFuncHooker(void *Function
 	<p>Note: Currently, there is a hack in SymbolFinder.cpp:GetSymbolAddr which treats a null moduleHint
 	as though you wanted to start the search with kernel32.dll.</p>
 
+	<p>On Linux nothing is indexed up front. Each module's own .gnu.hash table is queried, those
+	whose names start with moduleHint first, and ifuncs resolve to the implementation the loader
+	picked.</p>
+
 	<p>Note: This only creates the function hooking object. InstallHook must be called for the 
 	actual hook to take place.</p>
 
@@ -72,6 +110,81 @@ FUNCHOOKER_DLLAPI FuncHooker* FUNCHOOKER_DLLCALL CreateFuncHooker(void *Function
 */
 FUNCHOOKER_DLLAPI FuncHooker* FUNCHOOKER_DLLCALL CreateFuncHookerFromName(const char *funcName, void *InjectionPtr, const char *moduleHint=nullptr);
 
+/*! \brief Hooks the function with the passed name once a module defining it is loaded.
+    \param[in]  funcName     - The name of the function you are trying to hook
+	\param[in]  InjectionPtr - A pointer to the function which will be hooking the function named funcName
+	\param[in]  moduleHint   - Only modules with this name are searched. On Linux, modules whose names
+	                           start with it. Null to take the first module defining funcName.
+	\param[out] trampoline   - Set to the hook's trampoline just before the hook is installed, and to
+	                           null while it isn't. May be null.
+
+	<p>If a module defining funcName is already loaded the hook is installed straight away.
+	Otherwise it waits, and is installed as soon as such a module is loaded, without the caller
+	polling for it. Every hook waiting on a module is installed under the same pause. If the
+	module is unloaded, the hook goes back to waiting for it to be loaded again.</p>
+
+	<p>On Windows hooks go in before the module's DllMain runs. On Linux the loader's debugger
+	breakpoint is hooked to find out about modules, and hooks go in before the module's
+	initializers run. Exported and local functions are both found. An ifunc can't be resolved
+	until its module is relocated, so it's hooked once the loader is done with the module, after
+	the module's initializers have run.</p>
+
+	<p>Hooks are installed from within the loader, on whichever thread loaded the module. Ifuncs
+	are hooked from a thread of their own, or by this call if the module is already loaded.</p>
+
+	\return A handle to the pending hook, to pass to DestroyPendingFuncHooker. Null on failure.
+*/
+FUNCHOOKER_DLLAPI FuncHookerPending* FUNCHOOKER_DLLCALL CreatePendingFuncHooker(const char *funcName, void *InjectionPtr, const char *moduleHint, const void **trampoline);
+
+/*! \brief Gets the hook a pending hook has installed.
+	\param[in] pending - The pending hook.
+	\return The installed hook, or null while it's waiting for its module. The pending hook keeps
+	        ownership of it.
+*/
+FUNCHOOKER_DLLAPI FuncHooker* FUNCHOOKER_DLLCALL GetPendingFuncHooker(FuncHookerPending *pending);
+
+/*! \brief Stops a pending hook from waiting, and removes and destroys its hook if it was installed.
+	\param[in] pending - The pending hook.
+*/
+FUNCHOOKER_DLLAPI void FUNCHOOKER_DLLCALL DestroyPendingFuncHooker(FuncHookerPending *pending);
+
+/*! \brief Hooks every function whose name matches a pattern.
+	\param[in] pattern         - The names to hook. * matches any run of characters and ? any one.
+	\param[in] moduleFilter    - Only modules whose names match this pattern are searched, "libc*" say.
+	                              Null to search every module.
+	\param[in] injectorFactory - Called once per function, on this thread, for the function to hook it with.
+	\param[in] context         - Passed to injectorFactory.
+	\param[in] flags           - FUNCHOOKER_MATCH_EXPORTED, or 0 to match local functions as well.
+
+	<p>Functions with more than one matching name are hooked once, under the first of them. Each
+	hook is prepared in parallel, every trampoline is written, and then all the hooks are installed
+	under a single pause. Functions that can't be hooked are skipped, and GetFuncHookerGroupHook
+	gives null for them.</p>
+
+	<p>Patterns are matched against every function of every module searched, libc internals
+	included. Keep them narrow.</p>
+
+	\return A handle to the hooks, to pass to DestroyFuncHookerGroup. Null on failure, in which
+	        case any trampoline that was written is set back to null.
+*/
+FUNCHOOKER_DLLAPI FuncHookerGroup* FUNCHOOKER_DLLCALL HookMatching(const char *pattern, const char *moduleFilter, FuncHookerInjectorFactory injectorFactory, void *context, unsigned flags);
+
+/*! \brief Gets how many functions a group hooked, counting those which couldn't be hooked. */
+FUNCHOOKER_DLLAPI unsigned FUNCHOOKER_DLLCALL GetFuncHookerGroupCount(const FuncHookerGroup *group);
+
+/*! \brief Gets one of a group's hooks.
+	\return The hook, or null if its function couldn't be hooked. The group keeps ownership of it.
+*/
+FUNCHOOKER_DLLAPI FuncHooker* FUNCHOOKER_DLLCALL GetFuncHookerGroupHook(const FuncHookerGroup *group, unsigned index);
+
+/*! \brief Gets the name of the function one of a group's hooks is on. */
+FUNCHOOKER_DLLAPI const char* FUNCHOOKER_DLLCALL GetFuncHookerGroupName(const FuncHookerGroup *group, unsigned index);
+
+/*! \brief Removes all of a group's hooks under a single pause, and destroys them.
+	\param[in] group - The group.
+*/
+FUNCHOOKER_DLLAPI void FUNCHOOKER_DLLCALL DestroyFuncHookerGroup(FuncHookerGroup *group);
+
 /*! \brief Returns the trampoline pointer for a function hooking object.
 	\param[in] hooker - A pointer to the function hooking object.
 
@@ -100,6 +213,40 @@ FUNCHOOKER_DLLAPI const void* FUNCHOOKER_DLLCALL GetTrampoline(const FuncHooker
 */
 FUNCHOOKER_DLLAPI bool FUNCHOOKER_DLLCALL InstallHook(FuncHooker *hooker);
 
+/*! \brief Installs many function hooks without pausing the process for too long at once.
+	\param[in]  hookers      - The function hooking objects to install.
+	\param[in]  count        - The number of entries in hookers. Null entries are skipped.
+	\param[in]  maxPauseUs   - The longest the process's threads should be paused for at a time.
+	\param[out] stats        - Filled in with how long threads were paused for. May be null.
+
+	<p>Installing hooks one at a time pauses every thread once per hook, while installing a
+	large number under one pause can stall the process for a long time. Instead, the hooks are
+	installed in chunks, and threads are resumed and left to run between chunks.</p>
+
+	<p>Chunks are sized as installation goes. Every pause is timed, split into the fixed cost
+	of pausing and resuming threads and the cost of each hook written, and the next chunk is
+	as large as will fit in maxPauseUs by those estimates. The first chunk is a single hook.
+	If pausing the threads alone takes longer than maxPauseUs, hooks are installed one at a
+	time and the pauses are counted in stats->overBudget.</p>
+
+	<p>All the slow work of preparing hooks is done before any threads are paused.</p>
+
+	\return The number of hooks which are installed.
+*/
+FUNCHOOKER_DLLAPI unsigned FUNCHOOKER_DLLCALL InstallHooksBounded(FuncHooker **hookers, unsigned count, unsigned maxPauseUs, FuncHookerPauseStats *stats);
+
+/*! \brief Gets every pause taken to install or remove hooks since the last ResetFuncHookerPauseStats.
+	\param[out] stats - Filled in with the pauses. overBudget is always 0.
+
+	<p>Each install or removal pauses the process once, and InstallHooksBounded pauses once per
+	chunk. Only copying the new code and moving threads out of the way of it happens while
+	threads are paused; everything else is worked out beforehand.</p>
+*/
+FUNCHOOKER_DLLAPI void FUNCHOOKER_DLLCALL GetFuncHookerPauseStats(FuncHookerPauseStats *stats);
+
+/*! \brief Clears the pauses GetFuncHookerPauseStats reports. */
+FUNCHOOKER_DLLAPI void FUNCHOOKER_DLLCALL ResetFuncHookerPauseStats(void);
+
 /*! \brief Uninstalls a function hook.
 	\param[in] hooker - A pointer to the function hooking object.
 	
@@ -117,11 +264,43 @@ FUNCHOOKER_DLLAPI void FUNCHOOKER_DLLCALL RemoveHook(FuncHooker *hooker);
 /*! \brief Destroys a function hooking object
 	\param[in] hooker - A pointer to the function hooking object.
 
-	Destroys and frees all memory associated with the function hook. If the hook was still
-	installed, it is removed. All traces of the hooking having taken place are removed.
+	<p>Destroys and frees all memory associated with the function hook. If the hook was still
+	installed, it is removed. All traces of the hooking having taken place are removed.</p>
+
+	<p>Other threads may still be running the hook's trampoline, so its memory is not freed
+	immediately. It is freed by a later ReclaimFuncHookerMemory, once no thread is using it.
+	The trampoline must not be called again once this returns.</p>
+
+	\sa ReclaimFuncHookerMemory
 */
 FUNCHOOKER_DLLAPI void FUNCHOOKER_DLLCALL DestroyFuncHooker(FuncHooker *hooker);
 
+/*! \brief Frees the trampolines of destroyed hooks which no thread is still using.
+
+	<p>Each thread is briefly paused on its own, suspended on Windows and parked with a signal
+	on Linux, and its registers and stack are checked for references to trampolines.
+	Trampolines still in use are kept and checked again next time. Threads are never all
+	paused at once. On Linux, if a thread has the park signal blocked, nothing is freed.</p>
+
+	<p>This also happens on its own once enough trampolines are waiting, so calling it is
+	only needed to release memory sooner.</p>
+
+	\return The number of trampolines freed.
+*/
+FUNCHOOKER_DLLAPI unsigned FUNCHOOKER_DLLCALL ReclaimFuncHookerMemory(void);
+
+/*! \brief Keeps track of threads as they start and exit, so installing hooks pauses them faster.
+
+	<p>Without this, every install and removal lists the process's threads over and over until no
+	new ones turn up. Once enabled, threads record themselves as they start and exit, and are all
+	paused in a single pass. Threads starting during a pause wait until it's over.</p>
+
+	<p>Threads started by anything other than pthread_create on Linux are missed. Tracking can't
+	be turned off again. On Linux it needs OSUtilities built with THREAD_REGISTRY_HOOK_PTHREAD,
+	which replaces pthread_create for the whole program, and otherwise does nothing.</p>
+*/
+FUNCHOOKER_DLLAPI void FUNCHOOKER_DLLCALL TrackFuncHookerThreads(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,7 +18,9 @@
 
 /*! \brief Wraps the C function hooking interface.
 
-    You should never create one of these directly. Create them using factory functions.
+    <p>You should never create one of these directly. Create them using factory functions.</p>
+	<p>The wrapper is deliberately just the C handle, with no virtual functions, so it costs a
+	single pointer per hook. Delete the FuncHookerImpl the factory returned, not the wrapper.</p>
 
 	\sa CreateFuncHooker
 */
@@ -27,17 +29,19 @@ class FuncHookerWrapper
 	private:
 		FuncHooker *hooker;
 
+	protected:
+		// Not virtual, so only FuncHookerImpl may destroy a wrapper.
+		~FuncHookerWrapper()
+		{
+			::DestroyFuncHooker(hooker);
+		}
+
 	public:
 		FuncHookerWrapper(void *FunctionPtr, void *InjectionPtr) : 
 		                  hooker(::CreateFuncHooker(FunctionPtr, InjectionPtr)) {}
 
 		FuncHookerWrapper(const char *funcName, void *InjectionPtr, const char *moduleHint=nullptr) :
 						  hooker(::CreateFuncHookerFromName(funcName, InjectionPtr, moduleHint)){}
-		
-		virtual ~FuncHookerWrapper()
-		{
-			::DestroyFuncHooker(hooker);
-		}
 
 		/*! \brief Simply calls the C interface for getting a trampoline.
 
@@ -145,8 +149,6 @@ class FuncHookerImpl<FUNCTION_TYPE(N, CC, CONST, VOLATILE, MEMBER, VOID)> : publ
 		                  FuncHookerWrapper(injecteeFuncName, reinterpret_cast<void*>(InjectorFunc), module){}  \
 						                                                                                        \
 	public:                                                                                                     \
-		virtual ~FuncHookerImpl() {}                                                                            \
-		                                                                                                        \
 		MMP_IF_ELSE(VOID, void, R) CallInjectee(MMP_IF(MEMBER, C* c) MMP_COMMA_IF(MMP_AND(MEMBER, MMP_BOOL(N))) \
 		    MMP_ENUM_MC(N, PARAMETER_LIST)) const                                                               \
 		{                                                                                                       \
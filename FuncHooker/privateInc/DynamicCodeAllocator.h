@@ -11,6 +11,7 @@
 #define DYNAMIC_CODE_ALLOCATOR_H
 
 #include <vector>
+#include <mutex>
 #include "PageManager.h"
 #include "MemoryTree.h"
 
@@ -29,17 +30,46 @@ namespace std
 }
 
 /*! \brief Allocator for sections of dynamically generated code.
+
+    <p>Safe to use from any number of threads. Each thread allocates from and frees
+	to a small cache of objects, selected by hashing the thread's id. Caches are refilled
+	from (and overflow back into) the shared free tree in batches, so the arena lock is
+	only taken once every few allocations, and pages are only ever mapped while holding it.</p>
 */
 class DynamicCodeAllocator
 {
 	private:
 		typedef std::vector<unsigned char*> PageList;
 
-        unsigned size;           //!< Size (in bytes) of the allocation unit
-		PageManager pageManager; //!< Manager pages of memory for the allocator.
-		PageList pageList;       //!< All pages in use.
-		MemoryTree freeTree;     //!< All free blocks of memory
+		enum
+		{
+			CACHE_STRIPES = 16, //!< Number of thread caches. Threads are hashed into these.
+			CACHE_SIZE    = 16, //!< Maximum objects held by a single thread cache.
+			CACHE_REFILL  = 8   //!< Objects moved between a cache and the arena at once.
+		};
+
+		//! \brief A handful of free objects, reserved for the threads hashing to it.
+		struct StubCache
+		{
+			std::mutex lock;
+			void *objects[CACHE_SIZE];
+			unsigned count;
+
+			StubCache();
+		};
+
+        unsigned size;                    //!< Size (in bytes) of the allocation unit
+		PageManager pageManager;          //!< Manager pages of memory for the allocator.
+		PageList pageList;                //!< All pages in use.
+		MemoryTree freeTree;              //!< All free blocks of memory
+		std::mutex arenaLock;             //!< Guards pageManager, pageList and freeTree.
+		StubCache caches[CACHE_STRIPES];  //!< Per thread object caches.
 
+		StubCache& GetThreadCache();
+		void *TakeFromCache(StubCache& cache, void *nearAddr);
+		void RefillCache(StubCache& cache, void *nearAddr) throw(std::memory_exception);
+		void FlushCache(StubCache& cache, unsigned count);
+		void *AllocateFromArena(void *nearAddr) throw(std::memory_exception);
 		void CreatePage(void *addrNear) throw(std::memory_exception);
 
         DynamicCodeAllocator(const DynamicCodeAllocator&);            // Do not implement
@@ -59,6 +89,8 @@ class DynamicCodeAllocator
 		void Free(void *object) throw(std::memory_exception);
 
         /// \brief Frees all empty pages
+		///
+		/// Drains every thread cache back into the arena first, so this is comparatively slow.
         unsigned FreeEmptyPages(void);
 };
 
@@ -11,16 +11,36 @@
 #define FUNC_HOOKER_CPP_H
 
 #include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
 
 struct InjectionStub;
 class  Disassembler;
 class DynamicCodeAllocator;
-
+class StubReclaimer;
+class InstallScheduler;
+class PendingHooks;
+class PatchPlan;
+
+/*! \brief Internal record for a single hook.
+
+	<p>Programs may hold on to a very large number of these, so the record is kept small. The
+	disassembler only lives while a hook is being prepared, backups of the code overwritten are
+	stored inline, and records are pooled in contiguous chunks rather than allocated
+	individually.</p>
+*/
 struct FuncHooker
 {
 	private:
 		typedef unsigned char uint8_t;
 
+		enum
+		{
+			MAX_BACKUP_SIZE       = 32, //!< Longest jump we write plus the longest instruction it can split.
+			MAX_PROXY_BACKUP_SIZE = 16  //!< Longest proxy jump we write.
+		};
+
 		struct DeadZone
 		{
 			uint8_t *addr;
@@ -29,44 +49,60 @@ struct FuncHooker
 			DeadZone(uint8_t *addr=NULL, unsigned len=0);
 		};
 
-		static DynamicCodeAllocator *stubArea;
-		static unsigned instances;
+		static DynamicCodeAllocator *stubArea;    //!< Shared by all hooks. Valid while instances is non-zero.
+		static std::atomic<unsigned> instances;   //!< References to stubArea
+		static std::mutex stubAreaLock;           //!< Only taken to create or destroy stubArea
+		static std::mutex patchLock;              //!< Serializes all writes to hooked code pages
 
-		bool installed;
 		InjectionStub *stubCode;
 		void* InjectionFunc;
-
 		uint8_t* injectionJumpTarget;
-		unsigned overwriteSize;
+		uint8_t *funcPtr;
 
-		uint8_t* backupCode;
-		uint8_t* proxyBackupCode;
-		unsigned proxyBackupCodeSize;
-		unsigned backupCodeSize;
+		uint8_t backupCode[MAX_BACKUP_SIZE];
+		uint8_t proxyBackupCode[MAX_PROXY_BACKUP_SIZE];
 
+		uint8_t overwriteSize;
+		uint8_t backupCodeSize;
+		uint8_t proxyBackupCodeSize;
+		bool installed;
 		bool hotpatchable;
 
-		Disassembler *disasm;
-		uint8_t *funcPtr;
+		static void AcquireStubArea();
+		static void ReleaseStubArea();
 
 		void FindFunctionBody();
-		DeadZone FindNearestDeadZone(uint8_t *start, unsigned delta, unsigned minSize = 0);
+		DeadZone FindNearestDeadZone(Disassembler &disasm, uint8_t *start, unsigned delta, unsigned minSize = 0);
 		bool PrepareFunctionForHook();
+		bool Prepare();
+		void Abandon();
+		void PlanInstall(PatchPlan &plan) const;
+		void PlanRemove(PatchPlan &plan) const;
 		void InstallProxy(const DeadZone& zone, void *stubDist, void *injectDist, uint8_t *stubMem, unsigned deadZoneMinSize);
-		bool RelocateFunctionHeader(unsigned headerSize);
+		bool RelocateFunctionHeader(Disassembler &disasm, unsigned headerSize);
 
 		FuncHooker(const FuncHooker&);            // Do not implement
 		FuncHooker& operator=(const FuncHooker&); // Do not implement
 
+		friend class StubReclaimer;    // Releases the stub area reference of each stub it frees.
+		friend class InstallScheduler; // Plans hooks in batches to apply under one pause.
+		friend class PendingHooks;     // Hands out trampolines before installing, and drops hooks on unload.
+		friend struct FuncHookerGroup; // Installs and removes many hooks under one pause.
+
 	public:
 		FuncHooker(void *FunctionPtr, void *InjectionPtr);
-		virtual ~FuncHooker();
+		~FuncHooker();
+
+		static void *operator new(size_t size);
+		static void operator delete(void *mem);
 
 		const void *GetTrampoline() const;
 
 		bool InstallHook();
 		void RemoveHook();
 
+		static unsigned ReclaimStubs();
+
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,64 @@
+/************************************************************************************\
+ * FuncHooker - An Andrew Shurney Production                                        *
+\************************************************************************************/
+
+/*! \file		FuncHookerGroup.h
+ *  \author		Andrew Shurney
+ *  \brief		Hooks on every function matching a pattern, installed and removed together
+ */
+
+#ifndef FUNC_HOOKER_GROUP_H
+#define FUNC_HOOKER_GROUP_H
+
+#include <string>
+#include <vector>
+#include "FuncHooker.h"
+
+/*! \brief A set of hooks made from one pattern, which go in and come out under one pause each.
+
+	<p>Matching names are found by the SymbolFinder, and names sharing an address are hooked
+	once. The injector factory is asked for each hook's injection function on the calling
+	thread. Disassembling and building trampolines, the slow part, is then split across a
+	thread per core. Trampolines are handed out before anything is installed.</p>
+*/
+struct FuncHookerGroup
+{
+	private:
+		struct Hook
+		{
+			std::string name;
+			const void *target;
+			void *injection;
+			const void **trampoline;  //!< Where the factory asked for the trampoline. May be null.
+			FuncHooker *hooker;       //!< Null if the function couldn't be hooked.
+		};
+		typedef std::vector<Hook> Hooks;
+
+		Hooks hooks;
+
+		FuncHookerGroup(const FuncHookerGroup&);            // Do not implement
+		FuncHookerGroup& operator=(const FuncHookerGroup&); // Do not implement
+
+		void Prepare();
+
+	public:
+		FuncHookerGroup();
+		~FuncHookerGroup();
+
+		/*! \brief Finds the functions to hook and asks the factory how to hook each one. */
+		void Match(const char *pattern, const char *moduleFilter, unsigned flags, FuncHookerInjectorFactory factory, void *context);
+
+		/*! \brief Prepares every hook, then installs them all under a single pause.
+			\return False if they couldn't be installed, in which case every trampoline slot is cleared.
+		*/
+		bool Install();
+
+		/*! \brief Removes every installed hook under a single pause. */
+		void Remove();
+
+		unsigned GetCount() const;
+		FuncHooker *GetHooker(unsigned index) const;
+		const char *GetName(unsigned index) const;
+};
+
+#endif
@@ -0,0 +1,65 @@
+/************************************************************************************\
+ * FuncHooker - An Andrew Shurney Production                                        *
+\************************************************************************************/
+
+/*! \file		InstallScheduler.h
+ *  \author		Andrew Shurney
+ *  \brief		Installs hooks in chunks sized to a maximum pause
+ */
+
+#ifndef INSTALL_SCHEDULER_H
+#define INSTALL_SCHEDULER_H
+
+#include <vector>
+#include <cstddef>
+#include "FuncHooker.h"
+
+/*! \brief Installs a set of hooks in chunks, each under its own pause.
+
+	<p>Every hook is prepared before any thread is paused. Hooks are then written a chunk at
+	a time, with threads paused for the chunk and resumed and given a chance to run before the
+	next one.</p>
+
+	<p>Each chunk is one PatchPlan, and its pause is timed in three parts: pausing the threads,
+	writing the hooks and resuming the threads. Pausing and resuming make up a fixed cost, writing is a cost per hook, and both
+	are kept as running averages. The next chunk is the largest which those averages say will
+	fit in the pause allowed. It starts at one hook, may at most double from one chunk to the
+	next, and is halved after a pause which ran over.</p>
+*/
+class InstallScheduler
+{
+	private:
+		typedef std::vector<FuncHooker*> Hooks;
+
+		double maxPauseUs;       //!< Longest we'd like to pause threads for.
+		double fixedCostUs;      //!< Running average of pausing and resuming threads.
+		double perHookUs;        //!< Running average of writing a single hook.
+		unsigned samples;        //!< Pauses the averages are made from.
+		unsigned lastChunk;      //!< Hooks written under the last pause.
+		bool lastOverBudget;     //!< The last pause ran over maxPauseUs.
+		FuncHookerPauseStats stats;
+
+		InstallScheduler(const InstallScheduler&);            // Do not implement
+		InstallScheduler& operator=(const InstallScheduler&); // Do not implement
+
+		unsigned NextChunkSize(size_t remaining) const;
+		unsigned InstallChunk(FuncHooker **hooks, unsigned count);
+		void Learn(unsigned hooks, double fixedUs, double writeUs);
+
+	public:
+		InstallScheduler(unsigned maxPauseUs);
+
+		/*! \brief Installs every hook in hookers which isn't already installed.
+			\return The number of hooks installed, counting those which already were.
+		*/
+		unsigned Install(FuncHooker **hookers, unsigned count);
+
+		/*! \brief Installs hooks which have all been prepared already, under a single pause.
+			\return The number of hooks installed. Either all of them or none.
+		*/
+		unsigned InstallPrepared(FuncHooker **hookers, unsigned count);
+
+		const FuncHookerPauseStats& GetStats() const;
+};
+
+#endif
@@ -0,0 +1,95 @@
+/************************************************************************************\
+ * FuncHooker - An Andrew Shurney Production                                        *
+\************************************************************************************/
+
+/*! \file		PatchPlan.h
+ *  \author		Andrew Shurney
+ *  \brief		Code writes worked out in full before any thread is paused
+ */
+
+#ifndef PATCH_PLAN_H
+#define PATCH_PLAN_H
+
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include "SingleThreadBlock.h"
+#include "FuncHooker.h"
+
+/*! \brief Every byte to write and every instruction pointer to move for a set of hooks.
+
+	<p>Threads paused while holding the heap lock would deadlock anything which allocates
+	during the pause, and everything done during the pause lengthens it. So hooks are planned
+	first: the final bytes of each patch are encoded, the bytes they replace are recorded and
+	the ranges threads need moving out of are listed. Apply then only makes the pages writable,
+	pauses, copies bytes and moves instruction pointers.</p>
+
+	<p>Every pause Apply takes is timed and added to process wide statistics.</p>
+*/
+class PatchPlan
+{
+	public:
+		enum
+		{
+			MAX_PATCH_SIZE = 32 //!< Longest run of bytes a single patch writes.
+		};
+
+		struct PauseTiming
+		{
+			double stopUs;   //!< Pausing every other thread.
+			double applyUs;  //!< Copying the patches and moving instruction pointers.
+			double resumeUs; //!< Resuming the threads.
+
+			double GetTotalUs() const;
+		};
+
+	private:
+		struct Patch
+		{
+			uint8_t *target;
+			unsigned size;
+			uint8_t newBytes[MAX_PATCH_SIZE];
+			uint8_t oldBytes[MAX_PATCH_SIZE]; //!< What target held when planned.
+		};
+
+		typedef std::vector<Patch> Patches;
+		typedef std::vector<SingleThreadBlock::IPRemap> IPRemaps;
+
+		Patches patches;
+		IPRemaps remaps;
+
+		static std::mutex statsLock;
+		static FuncHookerPauseStats stats;
+
+		PatchPlan(const PatchPlan&);            // Do not implement
+		PatchPlan& operator=(const PatchPlan&); // Do not implement
+
+	public:
+		PatchPlan();
+
+		void Reserve(unsigned patchCount);
+
+		/*! \brief Adds size bytes to be copied from newBytes over target. */
+		void AddPatch(void *target, const void *newBytes, unsigned size);
+
+		/*! \brief Threads found from start to start+range are moved to the same offset from dest. */
+		void AddRemap(const void *start, unsigned range, void *dest);
+
+		unsigned GetPatchCount() const;
+
+		/*! \brief Pauses every other thread and applies the plan.
+
+			<p>The caller must hold the lock serializing code writes, so pages don't have their
+			protection changed underneath us.</p>
+		*/
+		PauseTiming Apply();
+
+		/*! \brief Adds a pause to stats. A zero budgetUs never counts as over budget. */
+		static void RecordPause(FuncHookerPauseStats& stats, double pauseUs, double budgetUs);
+
+		/*! \brief Every pause taken by Apply since the last ResetPauseStats. */
+		static void GetPauseStats(FuncHookerPauseStats& out);
+		static void ResetPauseStats();
+};
+
+#endif
@@ -0,0 +1,106 @@
+/************************************************************************************\
+ * FuncHooker - An Andrew Shurney Production                                        *
+\************************************************************************************/
+
+/*! \file		PendingHooks.h
+ *  \author		Andrew Shurney
+ *  \brief		Hooks waiting for the module they're in to be loaded
+ */
+
+#ifndef PENDING_HOOKS_H
+#define PENDING_HOOKS_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include "FuncHooker.h"
+#include "ModuleExplorer.h"
+
+/*! \brief A hook by name, installed whenever a module defining the name is loaded. */
+struct FuncHookerPending
+{
+	std::string funcName;
+	std::string moduleHint;   //!< Empty to take the name from any module.
+	void *injection;
+	const void **trampoline;  //!< Where to put the trampoline. May be null.
+	FuncHooker *hooker;       //!< Null while waiting for a module.
+	const void *moduleBase;   //!< The module hooker is in.
+};
+
+/*! \brief Every pending hook, installing them as the ModuleWatcher reports modules loading.
+
+	<p>All the hooks a newly loaded module satisfies are prepared, have their trampolines handed
+	out, and are then installed together under a single pause. If the module is unloaded again,
+	its hooks are dropped without touching the unmapped code and go back to waiting.</p>
+
+	<p>On Windows the loader tells the ModuleWatcher about each module before running its entry
+	point. On Linux the loader's breakpoint (r_debug.r_brk) is hooked the first time a pending
+	hook is made, and the watcher is refreshed from there each time the loader's module list is
+	consistent. That's before the new module's relocations and initializers have run, so hooks
+	are in place before any of its code is.</p>
+
+	<p>An ifunc's resolver can't be called until its module is relocated, which happens after the
+	breakpoint. Hooks on ifuncs are put aside, and a thread is started which waits for the loader
+	to be done, calls the resolvers and installs those hooks. Add does the same itself, once it
+	has let go of the locks.</p>
+
+	<p>Lock order is the ModuleWatcher's lock, then ours, as the watcher calls us with its lock
+	held.</p>
+*/
+class PendingHooks
+{
+	private:
+		typedef std::vector<FuncHookerPending*> Hooks;
+
+		Hooks hooks;
+		std::mutex lock;
+		std::once_flag watching;
+		unsigned listenerId;
+#ifndef WIN32
+		struct Ifunc
+		{
+			FuncHookerPending *pending;
+			std::string funcName;      //!< To tell pending apart from another hook at its address.
+			const void *moduleBase;
+			const void *resolver;
+		};
+		typedef std::vector<Ifunc> Ifuncs;
+
+		FuncHooker *breakpointHook;  //!< On the loader's breakpoint.
+		Ifuncs ifuncs;               //!< Found by Install, waiting for their modules to be relocated.
+#endif
+
+		PendingHooks();
+		~PendingHooks();
+
+		PendingHooks(const PendingHooks&);            // Do not implement
+		PendingHooks& operator=(const PendingHooks&); // Do not implement
+
+		void StartWatching();
+		void ModulesChanged(const ModuleExplorer::Modules& loaded, const ModuleExplorer::Modules& unloaded);
+		void Install(const ModuleExplorer::Modules& modules, const Hooks& waiting);
+		bool Prepare(FuncHookerPending *pending, const void *target, const void *moduleBase, std::vector<FuncHooker*>& batch, Hooks& prepared);
+		void InstallPrepared(std::vector<FuncHooker*>& batch, const Hooks& prepared);
+
+		static bool IsHinted(const Module& mod, const std::string& moduleHint);
+		static const void *FindInModule(const Module& mod, const char *name);
+#ifndef WIN32
+		void InstallIfuncs(Ifuncs waiting);
+
+		static const void *FindIfunc(const Module& mod, const char *name);
+		static void LoaderBreakpoint();
+#endif
+
+	public:
+		static PendingHooks& Get();
+
+		/*! \brief Installs a hook now if its module is already loaded, or whenever it is. */
+		FuncHookerPending *Add(const char *funcName, void *injection, const char *moduleHint, const void **trampoline);
+
+		/*! \brief Stops waiting, and removes the hook if it's installed. */
+		void Remove(FuncHookerPending *pending);
+
+		FuncHooker *GetHooker(FuncHookerPending *pending);
+};
+
+#endif
@@ -0,0 +1,92 @@
+/************************************************************************************\
+ * FuncHooker - An Andrew Shurney Production                                        *
+\************************************************************************************/
+
+/*! \file		StubReclaimer.h
+ *  \author		Andrew Shurney
+ *  \brief		Frees trampolines once no thread can still be executing them
+ */
+
+#ifndef STUB_RECLAIMER_H
+#define STUB_RECLAIMER_H
+
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+struct InjectionStub;
+class DynamicCodeAllocator;
+
+/*! \brief Defers freeing trampolines until no thread can still be running them.
+
+	<p>When a hook is destroyed, another thread may be part way through its relocated function
+	header, or inside a function the header called. Freeing the stub then would have that
+	thread execute whatever is allocated there next. Instead, destroyed hooks retire their stubs
+	here.</p>
+
+	<p>Reclaim compares every thread's registers, and every word between its stack pointer and
+	stack base, against the retired stubs. Each thread is paused on its own, scanned, and let go
+	before the next, so the process is never stopped as a whole. On Windows the thread is
+	suspended. On Linux a SingleThreadBlock parks just that thread, and its registers are read
+	from where the park signal interrupted it. If a thread couldn't be parked, or its stack
+	couldn't be found, nothing is freed that pass. Stubs nothing points into are freed, the rest
+	wait for the next pass. Scanning is conservative; a stale value which happens to point into
+	a stub only delays its reclamation.</p>
+
+	<p>Retire reclaims on its own once the pending stubs reach AUTO_RECLAIM_THRESHOLD, or twice
+	what the last pass left behind, whichever is more.</p>
+
+	<p>Every retired stub holds a reference to the stub area it came from, so the allocator
+	outlives all of its retired stubs.</p>
+*/
+class StubReclaimer
+{
+	private:
+		enum
+		{
+			AUTO_RECLAIM_THRESHOLD = 256 //!< Fewest retired stubs which trigger a reclaim on their own.
+		};
+
+		struct RetiredStub
+		{
+			InjectionStub *stub;
+			DynamicCodeAllocator *allocator;
+
+			RetiredStub(InjectionStub *stub, DynamicCodeAllocator *allocator);
+		};
+
+		typedef std::vector<RetiredStub> RetiredStubs;
+		typedef std::vector<uint8_t*> StubStarts;
+
+		std::mutex lock;        //!< Guards retired.
+		std::mutex reclaimLock; //!< Only one reclaim pass runs at a time.
+		RetiredStubs retired;   //!< Stubs waiting to be freed.
+		size_t reclaimAt;       //!< Pending count at which Retire reclaims. Guarded by lock.
+
+		StubReclaimer();
+		StubReclaimer(const StubReclaimer&);            // Do not implement
+		StubReclaimer& operator=(const StubReclaimer&); // Do not implement
+
+		static void MarkReferenced(const StubStarts& starts, std::vector<char>& referenced, const void *addr);
+		static void ScanStack(const StubStarts& starts, std::vector<char>& referenced, const void *sp, const void *stackBase);
+		static void MarkRunning(const StubStarts& starts, std::vector<char>& referenced);
+
+	public:
+		static StubReclaimer& Get();
+
+		/*! \brief Hands a stub over to be freed once it's safe.
+
+		    The caller's reference to the stub area is transferred with the stub.
+		*/
+		void Retire(InjectionStub *stub, DynamicCodeAllocator *allocator);
+
+		/*! \brief Frees every retired stub no thread is using.
+		    \return Number of stubs freed.
+		*/
+		unsigned Reclaim();
+
+		/*! \brief Number of stubs waiting to be freed. */
+		unsigned GetPending();
+};
+
+#endif
@@ -8,12 +8,26 @@
  */
 
 #include <cassert>
+#include <cstdlib>
 #include <algorithm>
+#include <thread>
+#include <functional>
 #include "PageManager.h"
 #include "privateInc/DynamicCodeAllocator.h"
 
+// Returns true if obj can be reached from nearAddr with a 32 bit relative jump
+static bool IsNear(void *obj, void *nearAddr)
+{
+	if(!nearAddr || sizeof(uintptr_t) <= 4)
+		return true;
+
+	intptr_t dist = reinterpret_cast<uint8_t*>(obj) - reinterpret_cast<uint8_t*>(nearAddr);
+	return std::abs(dist) < (1u<<31) - 1;
+}
+
 DynamicCodeAllocator::DynamicCodeAllocator(unsigned size) : size(std::max(size, MemoryTree::MinObjectSize())),
-	                                                        pageManager(size), pageList(), freeTree(size)
+	                                                        pageManager(size), pageList(), freeTree(size),
+															arenaLock(), caches()
 {
 }
 
@@ -23,40 +37,133 @@ DynamicCodeAllocator::~DynamicCodeAllocator() throw()
 
 void *DynamicCodeAllocator::Allocate(void *nearAddr) throw(std::memory_exception)
 {
-	MemoryTree::GenericObject *obj = freeTree.GetRoot();
-	MemoryTree::GenericObject **objParentPtr = NULL;
+	StubCache& cache = GetThreadCache();
+	std::lock_guard<std::mutex> cacheLock(cache.lock);
 
-	if(nearAddr && sizeof(uintptr_t) > 4)
+	void *obj = TakeFromCache(cache, nearAddr);
+	if(obj)
+		return obj;
+
+	// Slow path, go to the shared arena
+	RefillCache(cache, nearAddr);
+
+	obj = TakeFromCache(cache, nearAddr);
+	if(!obj)
+		obj = TakeFromCache(cache, NULL); // Nothing close could be mapped. The caller will need a long jump.
+
+	if(!obj)
+		throw std::memory_exception(/*"Couldn't find memory near the address.",*/ 0);
+
+	return obj;
+}
+
+void DynamicCodeAllocator::Free(void *addr) throw(std::memory_exception)
+{
+	if(!addr)
+		return;
+
+	StubCache& cache = GetThreadCache();
+	std::lock_guard<std::mutex> cacheLock(cache.lock);
+
+	if(cache.count == CACHE_SIZE)
+		FlushCache(cache, CACHE_REFILL);
+
+	cache.objects[cache.count++] = addr;
+}
+
+DynamicCodeAllocator::StubCache& DynamicCodeAllocator::GetThreadCache()
+{
+	size_t threadHash = std::hash<std::thread::id>()(std::this_thread::get_id());
+	return caches[threadHash % CACHE_STRIPES];
+}
+
+void *DynamicCodeAllocator::TakeFromCache(StubCache& cache, void *nearAddr)
+{
+	// Search from the top, most recently freed objects are the most likely to still be hot
+	for(unsigned i=cache.count; i-- > 0;)
 	{
-		uint8_t *addr = reinterpret_cast<uint8_t*>(nearAddr);
-		
-		obj = freeTree.FindFirstInRange(addr - (1u<<31) - 1, addr + (1u<<31)-1, &objParentPtr);
+		void *obj = cache.objects[i];
+		if(IsNear(obj, nearAddr))
+		{
+			cache.objects[i] = cache.objects[--cache.count];
+			return obj;
+		}
+	}
+
+	return NULL;
+}
+
+void DynamicCodeAllocator::RefillCache(StubCache& cache, void *nearAddr) throw(std::memory_exception)
+{
+	// Everything cached is too far from nearAddr. Make room for some closer objects.
+	if(cache.count + CACHE_REFILL > CACHE_SIZE)
+		FlushCache(cache, cache.count + CACHE_REFILL - CACHE_SIZE);
 
+	std::lock_guard<std::mutex> arena(arenaLock);
+
+	for(unsigned i=0; i < CACHE_REFILL; ++i)
+	{
+		void *obj = AllocateFromArena(nearAddr);
 		if(!obj)
 		{
+			// Only map a new page if we came away with nothing
+			if(i)
+				break;
+
 			CreatePage(nearAddr);
-			obj = freeTree.FindFirstInRange(addr - (1u<<31) - 1, addr + (1u<<31)-1, &objParentPtr);
+			obj = AllocateFromArena(nearAddr);
+			if(!obj)
+				obj = AllocateFromArena(NULL);
+
+			if(!obj)
+				break;
 		}
+
+		cache.objects[cache.count++] = obj;
 	}
+}
 
-	if(!obj)
+void DynamicCodeAllocator::FlushCache(StubCache& cache, unsigned count)
+{
+	count = std::min(count, cache.count);
+
+	std::lock_guard<std::mutex> arena(arenaLock);
+
+	while(count--)
+		freeTree.Insert(cache.objects[--cache.count]);
+}
+
+void *DynamicCodeAllocator::AllocateFromArena(void *nearAddr) throw(std::memory_exception)
+{
+	MemoryTree::GenericObject *obj = freeTree.GetRoot();
+	MemoryTree::GenericObject **objParentPtr = NULL;
+
+	if(nearAddr && sizeof(uintptr_t) > 4)
 	{
-		CreatePage(nearAddr);
-		obj = freeTree.GetRoot();
+		uint8_t *addr = reinterpret_cast<uint8_t*>(nearAddr);
+		
+		obj = freeTree.FindFirstInRange(addr - (1u<<31) + 1, addr + (1u<<31)-1, &objParentPtr);
 	}
 
+	if(!obj)
+		return NULL;
+
 	freeTree.Erase(obj, objParentPtr);
 
 	return obj;
 }
 
-void DynamicCodeAllocator::Free(void *addr) throw(std::memory_exception)
-{
-	freeTree.Insert(addr);
-}
-
 unsigned DynamicCodeAllocator::FreeEmptyPages()
 {
+	// Give back everything sitting in the thread caches, or no page will ever look empty
+	for(unsigned i=0; i < CACHE_STRIPES; ++i)
+	{
+		std::lock_guard<std::mutex> cacheLock(caches[i].lock);
+		FlushCache(caches[i], caches[i].count);
+	}
+
+	std::lock_guard<std::mutex> arena(arenaLock);
+
 	unsigned pagesFreed = 0;
 	unsigned pageSize = pageManager.GetPageSize();
 	unsigned objectsPerPage = pageSize / size;
@@ -90,6 +197,7 @@ unsigned DynamicCodeAllocator::FreeEmptyPages()
 	return pagesFreed;
 }
 
+// Assumes arenaLock is held
 void DynamicCodeAllocator::CreatePage(void *addrNear) throw(std::memory_exception)
 {
 	unsigned objectsPerPage = pageManager.GetPageSize() / size;
@@ -109,6 +217,8 @@ void DynamicCodeAllocator::CreatePage(void *addrNear) throw(std::memory_exceptio
 	freeTree.BinaryInsert(pageMem, pageMem + objectsPerPage*size);
 }
 
+DynamicCodeAllocator::StubCache::StubCache() : lock(), count(0) {}
+
 namespace std
 {
 	memory_exception::memory_exception(unsigned code) : bad_alloc(), code(code){}
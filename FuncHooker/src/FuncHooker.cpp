@@ -12,8 +12,13 @@
 
 #include "FuncHooker.h"
 #include "privateInc/FuncHookerCPP.h"
+#include "privateInc/FuncHookerGroup.h"
+#include "privateInc/InstallScheduler.h"
+#include "privateInc/PatchPlan.h"
+#include "privateInc/PendingHooks.h"
 #include "SymbolFinder.h"
 #include "SymbolFinderManager.h"
+#include "ThreadRegistry.h"
 
 extern "C"
 {
@@ -40,6 +45,91 @@ extern "C"
 		return CreateFuncHooker(const_cast<void*>(FunctionPtr), InjectionPtr);
 	}
 
+	FuncHookerPending* CreatePendingFuncHooker(const char *funcName, void *InjectionPtr, const char *moduleHint, const void **trampoline)
+	{
+		if(!funcName || !InjectionPtr)
+			return NULL;
+
+		try
+		{
+			return PendingHooks::Get().Add(funcName, InjectionPtr, moduleHint, trampoline);
+		}
+		catch(...)
+		{
+			return NULL;
+		}
+	}
+
+	FuncHooker* GetPendingFuncHooker(FuncHookerPending *pending)
+	{
+		if(!pending)
+			return NULL;
+
+		return PendingHooks::Get().GetHooker(pending);
+	}
+
+	void DestroyPendingFuncHooker(FuncHookerPending *pending)
+	{
+		if(!pending)
+			return;
+
+		PendingHooks::Get().Remove(pending);
+	}
+
+	FuncHookerGroup* HookMatching(const char *pattern, const char *moduleFilter, FuncHookerInjectorFactory injectorFactory, void *context, unsigned flags)
+	{
+		if(!pattern || !injectorFactory)
+			return NULL;
+
+		FuncHookerGroup *group = NULL;
+		try
+		{
+			group = new FuncHookerGroup();
+			group->Match(pattern, moduleFilter, flags, injectorFactory, context);
+			if(!group->Install())
+			{
+				delete group;
+				return NULL;
+			}
+
+			return group;
+		}
+		catch(...)
+		{
+			delete group;
+			return NULL;
+		}
+	}
+
+	unsigned GetFuncHookerGroupCount(const FuncHookerGroup *group)
+	{
+		if(!group)
+			return 0;
+
+		return group->GetCount();
+	}
+
+	FuncHooker* GetFuncHookerGroupHook(const FuncHookerGroup *group, unsigned index)
+	{
+		if(!group)
+			return NULL;
+
+		return group->GetHooker(index);
+	}
+
+	const char* GetFuncHookerGroupName(const FuncHookerGroup *group, unsigned index)
+	{
+		if(!group)
+			return NULL;
+
+		return group->GetName(index);
+	}
+
+	void DestroyFuncHookerGroup(FuncHookerGroup *group)
+	{
+		delete group;
+	}
+
 	const void* GetTrampoline(const FuncHooker *hooker)
 	{
 		if(!hooker)
@@ -56,6 +146,33 @@ extern "C"
 		return hooker->InstallHook();
 	}
 
+	unsigned InstallHooksBounded(FuncHooker **hookers, unsigned count, unsigned maxPauseUs, FuncHookerPauseStats *stats)
+	{
+		if(!hookers)
+			return 0;
+
+		InstallScheduler scheduler(maxPauseUs);
+		unsigned installed = scheduler.Install(hookers, count);
+
+		if(stats)
+			*stats = scheduler.GetStats();
+
+		return installed;
+	}
+
+	void GetFuncHookerPauseStats(FuncHookerPauseStats *stats)
+	{
+		if(!stats)
+			return;
+
+		PatchPlan::GetPauseStats(*stats);
+	}
+
+	void ResetFuncHookerPauseStats(void)
+	{
+		PatchPlan::ResetPauseStats();
+	}
+
 	void RemoveHook(FuncHooker *hooker)
 	{
 		if(!hooker)
@@ -68,4 +185,14 @@ extern "C"
 	{
 		delete hooker;
 	}
+
+	unsigned ReclaimFuncHookerMemory(void)
+	{
+		return FuncHooker::ReclaimStubs();
+	}
+
+	void TrackFuncHookerThreads(void)
+	{
+		ThreadRegistry::Get()->Enable();
+	}
 }
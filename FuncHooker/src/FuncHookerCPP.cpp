@@ -16,11 +16,13 @@
 #include "privateInc/DynamicCodeAllocator.h"
 #include "privateInc/InjectionStub.h"
 #include "privateInc/Disassembler.h"
-#include "PriorityBlock.h"
-#include "SingleThreadBlock.h"
+#include "privateInc/StubReclaimer.h"
+#include "privateInc/PatchPlan.h"
 #include "PrivelegeBlock.h"
 #include "ASMStubs.h"
 #include "privateInc/FuncHookerCPP.h"
+#include <vector>
+#include <new>
 
 template<typename C, typename T>
 static uintptr_t GetOffset(T C::*member)
@@ -29,26 +31,107 @@ static uintptr_t GetOffset(T C::*member)
 	return reinterpret_cast<uintptr_t>(ptr);
 }
 
+namespace
+{
+	/*! \brief Hands out fixed size records from contiguous chunks.
+
+		Chunks are only released when the pool is destroyed, and then only if every record
+		has been returned.
+	*/
+	class RecordPool
+	{
+		private:
+			struct FreeRecord
+			{
+				FreeRecord *next;
+			};
+
+			typedef std::vector<void*> Chunks;
+
+			std::mutex lock;
+			Chunks chunks;
+			FreeRecord *freeList;
+			size_t recordSize;
+			unsigned recordsPerChunk;
+			unsigned live;
+
+			RecordPool(const RecordPool&);            // Do not implement
+			RecordPool& operator=(const RecordPool&); // Do not implement
+
+		public:
+			RecordPool(size_t recordSize, unsigned recordsPerChunk) : lock(), chunks(), freeList(NULL),
+			                                                          recordSize(recordSize < sizeof(FreeRecord) ? sizeof(FreeRecord) : recordSize),
+			                                                          recordsPerChunk(recordsPerChunk), live(0)
+			{
+			}
+
+			~RecordPool()
+			{
+				if(live)
+					return;
+
+				for(Chunks::iterator chunkIt = chunks.begin(); chunkIt != chunks.end(); ++chunkIt)
+					::operator delete(*chunkIt);
+			}
+
+			void *Allocate()
+			{
+				std::lock_guard<std::mutex> guard(lock);
+
+				if(!freeList)
+				{
+					uint8_t *chunk = static_cast<uint8_t*>(::operator new(recordSize * recordsPerChunk));
+					chunks.push_back(chunk);
+
+					for(unsigned i=recordsPerChunk; i--;)
+					{
+						FreeRecord *record = reinterpret_cast<FreeRecord*>(chunk + i*recordSize);
+						record->next = freeList;
+						freeList = record;
+					}
+				}
+
+				FreeRecord *record = freeList;
+				freeList = record->next;
+				++live;
+
+				return record;
+			}
+
+			void Free(void *mem)
+			{
+				std::lock_guard<std::mutex> guard(lock);
+
+				FreeRecord *record = static_cast<FreeRecord*>(mem);
+				record->next = freeList;
+				freeList = record;
+				--live;
+			}
+	};
+
+	RecordPool &GetRecordPool()
+	{
+		static RecordPool pool(sizeof(FuncHooker), 256);
+		return pool;
+	}
+}
+
 DynamicCodeAllocator *FuncHooker::stubArea = NULL;
-unsigned FuncHooker::instances = 0;
+std::atomic<unsigned> FuncHooker::instances(0);
+std::mutex FuncHooker::stubAreaLock;
+std::mutex FuncHooker::patchLock;
 
-FuncHooker::FuncHooker(void *FunctionPtr, void *InjectionPtr) : installed(false),
-					                                            stubCode(NULL),
+FuncHooker::FuncHooker(void *FunctionPtr, void *InjectionPtr) : stubCode(NULL),
 					                                            InjectionFunc(InjectionPtr),
 					                                            injectionJumpTarget(NULL),
+                                                                funcPtr((uint8_t*)FunctionPtr),
 					                                            overwriteSize(0),
-					                                            backupCode(NULL),
-					                                            proxyBackupCode(NULL),
+					                                            backupCodeSize(0),
 					                                            proxyBackupCodeSize(0),
-                                                                backupCodeSize(0),
-					                                            hotpatchable(false),
-					                                            disasm(new Disassembler(FunctionPtr)),
-                                                                funcPtr((uint8_t*)FunctionPtr)
+					                                            installed(false),
+					                                            hotpatchable(false)
 {
-	if(!stubArea)
-		stubArea = new DynamicCodeAllocator(sizeof(InjectionStub));
-
-	++instances;
+	AcquireStubArea();
 
 	try
 	{
@@ -56,7 +139,7 @@ FuncHooker::FuncHooker(void *FunctionPtr, void *InjectionPtr) : installed(false)
 	}
 	catch(const std::exception& e)
 	{
-		delete disasm;
+		ReleaseStubArea();
 		throw e;
 	}
 }
@@ -68,20 +151,65 @@ FuncHooker::~FuncHooker()
 
 	if(stubCode)
 	{
-		if(proxyBackupCode)
+		if(proxyBackupCodeSize)
 		{
+			std::lock_guard<std::mutex> patching(patchLock);
 			PrivelegeBlock write(injectionJumpTarget, proxyBackupCodeSize, PrivelegeBlock::ALL);
 			std::memcpy(injectionJumpTarget, proxyBackupCode, proxyBackupCodeSize);
 		}
 
-		stubCode->~InjectionStub();
-		stubArea->Free(stubCode);
+		// Threads may still be running the stub, so it's only freed once they've all left it.
+		// Our stub area reference goes with it.
+		StubReclaimer::Get().Retire(stubCode, stubArea);
 	}
+	else
+		ReleaseStubArea();
+}
+
+void *FuncHooker::operator new(size_t size)
+{
+	assert(size == sizeof(FuncHooker) && "Records are fixed size");
+	(void)size;
+
+	return GetRecordPool().Allocate();
+}
+
+void FuncHooker::operator delete(void *mem)
+{
+	if(mem)
+		GetRecordPool().Free(mem);
+}
+
+void FuncHooker::AcquireStubArea()
+{
+	// Fast path. If someone else already holds a reference, the allocator can't go away
+	// while we add ours.
+	unsigned refs = instances.load();
+	while(refs)
+	{
+		if(instances.compare_exchange_weak(refs, refs + 1))
+			return;
+	}
+
+	std::lock_guard<std::mutex> lock(stubAreaLock);
+
+	if(!instances.load())
+		stubArea = new DynamicCodeAllocator(sizeof(InjectionStub));
+
+	++instances;
+}
 
-	delete [] proxyBackupCode;
-	delete [] backupCode;
+void FuncHooker::ReleaseStubArea()
+{
+	// Fast path. We aren't the last reference, so there's nothing to destroy.
+	unsigned refs = instances.load();
+	while(refs > 1)
+	{
+		if(instances.compare_exchange_weak(refs, refs - 1))
+			return;
+	}
 
-	delete disasm;
+	std::lock_guard<std::mutex> lock(stubAreaLock);
 
 	if(!--instances)
 	{
@@ -97,39 +225,18 @@ bool FuncHooker::InstallHook()
 
 	try
 	{
-		if(!stubCode)
-		{
-			if(!PrepareFunctionForHook())
-				return false;
-		}
-
-		// Now we have to actually alter the original function. We're going to overwrite
-		// the first few u8s with a jump to our injection function.
-		// For starters, we're going to need to make the page writable
-		PrivelegeBlock write(funcPtr, backupCodeSize, PrivelegeBlock::ALL);
-
-		// Since multiple processes may be calling this function, it is probably a good
-		// idea to do this as fast as possible.
-		PriorityBlock fastest(100);
-
-		// Pause all other threads while this write is happening
-		SingleThreadBlock pauseThreads;
+		if(!Prepare())
+			return false;
 
-		// Make sure any thread IPs within the moved range are relocated to the stub
-		pauseThreads.OffsetIPs(funcPtr, overwriteSize, stubCode);
+		// Work out every byte we're going to write before anything is paused.
+		PatchPlan plan;
+		PlanInstall(plan);
 
-		const uint8_t nop = 0x90;
-		std::memset(funcPtr, nop, backupCodeSize);
+		// Only one thread may be rewriting code at a time. Otherwise two threads could pause
+		// each other, or one could restore a page's protection while the other is still writing.
+		std::lock_guard<std::mutex> patching(patchLock);
 
-#if defined(X64) || defined(WIN64)
-		if(overwriteSize >= sizeof(ASM::LJmp))
-			new (funcPtr) ASM::LJmp(injectionJumpTarget);
-		else
-#endif
-		if(overwriteSize >= sizeof(ASM::Jmp))
-			new (funcPtr) ASM::Jmp(funcPtr, injectionJumpTarget);
-		else
-			new (funcPtr) ASM::SJmp(funcPtr, injectionJumpTarget);
+		plan.Apply();
 
 		installed = true;
 		return true;
@@ -147,20 +254,71 @@ void FuncHooker::RemoveHook()
 
 	assert(stubCode && "This function has not yet been hooked.");
 
-	// Write the original backup code back into the function
-	// For starters, we're going to need to make the page writable
-	PrivelegeBlock write(funcPtr, backupCodeSize, PrivelegeBlock::ALL);
+	PatchPlan plan;
+	PlanRemove(plan);
 
-	// Since multiple processes may be calling this function, it is probably a good
-	// idea to do this as fast as possible.
-	PriorityBlock fastest(100);
+	std::lock_guard<std::mutex> patching(patchLock);
+
+	plan.Apply();
+
+	installed = false;
+}
 
-	// Pause all other threads while this write is happening
-	SingleThreadBlock pauseThreads;
+bool FuncHooker::Prepare()
+{
+	if(stubCode)
+		return true;
 
-	std::memcpy(funcPtr, backupCode, backupCodeSize);
+	return PrepareFunctionForHook();
+}
 
+void FuncHooker::Abandon()
+{
+	// The hooked code has been unmapped along with its module, so there's nothing to restore.
+	// The trampoline still has to outlive any thread running it.
 	installed = false;
+	proxyBackupCodeSize = 0;
+}
+
+void FuncHooker::PlanInstall(PatchPlan &plan) const
+{
+	// We're going to overwrite the first few u8s with a jump to our injection function,
+	// padding whatever is left of the instructions we split with nops.
+	uint8_t code[MAX_BACKUP_SIZE];
+
+	const uint8_t nop = 0x90;
+	std::memset(code, nop, backupCodeSize);
+
+	// Jumps are encoded relative to funcPtr, where they'll end up, not to where they're built.
+#if defined(X64) || defined(WIN64)
+	if(overwriteSize >= sizeof(ASM::LJmp))
+		new (code) ASM::LJmp(injectionJumpTarget);
+	else
+#endif
+	if(overwriteSize >= sizeof(ASM::Jmp))
+		new (code) ASM::Jmp(funcPtr, injectionJumpTarget);
+	else
+		new (code) ASM::SJmp(funcPtr, injectionJumpTarget);
+
+	plan.AddPatch(funcPtr, code, backupCodeSize);
+
+	// Make sure any thread IPs within the moved range are relocated to the stub
+	plan.AddRemap(funcPtr, overwriteSize, stubCode);
+}
+
+void FuncHooker::PlanRemove(PatchPlan &plan) const
+{
+	// Write the original backup code back into the function
+	plan.AddPatch(funcPtr, backupCode, backupCodeSize);
+
+	// Threads about to run the stub's first relocated instruction can run the original instead,
+	// which keeps them out of the stub entirely.
+	plan.AddRemap(stubCode->funcHeader, 0, funcPtr);
+}
+
+unsigned FuncHooker::ReclaimStubs()
+{
+	return StubReclaimer::Get().Reclaim();
 }
 
 const void *FuncHooker::GetTrampoline() const
@@ -176,10 +334,11 @@ void FuncHooker::FindFunctionBody()
 	// which, by process of elimination, would hopefully mean we are
 	// in the actual function.
 
+	Disassembler disasm(funcPtr);
 	for(;;)
 	{
-		uint8_t *lastFuncPos = disasm->GetIP<uint8_t*>();
-		Operation operation = disasm->ReadNextOperation();
+		uint8_t *lastFuncPos = disasm.GetIP<uint8_t*>();
+		Operation operation = disasm.ReadNextOperation();
 
 		bool bodyFound = false;
 		if(operation.GetMnemonic() == UD_Ijmp)
@@ -193,12 +352,12 @@ void FuncHooker::FindFunctionBody()
 				// Jump to absolute address
 				case UD_OP_PTR:{
 					Operand::Ptr ptr = operand.GetValue<Operand::Ptr>();
-					disasm->SetIP(reinterpret_cast<void*>((ptr.segment << 4) + ptr.offset));
+					disasm.SetIP(reinterpret_cast<void*>((ptr.segment << 4) + ptr.offset));
 				}break;
 				// Jump to relative offset
 				case UD_OP_JIMM:{
-					uint8_t *curIP = disasm->GetIP<uint8_t*>();
-					disasm->SetIP(curIP + operand.GetValue<int32_t>());
+					uint8_t *curIP = disasm.GetIP<uint8_t*>();
+					disasm.SetIP(curIP + operand.GetValue<int32_t>());
 				}break;
 				default:
 					bodyFound = true;
@@ -210,18 +369,18 @@ void FuncHooker::FindFunctionBody()
 
 		if(bodyFound)
 		{
-			disasm->SetIP(lastFuncPos);
+			disasm.SetIP(lastFuncPos);
 			break;
 		}
 	}
 
-	funcPtr = disasm->GetIP<uint8_t*>(); // Move our read pointer back one so we don't ignore an instruction
+	funcPtr = disasm.GetIP<uint8_t*>(); // Move our read pointer back one so we don't ignore an instruction
 }
 
 
-FuncHooker::DeadZone FuncHooker::FindNearestDeadZone(uint8_t *start, unsigned delta, unsigned minSize)
+FuncHooker::DeadZone FuncHooker::FindNearestDeadZone(Disassembler &disasm, uint8_t *start, unsigned delta, unsigned minSize)
 {
-	uint8_t *prevIP = disasm->GetIP<uint8_t*>();
+	uint8_t *prevIP = disasm.GetIP<uint8_t*>();
 
 	// Lets get tricky. We want to overwrite as few u8s of the function as possible.
 	// Unfortunately, a long jump is 5 u8s on x86 and on x64 could be 14 in the worst
@@ -253,19 +412,19 @@ FuncHooker::DeadZone FuncHooker::FindNearestDeadZone(uint8_t *start, unsigned de
 	// Now to look forward to find any deadzones
 
 	uint8_t *end = start + delta;
-	disasm->SetIP(start);
-	while(disasm->GetIP<uint8_t*>() < end)
+	disasm.SetIP(start);
+	while(disasm.GetIP<uint8_t*>() < end)
 	{
-		Operation operation = disasm->ReadNextOperation();
+		Operation operation = disasm.ReadNextOperation();
 
 		Operation::Mnemonic mnemonic = operation.GetMnemonic();
 		if(mnemonic == UD_Inop || mnemonic == UD_Iint3)
 		{
-			DeadZone zone(disasm->GetIP<uint8_t*>() - 1); // -1 to not count the instruction we just read.
+			DeadZone zone(disasm.GetIP<uint8_t*>() - 1); // -1 to not count the instruction we just read.
 
-			while(disasm->GetIP<uint8_t*>() < end)
+			while(disasm.GetIP<uint8_t*>() < end)
 			{
-				operation = disasm->ReadNextOperation();
+				operation = disasm.ReadNextOperation();
 				mnemonic = operation.GetMnemonic();
 
 				if(mnemonic == UD_Inop || mnemonic == UD_Iint3)
@@ -279,7 +438,7 @@ FuncHooker::DeadZone FuncHooker::FindNearestDeadZone(uint8_t *start, unsigned de
 		}
 	}
 
-	disasm->SetIP(prevIP);
+	disasm.SetIP(prevIP);
 	return DeadZone(NULL, 0);
 }
 
@@ -315,12 +474,14 @@ bool FuncHooker::PrepareFunctionForHook()
 #endif
 		deadZoneMinSize = sizeof(ASM::Jmp); // Otherwise, we just need 5 u8s for a regular jump.
 
-	DeadZone deadZone = FindNearestDeadZone(funcPtr, 127, deadZoneMinSize);
+	// The disassembler is only needed while preparing, so it doesn't live on in the record.
+	Disassembler disasm(funcPtr);
+	DeadZone deadZone = FindNearestDeadZone(disasm, funcPtr, 127, deadZoneMinSize);
 
 	// If we found a deadzone, we can setup a proxy, yay!
 	if(deadZone.addr)
 	{
-		overwriteSize = sizeof(ASM::SJmp); // We only need to erase 2 u8s for a short jump to our proxy
+		overwriteSize = static_cast<uint8_t>(sizeof(ASM::SJmp)); // We only need to erase 2 u8s for a short jump to our proxy
 		injectionJumpTarget = deadZone.addr;
 
 		InstallProxy(deadZone, reinterpret_cast<void*>(stubDist), reinterpret_cast<void*>(injectDist), stubMem, deadZoneMinSize);
@@ -330,7 +491,7 @@ bool FuncHooker::PrepareFunctionForHook()
 		// We couldn't write a 2u8 proxy. Determine our overwrite size.
 
 		injectionJumpTarget = reinterpret_cast<uint8_t*>(InjectionFunc);
-		overwriteSize = sizeof(ASM::Jmp);
+		overwriteSize = static_cast<uint8_t>(sizeof(ASM::Jmp));
 
 #if defined(X64) || defined(WIN64)
 		if(std::abs(injectDist) > (1u<<31) - 1)
@@ -338,7 +499,7 @@ bool FuncHooker::PrepareFunctionForHook()
 		    // We only need 14 u8s if both our stub code (for a long proxy) and our
 		    // InjectionFunctiton are over 2gb away
 			if(std::abs(stubDist) > (1u<<31) - 1)
-				overwriteSize = sizeof(ASM::LJmp);
+				overwriteSize = static_cast<uint8_t>(sizeof(ASM::LJmp));
 			else
 				injectionJumpTarget = stubMem + GetOffset(&InjectionStub::executeInjector); // If our stub code is close, jump there instead.
 		}
@@ -348,7 +509,7 @@ bool FuncHooker::PrepareFunctionForHook()
 	// Now actually allocate our stub code
 	stubCode = new (stubMem) InjectionStub(funcPtr, InjectionFunc, overwriteSize);
 
-	return RelocateFunctionHeader(overwriteSize);
+	return RelocateFunctionHeader(disasm, overwriteSize);
 }
 
 void FuncHooker::InstallProxy(const DeadZone& deadZone, void *stubDistPtr, void *injectDistPtr, uint8_t *stubMem, unsigned deadZoneMinSize)
@@ -365,8 +526,8 @@ void FuncHooker::InstallProxy(const DeadZone& deadZone, void *stubDistPtr, void
 #endif
 
 	// First, create a backup of the code we'll be overwriting with our proxy jump
-	proxyBackupCodeSize = deadZoneMinSize;
-	proxyBackupCode = new uint8_t[proxyBackupCodeSize];
+	assert(deadZoneMinSize <= sizeof(proxyBackupCode) && "Proxy jump doesn't fit the backup");
+	proxyBackupCodeSize = static_cast<uint8_t>(deadZoneMinSize);
 	std::memcpy(proxyBackupCode, deadZone.addr, proxyBackupCodeSize);
 
 	uint8_t *jumpTo;
@@ -382,6 +543,8 @@ void FuncHooker::InstallProxy(const DeadZone& deadZone, void *stubDistPtr, void
 
 	// Now, we write in our jump.
 	{
+		std::lock_guard<std::mutex> patching(patchLock);
+
 		// Make the page writeable first
 		PrivelegeBlock write(deadZone.addr, proxyBackupCodeSize, PrivelegeBlock::ALL);
 
@@ -392,16 +555,16 @@ void FuncHooker::InstallProxy(const DeadZone& deadZone, void *stubDistPtr, void
 	}
 }
 
-bool FuncHooker::RelocateFunctionHeader(unsigned headerSize)
+bool FuncHooker::RelocateFunctionHeader(Disassembler &disasm, unsigned headerSize)
 {
 	CodeRelocator relocator(funcPtr, stubCode->funcHeader, headerSize);
 
-	disasm->SetIP(funcPtr);
+	disasm.SetIP(funcPtr);
 
 	unsigned movedu8s = 0;
 	while(movedu8s < headerSize)
 	{
-		Operation operation = disasm->ReadNextOperation();
+		Operation operation = disasm.ReadNextOperation();
 		unsigned operSize = operation.GetSize();
 
 		// If the whole header fits in 1 operation, we know we won't need to
@@ -417,8 +580,10 @@ bool FuncHooker::RelocateFunctionHeader(unsigned headerSize)
 	}
 
 	// Make a backup copy of the area we are going to eventually overwrite.
-	backupCodeSize = movedu8s;
-	backupCode = new uint8_t[backupCodeSize];
+	if(movedu8s > sizeof(backupCode))
+		return false;
+
+	backupCodeSize = static_cast<uint8_t>(movedu8s);
 	std::memcpy(backupCode, funcPtr, backupCodeSize);
 
 	// Minor optimization. If we can skip all the nops in our function
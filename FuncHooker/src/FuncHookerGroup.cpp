@@ -0,0 +1,186 @@
+/************************************************************************************\
+ * FuncHooker - An Andrew Shurney Production                                        *
+\************************************************************************************/
+
+/*! \file		FuncHookerGroup.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Hooks on every function matching a pattern, installed and removed together
+ */
+
+#include "privateInc/FuncHookerGroup.h"
+#include "privateInc/FuncHookerCPP.h"
+#include "privateInc/InstallScheduler.h"
+#include "privateInc/PatchPlan.h"
+#include "SymbolFinder.h"
+#include "SymbolFinderManager.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <climits>
+#include <exception>
+
+// Fewer hooks than this per thread aren't worth starting a thread for.
+static const unsigned HOOKS_PER_THREAD = 64;
+
+FuncHookerGroup::FuncHookerGroup() : hooks()
+{
+}
+
+FuncHookerGroup::~FuncHookerGroup()
+{
+	Remove();
+
+	for(auto it = hooks.begin(); it != hooks.end(); ++it)
+		delete it->hooker;
+}
+
+void FuncHookerGroup::Match(const char *pattern, const char *moduleFilter, unsigned flags, FuncHookerInjectorFactory factory, void *context)
+{
+	SymbolFinder::Symbols symbols = SymbolFinderManager::Get()->FindSymbols(pattern, moduleFilter, (flags & FUNCHOOKER_MATCH_EXPORTED) != 0);
+
+	// An address can only be hooked once, however many names it goes by. Sorting by name
+	// first means the same one of them is kept every time.
+	std::sort(symbols.begin(), symbols.end());
+	std::stable_sort(symbols.begin(), symbols.end(), [](const SymbolFinder::Symbols::value_type& lhs, const SymbolFinder::Symbols::value_type& rhs)
+	{
+		return lhs.second < rhs.second;
+	});
+	symbols.erase(std::unique(symbols.begin(), symbols.end(), [](const SymbolFinder::Symbols::value_type& lhs, const SymbolFinder::Symbols::value_type& rhs)
+	{
+		return lhs.second == rhs.second;
+	}), symbols.end());
+
+	hooks.reserve(symbols.size());
+	for(auto it = symbols.begin(); it != symbols.end(); ++it)
+	{
+		Hook hook = { it->first, it->second, nullptr, nullptr, nullptr };
+		hook.injection = factory(hook.name.c_str(), hook.target, context, &hook.trampoline);
+		if(hook.injection)
+			hooks.push_back(hook);
+	}
+}
+
+bool FuncHookerGroup::Install()
+{
+	Prepare();
+
+	// A hook can be called the moment it's installed, so the trampolines are handed out first.
+	std::vector<FuncHooker*> batch;
+	batch.reserve(hooks.size());
+	for(auto it = hooks.begin(); it != hooks.end(); ++it)
+	{
+		if(!it->hooker)
+			continue;
+
+		if(it->trampoline)
+			*it->trampoline = it->hooker->GetTrampoline();
+
+		batch.push_back(it->hooker);
+	}
+
+	// A group that fails to install is deleted along with its hookers, so the caller's slots
+	// are cleared rather than left pointing at freed trampolines.
+	auto clearTrampolines = [this]()
+	{
+		for(auto it = hooks.begin(); it != hooks.end(); ++it)
+			if(it->hooker && it->trampoline)
+				*it->trampoline = nullptr;
+	};
+
+	bool installed;
+	try
+	{
+		InstallScheduler scheduler(UINT_MAX);
+		installed = batch.empty() || scheduler.InstallPrepared(&batch[0], static_cast<unsigned>(batch.size())) != 0;
+	}
+	catch(...)
+	{
+		clearTrampolines();
+		throw;
+	}
+
+	if(!installed)
+		clearTrampolines();
+
+	return installed;
+}
+
+void FuncHookerGroup::Prepare()
+{
+	unsigned threadCount = static_cast<unsigned>(hooks.size() / HOOKS_PER_THREAD) + 1;
+	threadCount = std::max(1u, std::min(threadCount, std::thread::hardware_concurrency()));
+
+	// Hooks are handed out one at a time, as some functions take much longer to prepare than
+	// others. Making and preparing hooks is safe from any number of threads.
+	std::atomic<size_t> next(0);
+	auto work = [this, &next]()
+	{
+		for(size_t i = next++; i < hooks.size(); i = next++)
+		{
+			Hook& hook = hooks[i];
+			try
+			{
+				hook.hooker = new FuncHooker(const_cast<void*>(hook.target), hook.injection);
+				if(!hook.hooker->Prepare())
+				{
+					delete hook.hooker;
+					hook.hooker = nullptr;
+				}
+			}
+			catch(const std::exception&)
+			{
+				delete hook.hooker;
+				hook.hooker = nullptr;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for(unsigned i=1; i<threadCount; ++i)
+		threads.emplace_back(work);
+
+	work();
+	for(auto it = threads.begin(); it != threads.end(); ++it)
+		it->join();
+}
+
+void FuncHookerGroup::Remove()
+{
+	PatchPlan plan;
+	plan.Reserve(static_cast<unsigned>(hooks.size()));
+
+	std::vector<FuncHooker*> installed;
+	for(auto it = hooks.begin(); it != hooks.end(); ++it)
+	{
+		if(it->hooker && it->hooker->installed)
+		{
+			it->hooker->PlanRemove(plan);
+			installed.push_back(it->hooker);
+		}
+	}
+
+	if(installed.empty())
+		return;
+
+	std::lock_guard<std::mutex> patching(FuncHooker::patchLock);
+	plan.Apply();
+
+	for(auto it = installed.begin(); it != installed.end(); ++it)
+		(*it)->installed = false;
+}
+
+unsigned FuncHookerGroup::GetCount() const
+{
+	return static_cast<unsigned>(hooks.size());
+}
+
+FuncHooker *FuncHookerGroup::GetHooker(unsigned index) const
+{
+	return index < hooks.size() ? hooks[index].hooker : nullptr;
+}
+
+const char *FuncHookerGroup::GetName(unsigned index) const
+{
+	return index < hooks.size() ? hooks[index].name.c_str() : nullptr;
+}
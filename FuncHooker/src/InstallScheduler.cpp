@@ -0,0 +1,155 @@
+/************************************************************************************\
+ * FuncHooker - An Andrew Shurney Production                                        *
+\************************************************************************************/
+
+/*! \file		InstallScheduler.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Installs hooks in chunks sized to a maximum pause
+ */
+
+#include "privateInc/InstallScheduler.h"
+#include "privateInc/FuncHookerCPP.h"
+#include "privateInc/PatchPlan.h"
+#include <mutex>
+#include <thread>
+#include <climits>
+#include <exception>
+
+// Weight given to each new pause in the running averages.
+static const double SAMPLE_WEIGHT = 0.25;
+
+InstallScheduler::InstallScheduler(unsigned maxPauseUs) : maxPauseUs(maxPauseUs), fixedCostUs(0), perHookUs(0), samples(0),
+                                                          lastChunk(0), lastOverBudget(false), stats()
+{
+}
+
+unsigned InstallScheduler::Install(FuncHooker **hookers, unsigned count)
+{
+	unsigned installed = 0;
+
+	// Disassembling, relocating and allocating trampolines all happen before any thread is
+	// paused.
+	Hooks pending;
+	pending.reserve(count);
+	for(unsigned i=0; i<count; ++i)
+	{
+		FuncHooker *hooker = hookers[i];
+		if(!hooker)
+			continue;
+
+		if(hooker->installed)
+		{
+			++installed;
+			continue;
+		}
+
+		try
+		{
+			if(hooker->Prepare())
+				pending.push_back(hooker);
+		}
+		catch(const std::exception&)
+		{
+		}
+	}
+
+	size_t next = 0;
+	while(next < pending.size())
+	{
+		unsigned chunk = NextChunkSize(pending.size() - next);
+		installed += InstallChunk(&pending[next], chunk);
+		next += chunk;
+
+		// Let the threads we just resumed get some work done before pausing them again.
+		std::this_thread::yield();
+	}
+
+	return installed;
+}
+
+unsigned InstallScheduler::InstallPrepared(FuncHooker **hookers, unsigned count)
+{
+	if(!count)
+		return 0;
+
+	return InstallChunk(hookers, count);
+}
+
+const FuncHookerPauseStats& InstallScheduler::GetStats() const
+{
+	return stats;
+}
+
+unsigned InstallScheduler::NextChunkSize(size_t remaining) const
+{
+	unsigned size = 1;
+	if(samples)
+	{
+		double room = maxPauseUs - fixedCostUs;
+		if(room > perHookUs)
+		{
+			double fit = perHookUs > 0 ? room / perHookUs : static_cast<double>(UINT_MAX);
+			size = fit < static_cast<double>(UINT_MAX / 2) ? static_cast<unsigned>(fit) : UINT_MAX / 2;
+		}
+
+		// One quick pause is a poor estimate of a much larger one, so grow gradually.
+		unsigned limit = lastOverBudget ? lastChunk / 2 : lastChunk * 2;
+		if(size > limit)
+			size = limit;
+
+		if(!size)
+			size = 1;
+	}
+
+	if(size > remaining)
+		size = static_cast<unsigned>(remaining);
+
+	return size;
+}
+
+unsigned InstallScheduler::InstallChunk(FuncHooker **hooks, unsigned count)
+{
+	PatchPlan plan;
+	plan.Reserve(count);
+	for(unsigned i=0; i<count; ++i)
+		hooks[i]->PlanInstall(plan);
+
+	PatchPlan::PauseTiming timing;
+	try
+	{
+		std::lock_guard<std::mutex> patching(FuncHooker::patchLock);
+		timing = plan.Apply();
+	}
+	catch(const std::exception&)
+	{
+		return 0;
+	}
+
+	for(unsigned i=0; i<count; ++i)
+		hooks[i]->installed = true;
+
+	Learn(count, timing.stopUs + timing.resumeUs, timing.applyUs);
+
+	lastOverBudget = timing.GetTotalUs() > maxPauseUs;
+	PatchPlan::RecordPause(stats, timing.GetTotalUs(), maxPauseUs);
+
+	return count;
+}
+
+void InstallScheduler::Learn(unsigned hooks, double fixedUs, double writeUs)
+{
+	double hookUs = hooks ? writeUs / hooks : 0;
+
+	if(!samples++)
+	{
+		fixedCostUs = fixedUs;
+		perHookUs = hookUs;
+	}
+	else
+	{
+		fixedCostUs += (fixedUs - fixedCostUs) * SAMPLE_WEIGHT;
+		perHookUs += (hookUs - perHookUs) * SAMPLE_WEIGHT;
+	}
+
+	lastChunk = hooks;
+}
@@ -148,12 +148,13 @@ void MemoryTree::Erase(GenericObject *node, GenericObject **parentPtr)
 
 		*parentPtr = newRoot;
 
-		if(newRootParent->left == newRoot)
-			newRootParent->left = NULL;
-		else
-			newRootParent->right = NULL;
+		// The predecessor never has a right child, but its left subtree must be kept
+		if(newRootParent != node)
+		{
+			newRootParent->right = newRoot->left;
+			newRoot->left = node->left;
+		}
 
-		newRoot->left = node->left;
 		newRoot->right = node->right;
 	}
 }
@@ -206,16 +207,16 @@ MemoryTree::GenericObject *MemoryTree::FindFirstInRangeRec(GenericObject *node,
 	if(end < start)
 		std::swap(end, start);
 
-	if(node >= start || node <= end)
+	if(node >= start && node <= end)
 		return reinterpret_cast<GenericObject*>(node);
 	else
 	{
+		GenericObject **childPtr = end < node ? &node->left : &node->right;
+
+		// Remember which link points at the child so the caller can erase it
 		if(parentNodePtr)
-			*parentNodePtr = &node;
+			*parentNodePtr = childPtr;
 
-		 if(end < node)
-			return FindFirstInRangeRec(node->left, start, end, parentNodePtr);
-		else
-			return FindFirstInRangeRec(node->right, start, end, parentNodePtr);
+		return FindFirstInRangeRec(*childPtr, start, end, parentNodePtr);
 	}
 }
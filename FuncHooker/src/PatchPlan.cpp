@@ -0,0 +1,149 @@
+/************************************************************************************\
+ * FuncHooker - An Andrew Shurney Production                                        *
+\************************************************************************************/
+
+/*! \file		PatchPlan.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Code writes worked out in full before any thread is paused
+ */
+
+#include "privateInc/PatchPlan.h"
+#include "PriorityBlock.h"
+#include "PrivelegeBlock.h"
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <cstring>
+#include <cassert>
+
+namespace
+{
+	typedef std::chrono::steady_clock PauseClock;
+
+	double ElapsedUs(PauseClock::time_point start, PauseClock::time_point end)
+	{
+		return std::chrono::duration<double, std::micro>(end - start).count();
+	}
+}
+
+std::mutex PatchPlan::statsLock;
+FuncHookerPauseStats PatchPlan::stats = FuncHookerPauseStats();
+
+PatchPlan::PatchPlan() : patches(), remaps()
+{
+}
+
+void PatchPlan::Reserve(unsigned patchCount)
+{
+	patches.reserve(patchCount);
+	remaps.reserve(patchCount);
+}
+
+void PatchPlan::AddPatch(void *target, const void *newBytes, unsigned size)
+{
+	assert(size <= MAX_PATCH_SIZE && "Patch too large");
+
+	Patch patch;
+	patch.target = static_cast<uint8_t*>(target);
+	patch.size = size;
+	std::memcpy(patch.newBytes, newBytes, size);
+	std::memcpy(patch.oldBytes, target, size);
+
+	patches.push_back(patch);
+}
+
+void PatchPlan::AddRemap(const void *start, unsigned range, void *dest)
+{
+	SingleThreadBlock::IPRemap remap = { start, range, dest };
+	remaps.push_back(remap);
+}
+
+unsigned PatchPlan::GetPatchCount() const
+{
+	return static_cast<unsigned>(patches.size());
+}
+
+PatchPlan::PauseTiming PatchPlan::Apply()
+{
+	std::sort(remaps.begin(), remaps.end(), [](const SingleThreadBlock::IPRemap& lhs, const SingleThreadBlock::IPRemap& rhs)
+	{
+		return lhs.start < rhs.start;
+	});
+
+	// Pages are made writable before pausing, as that can be slow. Patches sharing a page each
+	// get a block, and blocks are released newest first so the page ends up with the rights
+	// it started with.
+	std::deque<PrivelegeBlock> writable;
+	for(Patches::const_iterator patchIt = patches.begin(); patchIt != patches.end(); ++patchIt)
+		writable.emplace_back(patchIt->target, patchIt->size, PrivelegeBlock::ALL);
+
+	// Since multiple processes may be calling this function, it is probably a good
+	// idea to do this as fast as possible.
+	PriorityBlock fastest(100);
+
+	PauseClock::time_point start = PauseClock::now();
+	PauseClock::time_point paused;
+	PauseClock::time_point applied;
+	{
+		SingleThreadBlock pauseThreads;
+		paused = PauseClock::now();
+
+		for(Patches::const_iterator patchIt = patches.begin(); patchIt != patches.end(); ++patchIt)
+		{
+			assert(!std::memcmp(patchIt->target, patchIt->oldBytes, patchIt->size) && "Code changed since it was planned");
+			std::memcpy(patchIt->target, patchIt->newBytes, patchIt->size);
+		}
+
+		pauseThreads.OffsetIPs(remaps.empty() ? nullptr : &remaps[0], static_cast<unsigned>(remaps.size()));
+
+		applied = PauseClock::now();
+	}
+	PauseClock::time_point end = PauseClock::now();
+
+	while(!writable.empty())
+		writable.pop_back();
+
+	PauseTiming timing;
+	timing.stopUs = ElapsedUs(start, paused);
+	timing.applyUs = ElapsedUs(paused, applied);
+	timing.resumeUs = ElapsedUs(applied, end);
+
+	std::lock_guard<std::mutex> guard(statsLock);
+	RecordPause(stats, timing.GetTotalUs(), 0);
+
+	return timing;
+}
+
+void PatchPlan::RecordPause(FuncHookerPauseStats& stats, double pauseUs, double budgetUs)
+{
+	++stats.pauses;
+	if(budgetUs > 0 && pauseUs > budgetUs)
+		++stats.overBudget;
+
+	if(pauseUs > stats.maxPauseMicroseconds)
+		stats.maxPauseMicroseconds = pauseUs;
+	stats.totalPauseMicroseconds += pauseUs;
+
+	unsigned bucket = 0;
+	while(bucket + 1 < FUNCHOOKER_PAUSE_BUCKETS && pauseUs >= static_cast<double>(1u << bucket))
+		++bucket;
+
+	++stats.histogram[bucket];
+}
+
+void PatchPlan::GetPauseStats(FuncHookerPauseStats& out)
+{
+	std::lock_guard<std::mutex> guard(statsLock);
+	out = stats;
+}
+
+void PatchPlan::ResetPauseStats()
+{
+	std::lock_guard<std::mutex> guard(statsLock);
+	stats = FuncHookerPauseStats();
+}
+
+double PatchPlan::PauseTiming::GetTotalUs() const
+{
+	return stopUs + applyUs + resumeUs;
+}
@@ -0,0 +1,392 @@
+/************************************************************************************\
+ * FuncHooker - An Andrew Shurney Production                                        *
+\************************************************************************************/
+
+/*! \file		PendingHooks.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Hooks waiting for the module they're in to be loaded
+ */
+
+#include "privateInc/PendingHooks.h"
+#include "privateInc/FuncHookerCPP.h"
+#include "privateInc/InstallScheduler.h"
+#include "ModuleWatcher.h"
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <exception>
+
+#ifndef WIN32
+# include "ElfImage.h"
+# include "SymbolIndex.h"
+# include <elf.h>
+# include <dlfcn.h>
+# include <sys/auxv.h>
+
+# include <atomic>
+# include <thread>
+
+typedef void (*LoaderBreakpointPtr)();
+static LoaderBreakpointPtr loaderBreakpointTrampoline = nullptr;
+static std::atomic<bool> refreshOnBreakpoint(false);  //!< Off once we and the watcher are gone.
+static std::atomic<bool> destroyed(false);            //!< So ifunc threads left at exit do nothing.
+#endif
+
+PendingHooks::PendingHooks() : hooks(), lock(), watching(), listenerId(0)
+#ifndef WIN32
+                               , breakpointHook(nullptr), ifuncs()
+#endif
+{
+	// Made first, so it's still around when we're destroyed.
+	ModuleWatcher::Get();
+}
+
+PendingHooks::~PendingHooks()
+{
+	if(listenerId)
+		ModuleWatcher::Get()->RemoveListener(listenerId);
+
+#ifndef WIN32
+	// Taking the hook out would pause every thread on the way out of the process. It's left in
+	// and just passes calls on from now on.
+	refreshOnBreakpoint = false;
+	destroyed = true;
+#endif
+}
+
+PendingHooks& PendingHooks::Get()
+{
+	static PendingHooks pendingHooks;
+
+	return pendingHooks;
+}
+
+FuncHookerPending *PendingHooks::Add(const char *funcName, void *injection, const char *moduleHint, const void **trampoline)
+{
+	std::call_once(watching, [this]() { StartWatching(); });
+
+	FuncHookerPending *pending = new FuncHookerPending;
+	pending->funcName   = funcName;
+	pending->moduleHint = moduleHint ? moduleHint : "";
+	pending->injection  = injection;
+	pending->trampoline = trampoline;
+	pending->hooker     = nullptr;
+	pending->moduleBase = nullptr;
+
+#ifdef WIN32
+	// Module names are kept lower case, as file names aren't case sensitive.
+	std::transform(pending->moduleHint.begin(), pending->moduleHint.end(), pending->moduleHint.begin(), std::tolower);
+#endif
+
+	if(trampoline)
+		*trampoline = nullptr;
+
+	// Nothing can load between checking what's loaded and starting to wait.
+	ModuleWatcher *watcher = ModuleWatcher::Get();
+	watcher->Lock();
+	try
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		hooks.reserve(hooks.size() + 1);
+		Install(watcher->GetModules(), Hooks(1, pending));
+		hooks.push_back(pending);
+	}
+	catch(...)
+	{
+		watcher->Unlock();
+		delete pending->hooker;
+		delete pending;
+		return nullptr;
+	}
+	watcher->Unlock();
+
+#ifndef WIN32
+	// An ifunc in a module that's already loaded is hooked before returning. Waiting on the
+	// loader with the watcher locked could deadlock with a thread loading a module.
+	Ifuncs waiting;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		waiting.swap(ifuncs);
+	}
+	if(!waiting.empty())
+		InstallIfuncs(waiting);
+#endif
+
+	return pending;
+}
+
+void PendingHooks::Remove(FuncHookerPending *pending)
+{
+	// The watcher stays locked until the hook is out, so its module can't be dropped from
+	// under it.
+	ModuleWatcher *watcher = ModuleWatcher::Get();
+	watcher->Lock();
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		hooks.erase(std::remove(hooks.begin(), hooks.end(), pending), hooks.end());
+	}
+	delete pending->hooker;
+	watcher->Unlock();
+
+	delete pending;
+}
+
+FuncHooker *PendingHooks::GetHooker(FuncHookerPending *pending)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return pending->hooker;
+}
+
+void PendingHooks::StartWatching()
+{
+	ModuleWatcher *watcher = ModuleWatcher::Get();
+	listenerId = watcher->AddListener([this](const ModuleExplorer::Modules& loaded, const ModuleExplorer::Modules& unloaded)
+	{
+		ModulesChanged(loaded, unloaded);
+	});
+
+#ifndef WIN32
+	try
+	{
+		breakpointHook = new FuncHooker(ModuleWatcher::GetLoaderBreakpoint(), reinterpret_cast<void*>(LoaderBreakpoint));
+		if(breakpointHook->Prepare())
+		{
+			loaderBreakpointTrampoline = reinterpret_cast<LoaderBreakpointPtr>(const_cast<void*>(breakpointHook->GetTrampoline()));
+			refreshOnBreakpoint = true;
+			breakpointHook->InstallHook();
+		}
+	}
+	catch(const std::exception&)
+	{
+	}
+
+	// Catch anything loaded between the watcher listing modules and the breakpoint going in.
+	watcher->Refresh();
+#endif
+}
+
+void PendingHooks::ModulesChanged(const ModuleExplorer::Modules& loaded, const ModuleExplorer::Modules& unloaded)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	Hooks waiting;
+	for(auto it = hooks.begin(); it != hooks.end(); ++it)
+	{
+		FuncHookerPending *pending = *it;
+		if(pending->hooker)
+		{
+			auto modIt = std::find_if(unloaded.begin(), unloaded.end(), [pending](const Module& mod)
+			{
+				return mod.GetAddress() == pending->moduleBase;
+			});
+			if(modIt == unloaded.end())
+				continue;
+
+			pending->hooker->Abandon();
+			delete pending->hooker;
+			pending->hooker = nullptr;
+			pending->moduleBase = nullptr;
+
+			if(pending->trampoline)
+				*pending->trampoline = nullptr;
+		}
+
+		waiting.push_back(pending);
+	}
+
+	if(!waiting.empty() && !loaded.empty())
+		Install(loaded, waiting);
+
+#ifndef WIN32
+	// We're most likely inside the loader, which holds its lock until the module is relocated.
+	if(!ifuncs.empty())
+	{
+		Ifuncs waitingIfuncs;
+		waitingIfuncs.swap(ifuncs);
+		std::thread(&PendingHooks::InstallIfuncs, this, waitingIfuncs).detach();
+	}
+#endif
+}
+
+void PendingHooks::Install(const ModuleExplorer::Modules& modules, const Hooks& waiting)
+{
+	std::vector<FuncHooker*> batch;
+	Hooks prepared;
+
+	// Everything slow happens before the one pause: finding the names, disassembling and
+	// building trampolines.
+	for(auto it = waiting.begin(); it != waiting.end(); ++it)
+	{
+		FuncHookerPending *pending = *it;
+		for(auto modIt = modules.begin(); modIt != modules.end(); ++modIt)
+		{
+			if(!IsHinted(*modIt, pending->moduleHint))
+				continue;
+
+			const void *target = FindInModule(*modIt, pending->funcName.c_str());
+			if(target && Prepare(pending, target, modIt->GetAddress(), batch, prepared))
+				break;
+
+#ifndef WIN32
+			const void *resolver = target ? nullptr : FindIfunc(*modIt, pending->funcName.c_str());
+			if(resolver)
+			{
+				Ifunc ifunc = { pending, pending->funcName, modIt->GetAddress(), resolver };
+				ifuncs.push_back(ifunc);
+				break;
+			}
+#endif
+		}
+	}
+
+	InstallPrepared(batch, prepared);
+}
+
+bool PendingHooks::Prepare(FuncHookerPending *pending, const void *target, const void *moduleBase, std::vector<FuncHooker*>& batch, Hooks& prepared)
+{
+	try
+	{
+		FuncHooker *hooker = new FuncHooker(const_cast<void*>(target), pending->injection);
+		if(!hooker->Prepare())
+		{
+			delete hooker;
+			return false;
+		}
+
+		// Handed out before the hook goes in, so it's there for the first call.
+		if(pending->trampoline)
+			*pending->trampoline = hooker->GetTrampoline();
+
+		pending->hooker = hooker;
+		pending->moduleBase = moduleBase;
+		batch.push_back(hooker);
+		prepared.push_back(pending);
+	}
+	catch(const std::exception&)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+void PendingHooks::InstallPrepared(std::vector<FuncHooker*>& batch, const Hooks& prepared)
+{
+	InstallScheduler scheduler(UINT_MAX);
+	if(!batch.empty() && !scheduler.InstallPrepared(&batch[0], static_cast<unsigned>(batch.size())))
+	{
+		for(auto it = prepared.begin(); it != prepared.end(); ++it)
+		{
+			delete (*it)->hooker;
+			(*it)->hooker = nullptr;
+			(*it)->moduleBase = nullptr;
+
+			if((*it)->trampoline)
+				*(*it)->trampoline = nullptr;
+		}
+	}
+}
+
+bool PendingHooks::IsHinted(const Module& mod, const std::string& moduleHint)
+{
+#ifdef WIN32
+	return moduleHint.empty() || mod.GetName() == moduleHint;
+#else
+	// Hints may leave off version suffixes, so "libssl.so" finds libssl.so.3.
+	return !mod.GetName().compare(0, moduleHint.size(), moduleHint);
+#endif
+}
+
+const void *PendingHooks::FindInModule(const Module& mod, const char *name)
+{
+#ifdef WIN32
+	// Read from the export table directly. GetProcAddress could want the loader lock, which
+	// another thread may hold while waiting on us.
+	try
+	{
+		Module::Functions functions = mod.GetFunctions();
+		auto funcIt = functions.find(name);
+		return funcIt != functions.end() ? funcIt->second : nullptr;
+	}
+	catch(...)
+	{
+		return nullptr;
+	}
+#else
+	const ElfImage *image = mod.GetImage();
+	if(!image)
+		return nullptr;
+
+	const ElfImage::Symbol *found = image->FindExport(name);
+	if(found)
+		return ELF64_ST_TYPE(found->st_info) == STT_GNU_IFUNC ? nullptr : image->GetAddress(*found);
+
+	const SymbolIndex *index = mod.GetSymbolIndex();
+	return index ? index->FindName(name) : nullptr;
+#endif
+}
+
+#ifndef WIN32
+const void *PendingHooks::FindIfunc(const Module& mod, const char *name)
+{
+	const ElfImage *image = mod.GetImage();
+	const ElfImage::Symbol *found = image ? image->FindExport(name) : nullptr;
+
+	return found && ELF64_ST_TYPE(found->st_info) == STT_GNU_IFUNC ? image->GetAddress(*found) : nullptr;
+}
+
+void PendingHooks::InstallIfuncs(Ifuncs waiting)
+{
+	// dlopen takes the loader's lock, so once it returns, whichever module was being loaded has
+	// been relocated, or failed and been unloaded again.
+	void *self = dlopen(nullptr, RTLD_LAZY | RTLD_NOLOAD);
+	if(self)
+		dlclose(self);
+
+	if(destroyed)
+		return;
+
+	ModuleWatcher *watcher = ModuleWatcher::Get();
+	watcher->Lock();
+	try
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		const ModuleExplorer::Modules& modules = watcher->GetModules();
+
+		std::vector<FuncHooker*> batch;
+		Hooks prepared;
+		for(auto it = waiting.begin(); it != waiting.end(); ++it)
+		{
+			// The hook may have been removed, or its module unloaded, since it was put aside.
+			FuncHookerPending *pending = it->pending;
+			if(std::find(hooks.begin(), hooks.end(), pending) == hooks.end() || pending->hooker || pending->funcName != it->funcName)
+				continue;
+
+			const void *moduleBase = it->moduleBase;
+			if(std::find_if(modules.begin(), modules.end(), [moduleBase](const Module& mod){ return mod.GetAddress() == moduleBase; }) == modules.end())
+				continue;
+
+			// Called the way the loader does, which passes hwcaps on the architectures that want them.
+			typedef const void *(*IfuncResolver)(unsigned long);
+			const void *target = reinterpret_cast<IfuncResolver>(const_cast<void*>(it->resolver))(getauxval(AT_HWCAP));
+			if(target)
+				Prepare(pending, target, moduleBase, batch, prepared);
+		}
+
+		InstallPrepared(batch, prepared);
+	}
+	catch(...)
+	{
+	}
+	watcher->Unlock();
+}
+
+void PendingHooks::LoaderBreakpoint()
+{
+	loaderBreakpointTrampoline();
+
+	// The loader also stops here as it starts changing the list, when it can't be read.
+	if(refreshOnBreakpoint && ModuleWatcher::IsLoaderConsistent())
+		ModuleWatcher::Get()->Refresh();
+}
+#endif
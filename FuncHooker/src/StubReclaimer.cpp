@@ -0,0 +1,324 @@
+/************************************************************************************\
+ * FuncHooker - An Andrew Shurney Production                                        *
+\************************************************************************************/
+
+/*! \file		StubReclaimer.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Frees trampolines once no thread can still be executing them
+ */
+
+#include "privateInc/StubReclaimer.h"
+#include "privateInc/InjectionStub.h"
+#include "privateInc/DynamicCodeAllocator.h"
+#include "privateInc/FuncHookerCPP.h"
+#include "RemoteThread.h"
+#include "RemoteThreadManager.h"
+#include <algorithm>
+
+#ifdef WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <windows.h>
+#else
+# include "SingleThreadBlock.h"
+# include <cstring>
+# include <cstdlib>
+# include <dirent.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/syscall.h>
+
+namespace
+{
+# if defined(__x86_64__)
+	const size_t RED_ZONE = 128;   // Leaf functions keep values below the stack pointer.
+# else
+	const size_t RED_ZONE = 0;
+# endif
+
+	struct ScannedStack
+	{
+		const uint8_t *sp;
+		const uint8_t *begin;   // Of the mapping sp is in, or null if it wasn't found.
+		const uint8_t *end;
+	};
+
+	const char *ParseHex(const char *c, const char *end, uintptr_t& value)
+	{
+		value = 0;
+		for(; c < end; ++c)
+		{
+			if(*c >= '0' && *c <= '9')
+				value = value * 16 + (*c - '0');
+			else if(*c >= 'a' && *c <= 'f')
+				value = value * 16 + (*c - 'a' + 10);
+			else
+				break;
+		}
+		return c;
+	}
+
+	// Finds the mapping each stack pointer is in, which bounds the stack. A thread is parked, so
+	// /proc/self/maps is read with raw reads into a buffer on this stack, allocating nothing.
+	void FindStackMappings(ScannedStack *stacks, unsigned count)
+	{
+		int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+		if(fd < 0)
+			return;
+
+		char buffer[4096];
+		size_t used = 0;
+		for(;;)
+		{
+			ssize_t got = read(fd, buffer + used, sizeof(buffer) - used);
+			if(got <= 0)
+				break;
+			used += static_cast<size_t>(got);
+
+			size_t lineStart = 0;
+			for(size_t i=0; i<used; ++i)
+			{
+				if(buffer[i] != '\n')
+					continue;
+
+				uintptr_t begin, end;
+				const char *c = ParseHex(buffer + lineStart, buffer + i, begin);
+				if(c < buffer + i && *c == '-')
+				{
+					ParseHex(c + 1, buffer + i, end);
+					for(unsigned s=0; s<count; ++s)
+					{
+						uintptr_t sp = reinterpret_cast<uintptr_t>(stacks[s].sp);
+						if(sp >= begin && sp < end)
+						{
+							stacks[s].begin = reinterpret_cast<const uint8_t*>(begin);
+							stacks[s].end = reinterpret_cast<const uint8_t*>(end);
+						}
+					}
+				}
+
+				lineStart = i + 1;
+			}
+
+			// A line longer than the buffer is dropped. A stack in it isn't found, so nothing is freed.
+			std::memmove(buffer, buffer + lineStart, used - lineStart);
+			used -= lineStart;
+			if(used == sizeof(buffer))
+				used = 0;
+		}
+
+		close(fd);
+	}
+}
+#endif
+
+StubReclaimer::StubReclaimer() : lock(), reclaimLock(), retired(), reclaimAt(AUTO_RECLAIM_THRESHOLD)
+{
+}
+
+StubReclaimer& StubReclaimer::Get()
+{
+	static StubReclaimer reclaimer;
+	return reclaimer;
+}
+
+void StubReclaimer::Retire(InjectionStub *stub, DynamicCodeAllocator *allocator)
+{
+	bool reclaim;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		retired.push_back(RetiredStub(stub, allocator));
+		reclaim = retired.size() >= reclaimAt;
+	}
+
+	if(reclaim)
+		Reclaim();
+}
+
+unsigned StubReclaimer::Reclaim()
+{
+	std::lock_guard<std::mutex> reclaiming(reclaimLock);
+
+	RetiredStubs candidates;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		candidates.swap(retired);
+	}
+
+	if(candidates.empty())
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		reclaimAt = std::max<size_t>(AUTO_RECLAIM_THRESHOLD, 2 * retired.size());
+		return 0;
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [](const RetiredStub& lhs, const RetiredStub& rhs){ return lhs.stub < rhs.stub; });
+
+	// Everything the scan needs is allocated up front. While another thread is suspended it
+	// may hold the heap lock, so nothing may allocate until it's resumed.
+	StubStarts starts;
+	starts.reserve(candidates.size());
+	for(RetiredStubs::iterator stubIt = candidates.begin(); stubIt != candidates.end(); ++stubIt)
+		starts.push_back(reinterpret_cast<uint8_t*>(stubIt->stub));
+
+	std::vector<char> referenced(candidates.size(), 0);
+	MarkRunning(starts, referenced);
+
+	unsigned freed = 0;
+	RetiredStubs stillReferenced;
+	for(size_t i=0; i<candidates.size(); ++i)
+	{
+		if(referenced[i])
+		{
+			stillReferenced.push_back(candidates[i]);
+			continue;
+		}
+
+		candidates[i].stub->~InjectionStub();
+		candidates[i].allocator->Free(candidates[i].stub);
+		FuncHooker::ReleaseStubArea();
+		++freed;
+	}
+
+	// Stubs still in use wait for the pending count to double before the next automatic pass,
+	// so destroying hooks while many are stuck doesn't rescan them all on every retire.
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		retired.insert(retired.end(), stillReferenced.begin(), stillReferenced.end());
+		reclaimAt = std::max<size_t>(AUTO_RECLAIM_THRESHOLD, 2 * retired.size());
+	}
+
+	return freed;
+}
+
+unsigned StubReclaimer::GetPending()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return static_cast<unsigned>(retired.size());
+}
+
+void StubReclaimer::MarkReferenced(const StubStarts& starts, std::vector<char>& referenced, const void *addr)
+{
+	const uint8_t *addrPtr = reinterpret_cast<const uint8_t*>(addr);
+
+	// Find the last stub starting at or before addr.
+	StubStarts::const_iterator stubIt = std::upper_bound(starts.begin(), starts.end(), addrPtr);
+	if(stubIt == starts.begin())
+		return;
+
+	--stubIt;
+	if(addrPtr < *stubIt + sizeof(InjectionStub))
+		referenced[stubIt - starts.begin()] = 1;
+}
+
+void StubReclaimer::ScanStack(const StubStarts& starts, std::vector<char>& referenced, const void *sp, const void *stackBase)
+{
+	const uintptr_t *word = reinterpret_cast<const uintptr_t*>(reinterpret_cast<uintptr_t>(sp) & ~(sizeof(uintptr_t) - 1));
+	const uintptr_t *end = reinterpret_cast<const uintptr_t*>(stackBase);
+
+	for(; word < end; ++word)
+		MarkReferenced(starts, referenced, reinterpret_cast<const void*>(*word));
+}
+
+void StubReclaimer::MarkRunning(const StubStarts& starts, std::vector<char>& referenced)
+{
+#ifdef WIN32
+	unsigned curThreadId = static_cast<unsigned>(GetCurrentThreadId());
+
+	// Our own stack doesn't need a pause. Anything above this frame is still live.
+	const NT_TIB *curTib = reinterpret_cast<const NT_TIB*>(NtCurrentTeb());
+	ScanStack(starts, referenced, &curThreadId, curTib->StackBase);
+
+	RemoteThreadManager threadManager;
+	RemoteThreadManager::RemoteThreads threads = threadManager.GetRemoteThreads();
+	uintptr_t regs[RemoteThread::MAX_REGISTERS];
+
+	for(RemoteThreadManager::RemoteThreads::iterator threadIt = threads.begin(); threadIt != threads.end(); ++threadIt)
+	{
+		if(threadIt->GetThreadId() == curThreadId)
+			continue;
+
+		threadIt->Suspend();
+
+		// The instruction pointer, and any register which may hold a stub's address without
+		// having called it yet.
+		unsigned regCount = threadIt->GetRegisters(regs);
+		if(!regCount)
+			MarkReferenced(starts, referenced, threadIt->GetIp());
+		for(unsigned i=0; i<regCount; ++i)
+			MarkReferenced(starts, referenced, reinterpret_cast<const void*>(regs[i]));
+
+		const NT_TIB *tib = reinterpret_cast<const NT_TIB*>(threadIt->GetTEBAddr());
+		if(tib)
+			ScanStack(starts, referenced, threadIt->GetSp(), tib->StackBase);
+
+		threadIt->Resume();
+	}
+#else
+	pid_t curThreadId = static_cast<pid_t>(syscall(SYS_gettid));
+
+	// Our own stack doesn't need a pause. Anything above this frame is still live.
+	ScannedStack ownStack = { reinterpret_cast<const uint8_t*>(&curThreadId), nullptr, nullptr };
+	FindStackMappings(&ownStack, 1);
+	if(!ownStack.end)
+	{
+		std::fill(referenced.begin(), referenced.end(), 1);
+		return;
+	}
+	ScanStack(starts, referenced, ownStack.sp, ownStack.end);
+
+	// Threads are listed while none are parked, as listing allocates. One that starts after this
+	// can't be in a stub that was already retired, since its hook was removed before it started.
+	std::vector<pid_t> threadIds;
+	DIR *taskDir = opendir("/proc/self/task");
+	if(!taskDir)
+	{
+		std::fill(referenced.begin(), referenced.end(), 1);
+		return;
+	}
+	while(dirent *entry = readdir(taskDir))
+	{
+		char *end;
+		unsigned long threadId = strtoul(entry->d_name, &end, 10);
+		if(threadId && !*end && static_cast<pid_t>(threadId) != curThreadId)
+			threadIds.push_back(static_cast<pid_t>(threadId));
+	}
+	closedir(taskDir);
+
+	// Like on Windows, each thread is parked on its own, scanned, and let go before the next.
+	for(auto threadIt = threadIds.begin(); threadIt != threadIds.end(); ++threadIt)
+	{
+		SingleThreadBlock pauseThread(0, static_cast<unsigned>(*threadIt));
+
+		// A thread left running could be anywhere, so nothing can be proven unused.
+		if(!pauseThread.PausedAll())
+		{
+			std::fill(referenced.begin(), referenced.end(), 1);
+			return;
+		}
+
+		// It exited since it was listed.
+		if(!pauseThread.GetPausedCount())
+			continue;
+
+		// Its registers too, as it may hold a stub's address without having called it.
+		SingleThreadBlock::PausedThread thread = pauseThread.GetPausedThread(0);
+		for(unsigned r=0; r<thread.regCount; ++r)
+			MarkReferenced(starts, referenced, reinterpret_cast<const void*>(thread.regs[r]));
+
+		ScannedStack stack = { static_cast<const uint8_t*>(thread.sp), nullptr, nullptr };
+		FindStackMappings(&stack, 1);
+		if(!stack.end)
+		{
+			std::fill(referenced.begin(), referenced.end(), 1);
+			return;
+		}
+
+		const uint8_t *sp = static_cast<size_t>(stack.sp - stack.begin) > RED_ZONE ? stack.sp - RED_ZONE : stack.begin;
+		ScanStack(starts, referenced, sp, stack.end);
+	}
+#endif
+}
+
+StubReclaimer::RetiredStub::RetiredStub(InjectionStub *stub, DynamicCodeAllocator *allocator) : stub(stub), allocator(allocator)
+{
+}
@@ -0,0 +1,140 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		ElfImage.h
+ *  \author		Andrew Shurney
+ *  \brief		Reads the dynamic symbols of an ELF module (Linux only)
+ */
+
+#ifndef ELF_IMAGE_H
+#define ELF_IMAGE_H
+
+#ifndef WIN32
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <link.h>
+
+/*! \brief The dynamic symbol table of a loaded ELF module, read where it already is.
+
+	<p>For a module of the current process, the tables are found through its dynamic section
+	and read straight out of the loaded image. For a module of another process, the file it was
+	loaded from is mapped read only and the tables are found through its section headers.
+	Either way nothing is copied; names point into the image.</p>
+
+	<p>Addresses are translated to where the module is loaded in its process. Images read from a
+	file also have the file's full .symtab, if it wasn't stripped.</p>
+*/
+class ElfImage
+{
+	public:
+		typedef ElfW(Sym) Symbol;
+
+	private:
+		const uint8_t *fileMap;   //!< The whole file, if read from disk. Null for a loaded image.
+		size_t fileSize;
+		uintptr_t bias;           //!< Added to a symbol's value to get its address.
+		const ElfW(Phdr) *phdrs;
+		unsigned phdrCount;
+
+		const Symbol *dynSyms;
+		unsigned dynSymCount;
+		const char *dynStr;
+		size_t dynStrSize;
+		const uint32_t *gnuHash;  //!< .gnu.hash, if the module has one.
+		const uint32_t *sysvHash; //!< .hash, if the module has one.
+		const uint16_t *versyms;  //!< Version of each dynamic symbol, if the module has them.
+
+		const Symbol *symtab;     //!< .symtab, only read from files, and only if not stripped.
+		unsigned symtabCount;
+		const char *symStr;
+		size_t symStrSize;
+
+		std::string buildId;      //!< In hex. Empty if the module has none.
+
+		ElfImage(const ElfImage&);            // Do not implement
+		ElfImage& operator=(const ElfImage&); // Do not implement
+
+		void ReadDynamic(const ElfW(Dyn) *dynamic);
+		void ReadSections();
+		void ReadBuildId(const uint8_t *notes, size_t size);
+		static unsigned CountFromHash(const uint32_t *hash);
+		static unsigned CountFromGnuHash(const uint32_t *gnuHash);
+
+		const Symbol *FindWithGnuHash(const char *name) const;
+		const Symbol *FindWithSysvHash(const char *name) const;
+		const Symbol *FindLinear(const char *name) const;
+		bool IsMatch(const Symbol& symbol, const char *name) const;
+		bool IsDefaultVersion(const Symbol& symbol) const;
+
+	public:
+		/*! \brief Reads a module of the current process from its program headers. */
+		ElfImage(uintptr_t bias, const ElfW(Phdr) *phdrs, unsigned phdrCount);
+
+		/*! \brief Reads a module of another process from the file it was loaded from.
+			\param loadAddress - Where the file's first page is mapped in the other process.
+		*/
+		ElfImage(const std::string& path, const void *loadAddress);
+
+		~ElfImage();
+
+		unsigned GetSymbolCount() const;
+		const Symbol& GetSymbol(unsigned index) const;
+
+		/*! \brief Symbols in .symtab, which has the module's local functions as well as its exports.
+
+			<p>.symtab isn't loaded, so it's only there for images read from a file. Stripped
+			files don't have one.</p>
+		*/
+		unsigned GetStaticSymbolCount() const;
+		const Symbol& GetStaticSymbol(unsigned index) const;
+		const char *GetStaticName(const Symbol& symbol) const;
+
+		const char *GetName(const Symbol& symbol) const;
+		const void *GetAddress(const Symbol& symbol) const;
+
+		/*! \brief The GNU build id from the module's notes, as hex digits.
+
+			<p>It names the module's contents rather than its path, so it's what separate debug
+			files and the SymbolCache are found by. Empty if the linker didn't write one.</p>
+		*/
+		const std::string& GetBuildId() const;
+
+		/*! \brief Finds a symbol this module defines by name, through its hash table.
+
+			<p>The .gnu.hash bloom filter rejects most names the module doesn't define without
+			touching the symbol table at all. Otherwise a single bucket's chain is compared. Modules
+			with only a .hash table use that, and modules with neither are searched in full. If
+			a name has several versions, the default one is returned. Nothing is allocated.</p>
+
+			\return Null if the module doesn't define the name.
+		*/
+		const Symbol *FindExport(const char *name) const;
+
+		/*! \brief Whether the symbol is a function this module defines and lets others call.
+			\param allowIfuncs - Count ifuncs, whose address is a resolver rather than the function.
+		*/
+		static bool IsExportedFunction(const Symbol& symbol, bool allowIfuncs = false);
+
+		/*! \brief Where the bytes the module loads at an address can be read in this process.
+
+			<p>A loaded image is read in place. An image read from a file is read from the
+			file's mapping, which only has what the file holds, so not .bss.</p>
+
+			\param[out] available - How many bytes can be read from there, to the segment's end.
+			\return Null if no segment loads the address.
+		*/
+		const uint8_t *GetLoaded(const void *address, size_t *available) const;
+
+		/*! \brief Where the module's .eh_frame_hdr is loaded, in its process. Null if it has none. */
+		const void *GetEhFrameHdr() const;
+
+		/*! \brief Span of the module's loadable segments, relative to its first page. */
+		static size_t GetLoadSize(const ElfW(Phdr) *phdrs, unsigned phdrCount, uintptr_t *firstPage = nullptr);
+};
+
+#endif
+
+#endif
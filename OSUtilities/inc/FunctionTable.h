@@ -0,0 +1,70 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		FunctionTable.h
+ *  \author		Andrew Shurney
+ *  \brief		Where a module's functions start and end, from its unwind tables
+ */
+
+#ifndef FUNCTION_TABLE_H
+#define FUNCTION_TABLE_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#ifndef WIN32
+class ElfImage;
+#endif
+
+/*! \brief Sorted table of the start and size of every function a module has unwind data for.
+
+	<p>Unwinding needs to know which function any address is in, so compilers describe every
+	function's extent, symbols or not. Stripped modules keep it. On Linux it's the FDEs of
+	.eh_frame, found through .eh_frame_hdr and read in place: from the loaded image for a
+	module of this process, and from the mapped file for another. On Windows it's the x64
+	exception directory (.pdata). 32 bit Windows modules have none, so their table is
+	empty.</p>
+
+	<p>Like SymbolIndex, the table is two parallel arrays of 32 bit offsets into the module,
+	searched without branching on the comparisons. Functions split into several parts, such
+	as the cold part GCC moves away from the rest, have an entry for each part.</p>
+*/
+class FunctionTable
+{
+	private:
+		const uint8_t *moduleBase;
+		size_t moduleSize;
+		std::vector<uint32_t> starts;   //!< Offset of each function from moduleBase, ascending.
+		std::vector<uint32_t> sizes;
+
+		void Add(uintptr_t start, uintptr_t size);
+		void Sort();
+
+		FunctionTable(const FunctionTable&);            // Do not implement
+		FunctionTable& operator=(const FunctionTable&); // Do not implement
+
+	public:
+#ifdef WIN32
+		/*! \brief Reads the exception directory of a module loaded in a process. */
+		FunctionTable(unsigned procId, const void *moduleBase, size_t moduleSize);
+#else
+		/*! \brief Reads the FDEs of a module's .eh_frame. */
+		FunctionTable(const ElfImage& image, const void *moduleBase, size_t moduleSize);
+#endif
+
+		/*! \brief Finds the function containing addr.
+			\param[out] size - Set to the function's size, if found. May be null.
+			\return Where the function starts, or null if addr isn't in any function.
+		*/
+		const void *Find(const void *addr, size_t *size = nullptr) const;
+
+		unsigned GetCount() const;
+
+		/*! \brief The index'th function, in address order. */
+		const void *GetStart(unsigned index) const;
+		size_t GetSize(unsigned index) const;
+};
+
+#endif
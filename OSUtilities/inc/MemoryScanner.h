@@ -0,0 +1,205 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		MemoryScanner.h
+ *  \author		Andrew Shurney
+ *  \brief		Searches a process's memory for values
+ */
+
+#ifndef MEMORY_SCANNER_H
+#define MEMORY_SCANNER_H
+
+#include <vector>
+#include <utility>
+#include <type_traits>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include "ProcessHandle.h"
+#include "ProcessMemory.h"
+#include "SignatureScanner.h"
+
+/*! \brief Searches the memory of a process for values, and narrows down what it found.
+
+	<p>Scan looks through every readable region of the process, or only the writable ones,
+	which is where data lives. Regions are cut into 1MB chunks, which a thread per core takes
+	in turn, so while some threads wait on reads, others are matching. On Linux, the pages of
+	each chunk of an anonymous private mapping (the heap, stacks, and the like) are first
+	looked up in /proc/pid/pagemap, and those that aren't in memory are skipped rather than
+	faulted or swapped in. Pages of file mappings and shared mappings are always read: a
+	private file mapping's untouched pages still hold the file's contents, and pagemap only
+	knows which shared pages this process has touched. Anonymous pages that were never touched
+	are zeros, so a search for 0 doesn't find them.</p>
+
+	<p>Values are found at multiples of the query's alignment. 32 and 64 bit values aligned to
+	their size are compared 32 or 16 bytes at a time with AVX2 or SSE4.2, against both ends of
+	the range at once. Everything else is compared one value at a time.</p>
+
+	<p>Rescan narrows hits down, reading back only the hits, a few hundred bytes around each at
+	most, and keeping those that still match. It can also compare against the value each hit
+	had, to keep what changed, went up, and so on.</p>
+*/
+class MemoryScanner
+{
+	public:
+		enum ValueType
+		{
+			U8, U16, U32, U64,
+			I8, I16, I32, I64,
+			F32, F64
+		};
+
+		enum Compare
+		{
+			EXACT,
+			RANGE,       //!< low <= value <= high.
+			CHANGED,     //!< The rest compare against the value a hit had, so are for Rescan.
+			UNCHANGED,
+			INCREASED,
+			DECREASED
+		};
+
+		struct Query
+		{
+			ValueType type;
+			Compare compare;
+			uint64_t low;        //!< Bits of the value, or of the bottom of the range.
+			uint64_t high;
+			unsigned alignment;
+
+			template<typename T>
+			static Query Exact(T value, unsigned alignment = sizeof(T))
+			{
+				return Make(TypeOf<T>(), EXACT, Bits(value), Bits(value), alignment);
+			}
+
+			template<typename T>
+			static Query Range(T low, T high, unsigned alignment = sizeof(T))
+			{
+				return Make(TypeOf<T>(), RANGE, Bits(low), Bits(high), alignment);
+			}
+
+			/*! \brief Pointers into [begin, begin + size), such as to find what refers to an object. */
+			static Query PointerInto(const void *begin, size_t size, unsigned pointerSize = sizeof(void*))
+			{
+				uint64_t first = reinterpret_cast<uintptr_t>(begin);
+				return Make(pointerSize == 4 ? U32 : U64, RANGE, first, first + size - 1, pointerSize);
+			}
+
+			/*! \brief Hits whose value compares so with what it was, for Rescan. */
+			template<typename T>
+			static Query Compared(Compare compare)
+			{
+				return Make(TypeOf<T>(), compare, 0, 0, sizeof(T));
+			}
+
+			static Query Make(ValueType type, Compare compare, uint64_t low, uint64_t high, unsigned alignment)
+			{
+				Query query = { type, compare, low, high, alignment ? alignment : 1 };
+				return query;
+			}
+
+			template<typename T>
+			static uint64_t Bits(T value)
+			{
+				uint64_t bits = 0;
+				std::memcpy(&bits, &value, sizeof(T));
+				return bits;
+			}
+
+			template<typename T>
+			static ValueType TypeOf()
+			{
+				static_assert(std::is_arithmetic<T>::value && sizeof(T) <= 8, "Values are numbers of up to 8 bytes");
+				if(std::is_floating_point<T>::value)
+					return sizeof(T) == 4 ? F32 : F64;
+
+				static const ValueType unsignedTypes[] = { U8, U16, U32, U32, U64, U64, U64, U64 };
+				static const ValueType signedTypes[]   = { I8, I16, I32, I32, I64, I64, I64, I64 };
+				return std::is_signed<T>::value ? signedTypes[sizeof(T) - 1] : unsignedTypes[sizeof(T) - 1];
+			}
+		};
+
+		struct Hit
+		{
+			const void *address;   //!< In the scanned process.
+			uint64_t value;        //!< Bits of the value there, when last scanned.
+		};
+		typedef std::vector<Hit> Hits;
+
+		typedef std::vector<std::pair<const void*, size_t>> Regions;
+
+		struct Stats
+		{
+			uint64_t regions;
+			uint64_t bytesRead;
+			uint64_t pagesSkipped;   //!< Not in memory, so not read.
+			uint64_t bytesFailed;    //!< Couldn't be read, as they were unmapped during the scan.
+		};
+
+	private:
+		struct Region
+		{
+			const uint8_t *addr;
+			size_t size;
+			bool anonymous;        //!< Private and backed by no file, so its pages that aren't in memory hold nothing to find.
+		};
+
+		struct Chunk
+		{
+			const uint8_t *addr;
+			size_t size;           //!< Values starting in it are reported from it.
+			size_t readSize;       //!< Including the start of the next chunk, for values straddling the two.
+			bool checkPages;       //!< Whether to skip the pages pagemap says aren't in memory.
+		};
+
+		ProcessHandle procHandle;
+		unsigned threadCount;
+		bool writableOnly;
+		SignatureScanner::SimdLevel simd;
+		Stats stats;
+#ifndef WIN32
+		int pagemapFd;
+#endif
+
+		std::vector<Region> ListRegions() const;
+		void ScanChunk(const Query& query, const Chunk& chunk, std::vector<uint8_t>& buffer, ProcessMemory& memory, Hits& hits, Stats& chunkStats) const;
+		void ScanBlock(const Query& query, const uint8_t *data, size_t size, size_t reportLimit, const uint8_t *address, Hits& hits) const;
+		void RescanBlock(const Query& query, const Hit *begin, const Hit *end, ProcessMemory& memory, Hits& kept, Stats& blockStats) const;
+		size_t ScanSse42(const Query& query, const uint8_t *data, size_t size, size_t reportLimit, const uint8_t *address, Hits& hits) const;
+		size_t ScanAvx2(const Query& query, const uint8_t *data, size_t size, size_t reportLimit, const uint8_t *address, Hits& hits) const;
+
+		MemoryScanner(const MemoryScanner&);            // Do not implement
+		MemoryScanner& operator=(const MemoryScanner&); // Do not implement
+
+	public:
+		MemoryScanner(unsigned procId = 0);
+		~MemoryScanner();
+
+		/*! \brief Finds every value matching an EXACT or RANGE query, in address order. Throws
+			for the other compares. */
+		void Scan(const Query& query, Hits& hits);
+
+		/*! \brief Keeps only the hits that still match, updating their values. The query's
+			type should be the one they were found with. */
+		void Rescan(const Query& query, Hits& hits);
+
+		/*! \brief The regions Scan would look through. */
+		Regions GetRegions() const;
+
+		/*! \brief Whether to scan only writable regions. Defaults to true. */
+		void SetWritableOnly(bool writable);
+
+		/*! \brief Defaults to one thread per core. */
+		void SetThreadCount(unsigned count);
+
+		/*! \brief Limits the instructions used, to compare them. Defaults to
+			SignatureScanner::GetSupportedSimd. */
+		void SetSimd(SignatureScanner::SimdLevel level);
+
+		/*! \brief What the last Scan or Rescan did. */
+		const Stats& GetStats() const;
+};
+
+#endif
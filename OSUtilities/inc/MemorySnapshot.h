@@ -0,0 +1,112 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		MemorySnapshot.h
+ *  \author		Andrew Shurney
+ *  \brief		Copies of a process's memory, and what changed between them
+ */
+
+#ifndef MEMORY_SNAPSHOT_H
+#define MEMORY_SNAPSHOT_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "ProcessMemory.h"
+
+/*! \brief Keeps copies of ranges of a process's memory, and finds what changed in them each
+	time they're taken again.
+
+	<p>The first Take reads every range. After that, on Linux, only pages written since the
+	last Take are read back. Their soft-dirty bits are read from /proc/pid/pagemap, then
+	cleared for the whole process through /proc/pid/clear_refs. Pages read back are compared
+	with the copy, and the bytes that differ are reported as runs, with runs a few bytes apart
+	joined. A Take costs eight bytes of pagemap a page, and reads only what was written.</p>
+
+	<p>Without soft-dirty bits every page is read back and compared, which finds the same
+	changes at the cost of reading everything. That's the case on Windows, on kernels built
+	without them, and without the rights to clear them.</p>
+
+	<p>Clearing the bits clears them for everything watching the process, so there should be
+	one snapshot of a process at a time. A page written between its bit being read and the bits
+	being cleared, a few microseconds, is missed until it's written again. Stop the process
+	during Take for an exact diff.</p>
+*/
+class MemorySnapshot
+{
+	public:
+		struct Change
+		{
+			size_t offset;   //!< From the start of the range.
+			size_t size;
+		};
+		typedef std::vector<Change> Changes;
+
+	private:
+		static const size_t JOIN_GAP = 16;   //!< Changes closer than this are reported as one.
+
+		struct Range
+		{
+			const uint8_t *addr;
+			size_t size;
+			std::vector<uint8_t> data;   //!< As of the last Take.
+			Changes changes;             //!< Found by the last Take.
+			bool read;                   //!< Whether data has been read yet.
+		};
+
+		struct Run
+		{
+			unsigned range;
+			size_t offset;
+			size_t size;
+		};
+		typedef std::vector<Run> Runs;
+
+		ProcessHandle procHandle;
+		ProcessMemory memory;
+		std::vector<Range> ranges;
+		bool softDirty;       //!< Whether soft-dirty bits can be used.
+		size_t pagesRead;     //!< By the last Take.
+#ifndef WIN32
+		int pagemapFd;
+
+		bool FindDirtyPages(Runs& runs);
+		bool ClearSoftDirty();
+#endif
+		void AddRun(Runs& runs, unsigned range, size_t offset, size_t size) const;
+		void ReadRuns(const Runs& runs);
+		void Compare(Range& range, size_t offset, const uint8_t *now, size_t size);
+
+		MemorySnapshot(const MemorySnapshot&);            // Do not implement
+		MemorySnapshot& operator=(const MemorySnapshot&); // Do not implement
+
+	public:
+		MemorySnapshot(unsigned procId = 0);
+		~MemorySnapshot();
+
+		/*! \brief Adds a range to watch. It's first read by the next Take.
+			\return The range's number, for GetChanges and GetData.
+		*/
+		unsigned AddRange(const void *addr, size_t size);
+
+		/*! \brief Reads what changed since the last Take. Throws if a range can't be read. */
+		void Take();
+
+		unsigned GetRangeCount() const;
+
+		/*! \brief What the last Take found changed in a range, in address order. Empty after the
+			range's first Take. */
+		const Changes& GetChanges(unsigned range) const;
+
+		/*! \brief The copy of a range, as of the last Take. */
+		const uint8_t *GetData(unsigned range) const;
+
+		/*! \brief Pages the last Take read from the process. */
+		size_t GetPagesRead() const;
+
+		/*! \brief Whether Take reads only written pages, rather than everything. */
+		bool UsesSoftDirty() const;
+};
+
+#endif
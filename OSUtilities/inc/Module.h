@@ -11,15 +11,33 @@
 #define MODULE_H
 
 #include <string>
+#include <vector>
 #include <unordered_map>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
 #include "ProcessHandle.h"
 
+class SymbolSearch;
+class FunctionTable;
+
+#ifdef WIN32
 struct WIN_LDR_MODULE;
+#else
+class ElfImage;
+class SymbolIndex;
+#endif
+
+/*! \brief A module (dll, shared object or executable) loaded into a process.
 
+	<p>Copies share the same data. On Linux the module's ELF image is only read the first time
+	its symbols are asked for.</p>
+*/
 class Module
 {
 	public:
 		typedef std::unordered_map<std::string, const void*> Functions;
+		typedef std::vector<std::pair<const void*, size_t> > Ranges;
 
 	private:
 		struct ModuleData
@@ -29,16 +47,35 @@ class Module
 			void *address;
 			unsigned size;
 
+#ifndef WIN32
+			std::string path;
+			const void *phdrs;       //!< Program headers, if the module is in the current process.
+			unsigned phdrCount;
+			std::once_flag imageRead;
+			ElfImage *image;         //!< Null until read, or if it couldn't be.
+			std::once_flag indexBuilt;
+			SymbolIndex *index;      //!< Null until built, or if it couldn't be.
+#endif
+			std::once_flag searchBuilt;
+			SymbolSearch *search;    //!< Null until built, or if it couldn't be.
+			std::once_flag tableBuilt;
+			FunctionTable *table;    //!< Null until built, or if it couldn't be.
+
 			ModuleData(unsigned procId);
+			~ModuleData();
 		};
 
 		ModuleData *data;
-		unsigned *refs;
+		std::atomic<unsigned> *refs; // Module lists are copied and destroyed by any thread
 
 		void Destroy();
 
 		friend class ModuleExplorer;
+#ifdef WIN32
 		Module(const WIN_LDR_MODULE& module, unsigned procId = 0);
+#else
+		Module(const std::string& path, void *address, unsigned size, const void *phdrs, unsigned phdrCount, unsigned procId = 0);
+#endif
 
 	public:
 		Module(const Module& rhs);
@@ -49,10 +86,44 @@ class Module
 
 		const std::string& GetName() const;
 		const void *GetAddress() const;
+		unsigned GetSize() const;
+		unsigned GetProcId() const;
 
 		bool Contains(const void *addr) const;
 
 		Functions GetFunctions() const;
+
+		/*! \brief Start and size of each executable part of the module. On Windows these are its
+			executable sections, on Linux its executable segments.
+		*/
+		Ranges GetCodeRanges() const;
+
+		/*! \brief Index of the module's function names for pattern queries, built on first use.
+			Null if it can't be.
+
+			<p>On Windows it has the module's exports. On Linux it has every function in the
+			module's SymbolIndex.</p>
+		*/
+		const SymbolSearch *GetSymbolSearch() const;
+
+		/*! \brief Start and size of every function the module has unwind data for, built on
+			first use. Null if it can't be.
+
+			<p>Unlike the SymbolIndex this needs no symbols, so it covers stripped modules too.</p>
+		*/
+		const FunctionTable *GetFunctionTable() const;
+
+#ifndef WIN32
+		const std::string& GetPath() const;
+
+		/*! \brief The module's dynamic symbols, read on first use. Null if they can't be read. */
+		const ElfImage *GetImage() const;
+
+		/*! \brief Index of every function in the module by address, built on first use or read from
+			the SymbolCache. Null if it can't be.
+		*/
+		const SymbolIndex *GetSymbolIndex() const;
+#endif
 };
 
 #endif
\ No newline at end of file
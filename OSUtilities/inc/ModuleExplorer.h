@@ -15,7 +15,18 @@
 #include <vector>
 #include <unordered_map>
 #include <string>
+#include <cstddef>
 
+#ifndef WIN32
+struct dl_phdr_info;
+#endif
+
+/*! \brief Lists the modules loaded into a process.
+
+	<p>On Windows the loader's module list is read out of the process's PEB. On Linux, the
+	current process's modules come from dl_iterate_phdr and another process's from the files
+	mapped in /proc/&lt;pid&gt;/maps.</p>
+*/
 class ModuleExplorer
 {
 	public:
@@ -27,6 +38,14 @@ class ModuleExplorer
 		ProcessHandle procHandle;
 		ModuleMap knownModules;
 
+		static std::string NormalizeName(std::string name);
+
+#ifndef WIN32
+		static int AddLoadedModule(dl_phdr_info *info, size_t size, void *explorer);
+		void AddMappedModules();
+		void AddModule(const Module& mod);
+#endif
+
 	public:
 		ModuleExplorer(unsigned procId = 0);
 		~ModuleExplorer();
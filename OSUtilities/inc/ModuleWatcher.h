@@ -0,0 +1,97 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		ModuleWatcher.h
+ *  \author		Andrew Shurney
+ *  \brief		Follows modules of this process being loaded and unloaded
+ */
+
+#ifndef MODULE_WATCHER_H
+#define MODULE_WATCHER_H
+
+#include <map>
+#include <mutex>
+#include <functional>
+#include "ModuleExplorer.h"
+
+/*! \brief Keeps this process's module list up to date, telling listeners what changed.
+
+	<p>The list is read once, when the watcher is first used. After that only changes are
+	looked at. Modules still loaded keep the Module they started with, so whatever they've
+	already read or indexed is kept, and listeners are only told about modules which came or
+	went.</p>
+
+	<p>On Windows the loader calls us on every load and unload, through
+	LdrRegisterDllNotification. It does so before the dll's entry point runs, with the loader
+	lock held.</p>
+
+	<p>On Linux the loader calls the function at r_debug.r_brk (_dl_debug_state) whenever it
+	changes the module list. That's where debuggers put a breakpoint, and Refresh should be
+	called from there once the list is consistent again (IsLoaderConsistent). FuncHooker does
+	this when it has pending hooks. A Refresh with nothing changed costs one call to
+	dl_iterate_phdr, as the loader counts the loads and unloads it's done.</p>
+
+	<p>Listeners are called with the watcher locked, one change at a time, from the thread
+	which loaded or unloaded the module.</p>
+*/
+class ModuleWatcher
+{
+	public:
+		typedef std::function<void(const ModuleExplorer::Modules& loaded, const ModuleExplorer::Modules& unloaded)> Listener;
+
+	private:
+		typedef std::map<unsigned, Listener> Listeners;
+
+		ModuleExplorer::Modules modules;  //!< Sorted by address.
+		Listeners listeners;
+		unsigned nextListenerId;
+		std::recursive_mutex lock;        //!< Recursive, so listeners can load modules themselves.
+
+#ifdef WIN32
+		void *notificationCookie;
+#else
+		unsigned long long loads;         //!< The loader's counts as of the last Refresh.
+		unsigned long long unloads;
+#endif
+
+		ModuleWatcher();
+		~ModuleWatcher();
+
+		ModuleWatcher(const ModuleWatcher&);            // Do not implement
+		ModuleWatcher& operator=(const ModuleWatcher&); // Do not implement
+
+		void Apply(const ModuleExplorer::Modules& loaded, const ModuleExplorer::Modules& unloaded);
+
+#ifdef WIN32
+		static void __stdcall LoaderNotification(unsigned long reason, const void *data, void *context);
+#endif
+
+	public:
+		static ModuleWatcher* Get();
+
+		/*! \brief Calls listener on every change from now on.
+			\return An id for RemoveListener.
+		*/
+		unsigned AddListener(const Listener& listener);
+		void RemoveListener(unsigned id);
+
+		/*! \brief Compares the loader's module list to ours and passes on any differences. */
+		void Refresh();
+
+		/*! \brief Holds off changes until Unlock. GetModules is only valid in between. */
+		void Lock();
+		void Unlock();
+
+		const ModuleExplorer::Modules& GetModules() const;
+
+#ifndef WIN32
+		/*! \brief The function the loader calls on each change to its module list. */
+		static void *GetLoaderBreakpoint();
+
+		/*! \brief Whether the loader has finished changing its module list. */
+		static bool IsLoaderConsistent();
+#endif
+};
+
+#endif
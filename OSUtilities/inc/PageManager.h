@@ -12,6 +12,7 @@
 
 #include <vector>
 #include <set>
+#include <map>
 #include <cstdint>
 #include "OSMemoryRights.h"
 #include "ProcessHandle.h"
@@ -23,6 +24,7 @@ class PageManager
 		typedef std::vector<uint8_t*> Pages;
 		typedef std::set<uint8_t*> SortedPages;
 		typedef std::vector<Pages> VirtualPages;
+		typedef std::map<uint8_t*, unsigned> Regions;
 
 		unsigned pageSize;           //!< Physical memory page size for the system
 		unsigned virtualPageSize;    //!< Minimum allocation unit of virtual memory for the system.
@@ -31,10 +33,11 @@ class PageManager
 
 		VirtualPages pages;          //!< All pages held by the manager
 		SortedPages freePages;       //!< All pages currently not commited.
+		Regions regions;             //!< Reserved size of every region handed out.
 
-		uint8_t *AllocatePage(void *addr);
-		uint8_t *AllocatePageNear(void *near);
-		void FreePage(void *addr);
+		uint8_t *AllocatePage(void *addr, unsigned size);
+		uint8_t *AllocatePageNear(void *near, unsigned size);
+		void FreePage(void *addr, unsigned size);
 
 	public:
 		PageManager(unsigned pageSize, bool extraPage=false, unsigned procId = 0);
@@ -50,6 +53,24 @@ class PageManager
 		/*! \brief Returns a page to this page manager. */
 		void ReturnPage(void *page);
 
+		/*! \brief Requests a contiguous region of memory spanning many pages.
+		    \param[in] size - Minimum size of the region in bytes.
+		    \param[in] near - Address you want the returned region to be within +/- 2gb of.
+
+			<p>Regions are reserved directly from the OS rather than carved from the manager's
+			pages, so they can be any size. Like pages, the region is returned reserved and must
+			be committed before use.</p>
+
+			\return Start of the region, or NULL if it could not be reserved.
+		*/
+		void* RequestRegion(unsigned size, void *near=NULL);
+
+		/*! \brief Releases a region from RequestRegion back to the OS. */
+		void ReturnRegion(void *region);
+
+		/*! \brief Size a region of the requested size is actually reserved with. */
+		unsigned GetRegionSize(unsigned size) const;
+
 		/*! \brief Return all empty pages of memory to the OS
 		
 			The entire virtual page needs to be uncommitted to release.
@@ -10,6 +10,8 @@
 #ifndef PROCESS_HANDLE_H
 #define PROCESS_HANDLE_H
 
+#include <atomic>
+
 class ProcessHandle
 {
 	private:
@@ -22,7 +24,7 @@ class ProcessHandle
 		};
 
 		Data *data;
-		unsigned *refs;
+		std::atomic<unsigned> *refs; // Handles are copied out of ProcessHandleManager by any thread
 
 		void Destroy();
 		bool GrantRights(unsigned rights);
@@ -11,6 +11,7 @@
 #define PROCESS_HANDLE_MANAGER_H
 
 #include <unordered_map>
+#include <mutex>
 #include "ProcessHandle.h"
 
 class ProcessHandleManager
@@ -19,6 +20,7 @@ class ProcessHandleManager
 		typedef std::unordered_map<unsigned, ProcessHandle> ProcIdHandles;
 
 		ProcIdHandles procIdHandles;
+		std::mutex lock;
 
 		ProcessHandleManager();
 		~ProcessHandleManager();
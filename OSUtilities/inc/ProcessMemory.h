@@ -11,9 +11,60 @@
 #define PROCESS_MEMORY_H
 
 #include "ProcessHandle.h"
-
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstddef>
+#include <cstdint>
+
+/*! \brief Reads and writes memory of this or another process.
+
+	<p>On Linux, another process's memory is moved with process_vm_readv and process_vm_writev,
+	which honour its page protections. Pages they can't reach, such as read only code being
+	patched, go through /proc/pid/mem instead, which writes through protections as a debugger
+	does. If that fails too, it throws.</p>
+
+	<p>ReadV and WriteV move many ranges at once. On Linux that's up to IOV_MAX ranges a
+	system call. Windows has no such call, so they do one range at a time.</p>
+
+	<p>Reads can be cached, for code that reads many small, nearby things, such as headers
+	and tables, or the same things over and over. EnableCache keeps whole blocks of 4KB or
+	64KB in a least recently used list. A read fetches every block it's missing in one
+	ReadV, and while reads keep following on from the last block fetched, more and more
+	blocks after it are fetched with them. Reads larger than a few blocks skip the cache.
+	Writes go through to the process and update what's cached. What the process changes
+	itself isn't seen until it's invalidated, except in ranges marked immutable, such as
+	code, which InvalidateAll keeps.</p>
+*/
 class ProcessMemory
 {
+	public:
+		struct ReadRange
+		{
+			const void *addr;  //!< In the process.
+			void *val;         //!< Here.
+			unsigned size;
+		};
+
+		struct WriteRange
+		{
+			void *addr;        //!< In the process.
+			const void *val;   //!< Here.
+			unsigned size;
+		};
+
+		struct CacheStats
+		{
+			uint64_t hits;            //!< Blocks reads found cached.
+			uint64_t misses;          //!< Blocks reads had to fetch.
+			uint64_t prefetches;      //!< Blocks fetched ahead of sequential reads.
+			uint64_t evictions;
+			uint64_t invalidations;   //!< Blocks dropped by Invalidate and InvalidateAll.
+			uint64_t fetches;         //!< Reads from the process. One system call each on Linux.
+			uint64_t writes;          //!< Writes to the process, the same.
+		};
+
 	private:
 		class Memory
 		{
@@ -21,15 +72,30 @@ class ProcessMemory
 				virtual ~Memory() {}
 				virtual void Write(void *addr, const void* val, unsigned size) = 0;
 				virtual void Read(const void *addr, void* val, unsigned size) = 0;
+				virtual void WriteV(const WriteRange *ranges, unsigned count);
+				virtual void ReadV(const ReadRange *ranges, unsigned count);
 		};
 
 		class RemoteMemory : public Memory
 		{
 			private:
 				ProcessHandle procHandle;
+#ifndef WIN32
+				int memFd;     //!< /proc/pid/mem, opened the first time it's needed.
+
+				int GetMemFd();
+				void WriteMem(void *addr, const void *val, unsigned size);
+				void ReadMem(const void *addr, void *val, unsigned size);
+#endif
 
 			public:
 				RemoteMemory(unsigned procId);
+#ifndef WIN32
+				~RemoteMemory();
+
+				virtual void WriteV(const WriteRange *ranges, unsigned count);
+				virtual void ReadV(const ReadRange *ranges, unsigned count);
+#endif
 
 				virtual void Write(void *addr, const void* val, unsigned size);
 				virtual void Read(const void *addr, void* val, unsigned size);
@@ -42,18 +108,107 @@ class ProcessMemory
 				virtual void Read(const void *addr, void* val, unsigned size);
 		};
 
+		class CachedMemory : public Memory
+		{
+			private:
+				static const unsigned MAX_READ_BLOCKS = 8;   //!< Reads any larger aren't cached.
+				static const unsigned MAX_PREFETCH    = 16;
+
+				struct Block
+				{
+					uintptr_t addr;
+					uint8_t *data;
+				};
+				typedef std::list<Block> Blocks;
+
+				Memory *memory;
+				uintptr_t blockSize;
+				unsigned blockCount;
+				std::vector<uint8_t> storage;
+				Blocks blocks;                                         //!< Most recently used first.
+				std::vector<uint8_t*> unused;                          //!< Storage of dropped blocks.
+				std::unordered_map<uintptr_t, Blocks::iterator> blockMap;
+				std::vector<std::pair<uintptr_t, uintptr_t>> immutable; //!< Ranges InvalidateAll keeps.
+				std::unordered_set<uintptr_t> unreadable;              //!< Blocks that can't be fetched whole,
+				                                                       //!< such as ones past a mapping's end.
+				uintptr_t nextSequential;  //!< The block after the last one fetched.
+				unsigned prefetch;         //!< Blocks to fetch ahead, doubling while reads are sequential.
+				CacheStats stats;
+
+				bool Fetch(const std::vector<uintptr_t>& missing, const std::vector<ReadRange>& direct);
+				void Update(uintptr_t addr, const void *val, unsigned size);
+				bool IsImmutable(uintptr_t block) const;
+				bool IsCacheable(uintptr_t addr, unsigned size) const;
+				void Drop(Blocks::iterator block);
+
+				CachedMemory(const CachedMemory&);            // do not implement
+				CachedMemory& operator=(const CachedMemory&); // do not implement
+
+			public:
+				CachedMemory(Memory *memory, unsigned blockSize, unsigned blockCount);
+				~CachedMemory();
+
+				//! Gives back the memory being cached, which is otherwise deleted with the cache.
+				Memory *Release();
+
+				void Invalidate(uintptr_t begin, uintptr_t end);
+				void InvalidateAll();
+				void SetImmutable(uintptr_t begin, uintptr_t end);
+				const CacheStats& GetStats() const;
+
+				virtual void Write(void *addr, const void* val, unsigned size);
+				virtual void Read(const void *addr, void* val, unsigned size);
+				virtual void WriteV(const WriteRange *ranges, unsigned count);
+				virtual void ReadV(const ReadRange *ranges, unsigned count);
+		};
+
 		Memory *memory;
+		CachedMemory *cache;   //!< memory, while reads are cached. Otherwise null.
 
 		ProcessMemory(const ProcessMemory&);            // do not implement
 		ProcessMemory& operator=(const ProcessMemory&); // do not implement
 
 	public:
-		ProcessMemory(unsigned procId=0);
+		/*! \brief Moves memory of the process procId, or of this one if it's 0.
+			\param checked - Whether to go through the system for this process too, as for any
+			                  other, so that memory which isn't there fails rather than crashes.
+		*/
+		ProcessMemory(unsigned procId=0, bool checked=false);
 		~ProcessMemory();
 		
 		void Write(void *addr, const void* val, unsigned size);
 		void Read(const void *addr, void* val, unsigned size);
 
+		/*! \brief Writes every range, in as few system calls as the platform allows. */
+		void WriteV(const WriteRange *ranges, unsigned count);
+
+		/*! \brief Reads every range, in as few system calls as the platform allows. */
+		void ReadV(const ReadRange *ranges, unsigned count);
+
+		/*! \brief Starts caching reads.
+			\param blockSize - 4096 or 65536. The larger suits reading big tables a bit at a time.
+			\param blockCount - How many blocks to keep. At least 16.
+			Throws if either is out of range. Enabling it again changes the sizes, emptying it.
+		*/
+		void EnableCache(unsigned blockSize = 4096, unsigned blockCount = 64);
+
+		/*! \brief Stops caching reads, and forgets what was cached. */
+		void DisableCache();
+		bool IsCacheEnabled() const;
+
+		/*! \brief Forgets what's cached of a range, for when the process may have changed it. */
+		void Invalidate(const void *addr, size_t size);
+
+		/*! \brief Forgets what's cached, except in ranges marked immutable. */
+		void InvalidateAll();
+
+		/*! \brief Marks a range as never changing, such as a module's code, so InvalidateAll
+			keeps what's cached of it. Only whole blocks inside the range are kept. */
+		void SetImmutable(const void *addr, size_t size);
+
+		/*! \brief How the cache has done since it was enabled. All zero if it isn't. */
+		CacheStats GetCacheStats() const;
+
 		template<typename T>
 		void Write(void *addr, const T& val)
 		{
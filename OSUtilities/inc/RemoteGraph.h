@@ -0,0 +1,195 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		RemoteGraph.h
+ *  \author		Andrew Shurney
+ *  \brief		Copies structures of pointers out of a process, a level at a time
+ */
+
+#ifndef REMOTE_GRAPH_H
+#define REMOTE_GRAPH_H
+
+#include <vector>
+#include <unordered_map>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+#include "ProcessMemory.h"
+
+/*! \brief A pointer into another process, typed by what it points to.
+
+	<p>It's the size of a pointer, so it can stand in for the pointers of a structure copied
+	out of a process of the same bitness, such as struct Node { int value; RemotePtr<Node>
+	next; }.</p>
+*/
+template<typename T>
+class RemotePtr
+{
+	private:
+		const T *addr;
+
+	public:
+		RemotePtr(const void *addr = nullptr) : addr(static_cast<const T*>(addr))
+		{
+		}
+
+		const T *Get() const
+		{
+			return addr;
+		}
+
+		bool IsNull() const
+		{
+			return addr == nullptr;
+		}
+
+		/*! \brief Copies out what it points to, with a read of its own. */
+		T Read(ProcessMemory& memory) const
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "Only plain structures can be copied out of a process");
+			T value;
+			memory.Read(addr, &value, sizeof(T));
+			return value;
+		}
+};
+
+/*! \brief Copies a structure of pointers, such as a tree, list or table, out of a process,
+	breadth first.
+
+	<p>Each type is given its size and where its pointers are. Walk starts at a root, and
+	reads every node of a level at once, with one ReadV, which on Linux is one system call per
+	thousand or so nodes. The next level is every pointer in those nodes that hasn't been seen
+	yet. A tree of 10,000 nodes takes a few dozen system calls rather than 10,000 reads. A list
+	is still one level per node, as each node's address is only known once the one before is
+	read.</p>
+
+	<p>A pointer can also be to an array, whose length is a field beside it, such as a table
+	of buckets. The array is read as one node, and the pointers in each element followed.
+	Each address is read once, as the type it was first reached as, so cycles end.</p>
+
+	<p>Reads are checked, even in this process, so a bad pointer fails rather than crashes.
+	Nodes that can't be read are kept, zeroed and marked, and nothing in them is followed.</p>
+*/
+class RemoteGraph
+{
+	public:
+		static const size_t NOT_FOUND = static_cast<size_t>(-1);
+
+		struct Node
+		{
+			const void *address;   //!< In the process.
+			unsigned type;
+			unsigned count;        //!< Elements, for arrays. Otherwise 1.
+			unsigned depth;        //!< Pointers followed from the root.
+			size_t parent;         //!< Node it was reached from. NOT_FOUND for the root.
+			size_t data;           //!< Offset of its copy.
+			bool failed;           //!< Couldn't be read.
+		};
+
+		struct Stats
+		{
+			uint64_t levels;
+			uint64_t reads;          //!< ReadV and Read calls.
+			uint64_t bytesRead;
+			uint64_t nodesFailed;
+		};
+
+	private:
+		static const size_t NODE_ALIGN   = 16;
+		static const size_t MAX_ARRAY    = 16 << 20;  //!< Larger arrays are taken as garbage, and not followed.
+
+		struct Edge
+		{
+			size_t offset;        //!< Of the pointer, in each element of the type.
+			unsigned target;
+			size_t countOffset;   //!< Of the array's length.
+			unsigned countSize;   //!< 0 if it points to a single target.
+		};
+
+		struct Type
+		{
+			size_t size;
+			std::vector<Edge> edges;
+		};
+
+		struct Pending
+		{
+			const void *address;
+			unsigned type;
+			unsigned count;
+			size_t parent;
+		};
+
+		ProcessMemory memory;
+		std::vector<Type> types;
+		std::vector<Node> nodes;
+		std::vector<uint8_t> storage;
+		std::unordered_map<const void*, size_t> index;
+		unsigned pointerSize;
+		unsigned maxDepth;
+		size_t maxNodes;
+		Stats stats;
+
+		void Queue(std::vector<Pending>& pending, const void *address, unsigned type, unsigned count, size_t parent);
+		void ReadLevel(size_t first);
+		void ReadNodes(const ProcessMemory::ReadRange *reads, size_t first, size_t count);
+		void FollowEdges(size_t node, std::vector<Pending>& pending);
+		uint64_t LoadField(const uint8_t *data, unsigned size) const;
+
+		RemoteGraph(const RemoteGraph&);            // Do not implement
+		RemoteGraph& operator=(const RemoteGraph&); // Do not implement
+
+	public:
+		RemoteGraph(unsigned procId = 0);
+
+		/*! \brief Adds a type of node.
+			\return The type's number, for AddEdge and Walk.
+		*/
+		unsigned AddType(size_t size);
+
+		template<typename T>
+		unsigned AddType()
+		{
+			return AddType(sizeof(T));
+		}
+
+		/*! \brief Follows the pointer at offset in each type node to a target node. */
+		void AddEdge(unsigned type, size_t offset, unsigned target);
+
+		/*! \brief Follows the pointer at offset to an array of target nodes, whose length is the
+			unsigned integer of countSize bytes at countOffset. */
+		void AddArrayEdge(unsigned type, size_t offset, unsigned target, size_t countOffset, unsigned countSize = 4);
+
+		/*! \brief Defaults to this process's, sizeof(void*). Throws unless 4 or 8. */
+		void SetPointerSize(unsigned size);
+
+		/*! \brief Stops following pointers past a depth, or a number of nodes. */
+		void SetLimits(unsigned maxDepth, size_t maxNodes);
+
+		/*! \brief Copies out everything reachable from root, forgetting the last walk. */
+		void Walk(const void *root, unsigned type);
+
+		size_t GetNodeCount() const;
+		const Node& GetNode(size_t node) const;
+
+		/*! \brief The node at address, or NOT_FOUND if the walk didn't reach it. */
+		size_t Find(const void *address) const;
+
+		/*! \brief The copy of a node's element, or null past its last. */
+		const void *GetData(size_t node, unsigned element = 0) const;
+
+		/*! \brief The copy of what ptr points to, or null if the walk didn't reach it. */
+		template<typename T>
+		const T *Get(RemotePtr<T> ptr, unsigned element = 0) const
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "Only plain structures can be copied out of a process");
+			size_t node = Find(ptr.Get());
+			return node == NOT_FOUND ? nullptr : static_cast<const T*>(GetData(node, element));
+		}
+
+		/*! \brief What the last Walk did. */
+		const Stats& GetStats() const;
+};
+
+#endif
@@ -10,13 +10,20 @@
 #ifndef REMOTE_THREAD_H
 #define REMOTE_THREAD_H
 
+#include <cstdint>
 #include "ProcessHandle.h"
 
 struct THREAD_BASIC_INFORMATION;
 
+/*! \brief Handle to a thread of any process.
+
+	<p>On Linux the thread is controlled through ptrace, by the ThreadTracer of its process.
+	Threads of the current process can't be traced, so they can't be used this way.</p>
+*/
 class RemoteThread
 {
 	private:
+#ifdef WIN32
 		typedef long (__stdcall * NtQueryInformationThreadPtr)(void *threadHandle, 
 			                                                   unsigned threadInformationClass,
 														       void *threadInformation,
@@ -25,8 +32,9 @@ class RemoteThread
 		static unsigned initialized;
 		static void* ntdllHandle;
 		static NtQueryInformationThreadPtr NtQueryInformationThread;
+#endif
 
-		void *threadHandle;
+		void *threadHandle; //!< The thread's HANDLE on Windows, its tracer and id on Linux.
 		unsigned *refs;
 
 		void Destroy();
@@ -35,6 +43,11 @@ class RemoteThread
 		static void Deinitialize();
 
 	public:
+		enum
+		{
+			MAX_REGISTERS = 17 //!< General purpose registers GetRegisters copies at most.
+		};
+
 		RemoteThread(unsigned threadId);
 		RemoteThread(ProcessHandle procHandle, const void *startAddr, bool startSuspended = true);
 		RemoteThread(const RemoteThread& rhs);
@@ -54,6 +67,15 @@ class RemoteThread
 		const void *GetIp() const;
 		void SetIp(const void *ip);
 
+		const void *GetSp() const;
+
+		/*! \brief Copies the thread's general purpose registers, instruction and stack pointer
+			included, into regs, which must hold MAX_REGISTERS.
+			\return How many were copied, or 0 if they couldn't be read.
+		*/
+		unsigned GetRegisters(uintptr_t *regs) const;
+
+		/*! \brief The thread environment block on Windows, the thread pointer (fs base) on Linux. */
 		void* GetTEBAddr() const;
 
 		static unsigned GetThreadId(void *handle);
@@ -0,0 +1,125 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		SignatureScanner.h
+ *  \author		Andrew Shurney
+ *  \brief		Finds byte signatures with wildcards in a module's code
+ */
+
+#ifndef SIGNATURE_SCANNER_H
+#define SIGNATURE_SCANNER_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+class Module;
+
+/*! \brief Looks for many byte signatures at once, in one pass over memory.
+
+	<p>Signatures are written as hex bytes with ?? for bytes that can be anything, such as
+	"48 8B 05 ?? ?? ?? ?? 48 85 C0". Each one gets an anchor: the three byte window of it with
+	the most fixed bytes, and of those the least common ones. Signatures are sorted by anchor and
+	split into eight buckets, so signatures with similar anchors share one.</p>
+
+	<p>A pass first finds where any bucket's anchor could start, 32 or 16 bytes at a time with
+	AVX2 or SSE4.2. Each anchor byte's low and high nibbles are looked up in 16 entry tables of
+	bucket bits with a byte shuffle, and the three bytes' results ANDed together. Positions
+	left are checked against bitmaps of the byte pairs anchors contain, which stay selective
+	with hundreds of signatures, long after the buckets stop being. Past that point the
+	shuffles are skipped. The three bytes there are
+	then looked up in a hash of anchors, which keeps each signature's first eight bytes, and
+	only signatures whose first eight bytes match are compared in full, under their masks.</p>
+
+	<p>Modules of other processes are copied out in large blocks through ProcessMemory. Blocks
+	overlap by the longest signature, so nothing is missed at their edges.</p>
+*/
+class SignatureScanner
+{
+	public:
+		struct Match
+		{
+			unsigned signature;   //!< What Add returned for the signature.
+			const void *address;  //!< Where it starts, in the scanned process.
+		};
+		typedef std::vector<Match> Matches;
+
+		enum SimdLevel
+		{
+			SIMD_NONE,
+			SIMD_SSE42,
+			SIMD_AVX2
+		};
+
+	private:
+		static const unsigned BUCKET_COUNT  = 8;
+		static const unsigned ANCHOR_LENGTH = 3;
+
+		struct Signature
+		{
+			std::vector<uint8_t> bytes;
+			std::vector<uint8_t> mask;   //!< 0xFF for bytes which must match, 0 for wildcards.
+			unsigned anchor;             //!< Offset of the anchor window.
+		};
+
+		struct Anchor
+		{
+			uint32_t key;                //!< The anchor's fixed bytes, little endian.
+			uint32_t mask;               //!< Which of key's bytes are fixed.
+			unsigned signature;
+			unsigned offset;             //!< Of the anchor in the signature.
+			uint64_t head;               //!< The signature's first eight bytes, to reject most
+			uint64_t headMask;           //!< candidates without touching the signature.
+		};
+
+		std::vector<Signature> signatures;
+		std::vector<Anchor> anchors;           //!< Grouped by hash of key and mask.
+		std::vector<uint32_t> anchorHeads;     //!< Where each hash's anchors start, plus the end.
+		std::vector<uint32_t> anchorMasks;     //!< Each mask any anchor has. Usually just one.
+		unsigned hashShift;
+		uint64_t pairs[ANCHOR_LENGTH - 1][1024]; //!< Bitmaps of the byte pairs in anchors.
+		uint8_t lowNibbles[ANCHOR_LENGTH][16];   //!< Buckets each anchor byte's low nibble allows.
+		uint8_t highNibbles[ANCHOR_LENGTH][16];
+		bool nibblesFilter;                      //!< False once the nibbles let most bytes through.
+		size_t maxLength;
+		SimdLevel simd;
+
+		void Build();
+		void ScanBlock(const uint8_t *data, size_t size, size_t reportLimit, const uint8_t *address, Matches& matches) const;
+		size_t ScanSse42(const uint8_t *data, size_t size, size_t reportLimit, const uint8_t *address, Matches& matches) const;
+		size_t ScanAvx2(const uint8_t *data, size_t size, size_t reportLimit, const uint8_t *address, Matches& matches) const;
+		bool PairsAllow(const uint8_t *bytes) const;
+		uint32_t HashAnchor(uint32_t key, uint32_t mask) const;
+		void CheckCandidate(const uint8_t *data, size_t size, size_t pos, size_t reportLimit, const uint8_t *address, Matches& matches) const;
+		void CheckSignature(unsigned index, const uint8_t *data, size_t size, size_t start, size_t reportLimit, const uint8_t *address, Matches& matches) const;
+
+	public:
+		SignatureScanner();
+
+		/*! \brief Adds a signature such as "48 8B 05 ?? ?? ?? ?? 48 85 C0".
+			\return The signature's number, given back in each Match. Throws if the signature
+			        is malformed, shorter than three bytes, or all wildcards.
+		*/
+		unsigned Add(const char *signature);
+
+		/*! \brief Adds a signature of bytes, where mask is 0xFF for bytes which must match and 0
+			for wildcards. */
+		unsigned Add(const uint8_t *bytes, const uint8_t *mask, size_t length);
+
+		unsigned GetCount() const;
+
+		/*! \brief Finds every signature in memory of this process. */
+		void Scan(const void *begin, size_t size, Matches& matches) const;
+
+		/*! \brief Finds every signature in a module's executable sections. */
+		void Scan(const Module& mod, Matches& matches) const;
+
+		/*! \brief The widest instructions this cpu can use for scanning. */
+		static SimdLevel GetSupportedSimd();
+
+		/*! \brief Limits the instructions used, to compare them. Defaults to GetSupportedSimd. */
+		void SetSimd(SimdLevel level);
+};
+
+#endif
@@ -11,21 +11,113 @@
 #define SINGLE_THREAD_BLOCK_H
 
 #include <unordered_map>
+#include <vector>
 #include "RemoteThread.h"
 
+#ifndef WIN32
+# include "ThreadTracer.h"
+#endif
+
+class ThreadRegistry;
+
+/*! \brief Pauses every thread of a process but the current one for the life of the object.
+
+	<p>On Windows each thread is suspended. On Linux, threads of the current process are each
+	sent a real time signal whose handler parks it on a futex until the block is destroyed. The
+	handler publishes the context the kernel saved for the thread, so OffsetIPs rewrites the
+	instruction pointer that is restored when the handler returns. Threads of other processes
+	are stopped with ptrace by the process's ThreadTracer, all in one request.</p>
+
+	<p>Pausing another process isn't cheap. Each of its threads is stopped and later woken by
+	the kernel, which costs a pair of context switches apiece. On a single core machine, a
+	process of 203 threads took about 1.2ms to stop and 0.9ms to resume, or around 2.4ms in
+	all with its instruction pointers rewritten. That's well over the millisecond we'd like,
+	and only more cores bring it down.</p>
+
+	<p>Threads normally have to be listed again and again until no new ones turn up, since any
+	of them may start another before it's paused. A paused thread may hold the heap lock, so
+	nothing is allocated while any are. On Windows, if a thread started while the others were
+	being suspended, they're all resumed before listing them again. If the ThreadRegistry is
+	enabled and the block is for the current process, it's locked instead. Threads can't start
+	while the registry is locked, so the threads it knows of are paused in a single pass. A
+	thread still runs for a while before it's registered and after it's removed, though, so the
+	system's list is checked once more, and if it has any thread the registry didn't, threads
+	are listed as usual from then on.</p>
+
+	<p>A block can also pause a single thread of the current process, leaving the rest running,
+	for work that only needs to look at one thread at a time.</p>
+*/
 class SingleThreadBlock
 {
 	private:
+#ifdef WIN32
 		typedef std::unordered_map<unsigned, RemoteThread> ThreadIds;
 		ThreadIds threadIds;
+#else
+		typedef std::vector<unsigned> ParkedSlots;
+		ParkedSlots parkedSlots;  //!< Park slots of the threads this block paused, sorted by thread id.
+		int generation;           //!< Release generation the parked threads wait on.
+		bool missedThreads;       //!< Whether any thread of this process was left running.
+
+		ThreadTracer *tracer;                 //!< Tracer of the other process being paused, if any.
+		ThreadTracer::ThreadStates tracedThreads; //!< Where each of its threads was stopped.
+#endif
+		ThreadRegistry *registry; //!< Locked for the life of the block if threads are tracked, otherwise null.
+		bool registryMissed;      //!< Whether the system listed a thread the registry didn't have, so it's listed from then on.
+		unsigned onlyThread;      //!< The one thread to pause, or 0 to pause them all.
 
+		void Pause(unsigned procId);
 		unsigned PauseProcessThreads(unsigned procId);
 
 	public:
+		/*! \brief Threads with an instruction pointer from start to start+range move to the same offset from dest. */
+		struct IPRemap
+		{
+			const void *start;
+			unsigned range;
+			void *dest;
+		};
+
+		/*! \brief Pauses every thread of procId but the calling one. On Linux, throws if another
+			process can't be attached to. */
 		SingleThreadBlock(unsigned procId = 0);
+
+		/*! \brief Pauses only threadId, a thread of the current process. Nothing is paused if
+			it's the calling thread. */
+		SingleThreadBlock(unsigned procId, unsigned threadId);
 		~SingleThreadBlock();
 
 		void OffsetIPs(void *start, unsigned range, void *dest);
+
+		/*! \brief Applies many remaps, reading and writing each thread's instruction pointer once.
+
+			<p>remaps must be sorted by start and must not overlap. Nothing is allocated for
+			threads of the current process.</p>
+		*/
+		void OffsetIPs(const IPRemap *remaps, unsigned count);
+
+#ifndef WIN32
+		/*! \brief A thread of this process parked by the block, as it was when interrupted. */
+		struct PausedThread
+		{
+			unsigned threadId;
+			const uintptr_t *regs;   //!< Every register the kernel saved for it, general purpose ones included.
+			unsigned regCount;
+			const void *ip;
+			const void *sp;
+		};
+
+		/*! \brief Whether every other thread of this process was parked, or the one thread asked
+			for. Threads that had the signal blocked, or were past the most that can be parked,
+			are left running. Always false for other processes, whose threads aren't parked. */
+		bool PausedAll() const;
+
+		/*! \brief Threads of this process parked by the block. None for other processes. */
+		unsigned GetPausedCount() const;
+
+		/*! \brief Allocates nothing, so can be used while threads are parked. */
+		PausedThread GetPausedThread(unsigned index) const;
+#endif
 };
 
 #endif
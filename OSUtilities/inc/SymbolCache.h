@@ -0,0 +1,70 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		SymbolCache.h
+ *  \author		Andrew Shurney
+ *  \brief		Keeps built SymbolIndexes on disk, by build id (Linux only)
+ */
+
+#ifndef SYMBOL_CACHE_H
+#define SYMBOL_CACHE_H
+
+#ifndef WIN32
+
+#include <string>
+#include <mutex>
+#include <cstddef>
+
+class ElfImage;
+class SymbolIndex;
+
+/*! \brief Directory of saved SymbolIndexes, so a module's symbols are only parsed once.
+
+	<p>Each index is saved under its module's build id, which changes whenever the module does,
+	so a saved index is never stale and is shared by every process loading that module, whatever
+	its path. Modules without a build id aren't cached.</p>
+
+	<p>The directory is $XDG_CACHE_HOME/osutilities/symbols, or ~/.cache/osutilities/symbols.
+	An index saved without a .symtab is built again if a debug file for the module turns up
+	later.</p>
+*/
+class SymbolCache
+{
+	private:
+		std::string directory;  //!< Empty if caching is off.
+		std::mutex lock;
+
+		SymbolCache();
+
+		SymbolCache(const SymbolCache&);            // Do not implement
+		SymbolCache& operator=(const SymbolCache&); // Do not implement
+
+		std::string GetPath(const std::string& buildId);
+
+	public:
+		static SymbolCache* Get();
+
+		/*! \brief Moves the cache. An empty directory turns caching off. */
+		void SetDirectory(const std::string& dir);
+		std::string GetDirectory();
+
+		/*! \brief Maps the saved index of a module loaded at moduleBase.
+			\param root - Prefix to find debug files under, for a module of another mount namespace.
+			\return Null if there isn't one, or if it should be built again.
+		*/
+		SymbolIndex *Load(const ElfImage& image, const void *moduleBase, const std::string& root = "");
+
+		/*! \brief Saves a module's index. Failing to is not an error, just slower next time. */
+		void Store(const ElfImage& image, const SymbolIndex& index);
+
+		/*! \brief Path of the separate debug file with the module's .symtab, as installed by
+			distributions under /usr/lib/debug/.build-id.
+			\return Empty if there isn't one.
+		*/
+		static std::string FindDebugFile(const std::string& buildId, const std::string& root = "");
+};
+
+#endif
+
+#endif
@@ -11,18 +11,59 @@
 #define SYMBOL_FINDER_H
 
 #include <string>
+#include <vector>
 #include <unordered_map>
+#include <mutex>
 #include "ProcessHandle.h"
 #include "Module.h"
+#include "ModuleExplorer.h"
 
+#ifndef WIN32
+# include <memory>
+#endif
+
+/*! \brief Looks up symbols of a process by name or address.
+
+	<p>On Windows every module's exports are put in a map up front, and anything else is looked
+	up in the pdb. On Linux nothing is built up front: names are looked up in each module's own
+	.gnu.hash table when asked for, and addresses in a SymbolIndex of the module holding them,
+	built the first time that module is asked about. On Linux GetSymbolName finds the function
+	an address is anywhere inside, not only at its start.</p>
+
+	<p>On Linux, names that no module exports are looked for in every module's SymbolIndex,
+	which has the local functions from .symtab or a separate debug file.</p>
+
+	<p>For the current process, modules loaded or unloaded later are picked up through the
+	ModuleWatcher, and only their symbols are added or dropped.</p>
+*/
 class SymbolFinder
 {
 	private:
 		ProcessHandle procHandle;
+		unsigned listenerId;             //!< Our ModuleWatcher listener. Zero for other processes.
+#ifdef WIN32
 		std::unordered_multimap<const void*, std::pair<Module, std::string> > addrToName;
 		std::unordered_multimap<std::string, std::pair<Module, const void*> > nameToAddr;
+		ModuleExplorer::Modules modules;
+		mutable std::mutex exportsLock;  //!< Guards the maps and modules against modules loading and unloading.
+
+		void AddModuleExports(const Module& mod);
+		void RemoveModuleExports(const Module& mod);
+#else
+		typedef std::shared_ptr<const ModuleExplorer::Modules> ModuleList;
+
+		ModuleList modules;              //!< Sorted by address. Replaced whole, never changed.
+		mutable std::once_flag tablesLoaded;
+
+		ModuleList GetModuleList() const;
+		bool IsHinted(const Module& mod, const char *module) const;
+		const void *ResolveIfunc(const Module& mod, const char *symbol) const;
+#endif
 
-		void PopulateModuleExports();
+		void ModulesChanged(const ModuleExplorer::Modules& loaded, const ModuleExplorer::Modules& unloaded);
+
+		SymbolFinder(const SymbolFinder&);            // Do not implement
+		SymbolFinder& operator=(const SymbolFinder&); // Do not implement
 		
 		SymbolFinder(unsigned procId = 0);
 		~SymbolFinder();
@@ -30,8 +71,37 @@ class SymbolFinder
 		friend class SymbolFinderManager;
 
 	public:
+		typedef std::vector<std::pair<std::string, const void*> > Symbols;
+
 		const void *GetSymbolAddr(const char* symbol, const char* module=nullptr) const;
 		std::string GetSymbolName(const void *addr, const char* module=nullptr) const;
+
+		/*! \brief Finds every function whose name matches a pattern.
+			\param pattern      - '*' matches any run of characters, '?' any one character.
+			\param moduleFilter - Pattern the module's name must match. Null for every module.
+			\param exportedOnly - Leave out functions the module doesn't export.
+
+			<p>C++ names match on either their mangled or demangled form, so "*::Allocate(unsigned*"
+			finds every Allocate method taking an unsigned first. Mangled names are returned.
+			Each module's SymbolSearch is built the first time it's searched, after which a
+			query with a literal prefix or three literal characters in a row takes microseconds.</p>
+
+			<p>Aliases, names sharing an address, may both be returned.</p>
+		*/
+		Symbols FindSymbols(const char *pattern, const char *moduleFilter = nullptr, bool exportedOnly = false) const;
+
+		/*! \brief Whether str matches a glob style pattern of '*' and '?'. */
+		static bool MatchesPattern(const char *pattern, const char *str);
+
+#ifndef WIN32
+		/*! \brief Gets every module's full symbol table ready, several modules at once.
+
+			<p>Called the first time a name isn't found among the exports. Tables come from the
+			SymbolCache where they can, and are otherwise parsed on one thread per core. Calling
+			it earlier, off to the side, takes that wait out of the first such lookup.</p>
+		*/
+		void LoadSymbolTables() const;
+#endif
 };
 
 #endif
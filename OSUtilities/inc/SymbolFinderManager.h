@@ -11,6 +11,7 @@
 #define SYMBOL_FINDER_MANAGER_H
 
 #include <unordered_map>
+#include <mutex>
 
 class SymbolFinder;
 
@@ -18,6 +19,7 @@ class SymbolFinderManager
 {
 	private:
 		std::unordered_map<unsigned, SymbolFinder*> symbolFinders;
+		std::mutex lock;
 
 		SymbolFinderManager();
 		~SymbolFinderManager();
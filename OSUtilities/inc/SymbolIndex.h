@@ -0,0 +1,112 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		SymbolIndex.h
+ *  \author		Andrew Shurney
+ *  \brief		Finds the function containing an address in an ELF module (Linux only)
+ */
+
+#ifndef SYMBOL_INDEX_H
+#define SYMBOL_INDEX_H
+
+#ifndef WIN32
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+class ElfImage;
+
+/*! \brief Sorted table of a module's functions, for finding which one an address is in.
+
+	<p>Every function in .dynsym and .symtab is included, and in the .symtab of a separate
+	debug file if one is given. Where several names share a start address (aliases), one is
+	kept, global names before weak names before local ones. Functions with no size are taken to
+	run up to the next function.</p>
+
+	<p>The table is kept as three parallel arrays of 32 bit values: start offsets into the
+	module, sizes, and offsets of names into a block of strings. A lookup is a binary search of
+	the starts alone, written so the compiler can use conditional moves rather than branches,
+	followed by one check of the size.</p>
+
+	<p>Only offsets are stored, so the table doesn't depend on where the module is loaded and
+	can be saved to a file as is. Load maps such a file and uses it in place, without reading
+	it; see SymbolCache.</p>
+*/
+class SymbolIndex
+{
+	private:
+		struct FileHeader
+		{
+			uint32_t magic;
+			uint32_t version;
+			uint32_t moduleSize;
+			uint32_t count;
+			uint32_t stringsSize;
+			uint32_t flags;
+		};
+
+		static const uint32_t FILE_MAGIC   = 0x58444953; // "SIDX"
+		static const uint32_t FILE_VERSION = 1;
+		static const uint32_t HAS_STATIC   = 1;          //!< Built with a .symtab.
+
+		const uint8_t *moduleBase;
+		uint32_t moduleSize;
+		uint32_t count;
+		uint32_t flags;
+
+		const uint32_t *starts;   //!< Offset of each function from moduleBase, ascending.
+		const uint32_t *sizes;
+		const uint32_t *names;    //!< Offsets into strings.
+		const char *strings;
+		uint32_t stringsSize;
+
+		std::vector<uint32_t> columns;  //!< Backs the arrays of an index that was built.
+		std::vector<char> stringData;
+		void *fileMap;                  //!< Backs the arrays of an index that was loaded.
+		size_t fileSize;
+
+		SymbolIndex(const void *moduleBase);
+
+		SymbolIndex(const SymbolIndex&);            // Do not implement
+		SymbolIndex& operator=(const SymbolIndex&); // Do not implement
+
+	public:
+		/*! \brief Builds the index from a module's symbols.
+			\param debugImage - The module's separate debug file, for its .symtab. May be null.
+		*/
+		SymbolIndex(const ElfImage& image, const void *moduleBase, size_t moduleSize, const ElfImage *debugImage = nullptr);
+		~SymbolIndex();
+
+		/*! \brief Maps an index saved by Save for a module now loaded at moduleBase.
+			\return Null if the file is missing or damaged.
+		*/
+		static SymbolIndex *Load(const std::string& path, const void *moduleBase);
+
+		/*! \brief Writes the index to path. The file is replaced whole, so readers never see half of it. */
+		bool Save(const std::string& path) const;
+
+		/*! \brief Finds the function containing addr.
+			\param[out] offset - Set to how far into the function addr is, if found. May be null.
+			\return The function's name, or null if addr isn't in any function.
+		*/
+		const char *Find(const void *addr, size_t *offset = nullptr) const;
+
+		/*! \brief Finds a function by name, local ones included. A linear search. */
+		const void *FindName(const char *name) const;
+
+		unsigned GetCount() const;
+
+		/*! \brief The index'th function, in address order. */
+		const char *GetName(unsigned index) const;
+		const void *GetAddress(unsigned index) const;
+
+		/*! \brief Whether the index has a .symtab's functions, rather than only the exported ones. */
+		bool HasStaticSymbols() const;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		SymbolSearch.h
+ *  \author		Andrew Shurney
+ *  \brief		Finds a module's functions by prefix, glob or substring of their names
+ */
+
+#ifndef SYMBOL_SEARCH_H
+#define SYMBOL_SEARCH_H
+
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+/*! \brief Index of a module's function names for pattern queries, over both the mangled and
+	demangled form of each name.
+
+	<p>Names are copied into one block of memory, each demangled name straight after its
+	mangled one. Names that don't demangle are stored once.</p>
+
+	<p>Two structures narrow a query down before any name is compared. Entries are sorted by
+	mangled and by demangled name, so a pattern with a literal prefix only looks at the range
+	starting with it. Every name is also listed under each three character run (trigram) it
+	contains, so a pattern like "*::Allocate(unsigned*" only looks at names containing all the
+	trigrams of its literal parts, intersecting the rarest lists first. Whichever leaves fewer
+	names is used, and only those are matched against the pattern. Trigrams ignore case and
+	lump uncommon characters together, which keeps the table small at the cost of a few more
+	names to check.</p>
+
+	<p>Each trigram's list of names is stored as varint encoded gaps between ascending entry
+	numbers, most of which fit in a byte.</p>
+*/
+class SymbolSearch
+{
+	public:
+		typedef std::vector<std::pair<const char*, const void*> > Symbols;
+
+	private:
+		struct Entry
+		{
+			uint32_t name;       //!< Offset into names.
+			uint32_t demangled;  //!< Offset into names. The same as name if it doesn't demangle.
+			const void *address;
+		};
+
+		struct Trigram
+		{
+			uint32_t key;
+			uint32_t count;      //!< Entries containing it.
+			uint32_t start;      //!< Offset of its list into postings.
+		};
+
+		std::vector<char> names;
+		std::vector<Entry> entries;
+		std::vector<uint32_t> byName;       //!< Entries sorted by mangled name.
+		std::vector<uint32_t> byDemangled;  //!< Entries which demangle, sorted by demangled name.
+		std::vector<Trigram> trigrams;      //!< Sorted by key.
+		std::vector<uint8_t> postings;
+
+		void BuildTrigrams();
+		const Trigram *FindTrigram(uint32_t key) const;
+		void ReadList(const Trigram& trigram, std::vector<uint32_t>& found) const;
+		void IntersectList(const Trigram& trigram, std::vector<uint32_t>& found) const;
+		void PrefixRange(const std::vector<uint32_t>& sorted, bool demangled, const char *prefix, size_t length, size_t& first, size_t& last) const;
+		bool Matches(uint32_t entry, const char *pattern) const;
+
+		SymbolSearch(const SymbolSearch&);            // Do not implement
+		SymbolSearch& operator=(const SymbolSearch&); // Do not implement
+
+	public:
+		/*! \brief Builds the index. The names are copied, so needn't outlive it. */
+		SymbolSearch(const Symbols& symbols);
+
+		/*! \brief Finds every function whose mangled or demangled name matches a pattern.
+			\param pattern  - '*' matches any run of characters, '?' any one character.
+			\param matches  - Entry numbers of the functions found are added to it, in no order.
+		*/
+		void Find(const char *pattern, std::vector<unsigned>& matches) const;
+
+		unsigned GetCount() const;
+		const char *GetName(unsigned index) const;
+		const char *GetDemangledName(unsigned index) const;
+		const void *GetAddress(unsigned index) const;
+};
+
+#endif
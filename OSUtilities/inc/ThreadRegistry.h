@@ -0,0 +1,78 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		ThreadRegistry.h
+ *  \author		Andrew Shurney
+ *  \brief		Keeps track of this process's threads as they start and exit
+ */
+
+#ifndef THREAD_REGISTRY_H
+#define THREAD_REGISTRY_H
+
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <mutex>
+#include "RemoteThread.h"
+
+/*! \brief Set of the current process's live threads, updated as threads start and exit.
+
+	<p>Tracking is off until Enable is called, which seeds the set with a snapshot of the
+	threads already running. From then on threads add themselves as they start, before any of
+	their own code runs, and remove themselves as they exit. On Windows this is done from a TLS
+	callback, on Linux by wrapping pthread_create. Threads started by other means (a raw clone,
+	say) are not seen.</p>
+
+	<p>Wrapping pthread_create replaces it for the whole program, so on Linux it's only built
+	when OSUtilities is compiled with THREAD_REGISTRY_HOOK_PTHREAD defined. Without it, Enable
+	does nothing and threads are enumerated as before.</p>
+
+	<p>While the registry is locked, threads that are starting or exiting wait for it, so a
+	thread can't start running its own code behind the back of whoever holds the lock. That
+	lets SingleThreadBlock pause what's registered in one pass instead of re-enumerating threads
+	until no new ones turn up.</p>
+
+	<p>The set isn't the exact list of running threads, though. A thread runs system code
+	before it adds itself, and after it removes itself it still runs TLS destructors and the
+	rest of its teardown (DLL_THREAD_DETACH on Windows). So the set is a starting point, and
+	SingleThreadBlock checks it against the system's list once before trusting it.</p>
+*/
+class ThreadRegistry
+{
+	public:
+#ifdef WIN32
+		typedef std::unordered_map<unsigned, RemoteThread> Threads;
+#else
+		typedef std::unordered_set<unsigned> Threads;
+#endif
+
+	private:
+		Threads threads;
+		std::mutex lock;
+		std::atomic<bool> enabled;
+
+		ThreadRegistry();
+		~ThreadRegistry();
+
+		ThreadRegistry(const ThreadRegistry&);            // Do not implement
+		ThreadRegistry& operator=(const ThreadRegistry&); // Do not implement
+
+	public:
+		static ThreadRegistry* Get();
+
+		/*! \brief Starts tracking threads. Safe to call more than once. */
+		void Enable();
+		bool IsEnabled() const;
+
+		void ThreadStarted(unsigned threadId);
+		void ThreadExited(unsigned threadId);
+
+		/*! \brief Blocks threads from starting or exiting until Unlock. GetThreads is only valid in between. */
+		void Lock();
+		void Unlock();
+
+		const Threads& GetThreads() const;
+};
+
+#endif
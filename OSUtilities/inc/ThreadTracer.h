@@ -0,0 +1,149 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		ThreadTracer.h
+ *  \author		Andrew Shurney
+ *  \brief		Keeps another process's threads under ptrace (Linux only)
+ */
+
+#ifndef THREAD_TRACER_H
+#define THREAD_TRACER_H
+
+#ifndef WIN32
+
+#include <unordered_map>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/user.h>
+
+/*! \brief Stays attached to every thread of another process with ptrace.
+
+	<p>Threads are attached with PTRACE_SEIZE, which leaves them running, and stay attached
+	until the tracer is destroyed rather than being attached and detached for each operation.
+	PTRACE_O_TRACECLONE attaches new threads as they start, so the tracer always knows every
+	thread of the process without listing /proc again.</p>
+
+	<p>Linux only lets the thread that attached make ptrace requests, so every request is
+	handed to a thread owned by the tracer. That thread also reaps ptrace events in between,
+	passing signals on to the tracee and noting threads starting and exiting. Each call is one
+	round trip to it, so use InterruptAll and SetIps to deal with many threads at once.</p>
+
+	<p>Stops nest like SuspendThread on Windows. A thread runs again once it's been resumed as
+	many times as it was interrupted.</p>
+*/
+class ThreadTracer
+{
+	public:
+		struct ThreadState
+		{
+			unsigned threadId;
+			const void *ip;
+			const void *sp;
+		};
+		typedef std::vector<ThreadState> ThreadStates;
+
+	private:
+		struct Thread
+		{
+			unsigned stopCount;     //!< Outstanding interrupts. The thread is held stopped while non-zero.
+			bool stopped;           //!< In a ptrace stop right now.
+			bool stopPending;       //!< Counted in stopsPending until it reports stopping or exits.
+			bool listening;         //!< Stopped for a group stop, to be let go with PTRACE_LISTEN.
+			int pendingSignal;      //!< Signal the thread stopped for, to be delivered when it continues.
+			bool regsValid;         //!< regs holds the current registers.
+			user_regs_struct regs;
+
+			Thread();
+		};
+
+		typedef std::unordered_map<pid_t, Thread> Threads;
+		typedef std::unordered_map<unsigned, ThreadTracer*> Tracers;
+
+		// Only ever touched from the tracer thread.
+		pid_t procId;
+		Threads threads;
+		bool attached;
+		unsigned holdNewThreads;  //!< Threads starting during InterruptAll stay stopped until ResumeAll.
+		unsigned stopsPending;    //!< Threads we've interrupted that haven't reported stopping yet.
+		uint64_t exitCount;       //!< Threads seen exiting. Written under stateLock.
+
+		std::thread tracerThread;
+		pid_t tracerTid;
+		bool started;
+		bool stopping;
+		std::atomic<bool> tracerDone;
+
+		// Handing requests to the tracer thread.
+		std::mutex requestLock;   //!< Held by the caller for the whole of a request.
+		std::mutex stateLock;     //!< Guards the request, started, stopping and exitCount.
+		std::condition_variable requestDone;
+		std::condition_variable threadExited;
+		std::function<void()> request;
+		bool requestTaken;
+
+		ThreadTracer(unsigned procId);
+		~ThreadTracer();
+
+		ThreadTracer(const ThreadTracer&);            // Do not implement
+		ThreadTracer& operator=(const ThreadTracer&); // Do not implement
+
+		void Run(const std::function<void()>& work);
+		void TracerMain();
+
+		bool Attach();
+		void Detach();
+		void HandleEvent(pid_t tid, int status);
+		void WaitForStops();
+		void StopThread(pid_t tid, Thread& thread);
+		void ContinueThread(pid_t tid, Thread& thread);
+		bool ReadRegs(pid_t tid, Thread& thread);
+		bool WriteRegs(pid_t tid, Thread& thread);
+
+		static Tracers& GetTracers();
+		static std::mutex& GetTracersLock();
+
+	public:
+		/*! \brief Gets the tracer for a process, attaching to it the first time.
+			\return Null if the process couldn't be attached to.
+		*/
+		static ThreadTracer *Get(unsigned procId);
+
+		/*! \brief Detaches from a process, letting all its threads run freely again. */
+		static void Release(unsigned procId);
+
+		unsigned GetProcId() const;
+		bool IsTraced(unsigned threadId);
+		std::vector<unsigned> GetThreadIds();
+
+		bool Interrupt(unsigned threadId);
+		void Resume(unsigned threadId);
+
+		/*! \brief Stops every thread of the process and reads their instruction and stack pointers.
+
+			<p>All threads are interrupted before waiting on any of them, and the whole lot is a
+			single request to the tracer thread. Threads that start before ResumeAll are held
+			stopped as well, though they aren't in states.</p>
+		*/
+		bool InterruptAll(ThreadStates& states);
+		void ResumeAll();
+
+		/*! \brief Sets the instruction pointer of each stopped thread in states in one request. */
+		void SetIps(const ThreadStates& states);
+
+		/*! \brief Reads the registers of a stopped thread. */
+		bool GetRegs(unsigned threadId, user_regs_struct& regs);
+		bool SetRegs(unsigned threadId, const user_regs_struct& regs);
+
+		void WaitForExit(unsigned threadId);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,514 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		ElfImage.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Reads the dynamic symbols of an ELF module (Linux only)
+ */
+
+#ifndef WIN32
+
+#include "ElfImage.h"
+#include <exception>
+#include <cstring>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const unsigned char NATIVE_CLASS = __ELF_NATIVE_CLASS == 64 ? ELFCLASS64 : ELFCLASS32;
+
+ElfImage::ElfImage(uintptr_t bias, const ElfW(Phdr) *phdrs, unsigned phdrCount) : fileMap(nullptr), fileSize(0), bias(bias),
+                                                                                   phdrs(phdrs), phdrCount(phdrCount),
+                                                                                   dynSyms(nullptr), dynSymCount(0), dynStr(nullptr), dynStrSize(0),
+                                                                                   gnuHash(nullptr), sysvHash(nullptr), versyms(nullptr),
+                                                                                   symtab(nullptr), symtabCount(0), symStr(nullptr), symStrSize(0),
+                                                                                   buildId()
+{
+	for(unsigned i=0; i<phdrCount; ++i)
+	{
+		if(phdrs[i].p_type == PT_DYNAMIC)
+			ReadDynamic(reinterpret_cast<const ElfW(Dyn)*>(bias + phdrs[i].p_vaddr));
+		else if(phdrs[i].p_type == PT_NOTE && buildId.empty())
+			ReadBuildId(reinterpret_cast<const uint8_t*>(bias + phdrs[i].p_vaddr), phdrs[i].p_memsz);
+	}
+}
+
+ElfImage::ElfImage(const std::string& path, const void *loadAddress) : fileMap(nullptr), fileSize(0), bias(0),
+                                                                       phdrs(nullptr), phdrCount(0),
+                                                                       dynSyms(nullptr), dynSymCount(0), dynStr(nullptr), dynStrSize(0),
+                                                                       gnuHash(nullptr), sysvHash(nullptr), versyms(nullptr),
+                                                                       symtab(nullptr), symtabCount(0), symStr(nullptr), symStrSize(0),
+                                                                       buildId()
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		throw std::exception();
+
+	struct stat info;
+	if(fstat(fd, &info) || static_cast<size_t>(info.st_size) < sizeof(ElfW(Ehdr)))
+	{
+		close(fd);
+		throw std::exception();
+	}
+
+	fileSize = static_cast<size_t>(info.st_size);
+	void *map = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if(map == MAP_FAILED)
+		throw std::exception();
+
+	fileMap = static_cast<const uint8_t*>(map);
+
+	try
+	{
+		const ElfW(Ehdr) *header = reinterpret_cast<const ElfW(Ehdr)*>(fileMap);
+		if(std::memcmp(header->e_ident, ELFMAG, SELFMAG) || header->e_ident[EI_CLASS] != NATIVE_CLASS ||
+		   header->e_phoff + header->e_phnum * sizeof(ElfW(Phdr)) > fileSize)
+			throw std::exception();
+
+		phdrs = reinterpret_cast<const ElfW(Phdr)*>(fileMap + header->e_phoff);
+		phdrCount = header->e_phnum;
+		uintptr_t firstPage = 0;
+		GetLoadSize(phdrs, phdrCount, &firstPage);
+		bias = reinterpret_cast<uintptr_t>(loadAddress) - firstPage;
+
+		// Separate debug files keep the notes and program headers of the module they're for.
+		for(unsigned i=0; i<phdrCount && buildId.empty(); ++i)
+			if(phdrs[i].p_type == PT_NOTE && phdrs[i].p_offset + phdrs[i].p_filesz <= fileSize)
+				ReadBuildId(fileMap + phdrs[i].p_offset, phdrs[i].p_filesz);
+
+		ReadSections();
+	}
+	catch(...)
+	{
+		munmap(const_cast<uint8_t*>(fileMap), fileSize);
+		throw;
+	}
+}
+
+ElfImage::~ElfImage()
+{
+	if(fileMap)
+		munmap(const_cast<uint8_t*>(fileMap), fileSize);
+}
+
+void ElfImage::ReadDynamic(const ElfW(Dyn) *dynamic)
+{
+	// The loader usually rewrites these to absolute addresses, but not always (the vdso's are
+	// left alone), so anything below the module's bias is still relative to it.
+	auto translate = [this](ElfW(Addr) ptr) { return ptr < bias ? bias + ptr : ptr; };
+
+	for(const ElfW(Dyn) *entry = dynamic; entry->d_tag != DT_NULL; ++entry)
+	{
+		switch(entry->d_tag)
+		{
+			case DT_SYMTAB:
+				dynSyms = reinterpret_cast<const Symbol*>(translate(entry->d_un.d_ptr));
+			break;
+			case DT_STRTAB:
+				dynStr = reinterpret_cast<const char*>(translate(entry->d_un.d_ptr));
+			break;
+			case DT_STRSZ:
+				dynStrSize = entry->d_un.d_val;
+			break;
+			case DT_HASH:
+				sysvHash = reinterpret_cast<const uint32_t*>(translate(entry->d_un.d_ptr));
+			break;
+			case DT_GNU_HASH:
+				gnuHash = reinterpret_cast<const uint32_t*>(translate(entry->d_un.d_ptr));
+			break;
+			case DT_VERSYM:
+				versyms = reinterpret_cast<const uint16_t*>(translate(entry->d_un.d_ptr));
+			break;
+		}
+	}
+
+	if(!dynSyms || !dynStr)
+	{
+		dynSyms = nullptr;
+		gnuHash = sysvHash = nullptr;
+		versyms = nullptr;
+		return;
+	}
+
+	// The dynamic section doesn't say how many symbols there are, but either hash table does.
+	if(sysvHash)
+		dynSymCount = CountFromHash(sysvHash);
+	else if(gnuHash)
+		dynSymCount = CountFromGnuHash(gnuHash);
+}
+
+void ElfImage::ReadSections()
+{
+	const ElfW(Ehdr) *header = reinterpret_cast<const ElfW(Ehdr)*>(fileMap);
+	if(!header->e_shoff || header->e_shentsize != sizeof(ElfW(Shdr)) ||
+	   header->e_shoff + header->e_shnum * sizeof(ElfW(Shdr)) > fileSize)
+		return;
+
+	const ElfW(Shdr) *sections = reinterpret_cast<const ElfW(Shdr)*>(fileMap + header->e_shoff);
+	unsigned dynSymIndex = header->e_shnum;
+	for(unsigned i=0; i<header->e_shnum; ++i)
+	{
+		const ElfW(Shdr)& section = sections[i];
+		if(section.sh_type != SHT_DYNSYM || section.sh_link >= header->e_shnum)
+			continue;
+
+		const ElfW(Shdr)& strings = sections[section.sh_link];
+		if(section.sh_offset + section.sh_size > fileSize || strings.sh_offset + strings.sh_size > fileSize)
+			throw std::exception();
+
+		dynSyms = reinterpret_cast<const Symbol*>(fileMap + section.sh_offset);
+		dynSymCount = static_cast<unsigned>(section.sh_size / sizeof(Symbol));
+		dynStr = reinterpret_cast<const char*>(fileMap + strings.sh_offset);
+		dynStrSize = strings.sh_size;
+		dynSymIndex = i;
+		break;
+	}
+
+	for(unsigned i=0; i<header->e_shnum; ++i)
+	{
+		const ElfW(Shdr)& section = sections[i];
+		if(section.sh_type != SHT_SYMTAB || section.sh_link >= header->e_shnum)
+			continue;
+
+		const ElfW(Shdr)& strings = sections[section.sh_link];
+		if(section.sh_offset + section.sh_size > fileSize || strings.sh_offset + strings.sh_size > fileSize)
+			throw std::exception();
+
+		symtab = reinterpret_cast<const Symbol*>(fileMap + section.sh_offset);
+		symtabCount = static_cast<unsigned>(section.sh_size / sizeof(Symbol));
+		symStr = reinterpret_cast<const char*>(fileMap + strings.sh_offset);
+		symStrSize = strings.sh_size;
+		break;
+	}
+
+	// The hash and version tables only mean anything alongside the symbols they describe.
+	for(unsigned i=0; i<header->e_shnum && dynSymIndex < header->e_shnum; ++i)
+	{
+		const ElfW(Shdr)& section = sections[i];
+		if(section.sh_link != dynSymIndex || section.sh_offset + section.sh_size > fileSize)
+			continue;
+
+		const void *table = fileMap + section.sh_offset;
+		if(section.sh_type == SHT_GNU_HASH)
+			gnuHash = static_cast<const uint32_t*>(table);
+		else if(section.sh_type == SHT_HASH)
+			sysvHash = static_cast<const uint32_t*>(table);
+		else if(section.sh_type == SHT_GNU_versym && section.sh_size >= dynSymCount * sizeof(uint16_t))
+			versyms = static_cast<const uint16_t*>(table);
+	}
+}
+
+void ElfImage::ReadBuildId(const uint8_t *notes, size_t size)
+{
+	// Each note is a header, then its name and contents, each padded to 4 bytes.
+	auto padded = [](size_t size) { return (size + 3) & ~static_cast<size_t>(3); };
+
+	size_t pos = 0;
+	while(pos + sizeof(ElfW(Nhdr)) <= size)
+	{
+		const ElfW(Nhdr) *note = reinterpret_cast<const ElfW(Nhdr)*>(notes + pos);
+		const uint8_t *name = notes + pos + sizeof(ElfW(Nhdr));
+		const uint8_t *desc = name + padded(note->n_namesz);
+
+		pos += sizeof(ElfW(Nhdr)) + padded(note->n_namesz) + padded(note->n_descsz);
+		if(pos > size)
+			return;
+
+		if(note->n_type == NT_GNU_BUILD_ID && note->n_namesz == sizeof(ELF_NOTE_GNU) && !std::memcmp(name, ELF_NOTE_GNU, sizeof(ELF_NOTE_GNU)))
+		{
+			static const char digits[] = "0123456789abcdef";
+			for(unsigned i=0; i<note->n_descsz; ++i)
+			{
+				buildId += digits[desc[i] >> 4];
+				buildId += digits[desc[i] & 0xF];
+			}
+			return;
+		}
+	}
+}
+
+unsigned ElfImage::CountFromHash(const uint32_t *hash)
+{
+	// nbucket, nchain, then the tables. There's a chain entry for every symbol.
+	return hash[1];
+}
+
+unsigned ElfImage::CountFromGnuHash(const uint32_t *gnuHash)
+{
+	uint32_t bucketCount = gnuHash[0];
+	uint32_t symOffset = gnuHash[1];
+	uint32_t bloomSize = gnuHash[2];
+
+	const uint32_t *buckets = gnuHash + 4 + bloomSize * (sizeof(ElfW(Addr)) / sizeof(uint32_t));
+	const uint32_t *chains = buckets + bucketCount;
+
+	// Symbols below symOffset aren't hashed. Past that, the last symbol is the end of the chain
+	// starting in the highest bucket.
+	uint32_t last = 0;
+	for(uint32_t i=0; i<bucketCount; ++i)
+		if(buckets[i] > last)
+			last = buckets[i];
+
+	if(last < symOffset)
+		return symOffset;
+
+	while(!(chains[last - symOffset] & 1))
+		++last;
+
+	return last + 1;
+}
+
+unsigned ElfImage::GetSymbolCount() const
+{
+	return dynSymCount;
+}
+
+const ElfImage::Symbol& ElfImage::GetSymbol(unsigned index) const
+{
+	return dynSyms[index];
+}
+
+unsigned ElfImage::GetStaticSymbolCount() const
+{
+	return symtabCount;
+}
+
+const ElfImage::Symbol& ElfImage::GetStaticSymbol(unsigned index) const
+{
+	return symtab[index];
+}
+
+const char *ElfImage::GetStaticName(const Symbol& symbol) const
+{
+	if(symbol.st_name >= symStrSize)
+		return "";
+
+	return symStr + symbol.st_name;
+}
+
+const char *ElfImage::GetName(const Symbol& symbol) const
+{
+	if(symbol.st_name >= dynStrSize)
+		return "";
+
+	return dynStr + symbol.st_name;
+}
+
+const void *ElfImage::GetAddress(const Symbol& symbol) const
+{
+	return reinterpret_cast<const void*>(bias + symbol.st_value);
+}
+
+const std::string& ElfImage::GetBuildId() const
+{
+	return buildId;
+}
+
+const ElfImage::Symbol *ElfImage::FindExport(const char *name) const
+{
+	if(!dynSyms)
+		return nullptr;
+
+	if(gnuHash)
+		return FindWithGnuHash(name);
+
+	if(sysvHash)
+		return FindWithSysvHash(name);
+
+	return FindLinear(name);
+}
+
+const ElfImage::Symbol *ElfImage::FindWithGnuHash(const char *name) const
+{
+	uint32_t hash = 5381;
+	for(const unsigned char *c = reinterpret_cast<const unsigned char*>(name); *c; ++c)
+		hash = hash * 33 + *c;
+
+	uint32_t bucketCount = gnuHash[0];
+	uint32_t symOffset = gnuHash[1];
+	uint32_t bloomSize = gnuHash[2];
+	uint32_t bloomShift = gnuHash[3];
+	if(!bucketCount || !bloomSize)
+		return nullptr;
+
+	// Each name sets two bits of one bloom word. If either is clear, the module doesn't have it.
+	const unsigned wordBits = sizeof(ElfW(Addr)) * 8;
+	const ElfW(Addr) *bloom = reinterpret_cast<const ElfW(Addr)*>(gnuHash + 4);
+	ElfW(Addr) word = bloom[(hash / wordBits) % bloomSize];
+	ElfW(Addr) mask = (static_cast<ElfW(Addr)>(1) << (hash % wordBits)) | (static_cast<ElfW(Addr)>(1) << ((hash >> bloomShift) % wordBits));
+	if((word & mask) != mask)
+		return nullptr;
+
+	const uint32_t *buckets = reinterpret_cast<const uint32_t*>(bloom + bloomSize);
+	const uint32_t *chains = buckets + bucketCount;
+
+	uint32_t index = buckets[hash % bucketCount];
+	if(index < symOffset || index >= dynSymCount)
+		return nullptr;
+
+	// Chain entries hold the hash of their symbol with the low bit marking the chain's end, so
+	// names are only compared when the hashes match.
+	const Symbol *hidden = nullptr;
+	for(; index < dynSymCount; ++index)
+	{
+		uint32_t chainHash = chains[index - symOffset];
+		if((chainHash | 1) == (hash | 1) && IsMatch(dynSyms[index], name))
+		{
+			if(IsDefaultVersion(dynSyms[index]))
+				return &dynSyms[index];
+
+			if(!hidden)
+				hidden = &dynSyms[index];
+		}
+
+		if(chainHash & 1)
+			break;
+	}
+
+	return hidden;
+}
+
+const ElfImage::Symbol *ElfImage::FindWithSysvHash(const char *name) const
+{
+	uint32_t hash = 0;
+	for(const unsigned char *c = reinterpret_cast<const unsigned char*>(name); *c; ++c)
+	{
+		hash = (hash << 4) + *c;
+		uint32_t high = hash & 0xf0000000;
+		if(high)
+			hash ^= high >> 24;
+		hash &= ~high;
+	}
+
+	uint32_t bucketCount = sysvHash[0];
+	if(!bucketCount)
+		return nullptr;
+
+	const uint32_t *buckets = sysvHash + 2;
+	const uint32_t *chains = buckets + bucketCount;
+
+	const Symbol *hidden = nullptr;
+	for(uint32_t index = buckets[hash % bucketCount]; index && index < dynSymCount; index = chains[index])
+	{
+		if(!IsMatch(dynSyms[index], name))
+			continue;
+
+		if(IsDefaultVersion(dynSyms[index]))
+			return &dynSyms[index];
+
+		if(!hidden)
+			hidden = &dynSyms[index];
+	}
+
+	return hidden;
+}
+
+const ElfImage::Symbol *ElfImage::FindLinear(const char *name) const
+{
+	const Symbol *hidden = nullptr;
+	for(unsigned i=0; i<dynSymCount; ++i)
+	{
+		if(!IsMatch(dynSyms[i], name))
+			continue;
+
+		if(IsDefaultVersion(dynSyms[i]))
+			return &dynSyms[i];
+
+		if(!hidden)
+			hidden = &dynSyms[i];
+	}
+
+	return hidden;
+}
+
+bool ElfImage::IsMatch(const Symbol& symbol, const char *name) const
+{
+	return symbol.st_shndx != SHN_UNDEF && symbol.st_name < dynStrSize && !std::strcmp(dynStr + symbol.st_name, name);
+}
+
+bool ElfImage::IsDefaultVersion(const Symbol& symbol) const
+{
+	// Older versions kept for binary compatibility (memcpy@GLIBC_2.2.5, say) are marked hidden.
+	const uint16_t hiddenVersion = 0x8000;
+	return !versyms || !(versyms[&symbol - dynSyms] & hiddenVersion);
+}
+
+bool ElfImage::IsExportedFunction(const Symbol& symbol, bool allowIfuncs)
+{
+	// st_info and st_other are packed the same way in both classes.
+	unsigned type = ELF64_ST_TYPE(symbol.st_info);
+	if(symbol.st_shndx == SHN_UNDEF || (type != STT_FUNC && (!allowIfuncs || type != STT_GNU_IFUNC)))
+		return false;
+
+	unsigned binding = ELF64_ST_BIND(symbol.st_info);
+	if(binding != STB_GLOBAL && binding != STB_WEAK)
+		return false;
+
+	unsigned visibility = ELF64_ST_VISIBILITY(symbol.st_other);
+	return visibility == STV_DEFAULT || visibility == STV_PROTECTED;
+}
+
+const uint8_t *ElfImage::GetLoaded(const void *address, size_t *available) const
+{
+	uintptr_t vaddr = reinterpret_cast<uintptr_t>(address) - bias;
+	for(unsigned i=0; i<phdrCount; ++i)
+	{
+		const ElfW(Phdr)& phdr = phdrs[i];
+		size_t size = fileMap ? phdr.p_filesz : phdr.p_memsz;
+		if(phdr.p_type != PT_LOAD || vaddr < phdr.p_vaddr || vaddr >= phdr.p_vaddr + size)
+			continue;
+
+		size_t into = vaddr - phdr.p_vaddr;
+		if(fileMap && phdr.p_offset + size > fileSize)
+			return nullptr;
+
+		*available = size - into;
+		return fileMap ? fileMap + phdr.p_offset + into : static_cast<const uint8_t*>(address);
+	}
+
+	return nullptr;
+}
+
+const void *ElfImage::GetEhFrameHdr() const
+{
+	for(unsigned i=0; i<phdrCount; ++i)
+		if(phdrs[i].p_type == PT_GNU_EH_FRAME)
+			return reinterpret_cast<const void*>(bias + phdrs[i].p_vaddr);
+
+	return nullptr;
+}
+
+size_t ElfImage::GetLoadSize(const ElfW(Phdr) *phdrs, unsigned phdrCount, uintptr_t *firstPage)
+{
+	static const uintptr_t pageMask = ~static_cast<uintptr_t>(sysconf(_SC_PAGESIZE) - 1);
+
+	uintptr_t start = UINTPTR_MAX;
+	uintptr_t end = 0;
+
+	for(unsigned i=0; i<phdrCount; ++i)
+	{
+		if(phdrs[i].p_type != PT_LOAD)
+			continue;
+
+		uintptr_t segStart = phdrs[i].p_vaddr & pageMask;
+		if(segStart < start)
+			start = segStart;
+		if(phdrs[i].p_vaddr + phdrs[i].p_memsz > end)
+			end = phdrs[i].p_vaddr + phdrs[i].p_memsz;
+	}
+
+	if(start > end)
+		start = end = 0;
+
+	if(firstPage)
+		*firstPage = start;
+
+	return end - start;
+}
+
+#endif
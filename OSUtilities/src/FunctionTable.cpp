@@ -0,0 +1,455 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		FunctionTable.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Where a module's functions start and end, from its unwind tables
+ */
+
+#include "FunctionTable.h"
+#include <algorithm>
+#include <exception>
+#include <cstring>
+
+#ifdef WIN32
+# include "ProcessMemory.h"
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+#else
+# include "ElfImage.h"
+#endif
+
+#ifdef WIN32
+namespace
+{
+	// IMAGE_RUNTIME_FUNCTION_ENTRY as x64 lays it out, whatever this process is built for.
+	struct RuntimeFunction
+	{
+		DWORD begin;
+		DWORD end;
+		DWORD unwindInfo;
+	};
+}
+
+FunctionTable::FunctionTable(unsigned procId, const void *moduleBase, size_t moduleSize) : moduleBase(static_cast<const uint8_t*>(moduleBase)),
+                                                                                           moduleSize(moduleSize), starts(), sizes()
+{
+	ProcessMemory memory(procId);
+	memory.EnableCache(4096, 16);   // The headers are read a piece at a time.
+
+	const uint8_t *addr = this->moduleBase;
+	IMAGE_DOS_HEADER moduleDOSHeader = memory.Read<IMAGE_DOS_HEADER>(addr);
+	if(moduleDOSHeader.e_magic != IMAGE_DOS_SIGNATURE)
+		throw std::exception();
+
+	const uint8_t *ntHeaders = addr + moduleDOSHeader.e_lfanew;
+	if(memory.Read<DWORD>(ntHeaders) != IMAGE_NT_SIGNATURE)
+		throw std::exception();
+
+	// Only 64 bit images have an exception directory of function ranges.
+	IMAGE_FILE_HEADER fileHeader = memory.Read<IMAGE_FILE_HEADER>(ntHeaders + sizeof(DWORD));
+	if(fileHeader.SizeOfOptionalHeader < sizeof(IMAGE_OPTIONAL_HEADER64))
+		return;
+
+	IMAGE_OPTIONAL_HEADER64 optionalHeader = memory.Read<IMAGE_OPTIONAL_HEADER64>(ntHeaders + sizeof(DWORD) + sizeof(IMAGE_FILE_HEADER));
+	if(optionalHeader.Magic != IMAGE_NT_OPTIONAL_HDR64_MAGIC || optionalHeader.NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_EXCEPTION)
+		return;
+
+	const IMAGE_DATA_DIRECTORY& directory = optionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXCEPTION];
+	std::vector<RuntimeFunction> functions(directory.Size / sizeof(RuntimeFunction));
+	if(functions.empty())
+		return;
+
+	memory.Read(addr + directory.VirtualAddress, functions.data(), static_cast<unsigned>(functions.size() * sizeof(RuntimeFunction)));
+
+	starts.reserve(functions.size());
+	sizes.reserve(functions.size());
+	for(auto it = functions.begin(); it != functions.end(); ++it)
+		if(it->end > it->begin)
+			Add(reinterpret_cast<uintptr_t>(addr) + it->begin, it->end - it->begin);
+
+	Sort();
+}
+#else
+namespace
+{
+	// Pointer encodings of .eh_frame and .eh_frame_hdr, from the LSB.
+	enum
+	{
+		DW_EH_PE_absptr  = 0x00,
+		DW_EH_PE_uleb128 = 0x01,
+		DW_EH_PE_udata2  = 0x02,
+		DW_EH_PE_udata4  = 0x03,
+		DW_EH_PE_udata8  = 0x04,
+		DW_EH_PE_sleb128 = 0x09,
+		DW_EH_PE_sdata2  = 0x0A,
+		DW_EH_PE_sdata4  = 0x0B,
+		DW_EH_PE_sdata8  = 0x0C,
+
+		DW_EH_PE_pcrel   = 0x10,
+		DW_EH_PE_datarel = 0x30,
+		DW_EH_PE_indirect = 0x80,
+		DW_EH_PE_omit    = 0xFF
+	};
+
+	/*! \brief Reads a section of the module in place, from wherever this process can see it.
+		Addresses are where things are in the module's process, which pc relative pointers
+		are relative to.
+	*/
+	struct EhReader
+	{
+		const uint8_t *begin;
+		const uint8_t *end;
+		uintptr_t address;   //!< Of begin, in the module's process.
+
+		EhReader(const ElfImage& image, const void *sectionAddress) : begin(nullptr), end(nullptr), address(reinterpret_cast<uintptr_t>(sectionAddress))
+		{
+			size_t available = 0;
+			begin = image.GetLoaded(sectionAddress, &available);
+			end = begin ? begin + available : nullptr;
+		}
+
+		const uint8_t *At(uintptr_t addr) const
+		{
+			return addr >= address && addr - address < static_cast<uintptr_t>(end - begin) ? begin + (addr - address) : nullptr;
+		}
+
+		uintptr_t AddressOf(const uint8_t *pos) const
+		{
+			return address + (pos - begin);
+		}
+
+		template <typename T>
+		bool Read(const uint8_t *&pos, T& value) const
+		{
+			if(static_cast<size_t>(end - pos) < sizeof(T))
+				return false;
+
+			std::memcpy(&value, pos, sizeof(T));
+			pos += sizeof(T);
+			return true;
+		}
+
+		bool ReadULeb(const uint8_t *&pos, uint64_t& value) const
+		{
+			value = 0;
+			for(unsigned shift = 0; pos < end && shift < 64; shift += 7)
+			{
+				uint8_t byte = *pos++;
+				value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+				if(!(byte & 0x80))
+					return true;
+			}
+			return false;
+		}
+
+		bool ReadSLeb(const uint8_t *&pos, int64_t& value) const
+		{
+			uint64_t bits = 0;
+			unsigned shift = 0;
+			for(; pos < end && shift < 64; shift += 7)
+			{
+				uint8_t byte = *pos++;
+				bits |= static_cast<uint64_t>(byte & 0x7F) << shift;
+				if(!(byte & 0x80))
+				{
+					if(shift + 7 < 64 && (byte & 0x40))
+						bits |= ~static_cast<uint64_t>(0) << (shift + 7);
+					value = static_cast<int64_t>(bits);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/*! \brief Reads a pointer in one of the DW_EH_PE encodings.
+			\param dataBase - What datarel pointers are relative to.
+		*/
+		bool ReadEncoded(const uint8_t *&pos, uint8_t encoding, uintptr_t dataBase, uintptr_t& value) const
+		{
+			// Indirect pointers would have to be read out of the module's process.
+			if(encoding == DW_EH_PE_omit || (encoding & DW_EH_PE_indirect))
+				return false;
+
+			uintptr_t fieldAddress = AddressOf(pos);
+			bool read = false;
+			switch(encoding & 0x0F)
+			{
+				case DW_EH_PE_absptr:  { uintptr_t v; read = Read(pos, v); value = v; } break;
+				case DW_EH_PE_udata2:  { uint16_t v;  read = Read(pos, v); value = v; } break;
+				case DW_EH_PE_udata4:  { uint32_t v;  read = Read(pos, v); value = v; } break;
+				case DW_EH_PE_udata8:  { uint64_t v;  read = Read(pos, v); value = static_cast<uintptr_t>(v); } break;
+				case DW_EH_PE_sdata2:  { int16_t v;   read = Read(pos, v); value = static_cast<uintptr_t>(static_cast<intptr_t>(v)); } break;
+				case DW_EH_PE_sdata4:  { int32_t v;   read = Read(pos, v); value = static_cast<uintptr_t>(static_cast<intptr_t>(v)); } break;
+				case DW_EH_PE_sdata8:  { int64_t v;   read = Read(pos, v); value = static_cast<uintptr_t>(v); } break;
+				case DW_EH_PE_uleb128: { uint64_t v;  read = ReadULeb(pos, v); value = static_cast<uintptr_t>(v); } break;
+				case DW_EH_PE_sleb128: { int64_t v;   read = ReadSLeb(pos, v); value = static_cast<uintptr_t>(v); } break;
+			}
+
+			if(!read)
+				return false;
+
+			switch(encoding & 0x70)
+			{
+				case 0:
+				break;
+				case DW_EH_PE_pcrel:
+					value += fieldAddress;
+				break;
+				case DW_EH_PE_datarel:
+					value += dataBase;
+				break;
+				default:
+					return false;
+			}
+
+			return true;
+		}
+
+		/*! \brief Reads how FDEs using the CIE at pos encode their addresses. */
+		bool ReadCieEncoding(const uint8_t *pos, uint8_t& encoding) const
+		{
+			uint32_t length, id;
+			if(!Read(pos, length) || length == 0xFFFFFFFF || length > static_cast<size_t>(end - pos))
+				return false;
+
+			const uint8_t *cieEnd = pos + length;
+			uint8_t version;
+			if(!Read(pos, id) || id != 0 || !Read(pos, version))
+				return false;
+
+			const char *augmentation = reinterpret_cast<const char*>(pos);
+			const void *terminator = std::memchr(pos, '\0', cieEnd - pos);
+			if(!terminator)
+				return false;
+			pos = static_cast<const uint8_t*>(terminator) + 1;
+
+			// Very old GCCs put a pointer to exception data here.
+			if(augmentation[0] == 'e' && augmentation[1] == 'h')
+				pos += sizeof(uintptr_t);
+
+			uint64_t codeAlign, returnRegister, augmentationSize;
+			int64_t dataAlign;
+			if(!ReadULeb(pos, codeAlign) || !ReadSLeb(pos, dataAlign))
+				return false;
+			if(version == 1)
+				++pos;
+			else if(!ReadULeb(pos, returnRegister))
+				return false;
+
+			encoding = DW_EH_PE_absptr;
+			if(augmentation[0] != 'z')
+				return true;
+
+			if(!ReadULeb(pos, augmentationSize))
+				return false;
+
+			for(const char *c = augmentation + 1; *c && pos < cieEnd; ++c)
+			{
+				switch(*c)
+				{
+					case 'R':
+						encoding = *pos;
+						return true;
+					case 'L':
+						++pos;
+					break;
+					case 'P':
+					{
+						uint8_t personalityEncoding = *pos++;
+						uintptr_t personality;
+						if(!ReadEncoded(pos, personalityEncoding & ~DW_EH_PE_indirect, 0, personality))
+							return false;
+					}
+					break;
+					case 'S':
+					case 'B':
+					break;
+					default:
+						return true;
+				}
+			}
+
+			return true;
+		}
+	};
+
+	/*! \brief The FDEs of .eh_frame, with the encoding of each CIE they use read once. */
+	class FdeReader
+	{
+		private:
+			const EhReader& frames;
+			std::vector<std::pair<const uint8_t*, uint8_t> > cies;
+
+		public:
+			FdeReader(const EhReader& frames) : frames(frames), cies() {}
+
+			/*! \brief Reads the start and size of the function the FDE at pos describes.
+				\return False if pos isn't an FDE.
+			*/
+			bool Read(const uint8_t *pos, uintptr_t& start, uintptr_t& size)
+			{
+				uint32_t length, ciePointer;
+				if(!frames.Read(pos, length) || !length || length == 0xFFFFFFFF || length > static_cast<size_t>(frames.end - pos))
+					return false;
+
+				// The CIE pointer is how far back the CIE is from the pointer itself.
+				const uint8_t *idField = pos;
+				if(!frames.Read(pos, ciePointer) || !ciePointer || ciePointer > static_cast<size_t>(idField - frames.begin))
+					return false;
+
+				const uint8_t *cie = idField - ciePointer;
+				uint8_t encoding = 0;
+				auto known = std::find_if(cies.begin(), cies.end(), [cie](const std::pair<const uint8_t*, uint8_t>& entry) { return entry.first == cie; });
+				if(known != cies.end())
+					encoding = known->second;
+				else if(frames.ReadCieEncoding(cie, encoding))
+					cies.push_back(std::make_pair(cie, encoding));
+				else
+					return false;
+
+				// The range is a length, so has the size but not the relation of the start.
+				return frames.ReadEncoded(pos, encoding, 0, start) && frames.ReadEncoded(pos, encoding & 0x0F, 0, size);
+			}
+
+			/*! \brief The record after the one at pos, or null at the end. */
+			const uint8_t *Next(const uint8_t *pos) const
+			{
+				uint32_t length;
+				if(!frames.Read(pos, length) || !length || length == 0xFFFFFFFF || length > static_cast<size_t>(frames.end - pos))
+					return nullptr;
+				return pos + length;
+			}
+	};
+}
+
+FunctionTable::FunctionTable(const ElfImage& image, const void *moduleBase, size_t moduleSize) : moduleBase(static_cast<const uint8_t*>(moduleBase)),
+                                                                                                moduleSize(moduleSize), starts(), sizes()
+{
+	const void *hdrAddress = image.GetEhFrameHdr();
+	if(!hdrAddress)
+		return;
+
+	EhReader hdr(image, hdrAddress);
+	const uint8_t *pos = hdr.begin;
+	uint8_t version, framesEncoding, countEncoding, tableEncoding;
+	if(!pos || !hdr.Read(pos, version) || version != 1 || !hdr.Read(pos, framesEncoding) ||
+	   !hdr.Read(pos, countEncoding) || !hdr.Read(pos, tableEncoding))
+		return;
+
+	uintptr_t framesAddress;
+	if(!hdr.ReadEncoded(pos, framesEncoding, hdr.address, framesAddress))
+		return;
+
+	EhReader frames(image, reinterpret_cast<const void*>(framesAddress));
+	if(!frames.begin)
+		return;
+
+	FdeReader fdes(frames);
+	uintptr_t start, size;
+
+	// The header's search table points at every FDE. Without it, .eh_frame is walked to its
+	// terminator.
+	uintptr_t count;
+	if(countEncoding != DW_EH_PE_omit && tableEncoding != DW_EH_PE_omit && hdr.ReadEncoded(pos, countEncoding, hdr.address, count))
+	{
+		starts.reserve(count);
+		sizes.reserve(count);
+
+		for(uintptr_t i=0; i<count; ++i)
+		{
+			uintptr_t initial, fdeAddress;
+			if(!hdr.ReadEncoded(pos, tableEncoding, hdr.address, initial) || !hdr.ReadEncoded(pos, tableEncoding, hdr.address, fdeAddress))
+				break;
+
+			const uint8_t *fde = frames.At(fdeAddress);
+			if(fde && fdes.Read(fde, start, size))
+				Add(start, size);
+		}
+	}
+	else
+	{
+		for(const uint8_t *record = frames.begin; record; record = fdes.Next(record))
+			if(fdes.Read(record, start, size))
+				Add(start, size);
+	}
+
+	Sort();
+}
+#endif
+
+void FunctionTable::Add(uintptr_t start, uintptr_t size)
+{
+	uintptr_t offset = start - reinterpret_cast<uintptr_t>(moduleBase);
+	if(!size || offset >= moduleSize)
+		return;
+
+	starts.push_back(static_cast<uint32_t>(offset));
+	sizes.push_back(static_cast<uint32_t>(std::min<uintptr_t>(size, moduleSize - offset)));
+}
+
+void FunctionTable::Sort()
+{
+	if(std::is_sorted(starts.begin(), starts.end()))
+		return;
+
+	std::vector<uint32_t> order(starts.size());
+	for(uint32_t i=0; i<order.size(); ++i)
+		order[i] = i;
+
+	std::sort(order.begin(), order.end(), [this](uint32_t lhs, uint32_t rhs) { return starts[lhs] < starts[rhs]; });
+
+	std::vector<uint32_t> sortedStarts(order.size()), sortedSizes(order.size());
+	for(size_t i=0; i<order.size(); ++i)
+	{
+		sortedStarts[i] = starts[order[i]];
+		sortedSizes[i] = sizes[order[i]];
+	}
+
+	starts.swap(sortedStarts);
+	sizes.swap(sortedSizes);
+}
+
+const void *FunctionTable::Find(const void *addr, size_t *size) const
+{
+	const uint8_t *addrPtr = static_cast<const uint8_t*>(addr);
+	if(starts.empty() || addrPtr < moduleBase || addrPtr >= moduleBase + moduleSize)
+		return nullptr;
+
+	uint32_t target = static_cast<uint32_t>(addrPtr - moduleBase);
+
+	// Halve the range every step without branching on the comparison, as in SymbolIndex.
+	const uint32_t *base = starts.data();
+	size_t remaining = starts.size();
+	while(remaining > 1)
+	{
+		size_t half = remaining / 2;
+		base = base[half] <= target ? base + half : base;
+		remaining -= half;
+	}
+
+	size_t index = static_cast<size_t>(base - starts.data());
+	if(*base > target || target - *base >= sizes[index])
+		return nullptr;
+
+	if(size)
+		*size = sizes[index];
+
+	return moduleBase + *base;
+}
+
+unsigned FunctionTable::GetCount() const
+{
+	return static_cast<unsigned>(starts.size());
+}
+
+const void *FunctionTable::GetStart(unsigned index) const
+{
+	return moduleBase + starts[index];
+}
+
+size_t FunctionTable::GetSize(unsigned index) const
+{
+	return sizes[index];
+}
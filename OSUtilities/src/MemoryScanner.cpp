@@ -0,0 +1,722 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		MemoryScanner.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Searches a process's memory for values
+ */
+
+#include "MemoryScanner.h"
+#include "ProcessHandleManager.h"
+#include <algorithm>
+#include <exception>
+#include <thread>
+#include <atomic>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+# define SCANNER_X86
+# include <immintrin.h>
+#endif
+
+#ifdef WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+#else
+# include <cstdio>
+# include <sstream>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+// MSVC lets any function use any intrinsic. GCC needs to be told which functions may.
+#if defined(SCANNER_X86) && !defined(_MSC_VER)
+# define SCANNER_SSE42 __attribute__((target("sse4.2")))
+# define SCANNER_AVX2  __attribute__((target("avx2")))
+#else
+# define SCANNER_SSE42
+# define SCANNER_AVX2
+#endif
+
+namespace
+{
+	const size_t CHUNK_SIZE   = 1 << 20;
+	const size_t OVERLAP      = 7;        //!< So values up to 8 bytes can straddle chunks.
+	const size_t RESCAN_BLOCK = 4096;     //!< Hits rescanned at a time, by one thread.
+	const size_t SPAN_GAP     = 256;      //!< Hits closer than this are read back together.
+	const size_t SPAN_MAX     = 64*1024;
+
+	const unsigned valueSizes[] = { 1, 2, 4, 8, 1, 2, 4, 8, 4, 8 };
+
+	size_t GetPageSize()
+	{
+#ifdef WIN32
+		SYSTEM_INFO sysInfo;
+		GetSystemInfo(&sysInfo);
+		return sysInfo.dwPageSize;
+#else
+		return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+	}
+
+	template<typename T>
+	T FromBits(uint64_t bits)
+	{
+		T value;
+		std::memcpy(&value, &bits, sizeof(T));
+		return value;
+	}
+
+	uint64_t LoadBits(const uint8_t *data, unsigned size)
+	{
+		uint64_t bits = 0;
+		std::memcpy(&bits, data, size);
+		return bits;
+	}
+
+	template<typename T>
+	void ScanScalar(const MemoryScanner::Query& query, const uint8_t *data, size_t size, size_t pos, size_t reportLimit,
+	                const uint8_t *address, MemoryScanner::Hits& hits)
+	{
+		T low = FromBits<T>(query.low);
+		T high = FromBits<T>(query.high);
+		for(; pos + sizeof(T) <= size && pos < reportLimit; pos += query.alignment)
+		{
+			T value;
+			std::memcpy(&value, data + pos, sizeof(T));
+			if(low <= value && value <= high)
+			{
+				MemoryScanner::Hit hit = { address + pos, LoadBits(data + pos, sizeof(T)) };
+				hits.push_back(hit);
+			}
+		}
+	}
+
+	template<typename T>
+	bool TestAs(const MemoryScanner::Query& query, uint64_t now, uint64_t before)
+	{
+		T value = FromBits<T>(now);
+		switch(query.compare)
+		{
+			case MemoryScanner::EXACT:
+			case MemoryScanner::RANGE:
+				return FromBits<T>(query.low) <= value && value <= FromBits<T>(query.high);
+			case MemoryScanner::CHANGED:
+				return now != before;
+			case MemoryScanner::UNCHANGED:
+				return now == before;
+			case MemoryScanner::INCREASED:
+				return value > FromBits<T>(before);
+			default:
+				return value < FromBits<T>(before);
+		}
+	}
+
+	bool Test(const MemoryScanner::Query& query, uint64_t now, uint64_t before)
+	{
+		switch(query.type)
+		{
+			case MemoryScanner::U8:  return TestAs<uint8_t>(query, now, before);
+			case MemoryScanner::U16: return TestAs<uint16_t>(query, now, before);
+			case MemoryScanner::U32: return TestAs<uint32_t>(query, now, before);
+			case MemoryScanner::U64: return TestAs<uint64_t>(query, now, before);
+			case MemoryScanner::I8:  return TestAs<int8_t>(query, now, before);
+			case MemoryScanner::I16: return TestAs<int16_t>(query, now, before);
+			case MemoryScanner::I32: return TestAs<int32_t>(query, now, before);
+			case MemoryScanner::I64: return TestAs<int64_t>(query, now, before);
+			case MemoryScanner::F32: return TestAs<float>(query, now, before);
+			default:                 return TestAs<double>(query, now, before);
+		}
+	}
+
+#ifdef SCANNER_X86
+	// How the lanes of a vector are compared. Unsigned integers have their top bit flipped,
+	// so the signed compares order them right.
+	enum LaneKind
+	{
+		INT32_LANES,
+		INT64_LANES,
+		FLOAT_LANES,
+		DOUBLE_LANES
+	};
+
+	struct Lanes
+	{
+		LaneKind kind;
+		unsigned size;
+		uint64_t bias;
+		unsigned keep;   //!< Lanes at a multiple of the alignment, as a movemask.
+	};
+
+	Lanes GetLanes(const MemoryScanner::Query& query, unsigned vectorSize)
+	{
+		Lanes lanes;
+		lanes.size = valueSizes[query.type];
+		switch(query.type)
+		{
+			case MemoryScanner::U32: lanes.kind = INT32_LANES;  lanes.bias = 0x80000000u;                         break;
+			case MemoryScanner::U64: lanes.kind = INT64_LANES;  lanes.bias = static_cast<uint64_t>(1) << 63;      break;
+			case MemoryScanner::I32: lanes.kind = INT32_LANES;  lanes.bias = 0;                                   break;
+			case MemoryScanner::I64: lanes.kind = INT64_LANES;  lanes.bias = 0;                                   break;
+			case MemoryScanner::F32: lanes.kind = FLOAT_LANES;  lanes.bias = 0;                                   break;
+			default:                 lanes.kind = DOUBLE_LANES; lanes.bias = 0;                                   break;
+		}
+
+		lanes.keep = 0;
+		for(unsigned lane=0; lane < vectorSize / lanes.size; ++lane)
+			if(lane * lanes.size % query.alignment == 0)
+				lanes.keep |= 1u << lane;
+
+		return lanes;
+	}
+
+	SCANNER_SSE42 unsigned MatchSse42(LaneKind kind, __m128i values, __m128i low, __m128i high, __m128i bias)
+	{
+		switch(kind)
+		{
+			case INT32_LANES:
+				values = _mm_xor_si128(values, bias);
+				return ~_mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(_mm_cmpgt_epi32(low, values), _mm_cmpgt_epi32(values, high)))) & 0xF;
+			case INT64_LANES:
+				values = _mm_xor_si128(values, bias);
+				return ~_mm_movemask_pd(_mm_castsi128_pd(_mm_or_si128(_mm_cmpgt_epi64(low, values), _mm_cmpgt_epi64(values, high)))) & 0x3;
+			case FLOAT_LANES:
+				return _mm_movemask_ps(_mm_and_ps(_mm_cmpge_ps(_mm_castsi128_ps(values), _mm_castsi128_ps(low)),
+				                                  _mm_cmple_ps(_mm_castsi128_ps(values), _mm_castsi128_ps(high))));
+			default:
+				return _mm_movemask_pd(_mm_and_pd(_mm_cmpge_pd(_mm_castsi128_pd(values), _mm_castsi128_pd(low)),
+				                                  _mm_cmple_pd(_mm_castsi128_pd(values), _mm_castsi128_pd(high))));
+		}
+	}
+
+	SCANNER_AVX2 unsigned MatchAvx2(LaneKind kind, __m256i values, __m256i low, __m256i high, __m256i bias)
+	{
+		switch(kind)
+		{
+			case INT32_LANES:
+				values = _mm256_xor_si256(values, bias);
+				return ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_or_si256(_mm256_cmpgt_epi32(low, values), _mm256_cmpgt_epi32(values, high)))) & 0xFF;
+			case INT64_LANES:
+				values = _mm256_xor_si256(values, bias);
+				return ~_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_cmpgt_epi64(low, values), _mm256_cmpgt_epi64(values, high)))) & 0xF;
+			case FLOAT_LANES:
+				return _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(_mm256_castsi256_ps(values), _mm256_castsi256_ps(low), _CMP_GE_OQ),
+				                                        _mm256_cmp_ps(_mm256_castsi256_ps(values), _mm256_castsi256_ps(high), _CMP_LE_OQ)));
+			default:
+				return _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(_mm256_castsi256_pd(values), _mm256_castsi256_pd(low), _CMP_GE_OQ),
+				                                        _mm256_cmp_pd(_mm256_castsi256_pd(values), _mm256_castsi256_pd(high), _CMP_LE_OQ)));
+		}
+	}
+
+	unsigned LowestSetBit(unsigned bits)
+	{
+# ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, bits);
+		return index;
+# else
+		return __builtin_ctz(bits);
+# endif
+	}
+#endif
+
+	// Adds a region, joining it to the last if they touch, so values across the two are found.
+	template<typename Region>
+	void AddRegion(std::vector<Region>& regions, const void *begin, size_t size, bool anonymous)
+	{
+		const uint8_t *addr = static_cast<const uint8_t*>(begin);
+		if(!regions.empty() && regions.back().addr + regions.back().size == addr && regions.back().anonymous == anonymous)
+		{
+			regions.back().size += size;
+		}
+		else
+		{
+			Region region = { addr, size, anonymous };
+			regions.push_back(region);
+		}
+	}
+}
+
+MemoryScanner::MemoryScanner(unsigned procId) : procHandle(ProcessHandleManager::Get()->GetHandle(procId)),
+                                                threadCount(std::max(1u, std::thread::hardware_concurrency())), writableOnly(true),
+                                                simd(SignatureScanner::GetSupportedSimd()), stats()
+#ifndef WIN32
+                                                , pagemapFd(-1)
+#endif
+{
+#ifdef WIN32
+	if(!procHandle.EnsureRights(PROCESS_VM_READ | PROCESS_QUERY_INFORMATION))
+		throw std::exception();
+#else
+	// Without it every page is read, as though it were in memory.
+	std::ostringstream path;
+	path << "/proc/" << procHandle.GetProcId() << "/pagemap";
+	pagemapFd = open(path.str().c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+}
+
+MemoryScanner::~MemoryScanner()
+{
+#ifndef WIN32
+	if(pagemapFd >= 0)
+		close(pagemapFd);
+#endif
+}
+
+MemoryScanner::Regions MemoryScanner::GetRegions() const
+{
+	std::vector<Region> listed = ListRegions();
+
+	Regions regions;
+	for(auto it = listed.begin(); it != listed.end(); ++it)
+		regions.push_back(std::make_pair(static_cast<const void*>(it->addr), it->size));
+
+	return regions;
+}
+
+std::vector<MemoryScanner::Region> MemoryScanner::ListRegions() const
+{
+	std::vector<Region> regions;
+
+#ifdef WIN32
+	const DWORD readable = PAGE_READONLY | PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+	const DWORD writable = PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+
+	MEMORY_BASIC_INFORMATION info;
+	const uint8_t *addr = nullptr;
+	while(VirtualQueryEx(procHandle, addr, &info, sizeof(info)) == sizeof(info))
+	{
+		DWORD protect = info.Protect & 0xFF;
+		if(info.State == MEM_COMMIT && !(info.Protect & PAGE_GUARD) && (protect & readable) && (!writableOnly || (protect & writable)))
+			AddRegion(regions, info.BaseAddress, info.RegionSize, info.Type == MEM_PRIVATE);
+
+		addr = static_cast<const uint8_t*>(info.BaseAddress) + info.RegionSize;
+	}
+#else
+	std::ostringstream path;
+	path << "/proc/" << procHandle.GetProcId() << "/maps";
+
+	FILE *maps = fopen(path.str().c_str(), "r");
+	if(!maps)
+		throw std::exception();
+
+	char line[512];
+	while(fgets(line, sizeof(line), maps))
+	{
+		unsigned long long begin, end, inode;
+		char perms[5];
+		if(sscanf(line, "%llx-%llx %4s %*x %*s %llu", &begin, &end, perms, &inode) != 4)
+			continue;
+
+		// The vdso's data pages can't be read through /proc/pid/mem, and reading vsyscall faults.
+		if(perms[0] != 'r' || (writableOnly && perms[1] != 'w') || strstr(line, "[vvar") || strstr(line, "[vsyscall]"))
+			continue;
+
+		// Only private mappings with no file behind them are anonymous. A private file mapping's
+		// pages that were never faulted in still read back as the file's contents.
+		AddRegion(regions, reinterpret_cast<const void*>(static_cast<uintptr_t>(begin)), static_cast<size_t>(end - begin), perms[3] == 'p' && inode == 0);
+	}
+
+	fclose(maps);
+#endif
+
+	return regions;
+}
+
+void MemoryScanner::Scan(const Query& query, Hits& hits)
+{
+	if(query.compare != EXACT && query.compare != RANGE)
+		throw std::exception();
+
+	std::vector<Region> regions = ListRegions();
+
+	std::vector<Chunk> chunks;
+	for(auto it = regions.begin(); it != regions.end(); ++it)
+	{
+		const uint8_t *end = it->addr + it->size;
+		for(const uint8_t *addr = it->addr; addr < end; addr += CHUNK_SIZE)
+		{
+			size_t left = static_cast<size_t>(end - addr);
+			Chunk chunk = { addr, std::min(CHUNK_SIZE, left), std::min(CHUNK_SIZE + OVERLAP, left), it->anonymous };
+			chunks.push_back(chunk);
+		}
+	}
+
+	// Chunks are handed out in order, and each keeps its own hits, so they come out in
+	// address order however the threads go. This thread's memory is made first, so a process
+	// that can't be read throws here rather than in a thread. Reads are checked even in this
+	// process, as what was there when the regions were listed may not be any more.
+	unsigned workers = std::max(1u, std::min(threadCount, static_cast<unsigned>(chunks.size())));
+	std::vector<Hits> chunkHits(chunks.size());
+	std::vector<Stats> workerStats(workers, Stats());
+	std::atomic<size_t> next(0);
+	ProcessMemory memory(procHandle.GetProcId(), true);
+
+	auto work = [this, &query, &chunks, &chunkHits, &next](ProcessMemory& memory, Stats& workerStats)
+	{
+		std::vector<uint8_t> buffer(CHUNK_SIZE + OVERLAP);
+		for(size_t i = next++; i < chunks.size(); i = next++)
+			ScanChunk(query, chunks[i], buffer, memory, chunkHits[i], workerStats);
+	};
+
+	std::vector<std::thread> threads;
+	for(unsigned i=1; i<workers; ++i)
+	{
+		threads.emplace_back([this, &work, &workerStats, i]()
+		{
+			ProcessMemory memory(procHandle.GetProcId(), true);
+			work(memory, workerStats[i]);
+		});
+	}
+
+	work(memory, workerStats[0]);
+	for(auto it = threads.begin(); it != threads.end(); ++it)
+		it->join();
+
+	stats = Stats();
+	stats.regions = regions.size();
+	for(auto it = workerStats.begin(); it != workerStats.end(); ++it)
+	{
+		stats.bytesRead    += it->bytesRead;
+		stats.pagesSkipped += it->pagesSkipped;
+		stats.bytesFailed  += it->bytesFailed;
+	}
+
+	size_t found = 0;
+	for(auto it = chunkHits.begin(); it != chunkHits.end(); ++it)
+		found += it->size();
+
+	hits.clear();
+	hits.reserve(found);
+	for(auto it = chunkHits.begin(); it != chunkHits.end(); ++it)
+		hits.insert(hits.end(), it->begin(), it->end());
+}
+
+void MemoryScanner::ScanChunk(const Query& query, const Chunk& chunk, std::vector<uint8_t>& buffer, ProcessMemory& memory, Hits& hits, Stats& chunkStats) const
+{
+	// Runs of pages in memory, as offsets into the chunk.
+	std::vector<std::pair<size_t, size_t>> runs;
+
+#ifndef WIN32
+	static const size_t pageSize = GetPageSize();
+	uintptr_t firstPage = reinterpret_cast<uintptr_t>(chunk.addr) / pageSize;
+	uintptr_t endPage = (reinterpret_cast<uintptr_t>(chunk.addr) + chunk.readSize + pageSize - 1) / pageSize;
+	std::vector<uint64_t> entries(endPage - firstPage);
+	size_t entryBytes = entries.size() * sizeof(uint64_t);
+
+	if(chunk.checkPages && pagemapFd >= 0 && pread(pagemapFd, entries.data(), entryBytes, static_cast<off_t>(firstPage * sizeof(uint64_t))) == static_cast<ssize_t>(entryBytes))
+	{
+		// Bit 63 is set for pages in memory. Swapped out pages have bit 62 instead.
+		const uint64_t present = static_cast<uint64_t>(1) << 63;
+		for(size_t page=0; page < entries.size(); ++page)
+		{
+			size_t begin = page ? (firstPage + page) * pageSize - reinterpret_cast<uintptr_t>(chunk.addr) : 0;
+			size_t end = std::min(chunk.readSize, (firstPage + page + 1) * pageSize - reinterpret_cast<uintptr_t>(chunk.addr));
+
+			if(!(entries[page] & present))
+			{
+				if(begin < chunk.size)
+					++chunkStats.pagesSkipped;
+			}
+			else if(!runs.empty() && runs.back().first + runs.back().second == begin)
+				runs.back().second += end - begin;
+			else
+				runs.push_back(std::make_pair(begin, end - begin));
+		}
+	}
+	else
+#endif
+		runs.push_back(std::make_pair(static_cast<size_t>(0), chunk.readSize));
+
+	if(runs.empty())
+		return;
+
+	std::vector<ProcessMemory::ReadRange> reads(runs.size());
+	for(size_t i=0; i<runs.size(); ++i)
+	{
+		ProcessMemory::ReadRange read = { chunk.addr + runs[i].first, buffer.data() + runs[i].first, static_cast<unsigned>(runs[i].second) };
+		reads[i] = read;
+	}
+
+	// One read for the whole chunk. If part of it was unmapped since the regions were listed,
+	// each run is read on its own, and the ones that fail left out.
+	std::vector<bool> failed(runs.size(), false);
+	try
+	{
+		memory.ReadV(reads.data(), static_cast<unsigned>(reads.size()));
+	}
+	catch(const std::exception&)
+	{
+		for(size_t i=0; i<reads.size(); ++i)
+		{
+			try
+			{
+				memory.Read(reads[i].addr, reads[i].val, reads[i].size);
+			}
+			catch(const std::exception&)
+			{
+				failed[i] = true;
+				chunkStats.bytesFailed += reads[i].size;
+			}
+		}
+	}
+
+	for(size_t i=0; i<runs.size(); ++i)
+	{
+		if(failed[i])
+			continue;
+
+		chunkStats.bytesRead += runs[i].second;
+
+		// Runs past the end of the chunk are the next chunk's to report.
+		if(runs[i].first < chunk.size)
+			ScanBlock(query, buffer.data() + runs[i].first, runs[i].second, chunk.size - runs[i].first, chunk.addr + runs[i].first, hits);
+	}
+}
+
+void MemoryScanner::ScanBlock(const Query& query, const uint8_t *data, size_t size, size_t reportLimit, const uint8_t *address, Hits& hits) const
+{
+	// Values are looked for at multiples of the alignment in the process, not in the buffer.
+	size_t pos = (query.alignment - reinterpret_cast<uintptr_t>(address) % query.alignment) % query.alignment;
+	if(pos >= size || pos >= reportLimit)
+		return;
+
+	unsigned valueSize = valueSizes[query.type];
+	bool vectors = (valueSize == 4 || valueSize == 8) && query.alignment % valueSize == 0 && query.alignment <= 16 &&
+	               (query.alignment & (query.alignment - 1)) == 0;
+
+	if(vectors && simd == SignatureScanner::SIMD_AVX2)
+		pos += ScanAvx2(query, data + pos, size - pos, reportLimit - pos, address + pos, hits);
+	else if(vectors && simd == SignatureScanner::SIMD_SSE42)
+		pos += ScanSse42(query, data + pos, size - pos, reportLimit - pos, address + pos, hits);
+
+	switch(query.type)
+	{
+		case U8:  ScanScalar<uint8_t>(query, data, size, pos, reportLimit, address, hits);  break;
+		case U16: ScanScalar<uint16_t>(query, data, size, pos, reportLimit, address, hits); break;
+		case U32: ScanScalar<uint32_t>(query, data, size, pos, reportLimit, address, hits); break;
+		case U64: ScanScalar<uint64_t>(query, data, size, pos, reportLimit, address, hits); break;
+		case I8:  ScanScalar<int8_t>(query, data, size, pos, reportLimit, address, hits);   break;
+		case I16: ScanScalar<int16_t>(query, data, size, pos, reportLimit, address, hits);  break;
+		case I32: ScanScalar<int32_t>(query, data, size, pos, reportLimit, address, hits);  break;
+		case I64: ScanScalar<int64_t>(query, data, size, pos, reportLimit, address, hits);  break;
+		case F32: ScanScalar<float>(query, data, size, pos, reportLimit, address, hits);    break;
+		case F64: ScanScalar<double>(query, data, size, pos, reportLimit, address, hits);   break;
+	}
+}
+
+#ifdef SCANNER_X86
+SCANNER_SSE42 size_t MemoryScanner::ScanSse42(const Query& query, const uint8_t *data, size_t size, size_t reportLimit, const uint8_t *address, Hits& hits) const
+{
+	Lanes lanes = GetLanes(query, 16);
+	__m128i bias = lanes.size == 4 ? _mm_set1_epi32(static_cast<int>(lanes.bias)) : _mm_set1_epi64x(static_cast<long long>(lanes.bias));
+	__m128i low  = lanes.size == 4 ? _mm_set1_epi32(static_cast<int>(query.low ^ lanes.bias)) : _mm_set1_epi64x(static_cast<long long>(query.low ^ lanes.bias));
+	__m128i high = lanes.size == 4 ? _mm_set1_epi32(static_cast<int>(query.high ^ lanes.bias)) : _mm_set1_epi64x(static_cast<long long>(query.high ^ lanes.bias));
+
+	size_t pos = 0;
+	for(; pos + 16 <= size && pos < reportLimit; pos += 16)
+	{
+		unsigned found = MatchSse42(lanes.kind, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos)), low, high, bias) & lanes.keep;
+		while(found)
+		{
+			size_t at = pos + LowestSetBit(found) * lanes.size;
+			if(at < reportLimit)
+			{
+				Hit hit = { address + at, LoadBits(data + at, lanes.size) };
+				hits.push_back(hit);
+			}
+			found &= found - 1;
+		}
+	}
+
+	return pos;
+}
+
+SCANNER_AVX2 size_t MemoryScanner::ScanAvx2(const Query& query, const uint8_t *data, size_t size, size_t reportLimit, const uint8_t *address, Hits& hits) const
+{
+	Lanes lanes = GetLanes(query, 32);
+	__m256i bias = lanes.size == 4 ? _mm256_set1_epi32(static_cast<int>(lanes.bias)) : _mm256_set1_epi64x(static_cast<long long>(lanes.bias));
+	__m256i low  = lanes.size == 4 ? _mm256_set1_epi32(static_cast<int>(query.low ^ lanes.bias)) : _mm256_set1_epi64x(static_cast<long long>(query.low ^ lanes.bias));
+	__m256i high = lanes.size == 4 ? _mm256_set1_epi32(static_cast<int>(query.high ^ lanes.bias)) : _mm256_set1_epi64x(static_cast<long long>(query.high ^ lanes.bias));
+
+	size_t pos = 0;
+	for(; pos + 32 <= size && pos < reportLimit; pos += 32)
+	{
+		unsigned found = MatchAvx2(lanes.kind, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos)), low, high, bias) & lanes.keep;
+		while(found)
+		{
+			size_t at = pos + LowestSetBit(found) * lanes.size;
+			if(at < reportLimit)
+			{
+				Hit hit = { address + at, LoadBits(data + at, lanes.size) };
+				hits.push_back(hit);
+			}
+			found &= found - 1;
+		}
+	}
+
+	return pos;
+}
+#else
+size_t MemoryScanner::ScanSse42(const Query&, const uint8_t*, size_t, size_t, const uint8_t*, Hits&) const
+{
+	return 0;
+}
+
+size_t MemoryScanner::ScanAvx2(const Query&, const uint8_t*, size_t, size_t, const uint8_t*, Hits&) const
+{
+	return 0;
+}
+#endif
+
+void MemoryScanner::Rescan(const Query& query, Hits& hits)
+{
+	size_t blockCount = (hits.size() + RESCAN_BLOCK - 1) / RESCAN_BLOCK;
+	unsigned workers = std::max(1u, std::min(threadCount, static_cast<unsigned>(blockCount)));
+	std::vector<Hits> blockHits(blockCount);
+	std::vector<Stats> workerStats(workers, Stats());
+	std::atomic<size_t> next(0);
+	ProcessMemory memory(procHandle.GetProcId(), true);
+
+	auto work = [this, &query, &hits, &blockHits, &next](ProcessMemory& memory, Stats& workerStats)
+	{
+		for(size_t i = next++; i < blockHits.size(); i = next++)
+		{
+			const Hit *begin = hits.data() + i * RESCAN_BLOCK;
+			const Hit *end = hits.data() + std::min(hits.size(), (i + 1) * RESCAN_BLOCK);
+			RescanBlock(query, begin, end, memory, blockHits[i], workerStats);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for(unsigned i=1; i<workers; ++i)
+	{
+		threads.emplace_back([this, &work, &workerStats, i]()
+		{
+			ProcessMemory memory(procHandle.GetProcId(), true);
+			work(memory, workerStats[i]);
+		});
+	}
+
+	work(memory, workerStats[0]);
+	for(auto it = threads.begin(); it != threads.end(); ++it)
+		it->join();
+
+	stats = Stats();
+	for(auto it = workerStats.begin(); it != workerStats.end(); ++it)
+	{
+		stats.bytesRead   += it->bytesRead;
+		stats.bytesFailed += it->bytesFailed;
+	}
+
+	size_t kept = 0;
+	for(auto it = blockHits.begin(); it != blockHits.end(); ++it)
+		kept += it->size();
+
+	hits.clear();
+	hits.reserve(kept);
+	for(auto it = blockHits.begin(); it != blockHits.end(); ++it)
+		hits.insert(hits.end(), it->begin(), it->end());
+}
+
+void MemoryScanner::RescanBlock(const Query& query, const Hit *begin, const Hit *end, ProcessMemory& memory, Hits& kept, Stats& blockStats) const
+{
+	unsigned valueSize = valueSizes[query.type];
+
+	// Hits near each other are read back as one span, so a block is a single ReadV.
+	std::vector<ProcessMemory::ReadRange> spans;
+	std::vector<size_t> offsets;   //!< Of each hit's value in the buffer.
+	size_t bufferSize = 0;
+	offsets.reserve(end - begin);
+	for(const Hit *hit = begin; hit != end; ++hit)
+	{
+		const uint8_t *addr = static_cast<const uint8_t*>(hit->address);
+		if(!spans.empty())
+		{
+			ProcessMemory::ReadRange& span = spans.back();
+			const uint8_t *spanBegin = static_cast<const uint8_t*>(span.addr);
+			if(addr >= spanBegin && addr <= spanBegin + span.size + SPAN_GAP && addr + valueSize <= spanBegin + SPAN_MAX)
+			{
+				unsigned size = std::max(span.size, static_cast<unsigned>(addr + valueSize - spanBegin));
+				bufferSize += size - span.size;
+				span.size = size;
+				offsets.push_back(bufferSize - span.size + (addr - spanBegin));
+				continue;
+			}
+		}
+
+		ProcessMemory::ReadRange span = { addr, reinterpret_cast<void*>(bufferSize), valueSize };
+		spans.push_back(span);
+		offsets.push_back(bufferSize);
+		bufferSize += valueSize;
+	}
+
+	// Spans were placed before the buffer existed, so val holds offsets until now.
+	std::vector<uint8_t> buffer(bufferSize);
+	for(auto it = spans.begin(); it != spans.end(); ++it)
+		it->val = buffer.data() + reinterpret_cast<uintptr_t>(it->val);
+
+	std::vector<bool> failed(spans.size(), false);
+	try
+	{
+		memory.ReadV(spans.data(), static_cast<unsigned>(spans.size()));
+	}
+	catch(const std::exception&)
+	{
+		for(size_t i=0; i<spans.size(); ++i)
+		{
+			try
+			{
+				memory.Read(spans[i].addr, spans[i].val, spans[i].size);
+			}
+			catch(const std::exception&)
+			{
+				failed[i] = true;
+				blockStats.bytesFailed += spans[i].size;
+			}
+		}
+	}
+
+	// Hits of a failed span are gone, as whatever held them was unmapped.
+	size_t span = 0;
+	for(const Hit *hit = begin; hit != end; ++hit)
+	{
+		size_t offset = offsets[hit - begin];
+		while(static_cast<uint8_t*>(spans[span].val) + spans[span].size <= buffer.data() + offset)
+			++span;
+
+		if(failed[span])
+			continue;
+
+		uint64_t now = LoadBits(buffer.data() + offset, valueSize);
+		if(Test(query, now, hit->value))
+		{
+			Hit update = { hit->address, now };
+			kept.push_back(update);
+		}
+	}
+
+	for(size_t i=0; i<spans.size(); ++i)
+		if(!failed[i])
+			blockStats.bytesRead += spans[i].size;
+}
+
+void MemoryScanner::SetWritableOnly(bool writable)
+{
+	writableOnly = writable;
+}
+
+void MemoryScanner::SetThreadCount(unsigned count)
+{
+	threadCount = std::max(1u, count);
+}
+
+void MemoryScanner::SetSimd(SignatureScanner::SimdLevel level)
+{
+	simd = std::min(level, SignatureScanner::GetSupportedSimd());
+}
+
+const MemoryScanner::Stats& MemoryScanner::GetStats() const
+{
+	return stats;
+}
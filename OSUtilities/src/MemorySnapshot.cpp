@@ -0,0 +1,341 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		MemorySnapshot.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Copies of a process's memory, and what changed between them
+ */
+
+#include "MemorySnapshot.h"
+#include "ProcessHandleManager.h"
+#include <algorithm>
+#include <exception>
+#include <cstring>
+
+#ifdef WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+#else
+# include <mutex>
+# include <sstream>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+#endif
+
+namespace
+{
+	const size_t MAX_READ = 1u << 30;   //!< Largest run read at once.
+
+	size_t GetPageSize()
+	{
+#ifdef WIN32
+		SYSTEM_INFO sysInfo;
+		GetSystemInfo(&sysInfo);
+		return sysInfo.dwPageSize;
+#else
+		return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+	}
+
+#ifndef WIN32
+	const uint64_t PM_SOFT_DIRTY = static_cast<uint64_t>(1) << 55;
+	const size_t PAGEMAP_BATCH = 64*1024;   //!< Pagemap entries read at once.
+
+	bool WriteClearRefs(unsigned procId)
+	{
+		std::ostringstream path;
+		path << "/proc/" << procId << "/clear_refs";
+
+		int fd = open(path.str().c_str(), O_WRONLY | O_CLOEXEC);
+		if(fd < 0)
+			return false;
+
+		// 4 clears the soft-dirty bits.
+		bool cleared = write(fd, "4", 1) == 1;
+		close(fd);
+		return cleared;
+	}
+
+	// Kernels built without soft-dirty bits accept clear_refs, but never set the bit, which would
+	// look like nothing ever changes. A page this process has just mapped and written is always
+	// soft-dirty where they're supported, so it's checked on one of those, without clearing any.
+	bool SoftDirtyWorks()
+	{
+		static std::once_flag tested;
+		static bool works = false;
+
+		std::call_once(tested, []
+		{
+			size_t pageSize = GetPageSize();
+			void *page = mmap(nullptr, pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if(page == MAP_FAILED)
+				return;
+
+			*static_cast<volatile uint8_t*>(page) = 1;
+
+			int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+			if(fd >= 0)
+			{
+				uint64_t entry = 0;
+				off_t offset = static_cast<off_t>(reinterpret_cast<uintptr_t>(page) / pageSize * sizeof(entry));
+				works = pread(fd, &entry, sizeof(entry), offset) == sizeof(entry) && (entry & PM_SOFT_DIRTY);
+				close(fd);
+			}
+
+			munmap(page, pageSize);
+		});
+
+		return works;
+	}
+#endif
+}
+
+MemorySnapshot::MemorySnapshot(unsigned procId) : procHandle(ProcessHandleManager::Get()->GetHandle(procId)),
+                                                  memory(procHandle.GetProcId()), ranges(), softDirty(false), pagesRead(0)
+#ifndef WIN32
+                                                  , pagemapFd(-1)
+#endif
+{
+#ifndef WIN32
+	if(!SoftDirtyWorks())
+		return;
+
+	std::ostringstream path;
+	path << "/proc/" << procHandle.GetProcId() << "/pagemap";
+
+	pagemapFd = open(path.str().c_str(), O_RDONLY | O_CLOEXEC);
+	softDirty = pagemapFd >= 0;
+#endif
+}
+
+MemorySnapshot::~MemorySnapshot()
+{
+#ifndef WIN32
+	if(pagemapFd >= 0)
+		close(pagemapFd);
+#endif
+}
+
+unsigned MemorySnapshot::AddRange(const void *addr, size_t size)
+{
+	Range range;
+	range.addr = static_cast<const uint8_t*>(addr);
+	range.size = size;
+	range.read = false;
+
+	ranges.push_back(range);
+	return static_cast<unsigned>(ranges.size() - 1);
+}
+
+void MemorySnapshot::Take()
+{
+	Runs runs;
+	bool dirtyKnown = false;
+
+#ifndef WIN32
+	// The bits have to be read before they're cleared, and cleared before the pages are read,
+	// so nothing written after they're read is missed.
+	if(softDirty)
+	{
+		dirtyKnown = FindDirtyPages(runs);
+		if(!ClearSoftDirty())
+		{
+			softDirty = false;
+			dirtyKnown = false;
+		}
+	}
+#endif
+
+	if(!dirtyKnown)
+		runs.clear();
+
+	for(unsigned i=0; i<ranges.size(); ++i)
+	{
+		ranges[i].changes.clear();
+		if(!ranges[i].read || !dirtyKnown)
+			AddRun(runs, i, 0, ranges[i].size);
+	}
+
+	ReadRuns(runs);
+}
+
+void MemorySnapshot::AddRun(Runs& runs, unsigned range, size_t offset, size_t size) const
+{
+	if(!size)
+		return;
+
+	if(!runs.empty() && runs.back().range == range && runs.back().offset + runs.back().size == offset)
+	{
+		runs.back().size += size;
+		return;
+	}
+
+	Run run = { range, offset, size };
+	runs.push_back(run);
+}
+
+void MemorySnapshot::ReadRuns(const Runs& runs)
+{
+	size_t pageSize = GetPageSize();
+	pagesRead = 0;
+
+	// Everything is read in one batch, unless there's more than MAX_READ of it.
+	for(size_t first = 0; first < runs.size();)
+	{
+		std::vector<ProcessMemory::ReadRange> reads;
+		std::vector<Run> parts;
+		size_t total = 0;
+		for(; first < runs.size() && total < MAX_READ; ++first)
+		{
+			const Run& run = runs[first];
+			for(size_t offset = 0; offset < run.size; offset += MAX_READ)
+			{
+				Run part = { run.range, run.offset + offset, std::min(run.size - offset, MAX_READ) };
+				parts.push_back(part);
+				total += part.size;
+			}
+		}
+
+		std::vector<uint8_t> buffer(total);
+		uint8_t *to = buffer.data();
+		for(auto it = parts.begin(); it != parts.end(); ++it)
+		{
+			Range& range = ranges[it->range];
+			ProcessMemory::ReadRange read = { range.addr + it->offset, to, static_cast<unsigned>(it->size) };
+			reads.push_back(read);
+			to += it->size;
+
+			uintptr_t begin = reinterpret_cast<uintptr_t>(range.addr) + it->offset;
+			pagesRead += (begin + it->size + pageSize - 1) / pageSize - begin / pageSize;
+		}
+
+		memory.ReadV(reads.data(), static_cast<unsigned>(reads.size()));
+
+		const uint8_t *from = buffer.data();
+		for(auto it = parts.begin(); it != parts.end(); ++it)
+		{
+			Range& range = ranges[it->range];
+			if(!range.read)
+				range.data.resize(range.size);
+			else
+				Compare(range, it->offset, from, it->size);
+
+			std::memcpy(range.data.data() + it->offset, from, it->size);
+			from += it->size;
+		}
+	}
+
+	for(auto it = ranges.begin(); it != ranges.end(); ++it)
+		it->read = true;
+}
+
+void MemorySnapshot::Compare(Range& range, size_t offset, const uint8_t *now, size_t size)
+{
+	const uint8_t *before = range.data.data() + offset;
+	size_t pos = 0;
+	while(pos < size)
+	{
+		// Eight bytes at a time until something differs.
+		while(pos + sizeof(uint64_t) <= size)
+		{
+			uint64_t a, b;
+			std::memcpy(&a, before + pos, sizeof(a));
+			std::memcpy(&b, now + pos, sizeof(b));
+			if(a != b)
+				break;
+			pos += sizeof(uint64_t);
+		}
+
+		while(pos < size && before[pos] == now[pos])
+			++pos;
+		if(pos == size)
+			break;
+
+		size_t start = pos;
+		while(pos < size && before[pos] != now[pos])
+			++pos;
+
+		Changes& changes = range.changes;
+		if(!changes.empty() && changes.back().offset + changes.back().size + JOIN_GAP >= offset + start)
+			changes.back().size = offset + pos - changes.back().offset;
+		else
+		{
+			Change change = { offset + start, pos - start };
+			changes.push_back(change);
+		}
+	}
+}
+
+#ifndef WIN32
+bool MemorySnapshot::FindDirtyPages(Runs& runs)
+{
+	size_t pageSize = GetPageSize();
+	std::vector<uint64_t> entries;
+
+	for(unsigned i=0; i<ranges.size(); ++i)
+	{
+		const Range& range = ranges[i];
+		if(!range.read || !range.size)
+			continue;
+
+		uintptr_t begin = reinterpret_cast<uintptr_t>(range.addr), end = begin + range.size;
+		uintptr_t firstPage = begin / pageSize, lastPage = (end - 1) / pageSize;
+
+		for(uintptr_t page = firstPage; page <= lastPage;)
+		{
+			size_t count = static_cast<size_t>(std::min<uintptr_t>(lastPage - page + 1, PAGEMAP_BATCH));
+			entries.resize(count);
+
+			size_t bytes = count * sizeof(uint64_t);
+			if(pread(pagemapFd, entries.data(), bytes, static_cast<off_t>(page * sizeof(uint64_t))) != static_cast<ssize_t>(bytes))
+				return false;
+
+			for(size_t e=0; e<count; ++e)
+			{
+				if(!(entries[e] & PM_SOFT_DIRTY))
+					continue;
+
+				uintptr_t pageBegin = std::max((page + e) * pageSize, begin);
+				uintptr_t pageEnd = std::min((page + e + 1) * pageSize, end);
+				AddRun(runs, i, pageBegin - begin, pageEnd - pageBegin);
+			}
+
+			page += count;
+		}
+	}
+
+	return true;
+}
+
+bool MemorySnapshot::ClearSoftDirty()
+{
+	return WriteClearRefs(procHandle.GetProcId());
+}
+#endif
+
+unsigned MemorySnapshot::GetRangeCount() const
+{
+	return static_cast<unsigned>(ranges.size());
+}
+
+const MemorySnapshot::Changes& MemorySnapshot::GetChanges(unsigned range) const
+{
+	return ranges.at(range).changes;
+}
+
+const uint8_t *MemorySnapshot::GetData(unsigned range) const
+{
+	return ranges.at(range).data.data();
+}
+
+size_t MemorySnapshot::GetPagesRead() const
+{
+	return pagesRead;
+}
+
+bool MemorySnapshot::UsesSoftDirty() const
+{
+	return softDirty;
+}
@@ -10,15 +10,27 @@
 #include "Module.h"
 #include <cstdint>
 #include "ProcessHandleManager.h"
-#include "ProcessMemory.h"
-#include "UndocumentedStructs.h"
+#include "SymbolSearch.h"
+#include "FunctionTable.h"
 #include <algorithm>
 #include <cctype>
-
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
-
-Module::Module(const WIN_LDR_MODULE& module, unsigned procId) : data(new ModuleData(procId)), refs(new unsigned)
+#include <cstring>
+
+#ifdef WIN32
+# include "ProcessMemory.h"
+# include "UndocumentedStructs.h"
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+#else
+# include "ElfImage.h"
+# include "SymbolIndex.h"
+# include "SymbolCache.h"
+# include <sstream>
+# include <cstdio>
+#endif
+
+#ifdef WIN32
+Module::Module(const WIN_LDR_MODULE& module, unsigned procId) : data(new ModuleData(procId)), refs(new std::atomic<unsigned>(1))
 {
 	ProcessMemory memory(procId);
 
@@ -30,9 +42,18 @@ Module::Module(const WIN_LDR_MODULE& module, unsigned procId) : data(new ModuleD
 
 	data->address = module.BaseAddress;
 	data->size = module.SizeOfImage;
-
-	*refs = 1;
 }
+#else
+Module::Module(const std::string& path, void *address, unsigned size, const void *phdrs, unsigned phdrCount, unsigned procId) : data(new ModuleData(procId)), refs(new std::atomic<unsigned>(1))
+{
+	data->path = path;
+	data->name = path.substr(path.rfind('/') + 1);
+	data->address = address;
+	data->size = size;
+	data->phdrs = phdrs;
+	data->phdrCount = phdrCount;
+}
+#endif
 
 Module::Module(const Module& rhs) : data(rhs.data), refs(rhs.refs)
 {
@@ -63,6 +84,7 @@ Module& Module::operator=(Module&& rhs)
 	if(this == &rhs)
 		return *this;
 
+	Destroy();
 	data = rhs.data;
 	refs = rhs.refs;
 	rhs.data = nullptr;
@@ -98,15 +120,27 @@ const void *Module::GetAddress() const
 	return data->address;
 }
 
+unsigned Module::GetSize() const
+{
+	return data->size;
+}
+
+unsigned Module::GetProcId() const
+{
+	return data->procHandle.GetProcId();
+}
+
 bool Module::Contains(const void *addr) const
 {
 	return addr >= data->address && addr < (reinterpret_cast<unsigned char*>(data->address) + data->size);
 }
 
+#ifdef WIN32
 Module::Functions Module::GetFunctions() const
 {
 	Functions functions;
 	ProcessMemory memory(data->procHandle.GetProcId());
+	memory.EnableCache(4096, 16);   // The headers are read a piece at a time.
 
 	IMAGE_DOS_HEADER moduleDOSHeader = memory.Read<IMAGE_DOS_HEADER>(data->address);
 
@@ -114,7 +148,7 @@ Module::Functions Module::GetFunctions() const
 		throw std::exception();
 
 	uint8_t *addr = static_cast<uint8_t*>(data->address);
-	IMAGE_EXPORT_DIRECTORY exports;
+	IMAGE_DATA_DIRECTORY exportDir;
 
 	if(data->procHandle.IsX86())
 	{
@@ -123,7 +157,7 @@ Module::Functions Module::GetFunctions() const
 		if(moduleNTHeader.Signature != IMAGE_NT_SIGNATURE || moduleNTHeader.OptionalHeader.NumberOfRvaAndSizes <= 0)
 			throw std::exception();
 
-		memory.Read(addr + moduleNTHeader.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].VirtualAddress, exports);
+		exportDir = moduleNTHeader.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT];
 	}
 	else
 	{
@@ -132,8 +166,20 @@ Module::Functions Module::GetFunctions() const
 		if(moduleNTHeader.Signature != IMAGE_NT_SIGNATURE || moduleNTHeader.OptionalHeader.NumberOfRvaAndSizes <= 0)
 			throw std::exception();
 
-		memory.Read(addr + moduleNTHeader.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].VirtualAddress, exports);
+		exportDir = moduleNTHeader.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT];
 	}
+
+	if(exportDir.Size < sizeof(IMAGE_EXPORT_DIRECTORY))
+		return functions;
+
+	// The linker puts the tables and names inside the export directory, so it's read whole
+	// rather than a name at a time.
+	std::vector<uint8_t> directory(exportDir.Size + 1);
+	memory.Read(addr + exportDir.VirtualAddress, directory.data(), exportDir.Size);
+	directory[exportDir.Size] = '\0';
+
+	IMAGE_EXPORT_DIRECTORY exports;
+	std::memcpy(&exports, directory.data(), sizeof(exports));
 	
 	if(!exports.NumberOfFunctions)
 		return functions;
@@ -145,20 +191,365 @@ Module::Functions Module::GetFunctions() const
 	std::vector<DWORD> nameAddrs(exports.NumberOfNames);
 	std::vector<WORD>  ordinals(exports.NumberOfNames);
 
-	memory.Read(addr + exports.AddressOfFunctions,    funcAddrs.data(), sizeof(DWORD)*exports.NumberOfFunctions);
-	memory.Read(addr + exports.AddressOfNames,        nameAddrs.data(), sizeof(DWORD)*exports.NumberOfNames);
-	memory.Read(addr + exports.AddressOfNameOrdinals, ordinals.data(),  sizeof(WORD)*exports.NumberOfNames);
+	ProcessMemory::ReadRange tables[] =
+	{
+		{ addr + exports.AddressOfFunctions,    funcAddrs.data(), static_cast<unsigned>(sizeof(DWORD)*funcAddrs.size()) },
+		{ addr + exports.AddressOfNames,        nameAddrs.data(), static_cast<unsigned>(sizeof(DWORD)*nameAddrs.size()) },
+		{ addr + exports.AddressOfNameOrdinals, ordinals.data(),  static_cast<unsigned>(sizeof(WORD)*ordinals.size())   }
+	};
+	memory.ReadV(tables, sizeof(tables)/sizeof(tables[0]));
+
+	// Names outside the directory are unusual, and read together afterwards.
+	std::vector<std::string> outside;
+	std::vector<ProcessMemory::ReadRange> outsideReads;
+	std::vector<unsigned> outsideIndices;
 
 	for(unsigned i=0; i<exports.NumberOfNames; ++i)
 	{
-		char funcName[256];
-		memory.Read(addr + nameAddrs[i], funcName, sizeof(funcName)/sizeof(funcName[0]));
-		funcName[255] = '\0';
+		if(ordinals[i] >= exports.NumberOfFunctions)
+			continue;
+
+		// Forwarded exports point at the name of a function in another module, not at code.
+		DWORD funcAddr = funcAddrs[ordinals[i]];
+		if(funcAddr >= exportDir.VirtualAddress && funcAddr < exportDir.VirtualAddress + exportDir.Size)
+			continue;
+
+		DWORD nameAddr = nameAddrs[i];
+		if(nameAddr >= exportDir.VirtualAddress && nameAddr < exportDir.VirtualAddress + exportDir.Size)
+		{
+			const char *funcName = reinterpret_cast<const char*>(&directory[nameAddr - exportDir.VirtualAddress]);
+			functions.insert(std::make_pair(funcName, addr + funcAddr));
+		}
+		else
+			outsideIndices.push_back(i);
+	}
 
-		functions.insert(std::make_pair(funcName, reinterpret_cast<void*>(funcAddrs[i])));
+	outside.resize(outsideIndices.size(), std::string(256, '\0'));
+	for(size_t i=0; i<outsideIndices.size(); ++i)
+	{
+		ProcessMemory::ReadRange range = { addr + nameAddrs[outsideIndices[i]], &outside[i][0], 255 };
+		outsideReads.push_back(range);
 	}
 
+	if(!outsideReads.empty())
+		memory.ReadV(outsideReads.data(), static_cast<unsigned>(outsideReads.size()));
+
+	for(size_t i=0; i<outsideIndices.size(); ++i)
+		functions.insert(std::make_pair(outside[i].c_str(), addr + funcAddrs[ordinals[outsideIndices[i]]]));
+
 	return functions;
 }
 
-Module::ModuleData::ModuleData(unsigned procId) : procHandle(ProcessHandleManager::Get()->GetHandle(procId)) {}
+Module::Ranges Module::GetCodeRanges() const
+{
+	Ranges ranges;
+	ProcessMemory memory(data->procHandle.GetProcId());
+	memory.EnableCache(4096, 16);   // The headers are read a piece at a time.
+
+	uint8_t *addr = static_cast<uint8_t*>(data->address);
+	IMAGE_DOS_HEADER moduleDOSHeader = memory.Read<IMAGE_DOS_HEADER>(addr);
+	if(moduleDOSHeader.e_magic != IMAGE_DOS_SIGNATURE)
+		throw std::exception();
+
+	// The file header is laid out the same in 32 and 64 bit images, and the section table
+	// follows the optional header whatever its size.
+	uint8_t *ntHeaders = addr + moduleDOSHeader.e_lfanew;
+	if(memory.Read<DWORD>(ntHeaders) != IMAGE_NT_SIGNATURE)
+		throw std::exception();
+
+	IMAGE_FILE_HEADER fileHeader = memory.Read<IMAGE_FILE_HEADER>(ntHeaders + sizeof(DWORD));
+	std::vector<IMAGE_SECTION_HEADER> sections(fileHeader.NumberOfSections);
+	if(sections.empty())
+		return ranges;
+
+	memory.Read(ntHeaders + sizeof(DWORD) + sizeof(IMAGE_FILE_HEADER) + fileHeader.SizeOfOptionalHeader, sections.data(),
+	            static_cast<unsigned>(sizeof(IMAGE_SECTION_HEADER) * sections.size()));
+
+	for(auto it = sections.begin(); it != sections.end(); ++it)
+		if((it->Characteristics & IMAGE_SCN_MEM_EXECUTE) && it->Misc.VirtualSize)
+			ranges.push_back(std::make_pair(addr + it->VirtualAddress, static_cast<size_t>(it->Misc.VirtualSize)));
+
+	return ranges;
+}
+
+#else
+Module::Functions Module::GetFunctions() const
+{
+	const ElfImage *image = GetImage();
+	if(!image)
+		throw std::exception();
+
+	Functions functions;
+	for(unsigned i=0; i<image->GetSymbolCount(); ++i)
+	{
+		const ElfImage::Symbol& symbol = image->GetSymbol(i);
+		if(ElfImage::IsExportedFunction(symbol))
+			functions.insert(std::make_pair(image->GetName(symbol), image->GetAddress(symbol)));
+	}
+
+	return functions;
+}
+
+Module::Ranges Module::GetCodeRanges() const
+{
+	Ranges ranges;
+	if(data->phdrs)
+	{
+		// Loaded into this process, so the loader's program headers say where everything is.
+		const ElfW(Phdr) *phdrs = static_cast<const ElfW(Phdr)*>(data->phdrs);
+		uintptr_t firstPage = 0;
+		ElfImage::GetLoadSize(phdrs, data->phdrCount, &firstPage);
+		uintptr_t bias = reinterpret_cast<uintptr_t>(data->address) - firstPage;
+
+		for(unsigned i=0; i<data->phdrCount; ++i)
+			if(phdrs[i].p_type == PT_LOAD && (phdrs[i].p_flags & PF_X) && phdrs[i].p_memsz)
+				ranges.push_back(std::make_pair(reinterpret_cast<const void*>(bias + phdrs[i].p_vaddr), static_cast<size_t>(phdrs[i].p_memsz)));
+
+		return ranges;
+	}
+
+	// Another process's module is whatever of it is mapped executable.
+	std::ostringstream mapsPath;
+	mapsPath << "/proc/" << data->procHandle.GetProcId() << "/maps";
+
+	FILE *maps = std::fopen(mapsPath.str().c_str(), "r");
+	if(!maps)
+		throw std::exception();
+
+	uintptr_t moduleStart = reinterpret_cast<uintptr_t>(data->address);
+	uintptr_t moduleEnd = moduleStart + data->size;
+
+	char line[4096];
+	while(std::fgets(line, sizeof(line), maps))
+	{
+		unsigned long start, end;
+		char perms[8];
+		if(std::sscanf(line, "%lx-%lx %7s", &start, &end, perms) != 3 || perms[2] != 'x')
+			continue;
+
+		if(start >= moduleStart && end <= moduleEnd)
+			ranges.push_back(std::make_pair(reinterpret_cast<const void*>(start), static_cast<size_t>(end - start)));
+	}
+
+	std::fclose(maps);
+	return ranges;
+}
+
+const std::string& Module::GetPath() const
+{
+	return data->path;
+}
+
+const ElfImage *Module::GetImage() const
+{
+	ModuleData *moduleData = data;
+	std::call_once(moduleData->imageRead, [moduleData]()
+	{
+		try
+		{
+			if(moduleData->phdrs)
+			{
+				// Loaded into this process. The tables are read where the loader put them.
+				const ElfW(Phdr) *phdrs = static_cast<const ElfW(Phdr)*>(moduleData->phdrs);
+				uintptr_t firstPage = 0;
+				ElfImage::GetLoadSize(phdrs, moduleData->phdrCount, &firstPage);
+
+				moduleData->image = new ElfImage(reinterpret_cast<uintptr_t>(moduleData->address) - firstPage, phdrs, moduleData->phdrCount);
+			}
+			else
+			{
+				// The path is as the other process sees it, which may be in another mount namespace.
+				std::ostringstream path;
+				path << "/proc/" << moduleData->procHandle.GetProcId() << "/root" << moduleData->path;
+
+				moduleData->image = new ElfImage(path.str(), moduleData->address);
+			}
+		}
+		catch(...)
+		{
+		}
+	});
+
+	return moduleData->image;
+}
+
+const SymbolIndex *Module::GetSymbolIndex() const
+{
+	ModuleData *moduleData = data;
+	const Module *mod = this;
+	std::call_once(moduleData->indexBuilt, [moduleData, mod]()
+	{
+		const ElfImage *image = mod->GetImage();
+		if(!image)
+			return;
+
+		// Paths are as the module's process sees them, which may be in another mount namespace.
+		std::string root;
+		if(!moduleData->phdrs)
+		{
+			std::ostringstream rootPath;
+			rootPath << "/proc/" << moduleData->procHandle.GetProcId() << "/root";
+			root = rootPath.str();
+		}
+
+		SymbolCache *cache = SymbolCache::Get();
+		moduleData->index = cache->Load(*image, moduleData->address, root);
+		if(moduleData->index)
+			return;
+
+		ElfImage *fileImage = nullptr;
+		ElfImage *debugImage = nullptr;
+		try
+		{
+			// Modules of this process are read where they're loaded, which leaves out .symtab.
+			// Their file has it.
+			const ElfImage *source = image;
+			if(moduleData->phdrs && !moduleData->path.empty() && moduleData->path[0] == '/')
+			{
+				try
+				{
+					fileImage = new ElfImage(moduleData->path, moduleData->address);
+					source = fileImage;
+				}
+				catch(...)
+				{
+				}
+			}
+
+			// Stripped modules may have had their .symtab split off into a debug file.
+			if(!source->GetStaticSymbolCount())
+			{
+				std::string debugPath = SymbolCache::FindDebugFile(image->GetBuildId(), root);
+				if(!debugPath.empty())
+				{
+					try
+					{
+						debugImage = new ElfImage(debugPath, moduleData->address);
+						if(debugImage->GetBuildId() != image->GetBuildId())
+						{
+							delete debugImage;
+							debugImage = nullptr;
+						}
+					}
+					catch(...)
+					{
+					}
+				}
+			}
+
+			moduleData->index = new SymbolIndex(*source, moduleData->address, moduleData->size, debugImage);
+			cache->Store(*image, *moduleData->index);
+		}
+		catch(...)
+		{
+		}
+
+		// The index has its own copy of the names, so the files needn't stay mapped.
+		delete debugImage;
+		delete fileImage;
+	});
+
+	return moduleData->index;
+}
+
+#endif
+
+const SymbolSearch *Module::GetSymbolSearch() const
+{
+	ModuleData *moduleData = data;
+	const Module *mod = this;
+	std::call_once(moduleData->searchBuilt, [moduleData, mod]()
+	{
+		try
+		{
+			SymbolSearch::Symbols symbols;
+#ifdef WIN32
+			Module::Functions functions = mod->GetFunctions();
+			symbols.reserve(functions.size());
+			for(auto it = functions.begin(); it != functions.end(); ++it)
+				symbols.push_back(std::make_pair(it->first.c_str(), it->second));
+#else
+			const SymbolIndex *index = mod->GetSymbolIndex();
+			const ElfImage *image = mod->GetImage();
+			if(!index || !image)
+				return;
+
+			symbols.reserve(index->GetCount());
+			for(unsigned i=0; i<index->GetCount(); ++i)
+				symbols.push_back(std::make_pair(index->GetName(i), index->GetAddress(i)));
+
+			// The index keeps one name per address. Exported aliases are searchable too.
+			for(unsigned i=0; i<image->GetSymbolCount(); ++i)
+			{
+				const ElfImage::Symbol& symbol = image->GetSymbol(i);
+				if(ElfImage::IsExportedFunction(symbol, true))
+					symbols.push_back(std::make_pair(image->GetName(symbol), image->GetAddress(symbol)));
+			}
+
+			std::sort(symbols.begin(), symbols.end(), [](const SymbolSearch::Symbols::value_type& lhs, const SymbolSearch::Symbols::value_type& rhs)
+			{
+				int order = std::strcmp(lhs.first, rhs.first);
+				return order < 0 || (!order && lhs.second < rhs.second);
+			});
+			symbols.erase(std::unique(symbols.begin(), symbols.end(), [](const SymbolSearch::Symbols::value_type& lhs, const SymbolSearch::Symbols::value_type& rhs)
+			{
+				return lhs.second == rhs.second && !std::strcmp(lhs.first, rhs.first);
+			}), symbols.end());
+#endif
+
+			moduleData->search = new SymbolSearch(symbols);
+		}
+		catch(...)
+		{
+		}
+	});
+
+	return moduleData->search;
+}
+
+const FunctionTable *Module::GetFunctionTable() const
+{
+	ModuleData *moduleData = data;
+	const Module *mod = this;
+	std::call_once(moduleData->tableBuilt, [moduleData, mod]()
+	{
+		try
+		{
+#ifdef WIN32
+			moduleData->table = new FunctionTable(mod->GetProcId(), moduleData->address, moduleData->size);
+#else
+			const ElfImage *image = mod->GetImage();
+			if(image)
+				moduleData->table = new FunctionTable(*image, moduleData->address, moduleData->size);
+#endif
+		}
+		catch(...)
+		{
+		}
+	});
+
+	return moduleData->table;
+}
+
+#ifdef WIN32
+Module::ModuleData::ModuleData(unsigned procId) : procHandle(ProcessHandleManager::Get()->GetHandle(procId)), searchBuilt(), search(nullptr),
+                                                  tableBuilt(), table(nullptr) {}
+
+Module::ModuleData::~ModuleData()
+{
+	delete table;
+	delete search;
+}
+#else
+Module::ModuleData::ModuleData(unsigned procId) : procHandle(ProcessHandleManager::Get()->GetHandle(procId)), name(), address(nullptr), size(0),
+                                                  path(), phdrs(nullptr), phdrCount(0), imageRead(), image(nullptr),
+                                                  indexBuilt(), index(nullptr), searchBuilt(), search(nullptr), tableBuilt(), table(nullptr) {}
+
+Module::ModuleData::~ModuleData()
+{
+	delete table;
+	delete search;
+	delete index;
+	delete image;
+}
+#endif
@@ -9,19 +9,25 @@
 
 #include "ModuleExplorer.h"
 #include "ProcessHandleManager.h"
-#include "RemoteThreadManager.h"
 #include <cstdint>
-#include "ProcessMemory.h"
-#include "UndocumentedStructs.h"
 #include <cctype>
 #include <algorithm>
 
 #ifdef WIN32
+# include "RemoteThreadManager.h"
+# include "ProcessMemory.h"
+# include "UndocumentedStructs.h"
 # define WIN32_LEAN_AND_MEAN
 # include <Windows.h>
 # include <Winternl.h>
 #else
-# error unimplemented
+# include "ElfImage.h"
+# include <cstdio>
+# include <cstring>
+# include <elf.h>
+# include <fcntl.h>
+# include <link.h>
+# include <unistd.h>
 #endif
 
 ModuleExplorer::ModuleExplorer(unsigned procId) : procHandle(ProcessHandleManager::Get()->GetHandle(procId))
@@ -34,7 +40,9 @@ ModuleExplorer::~ModuleExplorer()
 
 void ModuleExplorer::Update()
 {
+#ifdef WIN32
 	ProcessMemory memory(procHandle.GetProcId());
+	memory.EnableCache();   // Loader entries tend to sit together on the heap.
 
 	RemoteThreadManager::RemoteThreads threads = RemoteThreadManager(procHandle.GetProcId()).GetRemoteThreads();
 
@@ -58,20 +66,138 @@ void ModuleExplorer::Update()
 	while(curModule.BaseAddress)
 	{
 		Module mod(curModule, procHandle.GetProcId());
-
-		std::string lowerModName = mod.GetName();
-		std::transform(lowerModName.begin(), lowerModName.end(), lowerModName.begin(), std::tolower);
-		knownModules.insert(std::make_pair(lowerModName, mod));
+		knownModules.insert(std::make_pair(NormalizeName(mod.GetName()), mod));
 
 		memory.Read(curModule.InLoadOrderModuleList.Flink, curModule);
 	}
+#else
+	if(procHandle.GetProcId() == static_cast<unsigned>(getpid()))
+		dl_iterate_phdr(AddLoadedModule, this);
+	else
+		AddMappedModules();
+#endif
+}
+
+std::string ModuleExplorer::NormalizeName(std::string name)
+{
+#ifdef WIN32
+	// Windows file names aren't case sensitive.
+	std::transform(name.begin(), name.end(), name.begin(), std::tolower);
+#endif
+	return name;
 }
 
+#ifndef WIN32
+int ModuleExplorer::AddLoadedModule(dl_phdr_info *info, size_t, void *explorerPtr)
+{
+	ModuleExplorer *explorer = static_cast<ModuleExplorer*>(explorerPtr);
+	if(!info->dlpi_phnum)
+		return 0;
+
+	std::string path = info->dlpi_name ? info->dlpi_name : "";
+	if(path.empty())
+	{
+		// The main program is listed without a name.
+		char exePath[4096];
+		ssize_t len = readlink("/proc/self/exe", exePath, sizeof(exePath) - 1);
+		if(len <= 0)
+			return 0;
+
+		path.assign(exePath, static_cast<size_t>(len));
+	}
+
+	uintptr_t firstPage = 0;
+	size_t size = ElfImage::GetLoadSize(info->dlpi_phdr, info->dlpi_phnum, &firstPage);
+
+	explorer->AddModule(Module(path, reinterpret_cast<void*>(info->dlpi_addr + firstPage), static_cast<unsigned>(size),
+	                           info->dlpi_phdr, info->dlpi_phnum, explorer->procHandle.GetProcId()));
+	return 0;
+}
+
+void ModuleExplorer::AddMappedModules()
+{
+	unsigned procId = procHandle.GetProcId();
+
+	char mapsPath[64];
+	std::snprintf(mapsPath, sizeof(mapsPath), "/proc/%u/maps", procId);
+
+	FILE *maps = std::fopen(mapsPath, "r");
+	if(!maps)
+		return;
+
+	// A module is every mapping of its file, from the one of its first page to the last.
+	std::string path;
+	uintptr_t moduleStart = 0;
+	uintptr_t moduleEnd = 0;
+
+	auto addPending = [&]()
+	{
+		if(!moduleStart)
+			return;
+
+		// Plenty of files that aren't modules get mapped (locale archives, fonts, caches...).
+		char rootPath[4096 + 64];
+		std::snprintf(rootPath, sizeof(rootPath), "/proc/%u/root%s", procId, path.c_str());
+
+		unsigned char magic[SELFMAG];
+		int fd = open(rootPath, O_RDONLY | O_CLOEXEC);
+		if(fd >= 0)
+		{
+			if(pread(fd, magic, sizeof(magic), 0) == static_cast<ssize_t>(sizeof(magic)) && !std::memcmp(magic, ELFMAG, SELFMAG))
+				AddModule(Module(path, reinterpret_cast<void*>(moduleStart), static_cast<unsigned>(moduleEnd - moduleStart), nullptr, 0, procId));
+			close(fd);
+		}
+
+		moduleStart = 0;
+	};
+
+	char line[4096 + 128];
+	while(std::fgets(line, sizeof(line), maps))
+	{
+		unsigned long start, end, offset;
+		int pathPos = 0;
+		if(std::sscanf(line, "%lx-%lx %*s %lx %*s %*s %n", &start, &end, &offset, &pathPos) != 3 || !pathPos)
+			continue;
+
+		char *name = line + pathPos;
+		name[std::strcspn(name, "\n")] = '\0';
+
+		// Anonymous and special mappings ([heap], [stack]...) aren't files, and deleted files can't be read.
+		size_t nameLen = std::strlen(name);
+		static const char deleted[] = " (deleted)";
+		if(name[0] != '/' || (nameLen >= sizeof(deleted) - 1 && !std::strcmp(name + nameLen - (sizeof(deleted) - 1), deleted)))
+			continue;
+
+		if(moduleStart && path == name)
+		{
+			moduleEnd = end;
+			continue;
+		}
+
+		addPending();
+		if(!offset)
+		{
+			path = name;
+			moduleStart = start;
+			moduleEnd = end;
+		}
+	}
+	addPending();
+
+	std::fclose(maps);
+}
+
+void ModuleExplorer::AddModule(const Module& mod)
+{
+	knownModules.insert(std::make_pair(NormalizeName(mod.GetName()), mod));
+}
+#endif
+
 ModuleExplorer::Modules ModuleExplorer::GetModules(std::string nameStartsWith)
 {
 	Modules modules;
 
-	std::transform(nameStartsWith.begin(), nameStartsWith.end(), nameStartsWith.begin(), std::tolower);
+	nameStartsWith = NormalizeName(nameStartsWith);
 	for(auto it = knownModules.begin(); it != knownModules.end(); ++it)
 		if(!it->first.compare(0, nameStartsWith.size(), nameStartsWith)) 
 			modules.push_back(it->second);
@@ -0,0 +1,304 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		ModuleWatcher.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Follows modules of this process being loaded and unloaded
+ */
+
+#include "ModuleWatcher.h"
+#include <algorithm>
+
+#ifdef WIN32
+# include "UndocumentedStructs.h"
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+#else
+# include <cstddef>
+# include <link.h>
+#endif
+
+static bool ByAddress(const Module& lhs, const Module& rhs)
+{
+	return lhs.GetAddress() < rhs.GetAddress();
+}
+
+#ifdef WIN32
+namespace
+{
+	// From the WDK. Loads and unloads are both described by the same fields.
+	struct LdrDllNotificationData
+	{
+		ULONG Flags;
+		const UNICODE_STRING *FullDllName;
+		const UNICODE_STRING *BaseDllName;
+		PVOID DllBase;
+		ULONG SizeOfImage;
+	};
+
+	enum
+	{
+		LDR_DLL_NOTIFICATION_REASON_LOADED   = 1,
+		LDR_DLL_NOTIFICATION_REASON_UNLOADED = 2
+	};
+
+	typedef VOID (CALLBACK *LdrDllNotificationFunction)(ULONG reason, const LdrDllNotificationData *data, PVOID context);
+	typedef LONG (NTAPI *LdrRegisterDllNotificationPtr)(ULONG flags, LdrDllNotificationFunction notification, PVOID context, PVOID *cookie);
+	typedef LONG (NTAPI *LdrUnregisterDllNotificationPtr)(PVOID cookie);
+}
+#else
+namespace
+{
+	struct LoaderCounts
+	{
+		unsigned long long loads;
+		unsigned long long unloads;
+	};
+
+	int ReadLoaderCounts(dl_phdr_info *info, size_t size, void *countsPtr)
+	{
+		LoaderCounts *counts = static_cast<LoaderCounts*>(countsPtr);
+		if(size >= offsetof(dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs))
+		{
+			counts->loads = info->dlpi_adds;
+			counts->unloads = info->dlpi_subs;
+		}
+
+		// The counts are the same for every module, so one is enough.
+		return 1;
+	}
+
+	int ReadDebugEntry(dl_phdr_info *info, size_t, void *debugPtr)
+	{
+		// The main program comes first. The loader writes where its r_debug is into the
+		// program's DT_DEBUG entry, for debuggers.
+		for(unsigned i=0; i<info->dlpi_phnum; ++i)
+		{
+			if(info->dlpi_phdr[i].p_type != PT_DYNAMIC)
+				continue;
+
+			const ElfW(Dyn) *dynamic = reinterpret_cast<const ElfW(Dyn)*>(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+			for(; dynamic->d_tag != DT_NULL; ++dynamic)
+				if(dynamic->d_tag == DT_DEBUG)
+					*static_cast<const r_debug**>(debugPtr) = reinterpret_cast<const r_debug*>(dynamic->d_un.d_ptr);
+		}
+
+		return 1;
+	}
+
+	const r_debug *FindLoaderDebug()
+	{
+		// _r_debug itself may be the program's own copy of it, made when the program was
+		// relocated and never updated after.
+		const r_debug *found = nullptr;
+		dl_iterate_phdr(ReadDebugEntry, &found);
+		return found ? found : &_r_debug;
+	}
+
+	const r_debug *GetLoaderDebug()
+	{
+		static const r_debug *debug = FindLoaderDebug();
+		return debug;
+	}
+}
+#endif
+
+#ifdef WIN32
+ModuleWatcher::ModuleWatcher() : modules(), listeners(), nextListenerId(1), lock(), notificationCookie(nullptr)
+#else
+ModuleWatcher::ModuleWatcher() : modules(), listeners(), nextListenerId(1), lock(), loads(0), unloads(0)
+#endif
+{
+	std::lock_guard<std::recursive_mutex> guard(lock);
+
+#ifdef WIN32
+	// Register before listing, so nothing loaded in between is missed. Anything listed and
+	// notified about both is only added once.
+	HMODULE ntdll = GetModuleHandleA("ntdll.dll");
+	LdrRegisterDllNotificationPtr registerNotification = reinterpret_cast<LdrRegisterDllNotificationPtr>(GetProcAddress(ntdll, "LdrRegisterDllNotification"));
+	if(registerNotification)
+		registerNotification(0, reinterpret_cast<LdrDllNotificationFunction>(LoaderNotification), this, &notificationCookie);
+#else
+	LoaderCounts counts = { 0, 0 };
+	dl_iterate_phdr(ReadLoaderCounts, &counts);
+	loads = counts.loads;
+	unloads = counts.unloads;
+#endif
+
+	try
+	{
+		modules = ModuleExplorer().GetModules();
+	}
+	catch(...)
+	{
+	}
+
+	std::sort(modules.begin(), modules.end(), ByAddress);
+}
+
+ModuleWatcher::~ModuleWatcher()
+{
+#ifdef WIN32
+	HMODULE ntdll = GetModuleHandleA("ntdll.dll");
+	LdrUnregisterDllNotificationPtr unregisterNotification = reinterpret_cast<LdrUnregisterDllNotificationPtr>(GetProcAddress(ntdll, "LdrUnregisterDllNotification"));
+	if(notificationCookie && unregisterNotification)
+		unregisterNotification(notificationCookie);
+#endif
+}
+
+ModuleWatcher* ModuleWatcher::Get()
+{
+	// Never destroyed. Listeners unregister from destructors of their own statics, which can run
+	// after a static watcher's, and modules are still unloaded during exit.
+	static ModuleWatcher *watcher = new ModuleWatcher();
+
+	return watcher;
+}
+
+unsigned ModuleWatcher::AddListener(const Listener& listener)
+{
+	std::lock_guard<std::recursive_mutex> guard(lock);
+
+	unsigned id = nextListenerId++;
+	listeners.insert(std::make_pair(id, listener));
+	return id;
+}
+
+void ModuleWatcher::RemoveListener(unsigned id)
+{
+	std::lock_guard<std::recursive_mutex> guard(lock);
+	listeners.erase(id);
+}
+
+void ModuleWatcher::Refresh()
+{
+	std::lock_guard<std::recursive_mutex> guard(lock);
+
+#ifndef WIN32
+	LoaderCounts counts = { 0, 0 };
+	dl_iterate_phdr(ReadLoaderCounts, &counts);
+	if(counts.loads == loads && counts.unloads == unloads && counts.loads)
+		return;
+
+	loads = counts.loads;
+	unloads = counts.unloads;
+#endif
+
+	ModuleExplorer::Modules current;
+	try
+	{
+		current = ModuleExplorer().GetModules();
+	}
+	catch(...)
+	{
+		return;
+	}
+
+	std::sort(current.begin(), current.end(), ByAddress);
+
+	// Walk both lists in address order. A module at the same address under the same name is
+	// taken to be the same one.
+	ModuleExplorer::Modules loaded, unloaded;
+	auto oldIt = modules.begin();
+	auto newIt = current.begin();
+	while(oldIt != modules.end() || newIt != current.end())
+	{
+		if(newIt == current.end() || (oldIt != modules.end() && oldIt->GetAddress() < newIt->GetAddress()))
+			unloaded.push_back(*oldIt++);
+		else if(oldIt == modules.end() || newIt->GetAddress() < oldIt->GetAddress())
+			loaded.push_back(*newIt++);
+		else
+		{
+			if(oldIt->GetName() != newIt->GetName())
+			{
+				unloaded.push_back(*oldIt);
+				loaded.push_back(*newIt);
+			}
+
+			++oldIt;
+			++newIt;
+		}
+	}
+
+	if(!loaded.empty() || !unloaded.empty())
+		Apply(loaded, unloaded);
+}
+
+void ModuleWatcher::Apply(const ModuleExplorer::Modules& loaded, const ModuleExplorer::Modules& unloaded)
+{
+	for(auto it = unloaded.begin(); it != unloaded.end(); ++it)
+	{
+		auto modIt = std::lower_bound(modules.begin(), modules.end(), *it, ByAddress);
+		if(modIt != modules.end() && modIt->GetAddress() == it->GetAddress())
+			modules.erase(modIt);
+	}
+
+	for(auto it = loaded.begin(); it != loaded.end(); ++it)
+		modules.insert(std::upper_bound(modules.begin(), modules.end(), *it, ByAddress), *it);
+
+	// A listener may remove itself, or others, as it's told.
+	Listeners toCall = listeners;
+	for(auto it = toCall.begin(); it != toCall.end(); ++it)
+		if(listeners.count(it->first))
+			it->second(loaded, unloaded);
+}
+
+void ModuleWatcher::Lock()
+{
+	lock.lock();
+}
+
+void ModuleWatcher::Unlock()
+{
+	lock.unlock();
+}
+
+const ModuleExplorer::Modules& ModuleWatcher::GetModules() const
+{
+	return modules;
+}
+
+#ifdef WIN32
+void __stdcall ModuleWatcher::LoaderNotification(unsigned long reason, const void *dataPtr, void *context)
+{
+	ModuleWatcher *watcher = static_cast<ModuleWatcher*>(context);
+	const LdrDllNotificationData *data = static_cast<const LdrDllNotificationData*>(dataPtr);
+
+	std::lock_guard<std::recursive_mutex> guard(watcher->lock);
+
+	auto modIt = std::lower_bound(watcher->modules.begin(), watcher->modules.end(), data->DllBase, [](const Module& lhs, const void *rhs)
+	{
+		return lhs.GetAddress() < rhs;
+	});
+	bool known = modIt != watcher->modules.end() && modIt->GetAddress() == data->DllBase;
+
+	ModuleExplorer::Modules loaded, unloaded;
+	if(reason == LDR_DLL_NOTIFICATION_REASON_LOADED && !known)
+	{
+		// The loader's module record isn't passed, but the fields Module uses are.
+		WIN_LDR_MODULE record = {};
+		record.BaseAddress = data->DllBase;
+		record.SizeOfImage = data->SizeOfImage;
+		record.FullDllName = *data->FullDllName;
+		record.BaseDllName = *data->BaseDllName;
+
+		loaded.push_back(Module(record, 0));
+	}
+	else if(reason == LDR_DLL_NOTIFICATION_REASON_UNLOADED && known)
+		unloaded.push_back(*modIt);
+
+	if(!loaded.empty() || !unloaded.empty())
+		watcher->Apply(loaded, unloaded);
+}
+#else
+void *ModuleWatcher::GetLoaderBreakpoint()
+{
+	return reinterpret_cast<void*>(GetLoaderDebug()->r_brk);
+}
+
+bool ModuleWatcher::IsLoaderConsistent()
+{
+	return GetLoaderDebug()->r_state == r_debug::RT_CONSISTENT;
+}
+#endif
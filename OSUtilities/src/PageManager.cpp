@@ -38,7 +38,7 @@ static unsigned GetSystemPageSize()
 PageManager::PageManager(unsigned size, bool extraPage, unsigned procId) : pageSize(0), virtualPageSize(0), 
 	                                                                       extraPage(extraPage), 
 																		   procHandle(ProcessHandleManager::Get()->GetHandle(procId)), 
-																		   pages(), freePages()
+																		   pages(), freePages(), regions()
 {
 	if(!procHandle.EnsureRights(PROCESS_VM_OPERATION))
 		throw std::exception();
@@ -63,14 +63,17 @@ PageManager::PageManager(unsigned size, bool extraPage, unsigned procId) : pageS
 PageManager::~PageManager()
 {
 	for(VirtualPages::iterator vIt=pages.begin(); vIt != pages.end(); ++vIt)
-		FreePage(vIt->front());
+		FreePage(vIt->front(), virtualPageSize);
+
+	for(Regions::iterator regionIt=regions.begin(); regionIt != regions.end(); ++regionIt)
+		FreePage(regionIt->first, regionIt->second);
 }
 
 void* PageManager::RequestPage(void *nearAddr)
 {
 	if(freePages.empty())
 	{
-		uint8_t *mem = AllocatePageNear(nearAddr);
+		uint8_t *mem = AllocatePageNear(nearAddr, virtualPageSize);
 
 		if(!mem)
 			return NULL;
@@ -118,6 +121,35 @@ void PageManager::ReturnPage(void *page)
 #endif
 }
 
+void* PageManager::RequestRegion(unsigned size, void *nearAddr)
+{
+	unsigned regionSize = GetRegionSize(size);
+
+	uint8_t *region = AllocatePageNear(nearAddr, regionSize);
+	if(!region)
+		return NULL;
+
+	regions.insert(std::make_pair(region, regionSize));
+
+	return region;
+}
+
+void PageManager::ReturnRegion(void *region)
+{
+	Regions::iterator regionIt = regions.find(reinterpret_cast<uint8_t*>(region));
+	if(regionIt == regions.end())
+		return;
+
+	FreePage(regionIt->first, regionIt->second);
+	regions.erase(regionIt);
+}
+
+unsigned PageManager::GetRegionSize(unsigned size) const
+{
+	// Reservations are made in virtual page units anyway, so hand the whole thing out.
+	return size + (virtualPageSize - 1) - ((size + (virtualPageSize - 1)) % virtualPageSize);
+}
+
 void PageManager::ReleaseEmptyPages()
 {
 	for(VirtualPages::iterator vIt = pages.begin(); vIt != pages.end();)
@@ -132,7 +164,7 @@ void PageManager::ReleaseEmptyPages()
 			for(Pages::iterator it = vIt->begin(); it != vIt->end() && !commitedPage; ++it)
 				freePages.erase(std::find(freePages.begin(), freePages.end(), *it));
 
-			FreePage(vIt->front());
+			FreePage(vIt->front(), virtualPageSize);
 
 			vIt = pages.erase(vIt);
 		}
@@ -183,7 +215,7 @@ uint8_t *PageManager::PageAlign(void *addr)
 	return reinterpret_cast<uint8_t*>(addrVal);
 }
 
-uint8_t *PageManager::AllocatePageNear(void *nearVoid)
+uint8_t *PageManager::AllocatePageNear(void *nearVoid, unsigned size)
 {
 	uint8_t *nearPage = PageManager::PageAlign(nearVoid);
 
@@ -201,37 +233,38 @@ uint8_t *PageManager::AllocatePageNear(void *nearVoid)
 		unsigned offset = virtualPageSize;
 		do
 		{
-			uint8_t *mem = AllocatePage(nearPage + offset);
+			uint8_t *mem = AllocatePage(nearPage + offset, size);
 			if(mem)
 			{
 				if(std::abs(nearPage - mem) < (1u<<31) - 1)
 					return mem;
 				else
-					FreePage(mem);
+					FreePage(mem, size);
 			}
 
 			offset += virtualPageSize;
 		} while(attempts++ < maxEffort);
 	}
 
-	return AllocatePage(NULL);
+	return AllocatePage(NULL, size);
 }
 
-uint8_t *PageManager::AllocatePage(void *addr)
+uint8_t *PageManager::AllocatePage(void *addr, unsigned size)
 {
 #ifdef WIN32
-	return reinterpret_cast<uint8_t*>(VirtualAllocEx(procHandle, addr, virtualPageSize, MEM_RESERVE, PAGE_NOACCESS));
+	return reinterpret_cast<uint8_t*>(VirtualAllocEx(procHandle, addr, size, MEM_RESERVE, PAGE_NOACCESS));
 #else
-	return reinterpret_cast<uint8_t*>(mmap(addr, virtualPageSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_UNINITIALIZED, -1, 0));
+	return reinterpret_cast<uint8_t*>(mmap(addr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_UNINITIALIZED, -1, 0));
 #endif
 }
 
-void PageManager::FreePage(void *addr)
+void PageManager::FreePage(void *addr, unsigned size)
 {
 #ifdef WIN32
+	(void)size;
 	VirtualFreeEx(procHandle, addr, 0, MEM_RELEASE);
 #else
-	munmap(addr, virtualPageSize);
+	munmap(addr, size);
 #endif
 }
 
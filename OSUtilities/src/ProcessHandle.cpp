@@ -12,20 +12,21 @@
 #ifdef WIN32
 # include <Windows.h>
 #else
-# error "Unsupported os"
+# include <unistd.h>
 #endif
 
-ProcessHandle::ProcessHandle(unsigned procId) : data(new Data), refs(new unsigned)
+ProcessHandle::ProcessHandle(unsigned procId) : data(new Data), refs(new std::atomic<unsigned>(1))
 {
-	*refs = 1;
-
 	data->rights = procId ? 0 : ~0u;
 	data->isX86 = false;
 #ifdef WIN32
 	data->processId = procId ? procId : GetCurrentProcessId();
 	data->handle = procId ? OpenProcess(data->rights, false, procId) : GetCurrentProcess();
 #else
-
+	// There are no process handles. Access is checked by each operation instead.
+	data->rights = ~0u;
+	data->processId = procId ? procId : static_cast<unsigned>(getpid());
+	data->handle = nullptr;
 #endif
 }
 
@@ -9,7 +9,7 @@
 
 #include "ProcessHandleManager.h"
 
-ProcessHandleManager::ProcessHandleManager() : procIdHandles()
+ProcessHandleManager::ProcessHandleManager() : procIdHandles(), lock()
 {
 
 }
@@ -28,6 +28,8 @@ ProcessHandleManager* ProcessHandleManager::Get()
 
 ProcessHandle ProcessHandleManager::GetHandle(unsigned procId)
 {
+	std::lock_guard<std::mutex> guard(lock);
+
 	auto handleIt = procIdHandles.find(procId);
 	if(handleIt == procIdHandles.end())
 	{
@@ -9,16 +9,41 @@
 
 #include "ProcessMemory.h"
 #include "ProcessHandleManager.h"
+#include <algorithm>
+#include <exception>
+#include <vector>
 #include <cstring>
+#include <cstdint>
 
 #ifdef WIN32
 # define WIN32_LEAN_AND_MEAN
 # include <Windows.h>
 #else
-# error unimplemented
+# include <sstream>
+# include <climits>
+# include <cerrno>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/uio.h>
+# ifndef IOV_MAX
+#  define IOV_MAX 1024
+# endif
 #endif
 
-ProcessMemory::ProcessMemory(unsigned procId) : memory(procId == GetCurrentProcessId() ? (Memory*)new LocalMemory() : (Memory*)new RemoteMemory(procId))
+namespace
+{
+	bool IsCurrentProcess(unsigned procId)
+	{
+#ifdef WIN32
+		return procId == GetCurrentProcessId();
+#else
+		return procId == static_cast<unsigned>(getpid());
+#endif
+	}
+}
+
+ProcessMemory::ProcessMemory(unsigned procId, bool checked) : memory(IsCurrentProcess(procId) && !checked ? (Memory*)new LocalMemory() : (Memory*)new RemoteMemory(procId)),
+                                                              cache(nullptr)
 {
 }
 
@@ -37,7 +62,81 @@ void ProcessMemory::Read(const void *addr, void* val, unsigned size)
 	memory->Read(addr, val, size);
 }
 
+void ProcessMemory::WriteV(const WriteRange *ranges, unsigned count)
+{
+	memory->WriteV(ranges, count);
+}
+
+void ProcessMemory::ReadV(const ReadRange *ranges, unsigned count)
+{
+	memory->ReadV(ranges, count);
+}
+
+void ProcessMemory::EnableCache(unsigned blockSize, unsigned blockCount)
+{
+	if((blockSize != 4096 && blockSize != 65536) || blockCount < 16)
+		throw std::exception();
+
+	DisableCache();
+	cache = new CachedMemory(memory, blockSize, blockCount);
+	memory = cache;
+}
+
+void ProcessMemory::DisableCache()
+{
+	if(!cache)
+		return;
+
+	memory = cache->Release();
+	delete cache;
+	cache = nullptr;
+}
+
+bool ProcessMemory::IsCacheEnabled() const
+{
+	return cache != nullptr;
+}
+
+void ProcessMemory::Invalidate(const void *addr, size_t size)
+{
+	if(cache && size)
+		cache->Invalidate(reinterpret_cast<uintptr_t>(addr), reinterpret_cast<uintptr_t>(addr) + size);
+}
+
+void ProcessMemory::InvalidateAll()
+{
+	if(cache)
+		cache->InvalidateAll();
+}
+
+void ProcessMemory::SetImmutable(const void *addr, size_t size)
+{
+	if(cache && size)
+		cache->SetImmutable(reinterpret_cast<uintptr_t>(addr), reinterpret_cast<uintptr_t>(addr) + size);
+}
+
+ProcessMemory::CacheStats ProcessMemory::GetCacheStats() const
+{
+	if(cache)
+		return cache->GetStats();
+
+	CacheStats none = {};
+	return none;
+}
+
+void ProcessMemory::Memory::WriteV(const WriteRange *ranges, unsigned count)
+{
+	for(unsigned i=0; i<count; ++i)
+		Write(ranges[i].addr, ranges[i].val, ranges[i].size);
+}
+
+void ProcessMemory::Memory::ReadV(const ReadRange *ranges, unsigned count)
+{
+	for(unsigned i=0; i<count; ++i)
+		Read(ranges[i].addr, ranges[i].val, ranges[i].size);
+}
 
+#ifdef WIN32
 ProcessMemory::RemoteMemory::RemoteMemory(unsigned procId) : procHandle(ProcessHandleManager::Get()->GetHandle(procId))
 {
 	if(!procHandle.EnsureRights(PROCESS_VM_WRITE | PROCESS_VM_READ))
@@ -53,6 +152,156 @@ void ProcessMemory::RemoteMemory::Read(const void *addr, void* val, unsigned siz
 {
 	ReadProcessMemory(procHandle, addr, val, size, NULL);
 }
+#else
+ProcessMemory::RemoteMemory::RemoteMemory(unsigned procId) : procHandle(ProcessHandleManager::Get()->GetHandle(procId)), memFd(-1)
+{
+}
+
+ProcessMemory::RemoteMemory::~RemoteMemory()
+{
+	if(memFd >= 0)
+		close(memFd);
+}
+
+void ProcessMemory::RemoteMemory::Write(void *addr, const void* val, unsigned size)
+{
+	WriteRange range = { addr, val, size };
+	WriteV(&range, 1);
+}
+
+void ProcessMemory::RemoteMemory::Read(const void *addr, void* val, unsigned size)
+{
+	ReadRange range = { addr, val, size };
+	ReadV(&range, 1);
+}
+
+void ProcessMemory::RemoteMemory::WriteV(const WriteRange *ranges, unsigned count)
+{
+	std::vector<iovec> local(std::min<unsigned>(count, IOV_MAX)), remote(local.size());
+	while(count)
+	{
+		unsigned batch = std::min<unsigned>(count, IOV_MAX);
+		for(unsigned i=0; i<batch; ++i)
+		{
+			local[i].iov_base  = const_cast<void*>(ranges[i].val);
+			local[i].iov_len   = ranges[i].size;
+			remote[i].iov_base = ranges[i].addr;
+			remote[i].iov_len  = ranges[i].size;
+		}
+
+		ssize_t result = process_vm_writev(procHandle.GetProcId(), local.data(), batch, remote.data(), batch, 0);
+		size_t moved = result > 0 ? static_cast<size_t>(result) : 0;
+
+		// It stops at the first range it can't write in full. That one is finished through
+		// /proc/pid/mem, and the batch picks up after it.
+		unsigned done = 0;
+		for(; done < batch && moved >= ranges[done].size; ++done)
+			moved -= ranges[done].size;
+
+		if(done < batch)
+		{
+			WriteMem(static_cast<uint8_t*>(ranges[done].addr) + moved, static_cast<const uint8_t*>(ranges[done].val) + moved,
+			         ranges[done].size - static_cast<unsigned>(moved));
+			++done;
+		}
+
+		ranges += done;
+		count -= done;
+	}
+}
+
+void ProcessMemory::RemoteMemory::ReadV(const ReadRange *ranges, unsigned count)
+{
+	std::vector<iovec> local(std::min<unsigned>(count, IOV_MAX)), remote(local.size());
+	while(count)
+	{
+		unsigned batch = std::min<unsigned>(count, IOV_MAX);
+		for(unsigned i=0; i<batch; ++i)
+		{
+			local[i].iov_base  = ranges[i].val;
+			local[i].iov_len   = ranges[i].size;
+			remote[i].iov_base = const_cast<void*>(ranges[i].addr);
+			remote[i].iov_len  = ranges[i].size;
+		}
+
+		ssize_t result = process_vm_readv(procHandle.GetProcId(), local.data(), batch, remote.data(), batch, 0);
+		size_t moved = result > 0 ? static_cast<size_t>(result) : 0;
+
+		unsigned done = 0;
+		for(; done < batch && moved >= ranges[done].size; ++done)
+			moved -= ranges[done].size;
+
+		if(done < batch)
+		{
+			ReadMem(static_cast<const uint8_t*>(ranges[done].addr) + moved, static_cast<uint8_t*>(ranges[done].val) + moved,
+			        ranges[done].size - static_cast<unsigned>(moved));
+			++done;
+		}
+
+		ranges += done;
+		count -= done;
+	}
+}
+
+int ProcessMemory::RemoteMemory::GetMemFd()
+{
+	if(memFd >= 0)
+		return memFd;
+
+	std::ostringstream path;
+	path << "/proc/" << procHandle.GetProcId() << "/mem";
+
+	memFd = open(path.str().c_str(), O_RDWR | O_CLOEXEC);
+	if(memFd < 0)
+		memFd = open(path.str().c_str(), O_RDONLY | O_CLOEXEC);
+	if(memFd < 0)
+		throw std::exception();
+
+	return memFd;
+}
+
+void ProcessMemory::RemoteMemory::WriteMem(void *addr, const void *val, unsigned size)
+{
+	int fd = GetMemFd();
+	const uint8_t *from = static_cast<const uint8_t*>(val);
+	uintptr_t to = reinterpret_cast<uintptr_t>(addr);
+	while(size)
+	{
+		ssize_t written = pwrite(fd, from, size, static_cast<off_t>(to));
+		if(written <= 0)
+		{
+			if(written < 0 && errno == EINTR)
+				continue;
+			throw std::exception();
+		}
+
+		from += written;
+		to += written;
+		size -= static_cast<unsigned>(written);
+	}
+}
+
+void ProcessMemory::RemoteMemory::ReadMem(const void *addr, void *val, unsigned size)
+{
+	int fd = GetMemFd();
+	uint8_t *to = static_cast<uint8_t*>(val);
+	uintptr_t from = reinterpret_cast<uintptr_t>(addr);
+	while(size)
+	{
+		ssize_t got = pread(fd, to, size, static_cast<off_t>(from));
+		if(got <= 0)
+		{
+			if(got < 0 && errno == EINTR)
+				continue;
+			throw std::exception();
+		}
+
+		to += got;
+		from += got;
+		size -= static_cast<unsigned>(got);
+	}
+}
+#endif
 
 void ProcessMemory::LocalMemory::Write(void *addr, const void* val, unsigned size)
 {
@@ -63,3 +312,344 @@ void ProcessMemory::LocalMemory::Read(const void *addr, void* val, unsigned size
 {
 	std::memcpy(val, addr, size);
 }
+
+ProcessMemory::CachedMemory::CachedMemory(Memory *memory, unsigned blockSize, unsigned blockCount) : memory(memory), blockSize(blockSize),
+	                                                                                                  blockCount(blockCount),
+	                                                                                                  storage(static_cast<size_t>(blockSize) * blockCount),
+	                                                                                                  nextSequential(0), prefetch(0), stats()
+{
+	blockMap.reserve(blockCount);
+}
+
+ProcessMemory::CachedMemory::~CachedMemory()
+{
+	delete memory;
+}
+
+ProcessMemory::Memory *ProcessMemory::CachedMemory::Release()
+{
+	Memory *released = memory;
+	memory = nullptr;
+	return released;
+}
+
+const ProcessMemory::CacheStats& ProcessMemory::CachedMemory::GetStats() const
+{
+	return stats;
+}
+
+void ProcessMemory::CachedMemory::Write(void *addr, const void* val, unsigned size)
+{
+	WriteRange range = { addr, val, size };
+	WriteV(&range, 1);
+}
+
+void ProcessMemory::CachedMemory::Read(const void *addr, void* val, unsigned size)
+{
+	ReadRange range = { addr, val, size };
+	ReadV(&range, 1);
+}
+
+void ProcessMemory::CachedMemory::WriteV(const WriteRange *ranges, unsigned count)
+{
+	++stats.writes;
+	try
+	{
+		memory->WriteV(ranges, count);
+	}
+	catch(...)
+	{
+		// Some of it may have been written, so none of it can be trusted.
+		for(unsigned i=0; i<count; ++i)
+			if(ranges[i].size)
+				Invalidate(reinterpret_cast<uintptr_t>(ranges[i].addr), reinterpret_cast<uintptr_t>(ranges[i].addr) + ranges[i].size);
+		throw;
+	}
+
+	for(unsigned i=0; i<count; ++i)
+		Update(reinterpret_cast<uintptr_t>(ranges[i].addr), ranges[i].val, ranges[i].size);
+}
+
+void ProcessMemory::CachedMemory::ReadV(const ReadRange *ranges, unsigned count)
+{
+	// Blocks that have to be fetched, and reads too large to be worth caching.
+	std::vector<uintptr_t> missing;
+	std::vector<ReadRange> direct;
+	size_t needed = 0;
+	for(unsigned i=0; i<count; ++i)
+	{
+		uintptr_t addr = reinterpret_cast<uintptr_t>(ranges[i].addr);
+		if(!ranges[i].size)
+			continue;
+
+		if(!IsCacheable(addr, ranges[i].size))
+		{
+			direct.push_back(ranges[i]);
+			continue;
+		}
+
+		uintptr_t first = addr & ~(blockSize - 1), end = addr + ranges[i].size;
+		for(uintptr_t block = first; block < end && block >= first; block += blockSize)
+		{
+			auto found = blockMap.find(block);
+			if(found == blockMap.end())
+			{
+				missing.push_back(block);
+				continue;
+			}
+
+			// Used now, so fetching the rest won't evict it.
+			blocks.splice(blocks.begin(), blocks, found->second);
+			++stats.hits;
+			++needed;
+		}
+	}
+
+	std::sort(missing.begin(), missing.end());
+	missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+	needed += missing.size();
+
+	if(needed > blockCount)
+	{
+		// More than the cache holds at once.
+		++stats.fetches;
+		memory->ReadV(ranges, count);
+		return;
+	}
+
+	if(!missing.empty() || !direct.empty())
+	{
+		size_t requested = missing.size();
+		stats.misses += requested;
+
+		if(requested)
+		{
+			// Reads carrying on from the last fetch are likely to carry on further.
+			prefetch = missing.front() == nextSequential ? std::min(prefetch ? prefetch * 2 : 1, static_cast<unsigned>(MAX_PREFETCH)) : 0;
+
+			uintptr_t block = missing.back();
+			for(unsigned i=0; i<prefetch && needed < blockCount; ++i, ++needed)
+			{
+				block += blockSize;
+				if(!block || blockMap.count(block))
+					break;
+
+				missing.push_back(block);
+			}
+		}
+
+		// Blocks past the end of a mapping can't be read. Without them, or failing that
+		// without the cache at all, the read may still work.
+		bool fetched = Fetch(missing, direct);
+		if(!fetched && missing.size() > requested)
+		{
+			missing.resize(requested);
+			fetched = Fetch(missing, direct);
+		}
+
+		if(!fetched)
+		{
+			// Some block can't be read whole. Once it's known which, reads of it go straight
+			// to the process, and the rest can still be cached.
+			prefetch = 0;
+			bool found = false;
+			for(size_t i=0; i<requested; ++i)
+			{
+				if(!Fetch(std::vector<uintptr_t>(1, missing[i]), std::vector<ReadRange>()))
+				{
+					unreadable.insert(missing[i]);
+					found = true;
+				}
+			}
+
+			if(found)
+				ReadV(ranges, count);
+			else
+			{
+				++stats.fetches;
+				memory->ReadV(ranges, count);
+			}
+			return;
+		}
+
+		stats.prefetches += missing.size() - requested;
+		if(!missing.empty())
+			nextSequential = missing.back() + blockSize;
+	}
+
+	for(unsigned i=0; i<count; ++i)
+	{
+		if(!ranges[i].size || !IsCacheable(reinterpret_cast<uintptr_t>(ranges[i].addr), ranges[i].size))
+			continue;
+
+		uintptr_t addr = reinterpret_cast<uintptr_t>(ranges[i].addr);
+		uint8_t *to = static_cast<uint8_t*>(ranges[i].val);
+		unsigned left = ranges[i].size;
+		while(left)
+		{
+			uintptr_t offset = addr & (blockSize - 1);
+			unsigned part = static_cast<unsigned>(std::min<uintptr_t>(left, blockSize - offset));
+			std::memcpy(to, blockMap.find(addr - offset)->second->data + offset, part);
+
+			addr += part;
+			to += part;
+			left -= part;
+		}
+	}
+}
+
+bool ProcessMemory::CachedMemory::IsCacheable(uintptr_t addr, unsigned size) const
+{
+	if(size > blockSize * MAX_READ_BLOCKS)
+		return false;
+
+	if(unreadable.empty())
+		return true;
+
+	uintptr_t first = addr & ~(blockSize - 1), end = addr + size;
+	for(uintptr_t block = first; block < end && block >= first; block += blockSize)
+		if(unreadable.count(block))
+			return false;
+
+	return true;
+}
+
+bool ProcessMemory::CachedMemory::Fetch(const std::vector<uintptr_t>& missing, const std::vector<ReadRange>& direct)
+{
+	// Runs of neighbouring blocks are read as one range, then shared out.
+	std::vector<uint8_t> fetched(missing.size() * blockSize);
+	std::vector<ReadRange> reads(direct);
+	for(size_t i=0; i<missing.size();)
+	{
+		size_t run = 1;
+		while(i + run < missing.size() && missing[i + run] == missing[i] + run * blockSize)
+			++run;
+
+		ReadRange range = { reinterpret_cast<const void*>(missing[i]), &fetched[i * blockSize], static_cast<unsigned>(run * blockSize) };
+		reads.push_back(range);
+		i += run;
+	}
+
+	++stats.fetches;
+	try
+	{
+		memory->ReadV(reads.data(), static_cast<unsigned>(reads.size()));
+	}
+	catch(...)
+	{
+		return false;
+	}
+
+	for(size_t i=0; i<missing.size(); ++i)
+	{
+		Block block = { missing[i], nullptr };
+		if(!unused.empty())
+		{
+			block.data = unused.back();
+			unused.pop_back();
+		}
+		else if(blocks.size() < blockCount)
+			block.data = &storage[blocks.size() * blockSize];
+		else
+		{
+			block.data = blocks.back().data;
+			blockMap.erase(blocks.back().addr);
+			blocks.pop_back();
+			++stats.evictions;
+		}
+
+		std::memcpy(block.data, &fetched[i * blockSize], blockSize);
+		blocks.push_front(block);
+		blockMap[block.addr] = blocks.begin();
+	}
+
+	return true;
+}
+
+void ProcessMemory::CachedMemory::Update(uintptr_t addr, const void *val, unsigned size)
+{
+	const uint8_t *from = static_cast<const uint8_t*>(val);
+	while(size)
+	{
+		uintptr_t offset = addr & (blockSize - 1);
+		unsigned part = static_cast<unsigned>(std::min<uintptr_t>(size, blockSize - offset));
+
+		auto found = blockMap.find(addr - offset);
+		if(found != blockMap.end())
+			std::memcpy(found->second->data + offset, from, part);
+
+		addr += part;
+		from += part;
+		size -= part;
+	}
+}
+
+void ProcessMemory::CachedMemory::Drop(Blocks::iterator block)
+{
+	unused.push_back(block->data);
+	blockMap.erase(block->addr);
+	blocks.erase(block);
+	++stats.invalidations;
+}
+
+void ProcessMemory::CachedMemory::Invalidate(uintptr_t begin, uintptr_t end)
+{
+	for(auto it = unreadable.begin(); it != unreadable.end();)
+	{
+		if(*it + blockSize > begin && *it < end)
+			it = unreadable.erase(it);
+		else
+			++it;
+	}
+
+	uintptr_t first = begin & ~(blockSize - 1);
+	if((end - first) / blockSize <= blockMap.size())
+	{
+		for(uintptr_t block = first; block < end && block >= first; block += blockSize)
+		{
+			auto found = blockMap.find(block);
+			if(found != blockMap.end())
+				Drop(found->second);
+		}
+	}
+	else
+	{
+		for(auto it = blockMap.begin(); it != blockMap.end();)
+		{
+			Blocks::iterator block = (it++)->second;
+			if(block->addr + blockSize > begin && block->addr < end)
+				Drop(block);
+		}
+	}
+
+	nextSequential = 0;
+	prefetch = 0;
+}
+
+void ProcessMemory::CachedMemory::InvalidateAll()
+{
+	for(auto it = blockMap.begin(); it != blockMap.end();)
+	{
+		Blocks::iterator block = (it++)->second;
+		if(!IsImmutable(block->addr))
+			Drop(block);
+	}
+
+	unreadable.clear();
+	nextSequential = 0;
+	prefetch = 0;
+}
+
+void ProcessMemory::CachedMemory::SetImmutable(uintptr_t begin, uintptr_t end)
+{
+	immutable.push_back(std::make_pair(begin, end));
+}
+
+bool ProcessMemory::CachedMemory::IsImmutable(uintptr_t block) const
+{
+	for(auto it = immutable.begin(); it != immutable.end(); ++it)
+		if(block >= it->first && block + blockSize <= it->second)
+			return true;
+
+	return false;
+}
@@ -0,0 +1,205 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		RemoteGraph.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Copies structures of pointers out of a process, a level at a time
+ */
+
+#include "RemoteGraph.h"
+#include <algorithm>
+#include <exception>
+#include <cstring>
+
+RemoteGraph::RemoteGraph(unsigned procId) : memory(procId, true), types(), nodes(), storage(), index(), pointerSize(sizeof(void*)),
+                                            maxDepth(~0u), maxNodes(NOT_FOUND), stats()
+{
+}
+
+unsigned RemoteGraph::AddType(size_t size)
+{
+	if(!size)
+		throw std::exception();
+
+	Type type;
+	type.size = size;
+	types.push_back(type);
+	return static_cast<unsigned>(types.size() - 1);
+}
+
+void RemoteGraph::AddEdge(unsigned type, size_t offset, unsigned target)
+{
+	if(type >= types.size() || target >= types.size() || offset + pointerSize > types[type].size)
+		throw std::exception();
+
+	Edge edge = { offset, target, 0, 0 };
+	types[type].edges.push_back(edge);
+}
+
+void RemoteGraph::AddArrayEdge(unsigned type, size_t offset, unsigned target, size_t countOffset, unsigned countSize)
+{
+	if(type >= types.size() || target >= types.size() || offset + pointerSize > types[type].size ||
+	   (countSize != 1 && countSize != 2 && countSize != 4 && countSize != 8) || countOffset + countSize > types[type].size)
+		throw std::exception();
+
+	Edge edge = { offset, target, countOffset, countSize };
+	types[type].edges.push_back(edge);
+}
+
+void RemoteGraph::SetPointerSize(unsigned size)
+{
+	if(size != 4 && size != 8)
+		throw std::exception();
+
+	pointerSize = size;
+}
+
+void RemoteGraph::SetLimits(unsigned maxDepth, size_t maxNodes)
+{
+	this->maxDepth = maxDepth;
+	this->maxNodes = maxNodes;
+}
+
+void RemoteGraph::Walk(const void *root, unsigned type)
+{
+	if(type >= types.size())
+		throw std::exception();
+
+	nodes.clear();
+	storage.clear();
+	index.clear();
+	stats = Stats();
+
+	std::vector<Pending> pending;
+	Queue(pending, root, type, 1, NOT_FOUND);
+
+	// A level is placed, read with one ReadV, and then searched for the next.
+	while(!pending.empty())
+	{
+		size_t first = nodes.size();
+		for(auto it = pending.begin(); it != pending.end(); ++it)
+		{
+			size_t offset = (storage.size() + NODE_ALIGN - 1) & ~(NODE_ALIGN - 1);
+			Node node = { it->address, it->type, it->count, it->parent == NOT_FOUND ? 0 : nodes[it->parent].depth + 1, it->parent, offset, false };
+			nodes.push_back(node);
+			storage.resize(offset + types[it->type].size * it->count);
+		}
+
+		ReadLevel(first);
+		++stats.levels;
+
+		pending.clear();
+		for(size_t i = first; i < nodes.size(); ++i)
+			if(!nodes[i].failed && nodes[i].depth < maxDepth)
+				FollowEdges(i, pending);
+	}
+}
+
+void RemoteGraph::Queue(std::vector<Pending>& pending, const void *address, unsigned type, unsigned count, size_t parent)
+{
+	// Nodes are numbered as they're queued, as they're placed in the same order.
+	size_t node = nodes.size() + pending.size();
+	if(!address || node >= maxNodes || !index.insert(std::make_pair(address, node)).second)
+		return;
+
+	Pending next = { address, type, count, parent };
+	pending.push_back(next);
+}
+
+void RemoteGraph::ReadLevel(size_t first)
+{
+	std::vector<ProcessMemory::ReadRange> reads;
+	reads.reserve(nodes.size() - first);
+	for(size_t i = first; i < nodes.size(); ++i)
+	{
+		ProcessMemory::ReadRange read = { nodes[i].address, storage.data() + nodes[i].data, static_cast<unsigned>(types[nodes[i].type].size * nodes[i].count) };
+		reads.push_back(read);
+	}
+
+	ReadNodes(reads.data(), first, reads.size());
+
+	for(size_t i=0; i<reads.size(); ++i)
+		if(!nodes[first + i].failed)
+			stats.bytesRead += reads[i].size;
+}
+
+void RemoteGraph::ReadNodes(const ProcessMemory::ReadRange *reads, size_t first, size_t count)
+{
+	// A bad pointer fails the whole ReadV, so then each half is read on its own, to find it.
+	// A few bad nodes in a level cost a few reads each, rather than a read for every node.
+	++stats.reads;
+	try
+	{
+		memory.ReadV(reads, static_cast<unsigned>(count));
+	}
+	catch(const std::exception&)
+	{
+		if(count > 1)
+		{
+			ReadNodes(reads, first, count / 2);
+			ReadNodes(reads + count / 2, first + count / 2, count - count / 2);
+		}
+		else
+		{
+			nodes[first].failed = true;
+			std::memset(reads->val, 0, reads->size);
+			++stats.nodesFailed;
+		}
+	}
+}
+
+void RemoteGraph::FollowEdges(size_t node, std::vector<Pending>& pending)
+{
+	const Type& type = types[nodes[node].type];
+	for(unsigned element=0; element < nodes[node].count; ++element)
+	{
+		const uint8_t *data = storage.data() + nodes[node].data + type.size * element;
+		for(auto it = type.edges.begin(); it != type.edges.end(); ++it)
+		{
+			uint64_t count = it->countSize ? LoadField(data + it->countOffset, it->countSize) : 1;
+			if(!count || count > MAX_ARRAY / types[it->target].size)
+				continue;
+
+			const void *address = reinterpret_cast<const void*>(static_cast<uintptr_t>(LoadField(data + it->offset, pointerSize)));
+			Queue(pending, address, it->target, static_cast<unsigned>(count), node);
+		}
+	}
+}
+
+uint64_t RemoteGraph::LoadField(const uint8_t *data, unsigned size) const
+{
+	// Little endian, so the low bytes of a wider integer.
+	uint64_t field = 0;
+	std::memcpy(&field, data, size);
+	return field;
+}
+
+size_t RemoteGraph::GetNodeCount() const
+{
+	return nodes.size();
+}
+
+const RemoteGraph::Node& RemoteGraph::GetNode(size_t node) const
+{
+	return nodes[node];
+}
+
+size_t RemoteGraph::Find(const void *address) const
+{
+	auto it = index.find(address);
+	return it == index.end() ? NOT_FOUND : it->second;
+}
+
+const void *RemoteGraph::GetData(size_t node, unsigned element) const
+{
+	if(element >= nodes[node].count)
+		return nullptr;
+
+	return storage.data() + nodes[node].data + types[nodes[node].type].size * element;
+}
+
+const RemoteGraph::Stats& RemoteGraph::GetStats() const
+{
+	return stats;
+}
@@ -12,21 +12,66 @@
 #include <cstdint>
 #include "ProcessMemory.h"
 #include <exception>
-#include "UndocumentedStructs.h"
 
 #ifdef WIN32
+# include "UndocumentedStructs.h"
 # define WIN32_LEAN_AND_MEAN
 # include <windows.h>
 #else
-# error "Unimplemented"
+# include "ThreadTracer.h"
+# include <cstdio>
+
+# if defined(__x86_64__)
+#  define REGS_IP rip
+#  define REGS_SP rsp
+# else
+#  define REGS_IP eip
+#  define REGS_SP esp
+# endif
+
+namespace
+{
+	struct TracedThread
+	{
+		ThreadTracer *tracer;
+		unsigned threadId;
+	};
+
+	unsigned GetThreadProcId(unsigned threadId)
+	{
+		char statusPath[64];
+		snprintf(statusPath, sizeof(statusPath), "/proc/%u/status", threadId);
+
+		FILE *status = fopen(statusPath, "r");
+		if(!status)
+			return 0;
+
+		unsigned procId = 0;
+		char line[256];
+		while(fgets(line, sizeof(line), status))
+			if(sscanf(line, "Tgid: %u", &procId) == 1)
+				break;
+
+		fclose(status);
+		return procId;
+	}
+
+	TracedThread *GetTracedThread(void *handle)
+	{
+		return static_cast<TracedThread*>(handle);
+	}
+}
 #endif
 
+#ifdef WIN32
 unsigned RemoteThread::initialized = 0;
 void *RemoteThread::ntdllHandle = nullptr;
 RemoteThread::NtQueryInformationThreadPtr RemoteThread::NtQueryInformationThread = nullptr;
+#endif
 
 void RemoteThread::Initialize()
 {
+#ifdef WIN32
 	if(!initialized++)
 	{
 		ntdllHandle = LoadLibrary("ntdll.dll");
@@ -38,22 +83,39 @@ void RemoteThread::Initialize()
 		if(!ntdllHandle || !NtQueryInformationThread)
 			throw std::exception("Couldn't find NtQueryInformation thread.");
 	}
+#endif
 }
 
 void RemoteThread::Deinitialize()
 {
+#ifdef WIN32
 	if(!--initialized)
 	{
 		FreeLibrary((HMODULE)ntdllHandle);
 		ntdllHandle = nullptr;
 		NtQueryInformationThread = nullptr;
 	}
+#endif
 }
 
-RemoteThread::RemoteThread(unsigned threadId) : threadHandle(OpenThread(THREAD_QUERY_INFORMATION | THREAD_GET_CONTEXT | THREAD_SET_CONTEXT | THREAD_SUSPEND_RESUME, false, threadId)), refs(new unsigned)
+RemoteThread::RemoteThread(unsigned threadId) : threadHandle(nullptr), refs(new unsigned)
 {
 	Initialize();
 
+#ifdef WIN32
+	threadHandle = OpenThread(THREAD_QUERY_INFORMATION | THREAD_GET_CONTEXT | THREAD_SET_CONTEXT | THREAD_SUSPEND_RESUME, false, threadId);
+#else
+	unsigned procId = GetThreadProcId(threadId);
+	ThreadTracer *tracer = procId ? ThreadTracer::Get(procId) : nullptr;
+	if(tracer)
+	{
+		TracedThread *thread = new TracedThread;
+		thread->tracer = tracer;
+		thread->threadId = threadId;
+		threadHandle = thread;
+	}
+#endif
+
 	assert(threadHandle && "Failed to open the remote thread. You don't have enough permissions.");
 
 	*refs = 1;
@@ -63,10 +125,17 @@ RemoteThread::RemoteThread(ProcessHandle handle, const void* startAddr, bool sta
 {
 	Initialize();
 
+#ifdef WIN32
 	if(!handle.EnsureRights(PROCESS_CREATE_THREAD | PROCESS_QUERY_INFORMATION | PROCESS_VM_OPERATION | PROCESS_VM_WRITE | PROCESS_VM_READ))
 		assert(0 && "Could not get remote thread rights on the process.");
 
 	threadHandle = CreateRemoteThread(handle, NULL, 0, reinterpret_cast<const LPTHREAD_START_ROUTINE>(startAddr), NULL, startSuspended ? CREATE_SUSPENDED : 0, NULL);
+#else
+	(void)handle;
+	(void)startAddr;
+	(void)startSuspended;
+	assert(0 && "Starting threads in other processes isn't supported on Linux.");
+#endif
 
 	assert(threadHandle && "Failed to create the remote thread.");
 
@@ -124,7 +193,11 @@ void RemoteThread::Destroy()
 	if(refs && !(--(*refs)))
 	{
 		delete refs;
+#ifdef WIN32
 		CloseHandle(threadHandle);
+#else
+		delete GetTracedThread(threadHandle);
+#endif
 		
 		refs = nullptr;
 		threadHandle = nullptr;
@@ -138,16 +211,32 @@ bool RemoteThread::IsValid() const
 
 void RemoteThread::Suspend()
 {
+#ifdef WIN32
 	SuspendThread(threadHandle);
+#else
+	TracedThread *thread = GetTracedThread(threadHandle);
+	thread->tracer->Interrupt(thread->threadId);
+#endif
 }
+
 void RemoteThread::Resume()
 {
+#ifdef WIN32
 	ResumeThread(threadHandle);
+#else
+	TracedThread *thread = GetTracedThread(threadHandle);
+	thread->tracer->Resume(thread->threadId);
+#endif
 }
 
 void RemoteThread::WaitForDeath() const
 {
+#ifdef WIN32
 	WaitForSingleObject(threadHandle, INFINITE);
+#else
+	TracedThread *thread = GetTracedThread(threadHandle);
+	thread->tracer->WaitForExit(thread->threadId);
+#endif
 }
 
 unsigned RemoteThread::GetThreadId() const
@@ -157,23 +246,33 @@ unsigned RemoteThread::GetThreadId() const
 
 const void *RemoteThread::GetIp() const
 {
+	void *ipPtr = NULL;
+
+#ifdef WIN32
 	CONTEXT threadContext;
 	threadContext.ContextFlags = CONTEXT_CONTROL;
 
 	GetThreadContext(threadHandle, &threadContext);
 
-	void *ipPtr = NULL;
 # if defined(X64) || defined(WIN64)
 	ipPtr = reinterpret_cast<void*>(threadContext.Rip);
 # else
 	ipPtr = reinterpret_cast<void*>(threadContext.Eip);
 # endif
+#else
+	TracedThread *thread = GetTracedThread(threadHandle);
+
+	user_regs_struct regs;
+	if(thread->tracer->GetRegs(thread->threadId, regs))
+		ipPtr = reinterpret_cast<void*>(regs.REGS_IP);
+#endif
 
 	return ipPtr;
 }
 
 void RemoteThread::SetIp(const void *ip)
 {
+#ifdef WIN32
 	CONTEXT threadContext;
 	threadContext.ContextFlags = CONTEXT_CONTROL;
 
@@ -186,16 +285,104 @@ void RemoteThread::SetIp(const void *ip)
 # endif
 
 	SetThreadContext(threadHandle, &threadContext);
+#else
+	TracedThread *thread = GetTracedThread(threadHandle);
+
+	user_regs_struct regs;
+	if(thread->tracer->GetRegs(thread->threadId, regs))
+	{
+		regs.REGS_IP = reinterpret_cast<uintptr_t>(ip);
+		thread->tracer->SetRegs(thread->threadId, regs);
+	}
+#endif
+}
+
+const void *RemoteThread::GetSp() const
+{
+	void *spPtr = NULL;
+
+#ifdef WIN32
+	CONTEXT threadContext;
+	threadContext.ContextFlags = CONTEXT_CONTROL;
+
+	GetThreadContext(threadHandle, &threadContext);
+
+# if defined(X64) || defined(WIN64)
+	spPtr = reinterpret_cast<void*>(threadContext.Rsp);
+# else
+	spPtr = reinterpret_cast<void*>(threadContext.Esp);
+# endif
+#else
+	TracedThread *thread = GetTracedThread(threadHandle);
+
+	user_regs_struct regs;
+	if(thread->tracer->GetRegs(thread->threadId, regs))
+		spPtr = reinterpret_cast<void*>(regs.REGS_SP);
+#endif
+
+	return spPtr;
+}
+
+unsigned RemoteThread::GetRegisters(uintptr_t *regs) const
+{
+#ifdef WIN32
+	CONTEXT threadContext;
+	threadContext.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+
+	if(!GetThreadContext(threadHandle, &threadContext))
+		return 0;
+
+# if defined(X64) || defined(WIN64)
+	const DWORD64 values[] = { threadContext.Rax, threadContext.Rbx, threadContext.Rcx, threadContext.Rdx, threadContext.Rsi, threadContext.Rdi,
+	                           threadContext.Rbp, threadContext.Rsp, threadContext.R8,  threadContext.R9,  threadContext.R10, threadContext.R11,
+	                           threadContext.R12, threadContext.R13, threadContext.R14, threadContext.R15, threadContext.Rip };
+# else
+	const DWORD values[] = { threadContext.Eax, threadContext.Ebx, threadContext.Ecx, threadContext.Edx, threadContext.Esi,
+	                         threadContext.Edi, threadContext.Ebp, threadContext.Esp, threadContext.Eip };
+# endif
+#else
+	TracedThread *thread = GetTracedThread(threadHandle);
+
+	user_regs_struct r;
+	if(!thread->tracer->GetRegs(thread->threadId, r))
+		return 0;
+
+# if defined(__x86_64__)
+	const unsigned long long values[] = { r.rax, r.rbx, r.rcx, r.rdx, r.rsi, r.rdi, r.rbp, r.rsp, r.r8,
+	                                      r.r9, r.r10, r.r11, r.r12, r.r13, r.r14, r.r15, r.rip };
+# else
+	const long values[] = { r.eax, r.ebx, r.ecx, r.edx, r.esi, r.edi, r.ebp, r.esp, r.eip };
+# endif
+#endif
+
+	unsigned count = sizeof(values) / sizeof(values[0]);
+	for(unsigned i=0; i<count; ++i)
+		regs[i] = static_cast<uintptr_t>(values[i]);
+
+	return count;
 }
 
 void* RemoteThread::GetTEBAddr() const
 {
+#ifdef WIN32
 	THREAD_BASIC_INFORMATION info;
 	GetThreadInfo(threadHandle, info);
 
 	return reinterpret_cast<void*>(info.TebBaseAddress);
+#elif defined(__x86_64__)
+	TracedThread *thread = GetTracedThread(threadHandle);
+
+	user_regs_struct regs;
+	if(!thread->tracer->GetRegs(thread->threadId, regs))
+		return nullptr;
+
+	return reinterpret_cast<void*>(regs.fs_base);
+#else
+	return nullptr;
+#endif
 }
 
+#ifdef WIN32
 void RemoteThread::GetThreadInfo(void *handle, THREAD_BASIC_INFORMATION& threadInfo)
 {
 	Initialize();
@@ -205,11 +392,16 @@ void RemoteThread::GetThreadInfo(void *handle, THREAD_BASIC_INFORMATION& threadI
 
 	Deinitialize();
 }
+#endif
 
 unsigned RemoteThread::GetThreadId(void *handle)
 {
+#ifdef WIN32
 	THREAD_BASIC_INFORMATION info;
 	GetThreadInfo(handle, info);
 
 	return reinterpret_cast<unsigned>(info.ClientId.UniqueThread);
+#else
+	return GetTracedThread(handle)->threadId;
+#endif
 }
@@ -15,7 +15,7 @@
 # include <windows.h>
 # include <Tlhelp32.h>
 #else
-# error "Unimplemented"
+# include "ThreadTracer.h"
 #endif
 
 RemoteThreadManager::RemoteThreadManager(unsigned procId) : procHandle(ProcessHandleManager::Get()->GetHandle(procId))
@@ -25,6 +25,7 @@ RemoteThreadManager::RemoteThreads RemoteThreadManager::GetRemoteThreads()
 {
 	RemoteThreads threads;
 
+#ifdef WIN32
 	DWORD procId = procHandle.GetProcId();
 
 	HANDLE threadsHandle = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
@@ -47,6 +48,16 @@ RemoteThreadManager::RemoteThreads RemoteThreadManager::GetRemoteThreads()
 
 		CloseHandle(threadsHandle);
 	}
+#else
+	// The tracer already knows every thread, there's no need to go through /proc.
+	ThreadTracer *tracer = ThreadTracer::Get(procHandle.GetProcId());
+	if(tracer)
+	{
+		std::vector<unsigned> threadIds = tracer->GetThreadIds();
+		for(auto it = threadIds.begin(); it != threadIds.end(); ++it)
+			threads.push_back(RemoteThread(*it));
+	}
+#endif
 
 	return threads;
 }
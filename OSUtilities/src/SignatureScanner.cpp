@@ -0,0 +1,498 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		SignatureScanner.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Finds byte signatures with wildcards in a module's code
+ */
+
+#include "SignatureScanner.h"
+#include "Module.h"
+#include "ProcessMemory.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <exception>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+# define SCANNER_X86
+# include <immintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h>
+# endif
+#endif
+
+#ifdef WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+#else
+# include <unistd.h>
+#endif
+
+// MSVC lets any function use any intrinsic. GCC needs to be told which functions may.
+#if defined(SCANNER_X86) && !defined(_MSC_VER)
+# define SCANNER_SSE42 __attribute__((target("sse4.2")))
+# define SCANNER_AVX2  __attribute__((target("avx2")))
+#else
+# define SCANNER_SSE42
+# define SCANNER_AVX2
+#endif
+
+namespace
+{
+	// Other processes are copied out this much at a time.
+	const size_t BLOCK_SIZE = 1 << 20;
+
+	unsigned LowestSetBit(unsigned bits)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, bits);
+		return index;
+#else
+		return __builtin_ctz(bits);
+#endif
+	}
+
+	// How much a fixed byte narrows a search through x86 code. Opcodes, prefixes and
+	// padding that turn up everywhere are worth little as an anchor.
+	unsigned ByteWeight(uint8_t byte)
+	{
+		switch(byte)
+		{
+			case 0x00: case 0xFF: case 0xCC: case 0x90: case 0x0F:
+			case 0x48: case 0x4C: case 0x89: case 0x8B: case 0x83:
+			case 0x24: case 0xE8: case 0xC3: case 0x44: case 0x8D:
+				return 1;
+			default:
+				return 4;
+		}
+	}
+
+	bool IsCurrentProcess(unsigned procId)
+	{
+#ifdef WIN32
+		return procId == GetCurrentProcessId();
+#else
+		return procId == static_cast<unsigned>(getpid());
+#endif
+	}
+}
+
+SignatureScanner::SignatureScanner() : signatures(), anchors(), anchorHeads(), anchorMasks(), hashShift(32), nibblesFilter(false), maxLength(0), simd(GetSupportedSimd())
+{
+	Build();
+}
+
+unsigned SignatureScanner::Add(const char *signature)
+{
+	std::vector<uint8_t> bytes;
+	std::vector<uint8_t> mask;
+
+	for(const char *c = signature; *c;)
+	{
+		if(std::isspace(static_cast<unsigned char>(*c)))
+		{
+			++c;
+			continue;
+		}
+
+		if(*c == '?')
+		{
+			c += c[1] == '?' ? 2 : 1;
+			bytes.push_back(0);
+			mask.push_back(0);
+		}
+		else
+		{
+			if(!std::isxdigit(static_cast<unsigned char>(c[0])) || !std::isxdigit(static_cast<unsigned char>(c[1])))
+				throw std::exception();
+
+			char hex[3] = { c[0], c[1], '\0' };
+			bytes.push_back(static_cast<uint8_t>(std::strtoul(hex, nullptr, 16)));
+			mask.push_back(0xFF);
+			c += 2;
+		}
+
+		if(*c && !std::isspace(static_cast<unsigned char>(*c)))
+			throw std::exception();
+	}
+
+	return Add(bytes.data(), mask.data(), bytes.size());
+}
+
+unsigned SignatureScanner::Add(const uint8_t *bytes, const uint8_t *mask, size_t length)
+{
+	if(length < ANCHOR_LENGTH)
+		throw std::exception();
+
+	Signature signature;
+	signature.bytes.assign(bytes, bytes + length);
+	signature.mask.assign(mask, mask + length);
+	signature.anchor = 0;
+
+	// The anchor is the window whose fixed bytes are least likely to turn up by chance. Any
+	// window with more fixed bytes beats one with fewer, as wildcards pass every pair.
+	unsigned bestWeight = 0;
+	for(size_t start=0; start + ANCHOR_LENGTH <= length; ++start)
+	{
+		unsigned weight = 0;
+		for(unsigned i=0; i<ANCHOR_LENGTH; ++i)
+			if(mask[start + i] == 0xFF)
+				weight += ByteWeight(bytes[start + i]) + 16;
+
+		if(weight > bestWeight)
+		{
+			bestWeight = weight;
+			signature.anchor = static_cast<unsigned>(start);
+		}
+	}
+
+	if(!bestWeight)
+		throw std::exception();
+
+	signatures.push_back(signature);
+	maxLength = std::max(maxLength, length);
+	Build();
+
+	return static_cast<unsigned>(signatures.size() - 1);
+}
+
+unsigned SignatureScanner::GetCount() const
+{
+	return static_cast<unsigned>(signatures.size());
+}
+
+void SignatureScanner::Build()
+{
+	std::memset(pairs, 0, sizeof(pairs));
+	std::memset(lowNibbles, 0, sizeof(lowNibbles));
+	std::memset(highNibbles, 0, sizeof(highNibbles));
+	anchors.clear();
+	anchorMasks.clear();
+
+	// Signatures with similar anchors go in the same bucket, so each bucket's tables let
+	// through as few other bytes as possible.
+	auto anchorByte = [this](unsigned index, unsigned i)
+	{
+		const Signature& signature = signatures[index];
+		unsigned pos = signature.anchor + i;
+		return signature.mask[pos] == 0xFF ? signature.bytes[pos] : 0x100u;
+	};
+
+	std::vector<unsigned> order(signatures.size());
+	for(unsigned i=0; i<order.size(); ++i)
+		order[i] = i;
+
+	std::sort(order.begin(), order.end(), [&anchorByte](unsigned lhs, unsigned rhs)
+	{
+		for(unsigned i=0; i<ANCHOR_LENGTH; ++i)
+			if(anchorByte(lhs, i) != anchorByte(rhs, i))
+				return anchorByte(lhs, i) < anchorByte(rhs, i);
+		return lhs < rhs;
+	});
+
+	for(size_t i=0; i<order.size(); ++i)
+	{
+		uint8_t bit = static_cast<uint8_t>(1 << (i * BUCKET_COUNT / order.size()));
+
+		const Signature& signature = signatures[order[i]];
+		Anchor anchor = { 0, 0, order[i], signature.anchor, 0, 0 };
+		for(size_t b=0; b<signature.bytes.size() && b<sizeof(uint64_t); ++b)
+		{
+			anchor.head     |= static_cast<uint64_t>(signature.bytes[b] & signature.mask[b]) << (b * 8);
+			anchor.headMask |= static_cast<uint64_t>(signature.mask[b]) << (b * 8);
+		}
+
+		for(unsigned k=0; k<ANCHOR_LENGTH; ++k)
+		{
+			unsigned byte = anchorByte(order[i], k);
+			if(byte > 0xFF)
+			{
+				for(unsigned n=0; n<16; ++n)
+				{
+					lowNibbles[k][n] |= bit;
+					highNibbles[k][n] |= bit;
+				}
+			}
+			else
+			{
+				anchor.key  |= byte << (k * 8);
+				anchor.mask |= 0xFFu << (k * 8);
+				lowNibbles[k][byte & 0xF] |= bit;
+				highNibbles[k][byte >> 4] |= bit;
+			}
+		}
+
+		// A wildcard in a pair sets every pair it could make.
+		for(unsigned k=0; k+1<ANCHOR_LENGTH; ++k)
+		{
+			unsigned first = anchorByte(order[i], k), second = anchorByte(order[i], k + 1);
+			for(unsigned a = first > 0xFF ? 0 : first; a <= (first > 0xFF ? 0xFF : first); ++a)
+				for(unsigned b = second > 0xFF ? 0 : second; b <= (second > 0xFF ? 0xFF : second); ++b)
+					pairs[k][(a | (b << 8)) >> 6] |= 1ull << (a & 63);
+		}
+
+		anchors.push_back(anchor);
+		if(std::find(anchorMasks.begin(), anchorMasks.end(), anchor.mask) == anchorMasks.end())
+			anchorMasks.push_back(anchor.mask);
+	}
+
+	// Roughly how many positions get past the nibbles. Each anchor byte is treated as letting
+	// through the share of all byte values it does, as if they were equally likely.
+	double passed = 1.0;
+	for(unsigned k=0; k<ANCHOR_LENGTH; ++k)
+	{
+		unsigned allowed = 0;
+		for(unsigned b=0; b<256; ++b)
+			if(lowNibbles[k][b & 0xF] & highNibbles[k][b >> 4])
+				++allowed;
+		passed *= allowed / 256.0;
+	}
+	nibblesFilter = passed < 0.25;
+
+	// Anchors are grouped by hash, with at least twice as many hashes as anchors.
+	unsigned hashBits = 4;
+	while((1u << hashBits) < anchors.size() * 2)
+		++hashBits;
+	hashShift = 32 - hashBits;
+
+	std::sort(anchors.begin(), anchors.end(), [this](const Anchor& lhs, const Anchor& rhs)
+	{
+		return HashAnchor(lhs.key, lhs.mask) < HashAnchor(rhs.key, rhs.mask);
+	});
+
+	anchorHeads.assign((1u << hashBits) + 1, 0);
+	for(auto it = anchors.begin(); it != anchors.end(); ++it)
+		++anchorHeads[HashAnchor(it->key, it->mask) + 1];
+	for(size_t h=1; h<anchorHeads.size(); ++h)
+		anchorHeads[h] += anchorHeads[h - 1];
+}
+
+bool SignatureScanner::PairsAllow(const uint8_t *bytes) const
+{
+	uint64_t allowed = 1;
+	for(unsigned k=0; k+1<ANCHOR_LENGTH; ++k)
+	{
+		unsigned pair = bytes[k] | (bytes[k + 1] << 8);
+		allowed &= pairs[k][pair >> 6] >> (pair & 63);
+	}
+	return allowed != 0;
+}
+
+uint32_t SignatureScanner::HashAnchor(uint32_t key, uint32_t mask) const
+{
+	return ((key ^ (mask * 0x9E3779B1u)) * 0x9E3779B1u) >> hashShift;
+}
+
+void SignatureScanner::Scan(const void *begin, size_t size, Matches& matches) const
+{
+	const uint8_t *data = static_cast<const uint8_t*>(begin);
+	ScanBlock(data, size, size, data, matches);
+}
+
+void SignatureScanner::Scan(const Module& mod, Matches& matches) const
+{
+	Module::Ranges ranges = mod.GetCodeRanges();
+	if(IsCurrentProcess(mod.GetProcId()))
+	{
+		for(auto it = ranges.begin(); it != ranges.end(); ++it)
+			Scan(it->first, it->second, matches);
+		return;
+	}
+
+	// Each block is read with the start of the next, so signatures straddling the two are
+	// found, and only reported from the block they start in.
+	ProcessMemory memory(mod.GetProcId());
+	size_t overlap = maxLength ? maxLength - 1 : 0;
+	std::vector<uint8_t> buffer(BLOCK_SIZE + overlap);
+
+	for(auto it = ranges.begin(); it != ranges.end(); ++it)
+	{
+		const uint8_t *start = static_cast<const uint8_t*>(it->first);
+		for(size_t offset = 0; offset < it->second; offset += BLOCK_SIZE)
+		{
+			size_t length = std::min(BLOCK_SIZE + overlap, it->second - offset);
+			memory.Read(start + offset, buffer.data(), static_cast<unsigned>(length));
+			ScanBlock(buffer.data(), length, std::min(BLOCK_SIZE, it->second - offset), start + offset, matches);
+		}
+	}
+}
+
+void SignatureScanner::ScanBlock(const uint8_t *data, size_t size, size_t reportLimit, const uint8_t *address, Matches& matches) const
+{
+	if(signatures.empty())
+		return;
+
+	size_t pos = 0;
+	if(nibblesFilter && simd == SIMD_AVX2)
+		pos = ScanAvx2(data, size, reportLimit, address, matches);
+	else if(nibblesFilter && simd == SIMD_SSE42)
+		pos = ScanSse42(data, size, reportLimit, address, matches);
+
+	for(; pos + ANCHOR_LENGTH <= size; ++pos)
+		if(PairsAllow(data + pos))
+			CheckCandidate(data, size, pos, reportLimit, address, matches);
+}
+
+#ifdef SCANNER_X86
+SCANNER_SSE42 size_t SignatureScanner::ScanSse42(const uint8_t *data, size_t size, size_t reportLimit, const uint8_t *address, Matches& matches) const
+{
+	const __m128i nibbleMask = _mm_set1_epi8(0x0F);
+	__m128i low[ANCHOR_LENGTH], high[ANCHOR_LENGTH];
+	for(unsigned k=0; k<ANCHOR_LENGTH; ++k)
+	{
+		low[k]  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lowNibbles[k]));
+		high[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(highNibbles[k]));
+	}
+
+	size_t pos = 0;
+	for(; pos + 16 + ANCHOR_LENGTH - 1 <= size; pos += 16)
+	{
+		__m128i found = _mm_set1_epi8(-1);
+		for(unsigned k=0; k<ANCHOR_LENGTH; ++k)
+		{
+			__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos + k));
+			__m128i lowBits = _mm_shuffle_epi8(low[k], _mm_and_si128(bytes, nibbleMask));
+			__m128i highBits = _mm_shuffle_epi8(high[k], _mm_and_si128(_mm_srli_epi16(bytes, 4), nibbleMask));
+			found = _mm_and_si128(found, _mm_and_si128(lowBits, highBits));
+		}
+
+		unsigned candidates = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(found, _mm_setzero_si128()))) & 0xFFFF;
+		while(candidates)
+		{
+			size_t candidate = pos + LowestSetBit(candidates);
+			if(PairsAllow(data + candidate))
+				CheckCandidate(data, size, candidate, reportLimit, address, matches);
+			candidates &= candidates - 1;
+		}
+	}
+
+	return pos;
+}
+
+SCANNER_AVX2 size_t SignatureScanner::ScanAvx2(const uint8_t *data, size_t size, size_t reportLimit, const uint8_t *address, Matches& matches) const
+{
+	// vpshufb looks up within each 128 bit lane, so each table is in both.
+	const __m256i nibbleMask = _mm256_set1_epi8(0x0F);
+	__m256i low[ANCHOR_LENGTH], high[ANCHOR_LENGTH];
+	for(unsigned k=0; k<ANCHOR_LENGTH; ++k)
+	{
+		low[k]  = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lowNibbles[k])));
+		high[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(highNibbles[k])));
+	}
+
+	size_t pos = 0;
+	for(; pos + 32 + ANCHOR_LENGTH - 1 <= size; pos += 32)
+	{
+		__m256i found = _mm256_set1_epi8(-1);
+		for(unsigned k=0; k<ANCHOR_LENGTH; ++k)
+		{
+			__m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos + k));
+			__m256i lowBits = _mm256_shuffle_epi8(low[k], _mm256_and_si256(bytes, nibbleMask));
+			__m256i highBits = _mm256_shuffle_epi8(high[k], _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibbleMask));
+			found = _mm256_and_si256(found, _mm256_and_si256(lowBits, highBits));
+		}
+
+		unsigned candidates = ~static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(found, _mm256_setzero_si256())));
+		while(candidates)
+		{
+			size_t candidate = pos + LowestSetBit(candidates);
+			if(PairsAllow(data + candidate))
+				CheckCandidate(data, size, candidate, reportLimit, address, matches);
+			candidates &= candidates - 1;
+		}
+	}
+
+	return pos;
+}
+#else
+size_t SignatureScanner::ScanSse42(const uint8_t*, size_t, size_t, const uint8_t*, Matches&) const
+{
+	return 0;
+}
+
+size_t SignatureScanner::ScanAvx2(const uint8_t*, size_t, size_t, const uint8_t*, Matches&) const
+{
+	return 0;
+}
+#endif
+
+void SignatureScanner::CheckCandidate(const uint8_t *data, size_t size, size_t pos, size_t reportLimit, const uint8_t *address, Matches& matches) const
+{
+	uint32_t bytes = 0;
+	for(unsigned k=0; k<ANCHOR_LENGTH; ++k)
+		bytes |= static_cast<uint32_t>(data[pos + k]) << (k * 8);
+	for(auto maskIt = anchorMasks.begin(); maskIt != anchorMasks.end(); ++maskIt)
+	{
+		uint32_t key = bytes & *maskIt;
+		uint32_t hash = HashAnchor(key, *maskIt);
+		for(uint32_t i = anchorHeads[hash]; i != anchorHeads[hash + 1]; ++i)
+		{
+			const Anchor& anchor = anchors[i];
+			if(anchor.key != key || anchor.mask != *maskIt || pos < anchor.offset)
+				continue;
+
+			size_t start = pos - anchor.offset;
+			if(start + sizeof(uint64_t) <= size)
+			{
+				uint64_t head;
+				std::memcpy(&head, data + start, sizeof(head));
+				if((head ^ anchor.head) & anchor.headMask)
+					continue;
+			}
+
+			CheckSignature(anchor.signature, data, size, start, reportLimit, address, matches);
+		}
+	}
+}
+
+void SignatureScanner::CheckSignature(unsigned index, const uint8_t *data, size_t size, size_t start, size_t reportLimit, const uint8_t *address, Matches& matches) const
+{
+	const Signature& signature = signatures[index];
+	size_t length = signature.bytes.size();
+	if(start >= reportLimit || start + length > size)
+		return;
+
+	const uint8_t *bytes = data + start;
+	for(size_t i=0; i<length; ++i)
+		if((bytes[i] ^ signature.bytes[i]) & signature.mask[i])
+			return;
+
+	Match match = { index, address + start };
+	matches.push_back(match);
+}
+
+SignatureScanner::SimdLevel SignatureScanner::GetSupportedSimd()
+{
+#if defined(SCANNER_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool sse42 = (info[2] & (1 << 20)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0 && (info[2] & (1 << 27)) != 0;
+
+	// AVX2 also needs the OS to save the upper halves of the ymm registers.
+	bool avx2 = false;
+	if(avx && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+
+	return avx2 ? SIMD_AVX2 : (sse42 ? SIMD_SSE42 : SIMD_NONE);
+#elif defined(SCANNER_X86)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return SIMD_AVX2;
+
+	return __builtin_cpu_supports("sse4.2") ? SIMD_SSE42 : SIMD_NONE;
+#else
+	return SIMD_NONE;
+#endif
+}
+
+void SignatureScanner::SetSimd(SimdLevel level)
+{
+	simd = std::min(level, GetSupportedSimd());
+}
@@ -10,41 +10,429 @@
 #include "SingleThreadBlock.h"
 #include "RemoteThread.h"
 #include "RemoteThreadManager.h"
+#include "ThreadRegistry.h"
 #include <cstdint>
+#include <algorithm>
 
 #ifdef WIN32
 # define WIN32_LEAN_AND_MEAN
 # include <windows.h>
+# include <Tlhelp32.h>
+
+namespace
+{
+	// Walks a toolhelp snapshot, which is mapped in on its own rather than built on our heap, so
+	// it's safe while threads that may hold the heap lock are suspended.
+	template<typename Fn>
+	void ForEachThread(DWORD procId, Fn fn)
+	{
+		HANDLE threadsHandle = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+		if(threadsHandle == INVALID_HANDLE_VALUE)
+			return;
+
+		THREADENTRY32 threadEntry;
+		threadEntry.dwSize = sizeof(threadEntry);
+
+		if(Thread32First(threadsHandle, &threadEntry))
+		{
+			do
+			{
+				if((threadEntry.dwSize >= FIELD_OFFSET(THREADENTRY32, th32OwnerProcessID) + sizeof(threadEntry.th32OwnerProcessID)) &&
+				   (procId == threadEntry.th32OwnerProcessID))
+					fn(static_cast<unsigned>(threadEntry.th32ThreadID));
+
+				threadEntry.dwSize = sizeof(threadEntry);
+			} while(Thread32Next(threadsHandle, &threadEntry));
+		}
+
+		CloseHandle(threadsHandle);
+	}
+}
+#else
+# include <atomic>
+# include <mutex>
+# include <climits>
+# include <cerrno>
+# include <csignal>
+# include <ctime>
+# include <fcntl.h>
+# include <unistd.h>
+# include <ucontext.h>
+# include <sys/syscall.h>
+# include <linux/futex.h>
+
+# if defined(__x86_64__)
+#  define CONTEXT_IP REG_RIP
+#  define CONTEXT_SP REG_RSP
+# elif defined(__i386__)
+#  define CONTEXT_IP REG_EIP
+#  define CONTEXT_SP REG_ESP
+# else
+#  error "Unsupported architecture"
+# endif
+
+namespace
+{
+	enum
+	{
+		MAX_PARKED_THREADS = 4096,  // Threads past this many are left running.
+		ACK_TIMEOUT_NS     = 50000000  // Threads that don't take the signal in this long (it's blocked, say) are left running.
+	};
+
+	enum SlotState
+	{
+		SLOT_FREE,
+		SLOT_SIGNALED,
+		SLOT_PARKED
+	};
+
+	struct ParkSlot
+	{
+		std::atomic<int> state;      // SlotState
+		std::atomic<int> tid;        // Thread the slot was handed to.
+		std::atomic<void*> context;  // ucontext_t of the parked thread.
+		int generation;              // Release generation to park until.
+	};
+
+	// Slots live as long as the process does. A thread that had the signal blocked may take it
+	// long after the block that sent it is gone, and its handler still needs valid memory.
+	ParkSlot parkSlots[MAX_PARKED_THREADS];
+	unsigned nextSlot = 0;
+
+	std::atomic<int> releaseGeneration(0);
+	std::atomic<int> parkedCount(0);  // Bumped by every handler so the pausing thread can wait on it.
+	std::atomic<int> parkTarget(0);   // parkedCount at which the pausing thread wants waking.
+
+	// Two threads pausing each other would deadlock, so only one block exists at a time.
+	std::mutex pauseLock;
+
+	struct Dirent64
+	{
+		uint64_t       ino;
+		int64_t        off;
+		unsigned short reclen;
+		unsigned char  type;
+		char           name[1];
+	};
+
+	long Futex(std::atomic<int> *addr, int op, int val, const timespec *timeout = nullptr)
+	{
+		return syscall(SYS_futex, reinterpret_cast<int*>(addr), op, val, timeout, nullptr, 0);
+	}
+
+	pid_t GetTid()
+	{
+		return static_cast<pid_t>(syscall(SYS_gettid));
+	}
+
+	int ParkSignal()
+	{
+		// glibc keeps the first couple of real time signals for itself, SIGRTMIN is past those.
+		return SIGRTMIN + 2;
+	}
+
+	int64_t MonotonicNs()
+	{
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+	}
+
+	// Everything in here must be async signal safe. No locks, no allocation, errno preserved.
+	void ParkHandler(int, siginfo_t *info, void *context)
+	{
+		if(info->si_code != SI_QUEUE)
+			return;
+
+		ParkSlot *slot = static_cast<ParkSlot*>(info->si_value.sival_ptr);
+		if(slot < parkSlots || slot >= parkSlots + MAX_PARKED_THREADS)
+			return;
+
+		int savedErrno = errno;
+
+		// The pausing thread may have given up on us and handed the slot to someone else.
+		int expected = SLOT_SIGNALED;
+		if(slot->tid.load(std::memory_order_acquire) == GetTid() &&
+		   slot->state.compare_exchange_strong(expected, SLOT_PARKED, std::memory_order_acq_rel))
+		{
+			int generation = slot->generation;
+			slot->context.store(context, std::memory_order_release);
+
+			// Only the last thread to park wakes the pausing thread, rather than every one of them
+			// bouncing it awake just to go back to sleep.
+			int parked = parkedCount.fetch_add(1, std::memory_order_acq_rel) + 1;
+			if(parked - parkTarget.load(std::memory_order_acquire) >= 0)
+				Futex(&parkedCount, FUTEX_WAKE_PRIVATE, 1);
+
+			while(releaseGeneration.load(std::memory_order_acquire) == generation)
+				Futex(&releaseGeneration, FUTEX_WAIT_PRIVATE, generation);
+
+			slot->context.store(nullptr, std::memory_order_relaxed);
+			slot->state.store(SLOT_FREE, std::memory_order_release);
+		}
+
+		errno = savedErrno;
+	}
+
+	void InstallParkHandler()
+	{
+		static std::once_flag installed;
+		std::call_once(installed, []
+		{
+			struct sigaction action = {};
+			action.sa_sigaction = ParkHandler;
+			action.sa_flags = SA_SIGINFO | SA_RESTART;
+			sigfillset(&action.sa_mask);
+			sigaction(ParkSignal(), &action, nullptr);
+		});
+	}
+
+	ParkSlot *AcquireSlot(pid_t tid, int generation)
+	{
+		for(unsigned i=0; i<MAX_PARKED_THREADS; ++i)
+		{
+			ParkSlot *slot = parkSlots + (nextSlot + i) % MAX_PARKED_THREADS;
+			if(slot->state.load(std::memory_order_acquire) != SLOT_FREE)
+				continue;
+
+			nextSlot = static_cast<unsigned>(slot - parkSlots + 1) % MAX_PARKED_THREADS;
+
+			slot->generation = generation;
+			slot->context.store(nullptr, std::memory_order_relaxed);
+			slot->tid.store(tid, std::memory_order_relaxed);
+			slot->state.store(SLOT_SIGNALED, std::memory_order_release);
+			return slot;
+		}
+
+		return nullptr;
+	}
+
+	// tgkill can't carry a payload, its queued sibling can. The slot pointer rides along in si_value.
+	bool SendParkSignal(pid_t procId, pid_t tid, ParkSlot *slot)
+	{
+		siginfo_t info = {};
+		info.si_signo = ParkSignal();
+		info.si_code  = SI_QUEUE;
+		info.si_pid   = procId;
+		info.si_uid   = getuid();
+		info.si_value.sival_ptr = slot;
+
+		return syscall(SYS_rt_tgsigqueueinfo, procId, tid, ParkSignal(), &info) == 0;
+	}
+
+	// Walks /proc/self/task with raw getdents so nothing is allocated once threads are parked.
+	template<typename Fn>
+	void ForEachTask(Fn fn)
+	{
+		int dir = open("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if(dir < 0)
+			return;
+
+		alignas(8) char buffer[4096];
+		for(;;)
+		{
+			long bytes = syscall(SYS_getdents64, dir, buffer, sizeof(buffer));
+			if(bytes <= 0)
+				break;
+
+			for(long offset = 0; offset < bytes;)
+			{
+				const Dirent64 *entry = reinterpret_cast<const Dirent64*>(buffer + offset);
+				offset += entry->reclen;
+
+				pid_t tid = 0;
+				const char *c = entry->name;
+				for(; *c >= '0' && *c <= '9'; ++c)
+					tid = tid * 10 + (*c - '0');
+
+				if(tid && !*c)
+					fn(tid);
+			}
+		}
+
+		close(dir);
+	}
+}
 #endif
 
-SingleThreadBlock::SingleThreadBlock(unsigned procId) : threadIds()
+SingleThreadBlock::SingleThreadBlock(unsigned procId)
+#ifdef WIN32
+	: threadIds(), registry(nullptr), registryMissed(false), onlyThread(0)
+#else
+	: parkedSlots(), generation(0), missedThreads(false), tracer(nullptr), tracedThreads(), registry(nullptr), registryMissed(false), onlyThread(0)
+#endif
+{
+	Pause(procId);
+}
+
+SingleThreadBlock::SingleThreadBlock(unsigned procId, unsigned threadId)
+#ifdef WIN32
+	: threadIds(), registry(nullptr), registryMissed(false), onlyThread(threadId)
+#else
+	: parkedSlots(), generation(0), missedThreads(false), tracer(nullptr), tracedThreads(), registry(nullptr), registryMissed(false), onlyThread(threadId)
+#endif
 {
+	(void)procId; // Only threads of the current process can be paused alone.
+	Pause(0);
+}
+
+void SingleThreadBlock::Pause(unsigned procId)
+{
+#ifdef WIN32
+	bool currentProcess = !procId || procId == GetCurrentProcessId();
+#else
+	bool currentProcess = !procId || procId == static_cast<unsigned>(getpid());
+
+	if(currentProcess)
+	{
+		InstallParkHandler();
+		parkedSlots.reserve(onlyThread ? 1 : MAX_PARKED_THREADS);
+
+		pauseLock.lock();
+		generation = releaseGeneration.load(std::memory_order_acquire);
+	}
+	else
+	{
+		// Pausing nothing would look just like pausing a process with no threads, so not being
+		// able to attach is an error.
+		tracer = ThreadTracer::Get(procId);
+		if(!tracer)
+			throw std::exception();
+	}
+#endif
+
+	// One thread on its own doesn't need everything else held still.
+	if(currentProcess && !onlyThread && ThreadRegistry::Get()->IsEnabled())
+	{
+		registry = ThreadRegistry::Get();
+		registry->Lock();
+	}
+
 	while(PauseProcessThreads(procId));
 }
 
 SingleThreadBlock::~SingleThreadBlock()
 {
+#ifdef WIN32
 	for(auto it=threadIds.begin(); it != threadIds.end(); ++it)
 		it->second.Resume();
+#else
+	if(tracer)
+	{
+		tracer->ResumeAll();
+		return;
+	}
+
+	// Also releases any straggler that takes the signal after we stopped waiting for it.
+	releaseGeneration.fetch_add(1, std::memory_order_release);
+	Futex(&releaseGeneration, FUTEX_WAKE_PRIVATE, INT_MAX);
+#endif
+
+	if(registry)
+		registry->Unlock();
+
+#ifndef WIN32
+	pauseLock.unlock();
+#endif
+}
+
+// Where a thread at ip should be moved to, or null if it isn't in any of the remaps.
+static const void *RemapIP(const SingleThreadBlock::IPRemap *remaps, unsigned count, const void *ip)
+{
+	const uint8_t *ipPtr = reinterpret_cast<const uint8_t*>(ip);
+
+	// The last remap starting at or before ip is the only one which could hold it.
+	const SingleThreadBlock::IPRemap *remap = std::upper_bound(remaps, remaps + count, ipPtr, [](const uint8_t *addr, const SingleThreadBlock::IPRemap& r)
+	{
+		return addr < reinterpret_cast<const uint8_t*>(r.start);
+	});
+	if(remap == remaps)
+		return nullptr;
+	--remap;
+
+	const uint8_t *startPtr = reinterpret_cast<const uint8_t*>(remap->start);
+	if(ipPtr > startPtr + remap->range)
+		return nullptr;
+
+	return reinterpret_cast<uint8_t*>(remap->dest) + (ipPtr - startPtr);
 }
 
 void SingleThreadBlock::OffsetIPs(void *start, unsigned range, void *dest)
 {
-	uint8_t *startPtr = reinterpret_cast<uint8_t*>(start);
-	uint8_t *destPtr = reinterpret_cast<uint8_t*>(dest);
+	IPRemap remap = { start, range, dest };
+	OffsetIPs(&remap, 1);
+}
+
+void SingleThreadBlock::OffsetIPs(const IPRemap *remaps, unsigned count)
+{
+	if(!count)
+		return;
 
+#ifdef WIN32
 	for(auto it=threadIds.begin(); it != threadIds.end(); ++it)
 	{
-		const uint8_t *ipPtr = reinterpret_cast<const uint8_t*>(it->second.GetIp());
-
-		if(ipPtr >= startPtr && ipPtr <= startPtr+range)
+		const void *ip = RemapIP(remaps, count, it->second.GetIp());
+		if(ip)
+			it->second.SetIp(ip);
+	}
+#else
+	if(tracer)
+	{
+		// Only the threads that actually move go back to the tracer, in one request.
+		ThreadTracer::ThreadStates moved;
+		for(auto it=tracedThreads.begin(); it != tracedThreads.end(); ++it)
 		{
-			ipPtr = destPtr + (ipPtr - startPtr);
-			it->second.SetIp(ipPtr);
+			const void *ip = RemapIP(remaps, count, it->ip);
+			if(ip)
+			{
+				it->ip = ip;
+				moved.push_back(*it);
+			}
 		}
+
+		if(!moved.empty())
+			tracer->SetIps(moved);
+		return;
 	}
+
+	for(auto it=parkedSlots.begin(); it != parkedSlots.end(); ++it)
+	{
+		// The kernel restores this context when the handler returns, so editing it moves the thread.
+		ucontext_t *context = static_cast<ucontext_t*>(parkSlots[*it].context.load(std::memory_order_acquire));
+		greg_t &ip = context->uc_mcontext.gregs[CONTEXT_IP];
+
+		const void *newIp = RemapIP(remaps, count, reinterpret_cast<const void*>(ip));
+		if(newIp)
+			ip = reinterpret_cast<greg_t>(newIp);
+	}
+#endif
 }
 
+#ifndef WIN32
+bool SingleThreadBlock::PausedAll() const
+{
+	return tracer == nullptr && !missedThreads;
+}
+
+unsigned SingleThreadBlock::GetPausedCount() const
+{
+	return tracer ? 0 : static_cast<unsigned>(parkedSlots.size());
+}
+
+SingleThreadBlock::PausedThread SingleThreadBlock::GetPausedThread(unsigned index) const
+{
+	static_assert(sizeof(greg_t) == sizeof(uintptr_t), "Registers are read as words");
+
+	const ParkSlot& slot = parkSlots[parkedSlots[index]];
+	const ucontext_t *context = static_cast<const ucontext_t*>(slot.context.load(std::memory_order_acquire));
+	const greg_t *gregs = context->uc_mcontext.gregs;
+
+	PausedThread thread = { static_cast<unsigned>(slot.tid.load(std::memory_order_relaxed)), reinterpret_cast<const uintptr_t*>(gregs), NGREG,
+	                        reinterpret_cast<const void*>(gregs[CONTEXT_IP]), reinterpret_cast<const void*>(gregs[CONTEXT_SP]) };
+	return thread;
+}
+#endif
+
 unsigned SingleThreadBlock::PauseProcessThreads(unsigned procId)
 {
 	unsigned threadsPaused = 0;
@@ -52,27 +440,178 @@ unsigned SingleThreadBlock::PauseProcessThreads(unsigned procId)
 #ifdef WIN32
 	unsigned curThread = static_cast<unsigned>(GetCurrentThreadId());
 
-	RemoteThreadManager remoteThreadManager(procId);
-	RemoteThreadManager::RemoteThreads remoteThreads = remoteThreadManager.GetRemoteThreads();
+	if(onlyThread)
+	{
+		if(onlyThread != curThread)
+		{
+			auto threadIt = threadIds.insert(std::make_pair(onlyThread, RemoteThread(onlyThread))).first;
+			threadIt->second.Suspend();
+		}
+
+		return 0;
+	}
 
-	for(auto it = remoteThreads.begin(); it != remoteThreads.end(); ++it)
+	// A suspended thread may hold the heap lock, so threadIds is filled before any thread is
+	// suspended, and nothing is allocated from then on.
+	if(registry && !registryMissed)
 	{
-		unsigned curThreadId = it->GetThreadId();
-		if(curThreadId != curThread)
+		// Nothing can start while the registry is locked, so the registry usually has everything.
+		const ThreadRegistry::Threads& threads = registry->GetThreads();
+		for(auto it = threads.begin(); it != threads.end(); ++it)
+			if(it->first != curThread)
+				threadIds.insert(*it);
+	}
+	else
+	{
+		// Otherwise threads are listed and opened with every thread running.
+		RemoteThreadManager remoteThreadManager(procId);
+		RemoteThreadManager::RemoteThreads remoteThreads = remoteThreadManager.GetRemoteThreads();
+
+		for(auto it = remoteThreads.begin(); it != remoteThreads.end(); ++it)
+			if(it->GetThreadId() != curThread)
+				threadIds.insert(std::make_pair(it->GetThreadId(), *it));
+	}
+
+	for(auto it = threadIds.begin(); it != threadIds.end(); ++it)
+		it->second.Suspend();
+
+	// The list is checked again without allocating. A thread may have started in the meantime,
+	// or, with the registry, still be running its TLS callbacks before it's added or after it's
+	// removed. If any was missed, they're all resumed and listed again, by the system this time.
+	bool missedThreads = false;
+	ForEachThread(procId ? procId : GetCurrentProcessId(), [&](unsigned threadId)
+	{
+		if(threadId != curThread && threadIds.find(threadId) == threadIds.end())
+			missedThreads = true;
+	});
+
+	if(missedThreads)
+	{
+		for(auto it = threadIds.begin(); it != threadIds.end(); ++it)
+			it->second.Resume();
+
+		threadIds.clear();
+		registryMissed = true;
+		threadsPaused = 1; // Go round again.
+	}
+#else
+	if(tracer)
+	{
+		// The tracer holds back threads starting during the pause, so one pass gets everything.
+		tracer->InterruptAll(tracedThreads);
+		return 0;
+	}
+
+	pid_t self = getpid();
+	pid_t curThread = GetTid();
+	missedThreads = false;
+	auto slotTidLess = [](unsigned slot, pid_t tid) { return parkSlots[slot].tid.load(std::memory_order_relaxed) < tid; };
+
+	// Signal every thread we don't already hold before waiting on any, so they all take the
+	// signal in parallel. parkedSlots was reserved up front, so none of this allocates.
+	size_t knownCount = parkedSlots.size();
+	int parkedBefore = parkedCount.load(std::memory_order_acquire);
+	parkTarget.store(INT_MAX, std::memory_order_release);
+
+	auto signalThread = [&](pid_t tid)
+	{
+		if(tid == curThread)
+			return;
+
+		if(parkedSlots.size() == parkedSlots.capacity())
 		{
-			auto tIt = threadIds.find(curThreadId);
-			if(tIt == threadIds.end())
-			{
-				it->Suspend();
-				threadIds.insert(std::make_pair(curThreadId, *it));
+			missedThreads = true;
+			return;
+		}
 
-				++threadsPaused;
-			}
+		auto knownEnd = parkedSlots.begin() + knownCount;
+		auto knownIt = std::lower_bound(parkedSlots.begin(), knownEnd, tid, slotTidLess);
+		if(knownIt != knownEnd && parkSlots[*knownIt].tid.load(std::memory_order_relaxed) == tid)
+			return;
+
+		ParkSlot *slot = AcquireSlot(tid, generation);
+		if(!slot)
+		{
+			missedThreads = true;
+			return;
 		}
+
+		if(SendParkSignal(self, tid, slot))
+			parkedSlots.push_back(static_cast<unsigned>(slot - parkSlots));
+		else
+			slot->state.store(SLOT_FREE, std::memory_order_release); // Thread exited already.
+	};
+
+	if(onlyThread)
+		signalThread(static_cast<pid_t>(onlyThread));
+	else if(registry && !registryMissed)
+	{
+		const ThreadRegistry::Threads& threads = registry->GetThreads();
+		for(auto it = threads.begin(); it != threads.end(); ++it)
+			signalThread(static_cast<pid_t>(*it));
 	}
-#else
+	else
+		ForEachTask(signalThread);
+
+	parkTarget.store(parkedBefore + static_cast<int>(parkedSlots.size() - knownCount), std::memory_order_release);
+
+	int64_t deadline = MonotonicNs() + ACK_TIMEOUT_NS;
+	for(auto it = parkedSlots.begin() + knownCount; it != parkedSlots.end(); ++it)
+	{
+		ParkSlot &slot = parkSlots[*it];
+		for(;;)
+		{
+			int seen = parkedCount.load(std::memory_order_acquire);
+			if(slot.state.load(std::memory_order_acquire) != SLOT_SIGNALED)
+				break;
+
+			int64_t remaining = deadline - MonotonicNs();
+			if(remaining <= 0)
+				break;
+
+			timespec timeout = { static_cast<time_t>(remaining / 1000000000), static_cast<long>(remaining % 1000000000) };
+			Futex(&parkedCount, FUTEX_WAIT_PRIVATE, seen, &timeout);
+		}
+	}
+
+	// Take back the slots of threads that never parked. If one parks just as we give up on it,
+	// the exchange fails and it's counted as paused after all.
+	auto keptEnd = std::remove_if(parkedSlots.begin() + knownCount, parkedSlots.end(), [](unsigned slot)
+	{
+		int expected = SLOT_SIGNALED;
+		return parkSlots[slot].state.compare_exchange_strong(expected, SLOT_FREE, std::memory_order_acq_rel);
+	});
+	if(keptEnd != parkedSlots.end())
+		missedThreads = true;
+	parkedSlots.erase(keptEnd, parkedSlots.end());
+
+	std::sort(parkedSlots.begin(), parkedSlots.end(), [](unsigned lhs, unsigned rhs)
+	{
+		return parkSlots[lhs].tid.load(std::memory_order_relaxed) < parkSlots[rhs].tid.load(std::memory_order_relaxed);
+	});
 
+	if(onlyThread)
+		threadsPaused = 0;
+	else if(registry && !registryMissed)
+	{
+		// A thread is only in the registry from its start routine until its cleanup handlers
+		// run, but it's running before and after. So the task list is checked once too, and if
+		// it has a thread we don't hold, the remaining rounds list tasks instead.
+		ForEachTask([&](pid_t tid)
+		{
+			if(tid == curThread)
+				return;
+
+			auto knownIt = std::lower_bound(parkedSlots.begin(), parkedSlots.end(), tid, slotTidLess);
+			if(knownIt == parkedSlots.end() || parkSlots[*knownIt].tid.load(std::memory_order_relaxed) != tid)
+				registryMissed = true;
+		});
+
+		threadsPaused = registryMissed ? 1 : 0;
+	}
+	else
+		threadsPaused = static_cast<unsigned>(parkedSlots.size() - knownCount);
 #endif
 
 	return threadsPaused;
-}
\ No newline at end of file
+}
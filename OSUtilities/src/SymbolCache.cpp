@@ -0,0 +1,101 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		SymbolCache.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Keeps built SymbolIndexes on disk, by build id (Linux only)
+ */
+
+#ifndef WIN32
+
+#include "SymbolCache.h"
+#include "SymbolIndex.h"
+#include "ElfImage.h"
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+
+SymbolCache::SymbolCache() : directory(), lock()
+{
+	const char *cacheHome = std::getenv("XDG_CACHE_HOME");
+	const char *home = std::getenv("HOME");
+
+	if(cacheHome && *cacheHome)
+		directory = std::string(cacheHome) + "/osutilities/symbols";
+	else if(home && *home)
+		directory = std::string(home) + "/.cache/osutilities/symbols";
+}
+
+SymbolCache* SymbolCache::Get()
+{
+	static SymbolCache cache;
+	return &cache;
+}
+
+void SymbolCache::SetDirectory(const std::string& dir)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	directory = dir;
+}
+
+std::string SymbolCache::GetDirectory()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return directory;
+}
+
+std::string SymbolCache::GetPath(const std::string& buildId)
+{
+	std::string dir = GetDirectory();
+	if(dir.empty() || buildId.empty())
+		return "";
+
+	return dir + "/" + buildId + ".sidx";
+}
+
+SymbolIndex *SymbolCache::Load(const ElfImage& image, const void *moduleBase, const std::string& root)
+{
+	std::string path = GetPath(image.GetBuildId());
+	if(path.empty())
+		return nullptr;
+
+	SymbolIndex *index = SymbolIndex::Load(path, moduleBase);
+	if(index && !index->HasStaticSymbols() && !FindDebugFile(image.GetBuildId(), root).empty())
+	{
+		delete index;
+		return nullptr;
+	}
+
+	return index;
+}
+
+void SymbolCache::Store(const ElfImage& image, const SymbolIndex& index)
+{
+	std::string path = GetPath(image.GetBuildId());
+	if(path.empty())
+		return;
+
+	// Make each missing directory along the way, as mkdir -p would.
+	for(size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1))
+		if(mkdir(path.substr(0, slash).c_str(), 0755) && errno != EEXIST)
+			return;
+
+	index.Save(path);
+}
+
+std::string SymbolCache::FindDebugFile(const std::string& buildId, const std::string& root)
+{
+	if(buildId.size() < 3)
+		return "";
+
+	// The first byte names a directory, the rest the file.
+	std::string path = root + "/usr/lib/debug/.build-id/" + buildId.substr(0, 2) + "/" + buildId.substr(2) + ".debug";
+	if(access(path.c_str(), R_OK))
+		return "";
+
+	return path;
+}
+
+#endif
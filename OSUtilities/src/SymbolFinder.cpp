@@ -10,10 +10,13 @@
 #include "SymbolFinder.h"
 #include "ProcessHandleManager.h"
 #include "ModuleExplorer.h"
+#include "ModuleWatcher.h"
 #include "Module.h"
+#include "SymbolSearch.h"
 #include <cstdint>
 #include <algorithm>
 #include <cctype>
+#include <cstring>
 
 #ifdef _MSC_VER
 # define WIN32_LEAN_AND_MEAN
@@ -22,42 +25,108 @@
 # include <DbgHelp.h>
 # pragma warning(default:4091)
 #else
+# include "ElfImage.h"
+# include "SymbolIndex.h"
+# include <thread>
+# include <atomic>
+# include <vector>
+# include <elf.h>
+# include <dlfcn.h>
+# include <unistd.h>
+#endif
+
+#ifdef WIN32
+// Module names are stored lower case, as file names aren't case sensitive.
+static std::string NormalizeModuleName(const char *module)
+{
+	std::string modName = module;
+	std::transform(modName.begin(), modName.end(), modName.begin(), std::tolower);
+	return modName;
+}
+#endif
 
+static bool IsCurrentProcess(unsigned procId)
+{
+#ifdef WIN32
+	return procId == GetCurrentProcessId();
+#else
+	return procId == static_cast<unsigned>(getpid());
 #endif
+}
 
-SymbolFinder::SymbolFinder(unsigned procId) : procHandle(ProcessHandleManager::Get()->GetHandle(procId)), addrToName(20000), nameToAddr(20000)
+#ifdef WIN32
+SymbolFinder::SymbolFinder(unsigned procId) : procHandle(ProcessHandleManager::Get()->GetHandle(procId)), listenerId(0), addrToName(20000), nameToAddr(20000),
+                                              modules(), exportsLock()
 {
 	if(!procHandle.EnsureRights(PROCESS_VM_READ | PROCESS_QUERY_INFORMATION))
 		throw std::exception();
 
-	PopulateModuleExports();
-
 #ifdef _MSC_VER
 	if(!SymInitialize(procHandle, NULL, true))
 		throw std::exception();
+#endif
 #else
+SymbolFinder::SymbolFinder(unsigned procId) : procHandle(ProcessHandleManager::Get()->GetHandle(procId)), listenerId(0), modules(), tablesLoaded()
+{
+#endif
+	try
+	{
+		// Our own modules are followed as they come and go. The watcher stays locked from
+		// listing the modules to listening, so no change can slip in between.
+		if(IsCurrentProcess(procHandle.GetProcId()))
+		{
+			ModuleWatcher *watcher = ModuleWatcher::Get();
+			watcher->Lock();
+			try
+			{
+				ModulesChanged(watcher->GetModules(), ModuleExplorer::Modules());
+				listenerId = watcher->AddListener([this](const ModuleExplorer::Modules& loaded, const ModuleExplorer::Modules& unloaded)
+				{
+					ModulesChanged(loaded, unloaded);
+				});
+			}
+			catch(...)
+			{
+			}
+			watcher->Unlock();
+		}
+		else
+			ModulesChanged(ModuleExplorer(procHandle.GetProcId()).GetModules(), ModuleExplorer::Modules());
+	}
+	catch(...)
+	{
+	}
 
+#ifndef WIN32
+	if(!modules)
+		modules = std::make_shared<const ModuleExplorer::Modules>();
 #endif
 }
 
 SymbolFinder::~SymbolFinder()
 {
+	if(listenerId)
+		ModuleWatcher::Get()->RemoveListener(listenerId);
+
+#ifdef _MSC_VER
      SymCleanup(procHandle);
+#endif
 }
 
+#ifdef WIN32
 const void *SymbolFinder::GetSymbolAddr(const char *symbol, const char* module) const
 {
 	static const char* kernel32Hack = "kernel32.dll";
 	if(!module)
 		module = kernel32Hack;
 
+	std::unique_lock<std::mutex> guard(exportsLock);
 	auto itPair = nameToAddr.equal_range(symbol);
 	if(itPair.first != nameToAddr.end())
 	{
 		if(module)
 		{
-			std::string modName = module;
-			std::transform(modName.begin(), modName.end(), modName.begin(), std::tolower);
+			std::string modName = NormalizeModuleName(module);
 
 			for(auto it = itPair.first; it != itPair.second; ++it)
 				if(it->second.first.GetName() == modName)
@@ -66,6 +135,7 @@ const void *SymbolFinder::GetSymbolAddr(const char *symbol, const char* module)
 
 		return itPair.first->second.second;
 	}
+	guard.unlock();
 
 #ifdef _MSC_VER
 	SYMBOL_INFO newStateSym;
@@ -77,19 +147,19 @@ const void *SymbolFinder::GetSymbolAddr(const char *symbol, const char* module)
 
 	return reinterpret_cast<void*>(newStateSym.Address);
 #else
-
+	return nullptr;
 #endif
 }
 
 std::string SymbolFinder::GetSymbolName(const void *addr, const char* module) const
 {
+	std::unique_lock<std::mutex> guard(exportsLock);
 	auto itPair = addrToName.equal_range(addr);
 	if(itPair.first != addrToName.end())
 	{
 		if(module)
 		{
-			std::string modName = module;
-			std::transform(modName.begin(), modName.end(), modName.begin(), std::tolower);
+			std::string modName = NormalizeModuleName(module);
 
 			for(auto it=itPair.first; it != itPair.second; ++it)
 				if(it->second.first.GetName() == modName)
@@ -98,6 +168,7 @@ std::string SymbolFinder::GetSymbolName(const void *addr, const char* module) co
 
 		return itPair.first->second.second;
 	}
+	guard.unlock();
 
 #ifdef _MSC_VER
 	const unsigned maxNameLen = 256;
@@ -113,34 +184,372 @@ std::string SymbolFinder::GetSymbolName(const void *addr, const char* module) co
 
 	return std::string(newStateSym->Name, newStateSym->NameLen);
 #else
-
+	return "";
 #endif
 }
 
-void SymbolFinder::PopulateModuleExports()
+#ifdef _MSC_VER
+namespace
 {
-	try
+	struct EnumContext
 	{
-		ModuleExplorer modExplorer(procHandle.GetProcId());
-		ModuleExplorer::Modules modules = modExplorer.GetModules();
+		SymbolFinder::Symbols *symbols;
+		const std::unordered_map<DWORD64, bool> *allowedModules;
+		const char *pattern;
+	};
+
+	BOOL CALLBACK AddEnumeratedSymbol(PSYMBOL_INFO info, ULONG, PVOID contextPtr)
+	{
+		const DWORD SYMTAG_FUNCTION = 5; // From cvconst.h
+		EnumContext *context = static_cast<EnumContext*>(contextPtr);
+
+		if(info->Tag == SYMTAG_FUNCTION && (!context->allowedModules || context->allowedModules->count(info->ModBase)) &&
+		   SymbolFinder::MatchesPattern(context->pattern, info->Name))
+			context->symbols->push_back(std::make_pair(std::string(info->Name, info->NameLen), reinterpret_cast<const void*>(info->Address)));
+
+		return TRUE;
+	}
+}
+#endif
+
+SymbolFinder::Symbols SymbolFinder::FindSymbols(const char *pattern, const char *moduleFilter, bool exportedOnly) const
+{
+	Symbols symbols;
+	std::string filter = moduleFilter ? NormalizeModuleName(moduleFilter) : "";
+	std::unordered_map<DWORD64, bool> allowedModules;
+
+	ModuleExplorer::Modules searched;
+	{
+		std::lock_guard<std::mutex> guard(exportsLock);
+		searched = modules;
+	}
 
-		for(auto it=modules.begin(); it != modules.end(); ++it)
+	std::vector<unsigned> matches;
+	for(auto it = searched.begin(); it != searched.end(); ++it)
+	{
+		if(moduleFilter && !MatchesPattern(filter.c_str(), it->GetName().c_str()))
+			continue;
+
+		allowedModules[reinterpret_cast<DWORD64>(it->GetAddress())] = true;
+
+		const SymbolSearch *search = it->GetSymbolSearch();
+		if(!search)
+			continue;
+
+		matches.clear();
+		search->Find(pattern, matches);
+		for(auto matchIt = matches.begin(); matchIt != matches.end(); ++matchIt)
+			symbols.push_back(std::make_pair(std::string(search->GetName(*matchIt)), search->GetAddress(*matchIt)));
+	}
+
+#ifdef _MSC_VER
+	// The pdb has every other function. DbgHelp filters by name itself, but its wildcards
+	// aren't quite ours, so everything is checked again.
+	if(!exportedOnly)
+	{
+		EnumContext context = { &symbols, moduleFilter ? &allowedModules : nullptr, pattern };
+		SymEnumSymbols(procHandle, 0, (std::string("*!") + pattern).c_str(), AddEnumeratedSymbol, &context);
+	}
+#endif
+
+	return symbols;
+}
+
+#else
+const void *SymbolFinder::GetSymbolAddr(const char *symbol, const char* module) const
+{
+	ModuleList modules = GetModuleList();
+
+	// The hinted module goes first, then everything else.
+	for(int pass = module ? 0 : 1; pass < 2; ++pass)
+	{
+		for(auto it = modules->begin(); it != modules->end(); ++it)
 		{
-			try
-			{
-				Module::Functions functions = it->GetFunctions();
-				for(auto fIt = functions.begin(); fIt != functions.end(); ++fIt)
-				{
-					addrToName.insert(std::make_pair(fIt->second, std::make_pair(*it, fIt->first)));
-					nameToAddr.insert(std::make_pair(fIt->first, std::make_pair(*it, fIt->second)));
-				}
-			}
-			catch(...)
+			if(module && IsHinted(*it, module) != !pass)
+				continue;
+
+			const ElfImage *image = it->GetImage();
+			if(!image)
+				continue;
+
+			const ElfImage::Symbol *found = image->FindExport(symbol);
+			if(!found)
+				continue;
+
+			if(ELF64_ST_TYPE(found->st_info) == STT_GNU_IFUNC)
 			{
+				const void *resolved = ResolveIfunc(*it, symbol);
+				if(resolved)
+					return resolved;
 			}
+
+			return image->GetAddress(*found);
 		}
 	}
+
+	// Not exported by anything, so it could be a local function.
+	LoadSymbolTables();
+	for(int pass = module ? 0 : 1; pass < 2; ++pass)
+	{
+		for(auto it = modules->begin(); it != modules->end(); ++it)
+		{
+			if(module && IsHinted(*it, module) != !pass)
+				continue;
+
+			const SymbolIndex *index = it->GetSymbolIndex();
+			const void *found = index ? index->FindName(symbol) : nullptr;
+			if(found)
+				return found;
+		}
+	}
+
+	return nullptr;
+}
+
+std::string SymbolFinder::GetSymbolName(const void *addr, const char* module) const
+{
+	ModuleList modules = GetModuleList();
+
+	// Modules are sorted by address, so the only one which could hold addr is the last to start
+	// at or before it.
+	auto modIt = std::upper_bound(modules->begin(), modules->end(), addr, [](const void *lhs, const Module& rhs)
+	{
+		return lhs < rhs.GetAddress();
+	});
+	if(modIt == modules->begin())
+		return "";
+	--modIt;
+
+	if(!modIt->Contains(addr) || (module && !IsHinted(*modIt, module)))
+		return "";
+
+	const SymbolIndex *index = modIt->GetSymbolIndex();
+	if(!index)
+		return "";
+
+	const char *name = index->Find(addr);
+	return name ? name : "";
+}
+
+void SymbolFinder::LoadSymbolTables() const
+{
+	std::call_once(tablesLoaded, [this]()
+	{
+		ModuleList modules = GetModuleList();
+		unsigned threadCount = std::max(1u, std::min(std::thread::hardware_concurrency(), static_cast<unsigned>(modules->size())));
+
+		// Each module is a separate job, handed out in order. Modules build their own index at
+		// most once, so this thread helping out can't duplicate anyone's work. Modules loaded
+		// later are indexed as they're first asked about.
+		std::atomic<size_t> next(0);
+		auto work = [&modules, &next]()
+		{
+			for(size_t i = next++; i < modules->size(); i = next++)
+				(*modules)[i].GetSymbolIndex();
+		};
+
+		std::vector<std::thread> threads;
+		for(unsigned i=1; i<threadCount; ++i)
+			threads.emplace_back(work);
+
+		work();
+		for(auto it = threads.begin(); it != threads.end(); ++it)
+			it->join();
+	});
+}
+
+SymbolFinder::Symbols SymbolFinder::FindSymbols(const char *pattern, const char *moduleFilter, bool exportedOnly) const
+{
+	Symbols symbols;
+	ModuleList modules = GetModuleList();
+	LoadSymbolTables();
+
+	std::vector<unsigned> matches;
+	for(auto it = modules->begin(); it != modules->end(); ++it)
+	{
+		if(moduleFilter && !MatchesPattern(moduleFilter, it->GetName().c_str()))
+			continue;
+
+		const SymbolSearch *search = it->GetSymbolSearch();
+		if(!search)
+			continue;
+
+		const ElfImage *image = it->GetImage();
+		matches.clear();
+		search->Find(pattern, matches);
+		for(auto matchIt = matches.begin(); matchIt != matches.end(); ++matchIt)
+		{
+			const char *name = search->GetName(*matchIt);
+			const void *addr = search->GetAddress(*matchIt);
+
+			const ElfImage::Symbol *exported = image ? image->FindExport(name) : nullptr;
+			if(exportedOnly && (!exported || !ElfImage::IsExportedFunction(*exported, true)))
+				continue;
+
+			// The index has an ifunc's resolver, not the function it picks.
+			if(exported && ELF64_ST_TYPE(exported->st_info) == STT_GNU_IFUNC && image->GetAddress(*exported) == addr)
+				addr = ResolveIfunc(*it, name);
+
+			if(addr)
+				symbols.push_back(std::make_pair(std::string(name), addr));
+		}
+	}
+
+	return symbols;
+}
+
+const void *SymbolFinder::ResolveIfunc(const Module& mod, const char *symbol) const
+{
+	// An ifunc's symbol is the resolver picking an implementation for this cpu. In our own
+	// process the loader can tell us which one it picked.
+	if(procHandle.GetProcId() != static_cast<unsigned>(getpid()))
+		return nullptr;
+
+	void *handle = dlopen(mod.GetPath().c_str(), RTLD_LAZY | RTLD_NOLOAD);
+	void *resolved = handle ? dlsym(handle, symbol) : nullptr;
+	if(handle)
+		dlclose(handle);
+
+	return resolved;
+}
+
+SymbolFinder::ModuleList SymbolFinder::GetModuleList() const
+{
+	return std::atomic_load(&modules);
+}
+
+void SymbolFinder::ModulesChanged(const ModuleExplorer::Modules& loaded, const ModuleExplorer::Modules& unloaded)
+{
+	// Readers keep whichever list they started with, so the new one is a copy. Changes come one
+	// at a time from the ModuleWatcher.
+	ModuleList oldModules = GetModuleList();
+	std::shared_ptr<ModuleExplorer::Modules> newModules = std::make_shared<ModuleExplorer::Modules>();
+	if(oldModules)
+		*newModules = *oldModules;
+
+	auto byAddress = [](const Module& lhs, const Module& rhs)
+	{
+		return lhs.GetAddress() < rhs.GetAddress();
+	};
+
+	for(auto it = unloaded.begin(); it != unloaded.end(); ++it)
+	{
+		auto modIt = std::lower_bound(newModules->begin(), newModules->end(), *it, byAddress);
+		if(modIt != newModules->end() && modIt->GetAddress() == it->GetAddress())
+			newModules->erase(modIt);
+	}
+
+	for(auto it = loaded.begin(); it != loaded.end(); ++it)
+		newModules->insert(std::upper_bound(newModules->begin(), newModules->end(), *it, byAddress), *it);
+
+	std::atomic_store(&modules, ModuleList(newModules));
+}
+
+bool SymbolFinder::IsHinted(const Module& mod, const char *module) const
+{
+	// Hints may leave off version suffixes, so "libssl.so" finds libssl.so.3.
+	return !mod.GetName().compare(0, std::strlen(module), module);
+}
+#endif
+
+bool SymbolFinder::MatchesPattern(const char *pattern, const char *str)
+{
+	// On a mismatch, go back to the last '*' and let it swallow one more character. Only the
+	// last '*' ever needs revisiting, so this is linear in practice.
+	const char *star = nullptr;
+	const char *starStr = nullptr;
+	while(*str)
+	{
+		if(*pattern == '*')
+		{
+			star = pattern++;
+			starStr = str;
+		}
+		else if(*pattern == '?' || *pattern == *str)
+		{
+			++pattern;
+			++str;
+		}
+		else if(star)
+		{
+			pattern = star + 1;
+			str = ++starStr;
+		}
+		else
+			return false;
+	}
+
+	while(*pattern == '*')
+		++pattern;
+
+	return !*pattern;
+}
+
+#ifdef WIN32
+void SymbolFinder::ModulesChanged(const ModuleExplorer::Modules& loaded, const ModuleExplorer::Modules& unloaded)
+{
+	for(auto it = unloaded.begin(); it != unloaded.end(); ++it)
+		RemoveModuleExports(*it);
+
+	for(auto it = loaded.begin(); it != loaded.end(); ++it)
+		AddModuleExports(*it);
+}
+
+void SymbolFinder::AddModuleExports(const Module& mod)
+{
+	Module::Functions functions;
+	try
+	{
+		functions = mod.GetFunctions();
+	}
 	catch(...)
 	{
 	}
+
+	std::lock_guard<std::mutex> guard(exportsLock);
+	for(auto fIt = functions.begin(); fIt != functions.end(); ++fIt)
+	{
+		addrToName.insert(std::make_pair(fIt->second, std::make_pair(mod, fIt->first)));
+		nameToAddr.insert(std::make_pair(fIt->first, std::make_pair(mod, fIt->second)));
+	}
+	modules.push_back(mod);
+
+#ifdef _MSC_VER
+	// Modules there when we started were loaded by SymInitialize.
+	if(listenerId)
+		SymLoadModuleEx(procHandle, NULL, mod.GetName().c_str(), NULL, reinterpret_cast<uintptr_t>(mod.GetAddress()), mod.GetSize(), NULL, 0);
+#endif
+}
+
+void SymbolFinder::RemoveModuleExports(const Module& mod)
+{
+	std::lock_guard<std::mutex> guard(exportsLock);
+	for(auto it = addrToName.begin(); it != addrToName.end();)
+	{
+		if(it->second.first.GetAddress() == mod.GetAddress())
+			it = addrToName.erase(it);
+		else
+			++it;
+	}
+
+	for(auto it = nameToAddr.begin(); it != nameToAddr.end();)
+	{
+		if(it->second.first.GetAddress() == mod.GetAddress())
+			it = nameToAddr.erase(it);
+		else
+			++it;
+	}
+
+	for(auto it = modules.begin(); it != modules.end();)
+	{
+		if(it->GetAddress() == mod.GetAddress())
+			it = modules.erase(it);
+		else
+			++it;
+	}
+
+#ifdef _MSC_VER
+	SymUnloadModule64(procHandle, reinterpret_cast<uintptr_t>(mod.GetAddress()));
+#endif
 }
+#endif
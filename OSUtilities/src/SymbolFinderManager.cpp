@@ -10,7 +10,7 @@
 #include "SymbolFinderManager.h"
 #include "SymbolFinder.h"
 
-SymbolFinderManager::SymbolFinderManager() : symbolFinders() {}
+SymbolFinderManager::SymbolFinderManager() : symbolFinders(), lock() {}
 SymbolFinderManager::~SymbolFinderManager() 
 {
 	for(auto it=symbolFinders.begin(); it != symbolFinders.end(); ++it)
@@ -21,6 +21,8 @@ const SymbolFinder* SymbolFinderManager::Get(unsigned procId)
 {
 	static SymbolFinderManager manager;
 
+	std::lock_guard<std::mutex> guard(manager.lock);
+
 	auto it = manager.symbolFinders.find(procId);
 	if(it == manager.symbolFinders.end())
 		it = manager.symbolFinders.insert(std::make_pair(procId, new SymbolFinder(procId))).first;
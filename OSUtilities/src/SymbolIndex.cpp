@@ -0,0 +1,289 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		SymbolIndex.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Finds the function containing an address in an ELF module (Linux only)
+ */
+
+#ifndef WIN32
+
+#include "SymbolIndex.h"
+#include "ElfImage.h"
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace
+{
+	struct Entry
+	{
+		uint32_t start;
+		uint32_t size;
+		const char *name;
+		unsigned rank;  // Lower is preferred when names share a start.
+	};
+
+	unsigned BindingRank(const ElfImage::Symbol& symbol)
+	{
+		switch(ELF64_ST_BIND(symbol.st_info))
+		{
+			case STB_GLOBAL: return 0;
+			case STB_WEAK:   return 1;
+			default:         return 2;
+		}
+	}
+
+	bool IsFunction(const ElfImage::Symbol& symbol)
+	{
+		unsigned type = ELF64_ST_TYPE(symbol.st_info);
+		return symbol.st_shndx != SHN_UNDEF && (type == STT_FUNC || type == STT_GNU_IFUNC);
+	}
+}
+
+SymbolIndex::SymbolIndex(const void *moduleBase) : moduleBase(static_cast<const uint8_t*>(moduleBase)), moduleSize(0), count(0), flags(0),
+                                                   starts(nullptr), sizes(nullptr), names(nullptr), strings(nullptr), stringsSize(0),
+                                                   columns(), stringData(), fileMap(nullptr), fileSize(0)
+{
+}
+
+SymbolIndex::SymbolIndex(const ElfImage& image, const void *moduleBase, size_t moduleSize, const ElfImage *debugImage) : moduleBase(static_cast<const uint8_t*>(moduleBase)),
+                                                                                                                      moduleSize(static_cast<uint32_t>(moduleSize)), count(0), flags(0),
+                                                                                                                      starts(nullptr), sizes(nullptr), names(nullptr), strings(nullptr), stringsSize(0),
+                                                                                                                      columns(), stringData(), fileMap(nullptr), fileSize(0)
+{
+	std::vector<Entry> entries;
+	entries.reserve(image.GetSymbolCount() + image.GetStaticSymbolCount() + (debugImage ? debugImage->GetStaticSymbolCount() : 0));
+
+	auto add = [&](const ElfImage& source, const ElfImage::Symbol& symbol, const char *name)
+	{
+		if(!IsFunction(symbol) || !*name)
+			return;
+
+		const uint8_t *addr = static_cast<const uint8_t*>(source.GetAddress(symbol));
+		if(addr < this->moduleBase || addr >= this->moduleBase + this->moduleSize)
+			return;
+
+		Entry entry = { static_cast<uint32_t>(addr - this->moduleBase), static_cast<uint32_t>(symbol.st_size), name, BindingRank(symbol) };
+		entries.push_back(entry);
+	};
+
+	for(unsigned i=0; i<image.GetSymbolCount(); ++i)
+		add(image, image.GetSymbol(i), image.GetName(image.GetSymbol(i)));
+
+	for(unsigned i=0; i<image.GetStaticSymbolCount(); ++i)
+		add(image, image.GetStaticSymbol(i), image.GetStaticName(image.GetStaticSymbol(i)));
+
+	if(debugImage)
+		for(unsigned i=0; i<debugImage->GetStaticSymbolCount(); ++i)
+			add(*debugImage, debugImage->GetStaticSymbol(i), debugImage->GetStaticName(debugImage->GetStaticSymbol(i)));
+
+	if(image.GetStaticSymbolCount() || (debugImage && debugImage->GetStaticSymbolCount()))
+		flags |= HAS_STATIC;
+
+	std::sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs)
+	{
+		if(lhs.start != rhs.start)
+			return lhs.start < rhs.start;
+		return lhs.rank < rhs.rank;
+	});
+
+	// Best name for each start first, so dropping the rest keeps it.
+	entries.erase(std::unique(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs)
+	{
+		return lhs.start == rhs.start;
+	}), entries.end());
+
+	// Names are copied rather than pointed to, so the images can go once this is built.
+	count = static_cast<uint32_t>(entries.size());
+	columns.resize(count * 3);
+	for(size_t i=0; i<entries.size(); ++i)
+	{
+		uint32_t size = entries[i].size;
+		if(!size)
+			size = (i + 1 < entries.size() ? entries[i + 1].start : this->moduleSize) - entries[i].start;
+
+		columns[i]             = entries[i].start;
+		columns[count + i]     = size;
+		columns[count * 2 + i] = static_cast<uint32_t>(stringData.size());
+		stringData.insert(stringData.end(), entries[i].name, entries[i].name + std::strlen(entries[i].name) + 1);
+	}
+
+	starts      = columns.data();
+	sizes       = starts + count;
+	names       = sizes + count;
+	strings     = stringData.data();
+	stringsSize = static_cast<uint32_t>(stringData.size());
+}
+
+SymbolIndex::~SymbolIndex()
+{
+	if(fileMap)
+		munmap(fileMap, fileSize);
+}
+
+SymbolIndex *SymbolIndex::Load(const std::string& path, const void *moduleBase)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return nullptr;
+
+	struct stat info;
+	if(fstat(fd, &info) || static_cast<size_t>(info.st_size) < sizeof(FileHeader))
+	{
+		close(fd);
+		return nullptr;
+	}
+
+	size_t size = static_cast<size_t>(info.st_size);
+	void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if(map == MAP_FAILED)
+		return nullptr;
+
+	SymbolIndex *index = new SymbolIndex(moduleBase);
+	index->fileMap  = map;
+	index->fileSize = size;
+
+	const FileHeader *header = static_cast<const FileHeader*>(map);
+	if(header->magic != FILE_MAGIC || header->version != FILE_VERSION ||
+	   sizeof(FileHeader) + static_cast<uint64_t>(header->count) * 3 * sizeof(uint32_t) + header->stringsSize != size)
+	{
+		delete index;
+		return nullptr;
+	}
+
+	index->moduleSize  = header->moduleSize;
+	index->count       = header->count;
+	index->flags       = header->flags;
+	index->starts      = reinterpret_cast<const uint32_t*>(header + 1);
+	index->sizes       = index->starts + index->count;
+	index->names       = index->sizes + index->count;
+	index->strings     = reinterpret_cast<const char*>(index->names + index->count);
+	index->stringsSize = header->stringsSize;
+
+	// A damaged file must not send a lookup outside the mapping. Checking costs a pass over the
+	// names, which is still far less than building the index again.
+	bool valid = !index->stringsSize || !index->strings[index->stringsSize - 1];
+	for(uint32_t i=0; i<index->count && valid; ++i)
+		valid = index->names[i] < index->stringsSize && (!i || index->starts[i - 1] < index->starts[i]);
+
+	if(!valid)
+	{
+		delete index;
+		return nullptr;
+	}
+
+	return index;
+}
+
+bool SymbolIndex::Save(const std::string& path) const
+{
+	FileHeader header = { FILE_MAGIC, FILE_VERSION, moduleSize, count, stringsSize, flags };
+
+	// Written beside the real name and renamed over it, so a process loading it at the same time
+	// gets the old file or the new one.
+	std::ostringstream tempPath;
+	tempPath << path << '.' << getpid() << ".tmp";
+
+	int fd = open(tempPath.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0)
+		return false;
+
+	auto writeAll = [fd](const void *data, size_t size)
+	{
+		const char *bytes = static_cast<const char*>(data);
+		while(size)
+		{
+			ssize_t written = write(fd, bytes, size);
+			if(written <= 0)
+				return false;
+
+			bytes += written;
+			size  -= static_cast<size_t>(written);
+		}
+		return true;
+	};
+
+	bool written = writeAll(&header, sizeof(header)) &&
+	               writeAll(starts, count * sizeof(uint32_t)) &&
+	               writeAll(sizes,  count * sizeof(uint32_t)) &&
+	               writeAll(names,  count * sizeof(uint32_t)) &&
+	               writeAll(strings, stringsSize);
+
+	if(close(fd) || !written || rename(tempPath.str().c_str(), path.c_str()))
+	{
+		unlink(tempPath.str().c_str());
+		return false;
+	}
+
+	return true;
+}
+
+const char *SymbolIndex::Find(const void *addr, size_t *offset) const
+{
+	const uint8_t *addrPtr = static_cast<const uint8_t*>(addr);
+	if(!count || addrPtr < moduleBase || addrPtr >= moduleBase + moduleSize)
+		return nullptr;
+
+	uint32_t target = static_cast<uint32_t>(addrPtr - moduleBase);
+
+	// Halve the range every step without branching on the comparison, which a profiler's
+	// addresses would make unpredictable.
+	const uint32_t *base = starts;
+	size_t remaining = count;
+	while(remaining > 1)
+	{
+		size_t half = remaining / 2;
+		base = base[half] <= target ? base + half : base;
+		remaining -= half;
+	}
+
+	size_t index = static_cast<size_t>(base - starts);
+	uint32_t into = target - *base;
+	if(*base > target || into >= sizes[index])
+		return nullptr;
+
+	if(offset)
+		*offset = into;
+
+	return strings + names[index];
+}
+
+const void *SymbolIndex::FindName(const char *name) const
+{
+	for(uint32_t i=0; i<count; ++i)
+		if(!std::strcmp(strings + names[i], name))
+			return moduleBase + starts[i];
+
+	return nullptr;
+}
+
+unsigned SymbolIndex::GetCount() const
+{
+	return count;
+}
+
+const char *SymbolIndex::GetName(unsigned index) const
+{
+	return strings + names[index];
+}
+
+const void *SymbolIndex::GetAddress(unsigned index) const
+{
+	return moduleBase + starts[index];
+}
+
+bool SymbolIndex::HasStaticSymbols() const
+{
+	return (flags & HAS_STATIC) != 0;
+}
+
+#endif
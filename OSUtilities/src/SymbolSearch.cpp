@@ -0,0 +1,445 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		SymbolSearch.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Finds a module's functions by prefix, glob or substring of their names
+ */
+
+#include "SymbolSearch.h"
+#include "SymbolFinder.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#ifdef _MSC_VER
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+# pragma warning(disable:4091)
+# include <DbgHelp.h>
+# pragma warning(default:4091)
+#else
+# include <cxxabi.h>
+#endif
+
+namespace
+{
+	const unsigned CLASS_BITS = 6;
+	const uint32_t KEY_COUNT  = 1 << (CLASS_BITS * 3);
+
+	// Roughly how many list entries can be read in the time it takes to match one name.
+	const size_t LIST_READS_PER_MATCH = 16;
+
+	// Trigrams are made of character classes rather than characters. Letters are folded to one
+	// case, and punctuation not listed here all lands in class 0.
+	struct CharClasses
+	{
+		uint8_t classes[256];
+
+		CharClasses()
+		{
+			static const char punctuation[] = ":()<>,*& ~.[]-=+!$@?{}'|^/";
+
+			std::fill(classes, classes + 256, static_cast<uint8_t>(0));
+			uint8_t next = 1;
+			for(char c = 'a'; c <= 'z'; ++c, ++next)
+				classes[static_cast<uint8_t>(c)] = classes[static_cast<uint8_t>(c - 'a' + 'A')] = next;
+			for(char c = '0'; c <= '9'; ++c, ++next)
+				classes[static_cast<uint8_t>(c)] = next;
+			classes[static_cast<uint8_t>('_')] = next++;
+			for(const char *c = punctuation; *c; ++c, ++next)
+				classes[static_cast<uint8_t>(*c)] = next;
+		}
+	};
+
+	const uint8_t *GetCharClasses()
+	{
+		static const CharClasses charClasses;
+		return charClasses.classes;
+	}
+
+	uint32_t TrigramKey(const uint8_t *classes, const char *str)
+	{
+		return (classes[static_cast<uint8_t>(str[0])] << (CLASS_BITS * 2)) | (classes[static_cast<uint8_t>(str[1])] << CLASS_BITS) | classes[static_cast<uint8_t>(str[2])];
+	}
+
+	unsigned VarintSize(uint32_t value)
+	{
+		unsigned size = 1;
+		while(value >= 0x80)
+		{
+			value >>= 7;
+			++size;
+		}
+		return size;
+	}
+
+	uint8_t *WriteVarint(uint8_t *out, uint32_t value)
+	{
+		while(value >= 0x80)
+		{
+			*out++ = static_cast<uint8_t>(value | 0x80);
+			value >>= 7;
+		}
+		*out++ = static_cast<uint8_t>(value);
+		return out;
+	}
+
+	const uint8_t *ReadVarint(const uint8_t *in, uint32_t& value)
+	{
+		value = 0;
+		for(unsigned shift = 0; ; shift += 7)
+		{
+			uint8_t byte = *in++;
+			value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+			if(!(byte & 0x80))
+				return in;
+		}
+	}
+
+	// Demangles into the same buffer every time, rather than allocating a string per name.
+	class Demangler
+	{
+		private:
+#ifdef _MSC_VER
+			char buffer[2048];
+#else
+			char *buffer;
+			size_t bufferSize;
+#endif
+
+			Demangler(const Demangler&);            // Do not implement
+			Demangler& operator=(const Demangler&); // Do not implement
+
+		public:
+#ifdef _MSC_VER
+			Demangler()
+			{
+			}
+
+			const char *Demangle(const char *name)
+			{
+				if(name[0] != '?' || !UnDecorateSymbolName(name, buffer, sizeof(buffer), UNDNAME_COMPLETE))
+					return nullptr;
+
+				return buffer;
+			}
+#else
+			Demangler() : buffer(nullptr), bufferSize(0)
+			{
+			}
+
+			~Demangler()
+			{
+				std::free(buffer);
+			}
+
+			const char *Demangle(const char *name)
+			{
+				if(name[0] != '_' || name[1] != 'Z')
+					return nullptr;
+
+				// The buffer is realloc'd when too small, and bufferSize kept up to date.
+				int status = 0;
+				char *demangled = abi::__cxa_demangle(name, buffer, &bufferSize, &status);
+				if(demangled)
+					buffer = demangled;
+
+				return status == 0 ? demangled : nullptr;
+			}
+#endif
+	};
+}
+
+SymbolSearch::SymbolSearch(const Symbols& symbols) : names(), entries(), byName(), byDemangled(), trigrams(), postings()
+{
+	Demangler demangler;
+	entries.reserve(symbols.size());
+
+	for(auto it = symbols.begin(); it != symbols.end(); ++it)
+	{
+		Entry entry;
+		entry.address = it->second;
+		entry.name = static_cast<uint32_t>(names.size());
+		names.insert(names.end(), it->first, it->first + std::strlen(it->first) + 1);
+
+		const char *demangled = demangler.Demangle(it->first);
+		if(demangled && std::strcmp(demangled, it->first))
+		{
+			entry.demangled = static_cast<uint32_t>(names.size());
+			names.insert(names.end(), demangled, demangled + std::strlen(demangled) + 1);
+			byDemangled.push_back(static_cast<uint32_t>(entries.size()));
+		}
+		else
+			entry.demangled = entry.name;
+
+		byName.push_back(static_cast<uint32_t>(entries.size()));
+		entries.push_back(entry);
+	}
+
+	const char *strings = names.data();
+	std::sort(byName.begin(), byName.end(), [this, strings](uint32_t lhs, uint32_t rhs)
+	{
+		return std::strcmp(strings + entries[lhs].name, strings + entries[rhs].name) < 0;
+	});
+	std::sort(byDemangled.begin(), byDemangled.end(), [this, strings](uint32_t lhs, uint32_t rhs)
+	{
+		return std::strcmp(strings + entries[lhs].demangled, strings + entries[rhs].demangled) < 0;
+	});
+
+	BuildTrigrams();
+}
+
+void SymbolSearch::BuildTrigrams()
+{
+	const uint8_t *classes = GetCharClasses();
+
+	// Trigrams come out of each entry the same way twice: once to size every list, then again
+	// to fill them in. Lists are written where they'll stay, with nothing built up in between.
+	// Lists hold gaps between entry numbers plus one, so a trigram seen twice in an entry is
+	// spotted by its last entry being this one.
+	struct KeyState
+	{
+		uint32_t count;
+		uint32_t size;  //!< Bytes in the list, then where its next gap is written.
+		uint32_t last;  //!< Last entry added to the list, plus one.
+	};
+	std::vector<KeyState> states(KEY_COUNT);
+
+	auto forEachKey = [&](uint32_t index, auto visit)
+	{
+		const Entry& entry = entries[index];
+		for(uint32_t name = entry.name; ; name = entry.demangled)
+		{
+			const char *str = &names[name];
+			for(size_t i=0; str[i] && str[i + 1] && str[i + 2]; ++i)
+			{
+				KeyState& state = states[TrigramKey(classes, str + i)];
+				if(state.last != index + 1)
+					visit(state, index + 1);
+			}
+
+			if(name == entry.demangled)
+				break;
+		}
+	};
+
+	for(uint32_t i=0; i<entries.size(); ++i)
+	{
+		forEachKey(i, [](KeyState& state, uint32_t number)
+		{
+			state.size += VarintSize(number - state.last);
+			state.last = number;
+			++state.count;
+		});
+	}
+
+	uint32_t total = 0;
+	for(uint32_t key=0; key<KEY_COUNT; ++key)
+	{
+		KeyState& state = states[key];
+		if(!state.count)
+			continue;
+
+		Trigram trigram = { key, state.count, total };
+		trigrams.push_back(trigram);
+
+		total += state.size;
+		state.size = trigram.start;
+		state.last = 0;
+	}
+
+	postings.resize(total);
+	uint8_t *out = postings.data();
+	for(uint32_t i=0; i<entries.size(); ++i)
+	{
+		forEachKey(i, [out](KeyState& state, uint32_t number)
+		{
+			state.size = static_cast<uint32_t>(WriteVarint(out + state.size, number - state.last) - out);
+			state.last = number;
+		});
+	}
+}
+
+void SymbolSearch::ReadList(const Trigram& trigram, std::vector<uint32_t>& found) const
+{
+	found.resize(trigram.count);
+
+	const uint8_t *in = &postings[trigram.start];
+	uint32_t number = 0;
+	for(uint32_t i=0; i<trigram.count; ++i)
+	{
+		uint32_t gap;
+		in = ReadVarint(in, gap);
+		number += gap;
+		found[i] = number - 1;
+	}
+}
+
+void SymbolSearch::IntersectList(const Trigram& trigram, std::vector<uint32_t>& found) const
+{
+	const uint8_t *in = &postings[trigram.start];
+	uint32_t number = 0;
+	uint32_t read = 0;
+
+	size_t kept = 0;
+	for(size_t i=0; i<found.size() && read < trigram.count; ++i)
+	{
+		while(read < trigram.count && number < found[i] + 1)
+		{
+			uint32_t gap;
+			in = ReadVarint(in, gap);
+			number += gap;
+			++read;
+		}
+
+		if(number == found[i] + 1)
+			found[kept++] = found[i];
+	}
+
+	found.resize(kept);
+}
+
+const SymbolSearch::Trigram *SymbolSearch::FindTrigram(uint32_t key) const
+{
+	auto it = std::lower_bound(trigrams.begin(), trigrams.end(), key, [](const Trigram& trigram, uint32_t key)
+	{
+		return trigram.key < key;
+	});
+
+	return it != trigrams.end() && it->key == key ? &*it : nullptr;
+}
+
+void SymbolSearch::PrefixRange(const std::vector<uint32_t>& sorted, bool demangled, const char *prefix, size_t length, size_t& first, size_t& last) const
+{
+	const char *strings = names.data();
+	auto nameOf = [this, strings, demangled](uint32_t index)
+	{
+		return strings + (demangled ? entries[index].demangled : entries[index].name);
+	};
+
+	auto lower = std::lower_bound(sorted.begin(), sorted.end(), prefix, [&](uint32_t index, const char *prefix)
+	{
+		return std::strncmp(nameOf(index), prefix, length) < 0;
+	});
+	auto upper = std::upper_bound(lower, sorted.end(), prefix, [&](const char *prefix, uint32_t index)
+	{
+		return std::strncmp(prefix, nameOf(index), length) < 0;
+	});
+
+	first = lower - sorted.begin();
+	last = upper - sorted.begin();
+}
+
+bool SymbolSearch::Matches(uint32_t index, const char *pattern) const
+{
+	const Entry& entry = entries[index];
+	return SymbolFinder::MatchesPattern(pattern, &names[entry.name]) ||
+	       (entry.demangled != entry.name && SymbolFinder::MatchesPattern(pattern, &names[entry.demangled]));
+}
+
+void SymbolSearch::Find(const char *pattern, std::vector<unsigned>& matches) const
+{
+	// Names starting with the pattern's literal prefix.
+	size_t prefixLength = std::strcspn(pattern, "*?");
+	size_t nameFirst = 0, nameLast = 0, demangledFirst = 0, demangledLast = 0;
+	size_t prefixCount = entries.size();
+	if(prefixLength)
+	{
+		PrefixRange(byName, false, pattern, prefixLength, nameFirst, nameLast);
+		PrefixRange(byDemangled, true, pattern, prefixLength, demangledFirst, demangledLast);
+		prefixCount = (nameLast - nameFirst) + (demangledLast - demangledFirst);
+	}
+
+	// Names containing every trigram of the literal runs. A name without one of them can't
+	// match at all.
+	const uint8_t *classes = GetCharClasses();
+	std::vector<const Trigram*> required;
+	for(const char *run = pattern; *run;)
+	{
+		size_t runLength = std::strcspn(run, "*?");
+		for(size_t i=0; i+3 <= runLength; ++i)
+		{
+			const Trigram *trigram = FindTrigram(TrigramKey(classes, run + i));
+			if(!trigram)
+				return;
+
+			required.push_back(trigram);
+		}
+
+		run += runLength;
+		if(*run)
+			++run;
+	}
+
+	std::sort(required.begin(), required.end(), [](const Trigram *lhs, const Trigram *rhs)
+	{
+		return lhs->count < rhs->count;
+	});
+	required.erase(std::unique(required.begin(), required.end()), required.end());
+
+	if(!required.empty() && required[0]->count < prefixCount)
+	{
+		// The rarest list is cut down by the more common ones, until reading the next list would
+		// cost more than matching the names it could rule out. Trigrams from the same word tend
+		// to rule out the same names, so once a list barely helps the rest are left alone.
+		std::vector<uint32_t> candidates;
+		ReadList(*required[0], candidates);
+		for(size_t i=1; i<required.size() && required[i]->count < candidates.size() * LIST_READS_PER_MATCH; ++i)
+		{
+			size_t before = candidates.size();
+			IntersectList(*required[i], candidates);
+			if(candidates.size() > before - before / 4)
+				break;
+		}
+
+		for(auto it = candidates.begin(); it != candidates.end(); ++it)
+			if(Matches(*it, pattern))
+				matches.push_back(*it);
+	}
+	else if(prefixLength)
+	{
+		size_t found = matches.size();
+		for(size_t i=nameFirst; i<nameLast; ++i)
+			if(Matches(byName[i], pattern))
+				matches.push_back(byName[i]);
+
+		for(size_t i=demangledFirst; i<demangledLast; ++i)
+			if(Matches(byDemangled[i], pattern))
+				matches.push_back(byDemangled[i]);
+
+		// Both names of an entry can start with the prefix.
+		if(demangledFirst != demangledLast)
+		{
+			std::sort(matches.begin() + found, matches.end());
+			matches.erase(std::unique(matches.begin() + found, matches.end()), matches.end());
+		}
+	}
+	else
+	{
+		for(uint32_t i=0; i<entries.size(); ++i)
+			if(Matches(i, pattern))
+				matches.push_back(i);
+	}
+}
+
+unsigned SymbolSearch::GetCount() const
+{
+	return static_cast<unsigned>(entries.size());
+}
+
+const char *SymbolSearch::GetName(unsigned index) const
+{
+	return &names[entries[index].name];
+}
+
+const char *SymbolSearch::GetDemangledName(unsigned index) const
+{
+	return &names[entries[index].demangled];
+}
+
+const void *SymbolSearch::GetAddress(unsigned index) const
+{
+	return entries[index].address;
+}
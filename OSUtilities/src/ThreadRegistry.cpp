@@ -0,0 +1,212 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		ThreadRegistry.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Keeps track of this process's threads as they start and exit
+ */
+
+#include "ThreadRegistry.h"
+#include "RemoteThreadManager.h"
+
+#ifdef WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <windows.h>
+#else
+# include <new>
+# include <cerrno>
+# include <cstdlib>
+# include <dirent.h>
+# include <dlfcn.h>
+# include <pthread.h>
+# include <unistd.h>
+# include <sys/syscall.h>
+#endif
+
+ThreadRegistry::ThreadRegistry() : threads(), lock(), enabled(false)
+{}
+
+ThreadRegistry::~ThreadRegistry()
+{}
+
+ThreadRegistry* ThreadRegistry::Get()
+{
+	static ThreadRegistry registry;
+
+	return &registry;
+}
+
+void ThreadRegistry::Enable()
+{
+#if !defined(WIN32) && !defined(THREAD_REGISTRY_HOOK_PTHREAD)
+	// Without the pthread_create wrapper new threads would go unseen, so tracking stays off.
+	return;
+#endif
+
+	std::lock_guard<std::mutex> guard(lock);
+	if(enabled)
+		return;
+
+	// Turn tracking on before taking the snapshot. Threads starting or exiting in the meantime
+	// wait on the lock, and are added or removed once the snapshot is in.
+	enabled = true;
+
+#ifdef WIN32
+	RemoteThreadManager remoteThreadManager(0);
+	RemoteThreadManager::RemoteThreads remoteThreads = remoteThreadManager.GetRemoteThreads();
+
+	for(auto it = remoteThreads.begin(); it != remoteThreads.end(); ++it)
+		threads.insert(std::make_pair(it->GetThreadId(), *it));
+#else
+	DIR *taskDir = opendir("/proc/self/task");
+	if(!taskDir)
+		return;
+
+	while(dirent *entry = readdir(taskDir))
+	{
+		char *end;
+		unsigned long threadId = strtoul(entry->d_name, &end, 10);
+		if(threadId && !*end)
+			threads.insert(static_cast<unsigned>(threadId));
+	}
+
+	closedir(taskDir);
+#endif
+}
+
+bool ThreadRegistry::IsEnabled() const
+{
+	return enabled;
+}
+
+void ThreadRegistry::ThreadStarted(unsigned threadId)
+{
+	if(!enabled)
+		return;
+
+	std::lock_guard<std::mutex> guard(lock);
+#ifdef WIN32
+	threads.insert(std::make_pair(threadId, RemoteThread(threadId)));
+#else
+	threads.insert(threadId);
+#endif
+}
+
+void ThreadRegistry::ThreadExited(unsigned threadId)
+{
+	if(!enabled)
+		return;
+
+	std::lock_guard<std::mutex> guard(lock);
+	threads.erase(threadId);
+}
+
+void ThreadRegistry::Lock()
+{
+	lock.lock();
+}
+
+void ThreadRegistry::Unlock()
+{
+	lock.unlock();
+}
+
+const ThreadRegistry::Threads& ThreadRegistry::GetThreads() const
+{
+	return threads;
+}
+
+#ifdef WIN32
+
+// The loader calls TLS callbacks on every thread as it starts, before its start address, and
+// again as it exits. This works the same whether we're linked into the exe or a dll. The thread
+// keeps running loader code on either side, which SingleThreadBlock's check of the system's
+// thread list covers.
+static void NTAPI ThreadRegistryCallback(void *module, DWORD reason, void *reserved)
+{
+	if(reason == DLL_THREAD_ATTACH)
+		ThreadRegistry::Get()->ThreadStarted(GetCurrentThreadId());
+	else if(reason == DLL_THREAD_DETACH)
+		ThreadRegistry::Get()->ThreadExited(GetCurrentThreadId());
+}
+
+// Nothing references the callback, so the linker has to be told to keep it and the TLS directory.
+# ifdef _WIN64
+#  pragma comment(linker, "/INCLUDE:_tls_used")
+#  pragma comment(linker, "/INCLUDE:threadRegistryTlsCallback")
+#  pragma const_seg(".CRT$XLR")
+extern "C" const PIMAGE_TLS_CALLBACK threadRegistryTlsCallback = ThreadRegistryCallback;
+#  pragma const_seg()
+# else
+#  pragma comment(linker, "/INCLUDE:__tls_used")
+#  pragma comment(linker, "/INCLUDE:_threadRegistryTlsCallback")
+#  pragma data_seg(".CRT$XLR")
+extern "C" PIMAGE_TLS_CALLBACK threadRegistryTlsCallback = ThreadRegistryCallback;
+#  pragma data_seg()
+# endif
+
+#elif defined(THREAD_REGISTRY_HOOK_PTHREAD)
+
+namespace
+{
+	typedef void *(*ThreadStartPtr)(void*);
+	typedef int (*PthreadCreatePtr)(pthread_t*, const pthread_attr_t*, ThreadStartPtr, void*);
+
+	struct ThreadStart
+	{
+		ThreadStartPtr start;
+		void *arg;
+	};
+
+	unsigned GetTid()
+	{
+		return static_cast<unsigned>(syscall(SYS_gettid));
+	}
+
+	void RegisteredThreadExit(void*)
+	{
+		ThreadRegistry::Get()->ThreadExited(GetTid());
+	}
+
+	void *RegisteredThreadStart(void *startPtr)
+	{
+		ThreadStart start = *static_cast<ThreadStart*>(startPtr);
+		delete static_cast<ThreadStart*>(startPtr);
+
+		ThreadRegistry::Get()->ThreadStarted(GetTid());
+
+		// Cleanup handlers also run on pthread_exit and cancellation, which a plain call after
+		// start wouldn't. Key destructors and glibc's teardown still run after, unregistered.
+		void *result;
+		pthread_cleanup_push(RegisteredThreadExit, nullptr);
+		result = start.start(start.arg);
+		pthread_cleanup_pop(1);
+
+		return result;
+	}
+}
+
+// Interposes libc's pthread_create for the whole program, so new threads register themselves
+// before running any of their own code. Only built with THREAD_REGISTRY_HOOK_PTHREAD, so programs
+// that don't ask for tracking keep libc's. Threads are wrapped even before the registry is
+// enabled, so those still running once it is remove themselves when they exit.
+extern "C" int pthread_create(pthread_t *thread, const pthread_attr_t *attr, ThreadStartPtr start, void *arg) throw()
+{
+	static PthreadCreatePtr realCreate = reinterpret_cast<PthreadCreatePtr>(dlsym(RTLD_NEXT, "pthread_create"));
+
+	ThreadStart *registeredStart = new (std::nothrow) ThreadStart;
+	if(!registeredStart)
+		return EAGAIN;
+
+	registeredStart->start = start;
+	registeredStart->arg = arg;
+
+	int result = realCreate(thread, attr, RegisteredThreadStart, registeredStart);
+	if(result)
+		delete registeredStart;
+
+	return result;
+}
+
+#endif
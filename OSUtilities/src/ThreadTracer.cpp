@@ -0,0 +1,587 @@
+/************************************************************************************\
+ * OSUtilities - An Andrew Shurney Production                                       *
+\************************************************************************************/
+
+/*! \file		ThreadTracer.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Keeps another process's threads under ptrace (Linux only)
+ */
+
+#ifndef WIN32
+
+#include "ThreadTracer.h"
+#include <chrono>
+#include <cstdlib>
+#include <cerrno>
+#include <csignal>
+#include <dirent.h>
+#include <elf.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#if defined(__x86_64__)
+# define REGS_IP rip
+# define REGS_SP rsp
+#elif defined(__i386__)
+# define REGS_IP eip
+# define REGS_SP esp
+#else
+# error "Unsupported architecture"
+#endif
+
+namespace
+{
+	// Sent to the tracer thread to break it out of waitpid when a request comes in.
+	int WakeSignal()
+	{
+		return SIGRTMIN + 3;
+	}
+
+	void WakeHandler(int)
+	{
+	}
+
+	void InstallWakeHandler()
+	{
+		static std::once_flag installed;
+		std::call_once(installed, []
+		{
+			struct sigaction action = {};
+			action.sa_handler = WakeHandler;
+			sigemptyset(&action.sa_mask);
+			sigaction(WakeSignal(), &action, nullptr); // No SA_RESTART, waitpid has to return.
+		});
+	}
+
+	pid_t GetTid()
+	{
+		return static_cast<pid_t>(syscall(SYS_gettid));
+	}
+
+	// Only ever wait on our own tracees. Without __WNOTHREAD we'd also reap children of every
+	// other thread in the process.
+	pid_t WaitForEvent(int *status)
+	{
+		return waitpid(-1, status, __WALL | __WNOTHREAD);
+	}
+}
+
+ThreadTracer::Thread::Thread() : stopCount(0), stopped(false), stopPending(false), listening(false), pendingSignal(0), regsValid(false), regs()
+{
+}
+
+ThreadTracer::ThreadTracer(unsigned procId) : procId(static_cast<pid_t>(procId)), threads(), attached(false), holdNewThreads(0),
+                                              stopsPending(0), exitCount(0), tracerThread(), tracerTid(0), started(false),
+                                              stopping(false), tracerDone(false), requestLock(), stateLock(), requestDone(), threadExited(),
+                                              request(), requestTaken(false)
+{
+	InstallWakeHandler();
+
+	tracerThread = std::thread(&ThreadTracer::TracerMain, this);
+
+	std::unique_lock<std::mutex> guard(stateLock);
+	requestDone.wait(guard, [this] { return started; });
+}
+
+ThreadTracer::~ThreadTracer()
+{
+	{
+		std::lock_guard<std::mutex> guard(stateLock);
+		stopping = true;
+	}
+
+	// The tracer thread detaches from everything on its way out.
+	while(!tracerDone)
+	{
+		syscall(SYS_tgkill, getpid(), tracerTid, WakeSignal());
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+
+	tracerThread.join();
+}
+
+ThreadTracer::Tracers& ThreadTracer::GetTracers()
+{
+	static Tracers tracers;
+	return tracers;
+}
+
+std::mutex& ThreadTracer::GetTracersLock()
+{
+	static std::mutex lock;
+	return lock;
+}
+
+ThreadTracer *ThreadTracer::Get(unsigned procId)
+{
+	// A process can't trace its own threads.
+	if(procId == static_cast<unsigned>(getpid()))
+		return nullptr;
+
+	std::lock_guard<std::mutex> guard(GetTracersLock());
+
+	Tracers& tracers = GetTracers();
+	Tracers::iterator tracerIt = tracers.find(procId);
+	if(tracerIt != tracers.end())
+		return tracerIt->second;
+
+	ThreadTracer *tracer = new ThreadTracer(procId);
+	if(!tracer->attached)
+	{
+		delete tracer;
+		return nullptr;
+	}
+
+	tracers.insert(std::make_pair(procId, tracer));
+	return tracer;
+}
+
+void ThreadTracer::Release(unsigned procId)
+{
+	ThreadTracer *tracer = nullptr;
+	{
+		std::lock_guard<std::mutex> guard(GetTracersLock());
+
+		Tracers& tracers = GetTracers();
+		Tracers::iterator tracerIt = tracers.find(procId);
+		if(tracerIt == tracers.end())
+			return;
+
+		tracer = tracerIt->second;
+		tracers.erase(tracerIt);
+	}
+
+	delete tracer;
+}
+
+void ThreadTracer::Run(const std::function<void()>& work)
+{
+	if(GetTid() == tracerTid)
+	{
+		work();
+		return;
+	}
+
+	std::lock_guard<std::mutex> serial(requestLock);
+	std::unique_lock<std::mutex> guard(stateLock);
+
+	request = work;
+
+	// The tracer thread may be about to block in waitpid when the signal lands, so keep
+	// knocking until it's picked the request up.
+	while(!requestTaken)
+	{
+		syscall(SYS_tgkill, getpid(), tracerTid, WakeSignal());
+		requestDone.wait_for(guard, std::chrono::microseconds(100));
+	}
+
+	requestDone.wait(guard, [this] { return !request; });
+	requestTaken = false;
+}
+
+void ThreadTracer::TracerMain()
+{
+	sigset_t wake;
+	sigemptyset(&wake);
+	sigaddset(&wake, WakeSignal());
+	pthread_sigmask(SIG_UNBLOCK, &wake, nullptr);
+
+	bool attachedOk = Attach();
+	{
+		std::lock_guard<std::mutex> guard(stateLock);
+		tracerTid = GetTid();
+		attached = attachedOk;
+		started = true;
+	}
+	requestDone.notify_all();
+
+	for(;;)
+	{
+		std::function<void()> work;
+		{
+			std::lock_guard<std::mutex> guard(stateLock);
+			if(request && !requestTaken)
+			{
+				work = request;
+				requestTaken = true;
+			}
+			else if(stopping)
+				break;
+		}
+
+		if(work)
+		{
+			work();
+			{
+				std::lock_guard<std::mutex> guard(stateLock);
+				request = nullptr;
+			}
+			requestDone.notify_all();
+			continue;
+		}
+
+		int status;
+		pid_t tid = WaitForEvent(&status);
+		if(tid > 0)
+			HandleEvent(tid, status);
+		else if(errno == ECHILD)
+		{
+			// The process is gone, there's nothing left to wait on but requests.
+			std::unique_lock<std::mutex> guard(stateLock);
+			requestDone.wait_for(guard, std::chrono::milliseconds(10));
+		}
+	}
+
+	Detach();
+	tracerDone = true;
+}
+
+bool ThreadTracer::Attach()
+{
+	char taskPath[64];
+	snprintf(taskPath, sizeof(taskPath), "/proc/%d/task", static_cast<int>(procId));
+
+	// Threads may start while we're attaching to their parent, so keep going until a pass
+	// turns up nothing new. Once attached, TRACECLONE picks up new threads for us.
+	for(bool added = true; added;)
+	{
+		added = false;
+
+		DIR *taskDir = opendir(taskPath);
+		if(!taskDir)
+			break;
+
+		while(dirent *entry = readdir(taskDir))
+		{
+			char *end;
+			pid_t tid = static_cast<pid_t>(strtol(entry->d_name, &end, 10));
+			if(!tid || *end || threads.count(tid))
+				continue;
+
+			if(ptrace(PTRACE_SEIZE, tid, 0, PTRACE_O_TRACECLONE) == 0)
+			{
+				threads.insert(std::make_pair(tid, Thread()));
+				added = true;
+			}
+		}
+
+		closedir(taskDir);
+	}
+
+	return !threads.empty();
+}
+
+void ThreadTracer::Detach()
+{
+	// Only stopped threads can be detached.
+	for(Threads::iterator threadIt = threads.begin(); threadIt != threads.end(); ++threadIt)
+		StopThread(threadIt->first, threadIt->second);
+	WaitForStops();
+
+	for(Threads::iterator threadIt = threads.begin(); threadIt != threads.end(); ++threadIt)
+		ptrace(PTRACE_DETACH, threadIt->first, 0, threadIt->second.pendingSignal);
+
+	threads.clear();
+}
+
+void ThreadTracer::HandleEvent(pid_t tid, int status)
+{
+	if(WIFEXITED(status) || WIFSIGNALED(status))
+	{
+		Threads::iterator threadIt = threads.find(tid);
+		if(threadIt != threads.end())
+		{
+			if(threadIt->second.stopPending)
+				--stopsPending;
+			threads.erase(threadIt);
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(stateLock);
+			++exitCount;
+		}
+		threadExited.notify_all();
+		return;
+	}
+
+	if(!WIFSTOPPED(status))
+		return;
+
+	Threads::iterator threadIt = threads.find(tid);
+	if(threadIt == threads.end())
+	{
+		// First stop of a new thread.
+		threadIt = threads.insert(std::make_pair(tid, Thread())).first;
+		if(holdNewThreads)
+			threadIt->second.stopCount = 1;
+	}
+
+	Thread& thread = threadIt->second;
+	if(thread.stopPending)
+		--stopsPending;
+
+	thread.stopped = true;
+	thread.stopPending = false;
+	thread.regsValid = false;
+	thread.listening = false;
+
+	int signal = WSTOPSIG(status);
+	int event = status >> 16;
+
+	// Clone events need nothing beyond continuing the parent. A new thread runs none of its own
+	// code before reporting its first stop, which is held above while InterruptAll is in effect.
+	if(event == PTRACE_EVENT_STOP)
+	{
+		// Group stops report the stopping signal. Interrupts and a new thread's first stop
+		// report SIGTRAP.
+		if(signal == SIGSTOP || signal == SIGTSTP || signal == SIGTTIN || signal == SIGTTOU)
+			thread.listening = true;
+	}
+	else if(!event)
+		thread.pendingSignal = signal; // Signal delivery, pass it on when the thread continues.
+
+	if(!thread.stopCount)
+		ContinueThread(tid, thread);
+}
+
+void ThreadTracer::WaitForStops()
+{
+	while(stopsPending)
+	{
+		int status;
+		pid_t tid = WaitForEvent(&status);
+		if(tid > 0)
+			HandleEvent(tid, status);
+		else if(errno != EINTR)
+			break;
+	}
+}
+
+void ThreadTracer::StopThread(pid_t tid, Thread& thread)
+{
+	if(thread.stopCount++ || thread.stopped || thread.stopPending)
+		return;
+
+	if(ptrace(PTRACE_INTERRUPT, tid, 0, 0) == 0)
+	{
+		thread.stopPending = true;
+		++stopsPending;
+	}
+}
+
+void ThreadTracer::ContinueThread(pid_t tid, Thread& thread)
+{
+	if(!thread.stopped)
+		return;
+
+	if(thread.listening)
+		ptrace(PTRACE_LISTEN, tid, 0, 0);
+	else
+		ptrace(PTRACE_CONT, tid, 0, thread.pendingSignal);
+
+	thread.stopped = false;
+	thread.listening = false;
+	thread.regsValid = false;
+	thread.pendingSignal = 0;
+}
+
+bool ThreadTracer::ReadRegs(pid_t tid, Thread& thread)
+{
+	if(!thread.stopped)
+		return false;
+
+	if(thread.regsValid)
+		return true;
+
+	iovec regs = { &thread.regs, sizeof(thread.regs) };
+	thread.regsValid = ptrace(PTRACE_GETREGSET, tid, NT_PRSTATUS, &regs) == 0;
+
+	return thread.regsValid;
+}
+
+bool ThreadTracer::WriteRegs(pid_t tid, Thread& thread)
+{
+	if(!thread.stopped)
+		return false;
+
+	iovec regs = { &thread.regs, sizeof(thread.regs) };
+	return ptrace(PTRACE_SETREGSET, tid, NT_PRSTATUS, &regs) == 0;
+}
+
+unsigned ThreadTracer::GetProcId() const
+{
+	return static_cast<unsigned>(procId);
+}
+
+bool ThreadTracer::IsTraced(unsigned threadId)
+{
+	bool traced = false;
+	Run([&] { traced = threads.count(static_cast<pid_t>(threadId)) != 0; });
+
+	return traced;
+}
+
+std::vector<unsigned> ThreadTracer::GetThreadIds()
+{
+	std::vector<unsigned> threadIds;
+	Run([&]
+	{
+		threadIds.reserve(threads.size());
+		for(Threads::const_iterator threadIt = threads.begin(); threadIt != threads.end(); ++threadIt)
+			threadIds.push_back(static_cast<unsigned>(threadIt->first));
+	});
+
+	return threadIds;
+}
+
+bool ThreadTracer::Interrupt(unsigned threadId)
+{
+	bool stopped = false;
+	Run([&]
+	{
+		Threads::iterator threadIt = threads.find(static_cast<pid_t>(threadId));
+		if(threadIt == threads.end())
+			return;
+
+		StopThread(threadIt->first, threadIt->second);
+		WaitForStops();
+
+		// It may have exited rather than stopped.
+		threadIt = threads.find(static_cast<pid_t>(threadId));
+		stopped = threadIt != threads.end() && threadIt->second.stopped;
+	});
+
+	return stopped;
+}
+
+void ThreadTracer::Resume(unsigned threadId)
+{
+	Run([&]
+	{
+		Threads::iterator threadIt = threads.find(static_cast<pid_t>(threadId));
+		if(threadIt != threads.end() && threadIt->second.stopCount && !--threadIt->second.stopCount)
+			ContinueThread(threadIt->first, threadIt->second);
+	});
+}
+
+bool ThreadTracer::InterruptAll(ThreadStates& states)
+{
+	Run([&]
+	{
+		++holdNewThreads;
+
+		for(Threads::iterator threadIt = threads.begin(); threadIt != threads.end(); ++threadIt)
+			StopThread(threadIt->first, threadIt->second);
+		WaitForStops();
+
+		states.clear();
+		states.reserve(threads.size());
+		for(Threads::iterator threadIt = threads.begin(); threadIt != threads.end(); ++threadIt)
+		{
+			Thread& thread = threadIt->second;
+			if(!ReadRegs(threadIt->first, thread))
+				continue;
+
+			ThreadState state;
+			state.threadId = static_cast<unsigned>(threadIt->first);
+			state.ip = reinterpret_cast<const void*>(thread.regs.REGS_IP);
+			state.sp = reinterpret_cast<const void*>(thread.regs.REGS_SP);
+			states.push_back(state);
+		}
+	});
+
+	return !states.empty();
+}
+
+void ThreadTracer::ResumeAll()
+{
+	Run([&]
+	{
+		if(holdNewThreads)
+			--holdNewThreads;
+
+		for(Threads::iterator threadIt = threads.begin(); threadIt != threads.end(); ++threadIt)
+		{
+			Thread& thread = threadIt->second;
+			if(thread.stopCount && !--thread.stopCount)
+				ContinueThread(threadIt->first, thread);
+		}
+	});
+}
+
+void ThreadTracer::SetIps(const ThreadStates& states)
+{
+	Run([&]
+	{
+		for(ThreadStates::const_iterator stateIt = states.begin(); stateIt != states.end(); ++stateIt)
+		{
+			Threads::iterator threadIt = threads.find(static_cast<pid_t>(stateIt->threadId));
+			if(threadIt == threads.end() || !ReadRegs(threadIt->first, threadIt->second))
+				continue;
+
+			Thread& thread = threadIt->second;
+			thread.regs.REGS_IP = reinterpret_cast<uintptr_t>(stateIt->ip);
+			thread.regsValid = WriteRegs(threadIt->first, thread);
+		}
+	});
+}
+
+bool ThreadTracer::GetRegs(unsigned threadId, user_regs_struct& regs)
+{
+	bool read = false;
+	Run([&]
+	{
+		Threads::iterator threadIt = threads.find(static_cast<pid_t>(threadId));
+		if(threadIt == threads.end() || !ReadRegs(threadIt->first, threadIt->second))
+			return;
+
+		regs = threadIt->second.regs;
+		read = true;
+	});
+
+	return read;
+}
+
+bool ThreadTracer::SetRegs(unsigned threadId, const user_regs_struct& regs)
+{
+	bool written = false;
+	Run([&]
+	{
+		Threads::iterator threadIt = threads.find(static_cast<pid_t>(threadId));
+		if(threadIt == threads.end() || !threadIt->second.stopped)
+			return;
+
+		Thread& thread = threadIt->second;
+		thread.regs = regs;
+		written = WriteRegs(threadIt->first, thread);
+		thread.regsValid = written;
+	});
+
+	return written;
+}
+
+void ThreadTracer::WaitForExit(unsigned threadId)
+{
+	for(;;)
+	{
+		bool alive = false;
+		uint64_t exits = 0;
+		Run([&]
+		{
+			alive = threads.count(static_cast<pid_t>(threadId)) != 0;
+			exits = exitCount;
+		});
+
+		if(!alive)
+			return;
+
+		std::unique_lock<std::mutex> guard(stateLock);
+		threadExited.wait(guard, [&] { return exitCount != exits; });
+	}
+}
+
+#endif
@@ -129,6 +129,40 @@ class RemoteCode
 		   \return Handle to the remote function
 		*/
 		RemoteFunction GetFunction(const void* dllHandle, const std::string& function);
+
+		/*! \brief Copies a block of memory to the remote process for use as an argument.
+		    \param[in] mem  - Local memory to copy.
+		    \param[in] size - Number of bytes to copy.
+
+			<p>The block is placed contiguously in a staging area on the remote process with a
+			single write, no matter how large. Pass the returned address to a remote function
+			as a pointer argument.</p>
+			<p>Staged memory stays valid until ResetStaging is called. It is shared by every
+			RemoteCode object on the same process.</p>
+
+			\return Address of the copy on the remote process, or null on failure.
+		*/
+		void* Stage(const void *mem, unsigned size);
+
+		/*! \brief Releases everything staged on the remote process.
+
+			Staging space is retained for reuse, so staging the same amount of data again
+			doesn't need to reserve more memory.
+		*/
+		void ResetStaging();
+
+		/*! \brief Puts remote variables created from now on in memory mapped into both
+			processes, while it has room.
+		    \param[in] size - Bytes of memory to share.
+
+			<p>Reading and writing such a variable is a load or store here rather than a copy
+			between processes, so waiting on a call to finish can poll its flag without system
+			calls. Only variables of up to 256 bytes are shared. Like staged memory, it's shared
+			by every RemoteCode object on the same process.</p>
+
+			\return False if the memory couldn't be mapped into the remote process.
+		*/
+		bool ShareVariables(unsigned size = 64*1024);
 };
 
 #endif
@@ -77,6 +77,10 @@ class RemoteVariable
 		virtual bool     IsFloatingPoint() const = 0;
 		virtual unsigned GetSizeOf()       const;
 
+		/*! \brief Whether the variable is in memory shared with the other process, so reading
+			and writing it are plain loads and stores. \sa RemoteCode::ShareVariables */
+		bool IsShared() const;
+
 		virtual unsigned Push(CodeBuffer& buffer) const = 0;
 		virtual unsigned StoreAtStackOffset( CodeBuffer &buffer, int8_t offset ) const = 0;
 		virtual unsigned MovToReg(CodeBuffer& buffer, unsigned reg) const = 0;
@@ -12,9 +12,17 @@
 
 #include "ProcessHandle.h"
 #include "ProcessMemory.h"
+#include <vector>
+#include <cstdint>
 
 class PageManager;
 
+/*! \brief A page of code in another process, written an instruction at a time.
+
+	<p>Instructions are written to a copy of the page here, and only sent to the process, in
+	one write and one instruction cache flush, when Flush is called before the code runs.
+	Writing each one as it came cost two system calls an instruction.</p>
+*/
 class CodeBuffer
 {
 	private:
@@ -23,6 +31,9 @@ class CodeBuffer
 		unsigned char *mem;
 		unsigned char *curPos;
 		ProcessMemory memory;
+		std::vector<uint8_t> staged;   //!< The page as it will be once flushed.
+		unsigned dirtyBegin;           //!< The part of staged the process doesn't have yet.
+		unsigned dirtyEnd;
 
 		CodeBuffer(const CodeBuffer& rhs);            // do not implement
 		CodeBuffer& operator=(const CodeBuffer& rhs); // do not implement
@@ -52,6 +63,11 @@ class CodeBuffer
 		}
 
 		bool Write(void *buffer, unsigned bytes);
+
+		/*! \brief Sends everything written since the last flush to the process. Must be done
+			before the code is run. */
+		bool Flush();
+
 		bool Seek(int offset, unsigned origin = CUR);
 		unsigned Tell() const;
 		const void *GetCurAddr() const;
@@ -0,0 +1,75 @@
+/************************************************************************************\
+ * RemoteExecution - An Andrew Shurney Production                                   *
+\************************************************************************************/
+
+/*! \file		RemoteArena.h
+ *  \author		Andrew Shurney
+ *  \brief		Growable bump allocator over another process's memory
+ */
+
+#ifndef REMOTE_ARENA_H
+#define REMOTE_ARENA_H
+
+#include <vector>
+#include <cstdint>
+
+class PageManager;
+
+/*! \brief Growable bump allocator for staging bulk data on another process.
+
+	<p>Allocations are carved sequentially out of contiguous regions reserved through the page
+	manager. There is no individual free; everything is released at once with Reset. When a
+	request doesn't fit, a new region at least twice the size of the last is added, so any
+	single allocation is contiguous no matter how large.</p>
+
+	<p>Reset collapses the regions into one sized to everything that was allocated, so a caller
+	staging the same amount of data each round settles into a single region.</p>
+*/
+class RemoteArena
+{
+	private:
+		enum
+		{
+			MIN_REGION_SIZE = 64*1024, //!< Smallest region the arena reserves.
+			ALIGNMENT       = 16       //!< Alignment of every allocation.
+		};
+
+		struct Region
+		{
+			uint8_t *mem;  //!< Start of the region in the remote process.
+			unsigned size; //!< Committed size of the region.
+
+			Region(uint8_t *mem, unsigned size);
+		};
+
+		typedef std::vector<Region> Regions;
+
+		PageManager &pageManager; //!< Source of remote regions.
+		Regions regions;          //!< All regions, the last being the one allocated from.
+		unsigned used;            //!< Bytes used in the last region.
+		unsigned total;           //!< Bytes used in all regions, including padding.
+
+		RemoteArena(const RemoteArena&);            // do not implement
+		RemoteArena& operator=(const RemoteArena&); // do not implement
+
+		bool AddRegion(unsigned minSize);
+		void ReleaseRegions();
+
+	public:
+		RemoteArena(PageManager &pages);
+		~RemoteArena();
+
+		/*! \brief Allocates contiguous memory on the remote process.
+		    \param[in] size - Bytes to allocate.
+			\return Remote address of the allocation, or null if no region could be reserved.
+		*/
+		void *Allocate(unsigned size);
+
+		/*! \brief Frees everything allocated from the arena. */
+		void Reset();
+
+		/*! \brief Bytes consumed since the last reset, including alignment and unused region tails. */
+		unsigned GetUsed() const;
+};
+
+#endif
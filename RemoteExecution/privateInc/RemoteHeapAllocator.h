@@ -11,36 +11,85 @@
 #define HEAP_ALLOCATOR_H
 
 #include <vector>
+#include <map>
 #include <unordered_map>
 #include <cstdint>
 class PageManager;
 
+/*! \brief Heap allocator carving up pages of another process's memory.
+
+	<p>Small requests (up to MAX_SMALL_SIZE bytes) are served from size class slabs. Each slab
+	is one page of remote memory split into equal power of two sized objects. Which objects are
+	free is tracked in a bitmap kept in this process, so neither allocating nor freeing touches
+	the remote process. Slabs with free objects are kept on a per class list, making both
+	operations constant time.</p>
+
+	<p>Larger requests are served best fit from a size ordered tree of free blocks. Free blocks
+	are also indexed by address so they can be coalesced with their neighbors when released.
+	Blocks never span pages, so a page whose blocks are all free can be handed back.</p>
+
+	<p>Anything bigger than a page gets its own contiguous region from the page manager, which
+	is released as soon as the allocation is freed.</p>
+*/
 class RemoteHeapAllocator
 {
 	private:
-		typedef std::vector<unsigned char*> PageList;
-		typedef std::unordered_map<uint8_t*, unsigned> Allocations;
+		enum
+		{
+			MIN_CLASS_SHIFT  = 3,                                     //!< Smallest class is 8 bytes.
+			NUM_SIZE_CLASSES = 8,                                     //!< 8, 16, 32 ... 1024 bytes.
+			MAX_SMALL_SIZE   = 1 << (MIN_CLASS_SHIFT + NUM_SIZE_CLASSES - 1),
+			LARGE_ALIGN      = 16,                                    //!< Alignment of large blocks.
+			LARGE_CLASS      = NUM_SIZE_CLASSES                       //!< Size class of pages holding large blocks.
+		};
 
-		struct Node
+		/*! \brief Local bookkeeping for one remote page. */
+		struct Page
 		{
-			Node *next;
-			void *addr;
-			unsigned size;
+			uint8_t *base;                //!< Start of the page in the remote process.
+			unsigned sizeClass;           //!< Size class of the slab, or LARGE_CLASS.
+			unsigned freeCount;           //!< Free objects in a slab, or free bytes in a large page.
+			unsigned capacity;            //!< freeCount of the page when nothing is allocated from it.
+			unsigned firstFreeWord;       //!< No free bits exist below this word of freeBits.
+			Page *prev;                   //!< Previous slab of this size class with free objects.
+			Page *next;                   //!< Next slab of this size class with free objects.
+			std::vector<uint64_t> freeBits; //!< Set bit for every free object in the slab.
 
-			Node(void *addr = nullptr, unsigned size = 0, Node *next = nullptr);
+			Page(uint8_t *base, unsigned sizeClass);
 		};
 
-		PageManager &pageManager; //!< Manager pages of memory for the allocator.
-		PageList pageList;        //!< All pages in use.
-		Node *freeList;           //!< List of free memory blocks.
-		Allocations memInUse;     //!< The size of all allocated blocks
+		typedef std::unordered_map<uint8_t*, Page*> PageMap;
+		typedef std::multimap<unsigned, uint8_t*> FreeBySize;
+		typedef std::map<uint8_t*, FreeBySize::iterator> FreeByAddr;
+		typedef std::unordered_map<uint8_t*, unsigned> Allocations;
+
+		PageManager &pageManager;              //!< Manager pages of memory for the allocator.
+		PageMap pageMap;                       //!< Every system page of memory in use to the page holding it.
+		Page *partialSlabs[NUM_SIZE_CLASSES];  //!< Slabs with free objects, by size class.
+		FreeBySize freeBySize;                 //!< Free large blocks ordered by size for best fit.
+		FreeByAddr freeByAddr;                 //!< Free large blocks ordered by address for coalescing.
+		Allocations largeInUse;                //!< The size of all allocated large blocks.
+		Allocations regionsInUse;              //!< The committed size of all allocated regions.
 
 		RemoteHeapAllocator(const RemoteHeapAllocator&);            // do not implement
 		RemoteHeapAllocator& operator=(const RemoteHeapAllocator&); // do not implement
 
-		bool AllocatePage();
-		void* AllocateFromNode(Node *node, Node *prevNode, unsigned size);
-		uint8_t* SplitNode(Node *node, unsigned size);
+		Page *AllocatePage(unsigned sizeClass);
+		void ReleasePage(Page *page);
+		Page *FindPage(void *addr) const;
+
+		void *AllocateSmall(unsigned sizeClass);
+		void FreeSmall(Page *page, uint8_t *mem);
+		void LinkSlab(Page *slab);
+		void UnlinkSlab(Page *slab);
+
+		void *AllocateLarge(unsigned size);
+		void FreeLarge(Page *page, uint8_t *mem);
+		void InsertFreeBlock(uint8_t *mem, unsigned size);
+		void EraseFreeBlock(FreeByAddr::iterator blockIt);
+
+		void *AllocateRegion(unsigned size);
+		void FreeRegion(uint8_t *mem);
 
 	public:
 		RemoteHeapAllocator(PageManager &pages);
@@ -48,7 +97,7 @@ class RemoteHeapAllocator
 
 		void *Allocate(unsigned size);
 		void Free(void *addr);
-		
+
         /// \brief Frees all empty pages
         unsigned FreeEmptyPages(void);
 
@@ -12,6 +12,7 @@
 
 struct RemoteMemoryData;
 class CodeBuffer;
+class RemoteArena;
 
 class RemoteMemoryManager
 {
@@ -35,7 +36,22 @@ class RemoteMemoryManager
 		void *Allocate(unsigned size);
 		void Free(void *addr);
 
+		/*! \brief Maps a region of size bytes into both processes, for AllocateShared.
+			\return False if it couldn't be mapped. True if it already was.
+		*/
+		bool EnableSharedRegion(unsigned size = 64*1024);
+
+		/*! \brief Allocates from the shared region, if there is one and it has room. Freed with Free.
+			\return The address in the other process, or null.
+		*/
+		void *AllocateShared(unsigned size);
+
+		/*! \brief Where an address in the other process is mapped in this one, if it's in the
+			shared region. Otherwise null. */
+		void *GetLocalAddr(const void *addr) const;
+
 		CodeBuffer &GetCodeBuffer();
+		RemoteArena &GetStagingArena();
 
 		template<typename T>
 		T* Allocate()
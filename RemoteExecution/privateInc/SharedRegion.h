@@ -0,0 +1,73 @@
+/************************************************************************************\
+ * RemoteExecution - An Andrew Shurney Production                                   *
+\************************************************************************************/
+
+/*! \file		SharedRegion.h
+ *  \author		Andrew Shurney
+ *  \brief		Memory mapped into both this and another process
+ */
+
+#ifndef SHARED_REGION_H
+#define SHARED_REGION_H
+
+#include <vector>
+#include <cstdint>
+#include "ProcessHandle.h"
+
+/*! \brief A region of memory mapped into this process and another, with an allocator of
+	small objects over it.
+
+	<p>The region is an anonymous section backed by the page file, mapped here and into the
+	other process, so what either writes the other sees without a system call. Objects are
+	served from power of two size classes up to MAX_SIZE bytes, bumped off the region and
+	reused through a free list per class. The size class of every object is kept here, a byte
+	per MIN_CLASS_SHIFT sized unit.</p>
+*/
+class SharedRegion
+{
+	private:
+		enum
+		{
+			MIN_CLASS_SHIFT  = 3,                                     //!< Smallest class is 8 bytes.
+			NUM_SIZE_CLASSES = 6,                                     //!< 8, 16, 32 ... 256 bytes.
+			MAX_SIZE         = 1 << (MIN_CLASS_SHIFT + NUM_SIZE_CLASSES - 1)
+		};
+
+		ProcessHandle procHandle;
+		void *section;                                   //!< Handle of the section.
+		uint8_t *local;                                  //!< Where it's mapped here.
+		uint8_t *remote;                                 //!< Where it's mapped in the other process.
+		unsigned size;
+		unsigned used;                                   //!< Bytes bumped off the start so far.
+		std::vector<unsigned> freeObjects[NUM_SIZE_CLASSES]; //!< Offsets of freed objects, by class.
+		std::vector<uint8_t> sizeClasses;                //!< Of the object at each unit.
+
+		void Release();
+
+		SharedRegion(const SharedRegion&);            // do not implement
+		SharedRegion& operator=(const SharedRegion&); // do not implement
+
+	public:
+		/*! \brief Maps a region of at least size bytes into this process and procId. Throws if
+			it can't. */
+		SharedRegion(unsigned procId, unsigned size);
+		~SharedRegion();
+
+		/*! \brief Allocates an object in the region.
+			\return Its address in the other process, or null if it's larger than MAX_SIZE or
+			        the region is full.
+		*/
+		void *Allocate(unsigned size);
+
+		/*! \brief Frees an object from Allocate. */
+		void Free(void *addr);
+
+		/*! \brief Whether addr, in the other process, is in the region. */
+		bool Contains(const void *addr) const;
+
+		/*! \brief Where addr, in the other process, is mapped in this one. Null if it isn't in
+			the region. */
+		void *GetLocalAddr(const void *addr) const;
+};
+
+#endif
@@ -10,6 +10,8 @@
 #include "privateInc/CodeBuffer.h"
 #include "PageManager.h"
 #include "OSMemoryRights.h"
+#include <algorithm>
+#include <cstring>
 #include <cstdint>
 
 #ifdef WIN32
@@ -23,7 +25,10 @@ CodeBuffer::CodeBuffer(PageManager &pages) : pageManager(pages),
 	                                         procHandle(pages.GetProcHandle()), 
 	                                         mem(reinterpret_cast<uint8_t*>(pages.RequestPage())), 
 											 curPos(mem), 
-											 memory(procHandle.GetProcId())
+											 memory(procHandle.GetProcId()),
+											 staged(pages.GetPageSize()),
+											 dirtyBegin(pages.GetPageSize()),
+											 dirtyEnd(0)
 {
 #ifdef WIN32
 	if(!procHandle.EnsureRights(PROCESS_VM_READ | PROCESS_VM_WRITE))
@@ -32,6 +37,9 @@ CodeBuffer::CodeBuffer(PageManager &pages) : pageManager(pages),
 		throw std::exception();
 
 	pageManager.Commit(mem, pageManager.GetPageSize(), OSMemoryRights::READ | OSMemoryRights::WRITE | OSMemoryRights::EXECUTE);
+
+	// Flushes write whole spans, including anything Seek skipped over, so start from what's there.
+	memory.Read(mem, staged.data(), GetBufferSize());
 }
 
 CodeBuffer::~CodeBuffer()
@@ -41,18 +49,34 @@ CodeBuffer::~CodeBuffer()
 
 bool CodeBuffer::Write(void *buffer, unsigned bytes)
 {
-#ifdef WIN32
 	if(!buffer || curPos + bytes >= mem + GetBufferSize())
 		return false;
 
-	memory.Write(curPos, buffer, bytes);
-	if ( !FlushInstructionCache( procHandle.GetHandle(), curPos, bytes ) )
-		return false;
+	unsigned offset = Tell();
+	std::memcpy(&staged[offset], buffer, bytes);
+	dirtyBegin = std::min(dirtyBegin, offset);
+	dirtyEnd = std::max(dirtyEnd, offset + bytes);
 
 	curPos += bytes;
+
+	return true;
+}
+
+bool CodeBuffer::Flush()
+{
+	if(dirtyBegin >= dirtyEnd)
+		return true;
+
+#ifdef WIN32
+	memory.Write(mem + dirtyBegin, &staged[dirtyBegin], dirtyEnd - dirtyBegin);
+	if ( !FlushInstructionCache( procHandle.GetHandle(), mem + dirtyBegin, dirtyEnd - dirtyBegin ) )
+		return false;
 #else
 #endif
 
+	dirtyBegin = GetBufferSize();
+	dirtyEnd = 0;
+
 	return true;
 }
 
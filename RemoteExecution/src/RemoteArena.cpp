@@ -0,0 +1,98 @@
+/************************************************************************************\
+ * RemoteExecution - An Andrew Shurney Production                                   *
+\************************************************************************************/
+
+/*! \file		RemoteArena.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Growable bump allocator over another process's memory
+ */
+
+#include "privateInc/RemoteArena.h"
+#include "PageManager.h"
+#include <algorithm>
+
+static unsigned RoundUp(unsigned x, unsigned align)
+{
+	return (x + (align - 1)) & ~(align - 1);
+}
+
+RemoteArena::RemoteArena(PageManager &pages) : pageManager(pages), regions(), used(0), total(0)
+{
+}
+
+RemoteArena::~RemoteArena()
+{
+	ReleaseRegions();
+}
+
+void *RemoteArena::Allocate(unsigned size)
+{
+	unsigned actualSize = RoundUp(std::max(size, 1u), ALIGNMENT);
+
+	if(regions.empty() || regions.back().size - used < actualSize)
+	{
+		// What's left of the current region is abandoned until the next reset.
+		if(!regions.empty())
+			total += regions.back().size - used;
+
+		if(!AddRegion(actualSize))
+			return nullptr;
+	}
+
+	uint8_t *mem = regions.back().mem + used;
+	used += actualSize;
+	total += actualSize;
+
+	return mem;
+}
+
+void RemoteArena::Reset()
+{
+	if(regions.size() > 1)
+	{
+		unsigned highWater = total;
+
+		ReleaseRegions();
+		AddRegion(highWater);
+	}
+
+	used = 0;
+	total = 0;
+}
+
+unsigned RemoteArena::GetUsed() const
+{
+	return total;
+}
+
+bool RemoteArena::AddRegion(unsigned minSize)
+{
+	unsigned size = MIN_REGION_SIZE;
+	if(!regions.empty())
+		size = std::max(size, regions.back().size * 2);
+	size = pageManager.GetRegionSize(std::max(size, minSize));
+
+	uint8_t *mem = reinterpret_cast<uint8_t*>(pageManager.RequestRegion(size));
+	if(!mem)
+		return false;
+
+	pageManager.Commit(mem, size, OSMemoryRights::READ | OSMemoryRights::WRITE);
+
+	regions.push_back(Region(mem, size));
+	used = 0;
+
+	return true;
+}
+
+void RemoteArena::ReleaseRegions()
+{
+	for(Regions::iterator regionIt = regions.begin(); regionIt != regions.end(); ++regionIt)
+		pageManager.ReturnRegion(regionIt->mem);
+
+	regions.clear();
+	used = 0;
+}
+
+RemoteArena::Region::Region(uint8_t *mem, unsigned size) : mem(mem), size(size)
+{
+}
@@ -14,6 +14,8 @@
 #include "privateInc/CodeBuffer.h"
 #include "RemoteThread.h"
 #include "privateInc/RemoteMemoryManager.h"
+#include "privateInc/RemoteArena.h"
+#include "ProcessMemory.h"
 #include <cstdint>
 #include "ModuleExplorer.h"
 #include "Module.h"
@@ -29,6 +31,13 @@
 # endif
 #endif
 
+namespace
+{
+	// Checks of a shared flag to spin through before sleeping between them. Short calls finish
+	// well within it.
+	const unsigned SHARED_SPINS = 4096;
+}
+
 RemoteCode::RemoteCode(unsigned procId) : procHandle(new ProcessHandle(ProcessHandleManager::Get()->GetHandle(procId))),
 	                                      buffer(&RemoteMemoryManager::Get(procId).GetCodeBuffer()),
 										  remoteThread(nullptr),
@@ -47,6 +56,7 @@ RemoteCode::~RemoteCode()
 		// Kill the remote thread by returning.
 		ASM::Return ret;
 		buffer->Write(&ret, sizeof(ret));
+		buffer->Flush();
 		remoteThread->Resume(); // Start executing
 
 		remoteThread->WaitForDeath();
@@ -170,6 +180,28 @@ RemoteFunction RemoteCode::GetFunction(const void* dllHandle, const std::string&
 }
 
 
+void* RemoteCode::Stage(const void *mem, unsigned size)
+{
+	void *remoteMem = RemoteMemoryManager::Get(GetProcId()).GetStagingArena().Allocate(size);
+	if(!remoteMem)
+		return nullptr;
+
+	ProcessMemory memory(GetProcId());
+	memory.Write(remoteMem, mem, size);
+
+	return remoteMem;
+}
+
+void RemoteCode::ResetStaging()
+{
+	RemoteMemoryManager::Get(GetProcId()).GetStagingArena().Reset();
+}
+
+bool RemoteCode::ShareVariables(unsigned size)
+{
+	return RemoteMemoryManager::Get(GetProcId()).EnableSharedRegion(size);
+}
+
 void RemoteCode::ResetRemoteCode()
 {
 	buffer->Seek(0, CodeBuffer::BEG);
@@ -187,6 +219,7 @@ void RemoteCode::Execute()
 
 	// But the buffer back to the beginning and set our ip to there
 	ResetRemoteCode();
+	buffer->Flush();
 
 	remoteThread->Resume(); // Start executing
 
@@ -213,6 +246,7 @@ void RemoteCode::PrepareRemoteThread()
 	isX86.GetReturnVal(*buffer);
 
 	RemoteU32 codeRunning = WriteCodeEpilogue(); // Windows is going to execute some basic bookkeeping.
+	buffer->Flush();
 
 	remoteThread = new RemoteThread(*procHandle, bufferStart, false);
 
@@ -254,8 +288,16 @@ RemoteU32 RemoteCode::WriteCodeEpilogue()
 void RemoteCode::WaitForFinish(RemoteU32& codeRunning)
 {
 	// Sleep until the code is finished
+	unsigned spins = codeRunning.IsShared() ? SHARED_SPINS : 0;
 	while((uint32_t)codeRunning)
 	{
+		if(spins)
+		{
+			--spins;
+			YieldProcessor();
+			continue;
+		}
+
 		DWORD status;
 		if(!GetExitCodeProcess(*procHandle, &status) || status != STILL_ACTIVE)
 		  break;
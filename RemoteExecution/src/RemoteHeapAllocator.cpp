@@ -11,51 +11,65 @@
 #include "PageManager.h"
 #include <cstdint>
 #include <algorithm>
+#include <iterator>
 #include <cassert>
 
-static unsigned RoundUpSizeofUptr(unsigned x)
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+static unsigned RoundUp(unsigned x, unsigned align)
 {
-	return (x + (sizeof(uintptr_t) - 1)) & ~(sizeof(uintptr_t) - 1);
+	return (x + (align - 1)) & ~(align - 1);
 }
 
-RemoteHeapAllocator::RemoteHeapAllocator(PageManager &pages) : pageManager(pages), pageList(), freeList(nullptr)
+static unsigned LowestSetBit(uint64_t bits)
 {
+#ifdef _MSC_VER
+	unsigned long index;
+# ifdef X64
+	_BitScanForward64(&index, bits);
+# else
+	if(!_BitScanForward(&index, static_cast<unsigned long>(bits)))
+	{
+		_BitScanForward(&index, static_cast<unsigned long>(bits >> 32));
+		index += 32;
+	}
+# endif
+	return index;
+#else
+	return __builtin_ctzll(bits);
+#endif
+}
+
+RemoteHeapAllocator::RemoteHeapAllocator(PageManager &pages) : pageManager(pages), pageMap(), freeBySize(), freeByAddr(), largeInUse(), regionsInUse()
+{
+	std::fill(partialSlabs, partialSlabs + NUM_SIZE_CLASSES, nullptr);
 }
 
 RemoteHeapAllocator::~RemoteHeapAllocator()
 {
-	Node *curNode = freeList;
-	while(curNode)
-	{
-		Node *next = curNode->next;
-		delete curNode;
-		curNode = next;
-	}
+	for(PageMap::iterator pageIt = pageMap.begin(); pageIt != pageMap.end(); ++pageIt)
+		if(pageIt->first == pageIt->second->base)
+			delete pageIt->second;
+
+	for(Allocations::iterator regionIt = regionsInUse.begin(); regionIt != regionsInUse.end(); ++regionIt)
+		pageManager.ReturnRegion(regionIt->first);
 }
 
 void *RemoteHeapAllocator::Allocate(unsigned size)
 {
-	unsigned actualSize = RoundUpSizeofUptr(size);
+	if(size > pageManager.GetPageSize())
+		return AllocateRegion(size);
 
-	if(actualSize > pageManager.GetPageSize() || !freeList && !AllocatePage())
-		return nullptr;
+	if(size > MAX_SMALL_SIZE)
+		return AllocateLarge(size);
 
-	Node *prevNode = nullptr;
-	Node *curNode = freeList;
-	while(curNode)
-	{
-		void *addr = AllocateFromNode(curNode, prevNode, actualSize);
-		if(addr)
-			return addr;
-		
-		prevNode = curNode;
-		curNode = curNode->next;
-	}
-
-	if(AllocatePage())
-		return AllocateFromNode(freeList, nullptr, actualSize);
+	unsigned sizeClass = 0;
+	while((static_cast<unsigned>(1 << MIN_CLASS_SHIFT) << sizeClass) < size)
+		++sizeClass;
 
-	return nullptr;
+	return AllocateSmall(sizeClass);
 }
 
 void RemoteHeapAllocator::Free(void *addrPtr)
@@ -64,109 +78,45 @@ void RemoteHeapAllocator::Free(void *addrPtr)
 		return;
 
 	uint8_t *mem = reinterpret_cast<uint8_t*>(addrPtr);
-	auto allocIt = memInUse.find(mem);
-	assert(allocIt != memInUse.end() && "Bad free. Never allocated.");
-
-	unsigned size = allocIt->second;
-
-	Node *prevNode = nullptr;
-	Node *curNode = freeList;
-	while(curNode)
+	Page *page = FindPage(mem);
+	if(!page)
 	{
-		uint8_t *nodeMem = reinterpret_cast<uint8_t*>(curNode->addr);
-		uint8_t *nextMem = curNode->next ? reinterpret_cast<uint8_t*>(curNode->next->addr) : nullptr;
-
-		if(mem+size == nodeMem)
-		{
-			curNode->size += size;
-			curNode->addr = nodeMem - size;
-
-			return;
-		}
-
-		if(nodeMem + curNode->size == mem)
-		{
-			curNode->size += size;
-
-			Node *next = curNode->next;
-			if(nodeMem + curNode->size == nextMem)
-			{
-				curNode->size += next->size; // nextMem would be null if next were null. We know next is valid
-				curNode->next = next->next; 
-
-				delete next;
-			}
-
-			return;
-		}
-
-		if(mem + size < nextMem)
-		{
-			Node *newNode = new Node(mem, size, curNode->next);
-			curNode->next = newNode;
-			return;
-		}
-
-		prevNode = curNode;
-		curNode = curNode->next;
+		FreeRegion(mem);
+		return;
 	}
 
-	Node *newNode = new Node(mem, size);
-
-	if(prevNode)
-		prevNode->next = newNode;
+	if(page->sizeClass == LARGE_CLASS)
+		FreeLarge(page, mem);
 	else
-		freeList = newNode;
+		FreeSmall(page, mem);
 }
-		
+
 /// \brief Frees all empty pages
 unsigned RemoteHeapAllocator::FreeEmptyPages(void)
 {
-	unsigned pagesFreed = 0;
+	std::vector<Page*> emptyPages;
+	for(PageMap::iterator pageIt = pageMap.begin(); pageIt != pageMap.end(); ++pageIt)
+	{
+		Page *page = pageIt->second;
+		if(pageIt->first == page->base && page->freeCount == page->capacity)
+			emptyPages.push_back(page);
+	}
 
-	Node *prevNode = nullptr;
-	Node *curNode = freeList;
-	while(curNode)
+	for(std::vector<Page*>::iterator pageIt = emptyPages.begin(); pageIt != emptyPages.end(); ++pageIt)
 	{
-		auto nodeIt = std::find(pageList.begin(), pageList.end(), reinterpret_cast<uint8_t*>(curNode));
-		if(nodeIt != pageList.end() && curNode->size >= pageManager.GetPageSize())
-		{
-			if(curNode->size > pageManager.GetPageSize())
-			{
-				Node *newNode = reinterpret_cast<Node*>(reinterpret_cast<uint8_t*>(curNode) + pageManager.GetPageSize());
-				newNode->next = curNode->next;
-				newNode->size = curNode->size - pageManager.GetPageSize();
-
-				if(prevNode)
-					prevNode->next = newNode;
-				else
-					freeList = newNode;
-				
-				curNode = newNode;
-			}
-			else
-			{
-				if(prevNode)
-					prevNode->next = curNode->next;
-				else
-					freeList = curNode->next;
-
-				curNode = curNode->next;
-			}
-			
-			pageList.erase(nodeIt);
-			pageManager.ReturnPage(curNode);
-			++pagesFreed;
-		}
+		Page *page = *pageIt;
+		if(page->sizeClass == LARGE_CLASS)
+			EraseFreeBlock(freeByAddr.find(page->base));
+		else
+			UnlinkSlab(page);
 
-		prevNode = curNode;
-		curNode = curNode->next;
+		ReleasePage(page);
 	}
 
-	return pagesFreed;
+	return static_cast<unsigned>(emptyPages.size());
 }
 
-bool RemoteHeapAllocator::AllocatePage()
+RemoteHeapAllocator::Page *RemoteHeapAllocator::AllocatePage(unsigned sizeClass)
 {
 	uint8_t *newPage = reinterpret_cast<uint8_t*>(pageManager.RequestPage());
 	if(!newPage)
@@ -174,80 +124,233 @@ bool RemoteHeapAllocator::AllocatePage()
 		FreeEmptyPages();
 		newPage = reinterpret_cast<uint8_t*>(pageManager.RequestPage());
 		if(!newPage)
-			return false;
+			return nullptr;
+	}
+
+	unsigned pageSize = pageManager.GetPageSize();
+	pageManager.Commit(newPage, pageSize, OSMemoryRights::READ | OSMemoryRights::WRITE);
+
+	Page *page = new Page(newPage, sizeClass);
+	if(sizeClass == LARGE_CLASS)
+		page->capacity = pageSize;
+	else
+	{
+		unsigned objects = pageSize >> (sizeClass + MIN_CLASS_SHIFT);
+		page->capacity = objects;
+		page->freeBits.assign((objects + 63) / 64, ~static_cast<uint64_t>(0));
+		if(objects % 64)
+			page->freeBits.back() = (static_cast<uint64_t>(1) << (objects % 64)) - 1;
 	}
-	pageManager.Commit(newPage, pageManager.GetPageSize(), OSMemoryRights::READ | OSMemoryRights::WRITE);
+	page->freeCount = page->capacity;
+
+	// Pages are a multiple of the system page size, so every address within one can be found
+	// by aligning it down to a system page.
+	for(unsigned offset = 0; offset < pageSize; offset += PageManager::GetSysPageSize())
+		pageMap.insert(std::make_pair(newPage + offset, page));
 
-	pageList.push_back(newPage);
+	return page;
+}
+
+void RemoteHeapAllocator::ReleasePage(Page *page)
+{
+	unsigned pageSize = pageManager.GetPageSize();
+	for(unsigned offset = 0; offset < pageSize; offset += PageManager::GetSysPageSize())
+		pageMap.erase(page->base + offset);
 
-	Node *newNode = new Node(newPage, pageManager.GetPageSize());
+	pageManager.ReturnPage(page->base);
+	delete page;
+}
+
+RemoteHeapAllocator::Page *RemoteHeapAllocator::FindPage(void *addr) const
+{
+	PageMap::const_iterator pageIt = pageMap.find(PageManager::PageAlign(addr));
+	if(pageIt == pageMap.end())
+		return nullptr;
+
+	return pageIt->second;
+}
 
-	if(!freeList)
+void *RemoteHeapAllocator::AllocateSmall(unsigned sizeClass)
+{
+	Page *slab = partialSlabs[sizeClass];
+	if(!slab)
 	{
-		freeList = newNode;
+		slab = AllocatePage(sizeClass);
+		if(!slab)
+			return nullptr;
 
-		return true;
+		LinkSlab(slab);
 	}
-	else
+
+	// Every word below firstFreeWord is full and the slab has a free object, so this is bounded
+	// by the number of words in the bitmap.
+	unsigned word = slab->firstFreeWord;
+	while(!slab->freeBits[word])
+		++word;
+
+	uint64_t bits = slab->freeBits[word];
+	unsigned index = word * 64 + LowestSetBit(bits);
+
+	slab->freeBits[word] = bits & (bits - 1);
+	slab->firstFreeWord = word;
+
+	if(--slab->freeCount == 0)
+		UnlinkSlab(slab);
+
+	return slab->base + (index << (sizeClass + MIN_CLASS_SHIFT));
+}
+
+void RemoteHeapAllocator::FreeSmall(Page *slab, uint8_t *mem)
+{
+	unsigned shift = slab->sizeClass + MIN_CLASS_SHIFT;
+	unsigned offset = static_cast<unsigned>(mem - slab->base);
+	unsigned index = offset >> shift;
+	unsigned word = index / 64;
+	uint64_t bit = static_cast<uint64_t>(1) << (index % 64);
+
+	assert(!(offset & ((1u << shift) - 1)) && "Bad free. Not the start of an allocation.");
+	assert(!(slab->freeBits[word] & bit) && "Bad free. Already freed.");
+
+	slab->freeBits[word] |= bit;
+	if(word < slab->firstFreeWord)
+		slab->firstFreeWord = word;
+
+	if(slab->freeCount++ == 0)
+		LinkSlab(slab);
+	else if(slab->freeCount == slab->capacity && (slab->prev || slab->next))
 	{
-		Node *curNode = freeList;
-		while(curNode)
-		{
-			if(!curNode->next || newNode < curNode->next)
-			{
-				newNode->next = curNode->next;
-				curNode->next = newNode;
-				return true;
-			}
-
-			curNode = curNode->next;
-		}
+		// Keep one empty slab per class so alloc/free cycles don't thrash pages, but hand back
+		// any others.
+		UnlinkSlab(slab);
+		ReleasePage(slab);
 	}
+}
 
-	assert(false && "Unreachable code");
-	delete newNode;
-	pageManager.ReturnPage(newPage);
-	pageList.pop_back();
+void RemoteHeapAllocator::LinkSlab(Page *slab)
+{
+	Page *&head = partialSlabs[slab->sizeClass];
 
-	return false;
+	slab->prev = nullptr;
+	slab->next = head;
+	if(head)
+		head->prev = slab;
+	head = slab;
 }
 
-uint8_t* RemoteHeapAllocator::SplitNode(Node *node, unsigned size)
+void RemoteHeapAllocator::UnlinkSlab(Page *slab)
 {
-	uint8_t* mem = reinterpret_cast<uint8_t*>(node->addr);
-	uint8_t *nodeMem = reinterpret_cast<uint8_t*>(node->addr);
+	if(slab->prev)
+		slab->prev->next = slab->next;
+	else
+		partialSlabs[slab->sizeClass] = slab->next;
 
-	node->size -= size;
-	node->addr = nodeMem + size;
+	if(slab->next)
+		slab->next->prev = slab->prev;
 
-	return mem;
+	slab->prev = slab->next = nullptr;
 }
 
-void* RemoteHeapAllocator::AllocateFromNode(Node *node, Node *prevNode, unsigned size)
+void *RemoteHeapAllocator::AllocateLarge(unsigned size)
 {
-	uint8_t *mem = nullptr;
-	if(node->size == size) 
+	unsigned actualSize = RoundUp(size, LARGE_ALIGN);
+	if(actualSize > pageManager.GetPageSize())
+		return AllocateRegion(size);
+
+	FreeBySize::iterator fitIt = freeBySize.lower_bound(actualSize);
+	if(fitIt == freeBySize.end())
 	{
-		if(prevNode)
-			prevNode->next = node->next;
-		else
-			freeList = node->next;
+		Page *page = AllocatePage(LARGE_CLASS);
+		if(!page)
+			return nullptr;
+
+		InsertFreeBlock(page->base, page->capacity);
+		fitIt = freeBySize.lower_bound(actualSize);
+	}
+
+	unsigned blockSize = fitIt->first;
+	uint8_t *mem = fitIt->second;
+
+	EraseFreeBlock(freeByAddr.find(mem));
+	if(blockSize > actualSize)
+		InsertFreeBlock(mem + actualSize, blockSize - actualSize);
+
+	FindPage(mem)->freeCount -= actualSize;
+	largeInUse.insert(std::make_pair(mem, actualSize));
+
+	return mem;
+}
 
-		mem = reinterpret_cast<uint8_t*>(node->addr);
+void RemoteHeapAllocator::FreeLarge(Page *page, uint8_t *mem)
+{
+	Allocations::iterator allocIt = largeInUse.find(mem);
+	assert(allocIt != largeInUse.end() && "Bad free. Never allocated.");
+	if(allocIt == largeInUse.end())
+		return;
 
-		delete node;
+	unsigned size = allocIt->second;
+	largeInUse.erase(allocIt);
+	page->freeCount += size;
 
+	// Coalesce with the free blocks on either side, so long as they're in the same page.
+	FreeByAddr::iterator nextIt = freeByAddr.lower_bound(mem);
+	if(nextIt != freeByAddr.end() && nextIt->first == mem + size && nextIt->first < page->base + page->capacity)
+	{
+		size += nextIt->second->first;
+		EraseFreeBlock(nextIt++);
 	}
-	else if(node->size > size)
+
+	if(nextIt != freeByAddr.begin())
 	{
-		mem = SplitNode(node, size);
+		FreeByAddr::iterator prevIt = std::prev(nextIt);
+		if(prevIt->first >= page->base && prevIt->first + prevIt->second->first == mem)
+		{
+			mem = prevIt->first;
+			size += prevIt->second->first;
+			EraseFreeBlock(prevIt);
+		}
 	}
-	else
+
+	InsertFreeBlock(mem, size);
+}
+
+void RemoteHeapAllocator::InsertFreeBlock(uint8_t *mem, unsigned size)
+{
+	FreeBySize::iterator sizeIt = freeBySize.insert(std::make_pair(size, mem));
+	freeByAddr.insert(std::make_pair(mem, sizeIt));
+}
+
+void RemoteHeapAllocator::EraseFreeBlock(FreeByAddr::iterator blockIt)
+{
+	freeBySize.erase(blockIt->second);
+	freeByAddr.erase(blockIt);
+}
+
+void *RemoteHeapAllocator::AllocateRegion(unsigned size)
+{
+	unsigned actualSize = RoundUp(size, PageManager::GetSysPageSize());
+
+	uint8_t *mem = reinterpret_cast<uint8_t*>(pageManager.RequestRegion(actualSize));
+	if(!mem)
 		return nullptr;
 
-	memInUse.insert(std::make_pair(mem, size));
+	pageManager.Commit(mem, actualSize, OSMemoryRights::READ | OSMemoryRights::WRITE);
+	regionsInUse.insert(std::make_pair(mem, actualSize));
 
 	return mem;
 }
 
-RemoteHeapAllocator::Node::Node(void *addr, unsigned size, Node *next) : next(next), addr(addr), size(size) {}
\ No newline at end of file
+void RemoteHeapAllocator::FreeRegion(uint8_t *mem)
+{
+	Allocations::iterator regionIt = regionsInUse.find(mem);
+	assert(regionIt != regionsInUse.end() && "Bad free. Never allocated.");
+	if(regionIt == regionsInUse.end())
+		return;
+
+	pageManager.ReturnRegion(mem);
+	regionsInUse.erase(regionIt);
+}
+
+RemoteHeapAllocator::Page::Page(uint8_t *base, unsigned sizeClass) : base(base), sizeClass(sizeClass), freeCount(0), capacity(0),
+                                                                     firstFreeWord(0), prev(nullptr), next(nullptr), freeBits()
+{
+}
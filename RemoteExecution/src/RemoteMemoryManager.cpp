@@ -12,14 +12,23 @@
 #include "PageManager.h"
 #include "privateInc/RemoteHeapAllocator.h"
 #include "privateInc/CodeBuffer.h"
+#include "privateInc/RemoteArena.h"
+#include "privateInc/SharedRegion.h"
 
 struct RemoteMemoryData
 {
+	unsigned      procId;
 	PageManager   pageManager;
 	CodeBuffer    code;
 	RemoteHeapAllocator heap;
+	RemoteArena   staging;
+	SharedRegion *shared;
 
-	RemoteMemoryData(unsigned procId) : pageManager(4*1024, false, procId), code(pageManager), heap(pageManager){}
+	RemoteMemoryData(unsigned procId) : procId(procId), pageManager(4*1024, false, procId), code(pageManager), heap(pageManager), staging(pageManager), shared(nullptr){}
+	~RemoteMemoryData()
+	{
+		delete shared;
+	}
 };
 
 RemoteMemoryManager RemoteMemoryManager::Get(unsigned procId)
@@ -100,10 +109,51 @@ void *RemoteMemoryManager::Allocate(unsigned size)
 
 void RemoteMemoryManager::Free(void *addr)
 {
-	data->heap.Free(addr);
+	if(data->shared && data->shared->Contains(addr))
+		data->shared->Free(addr);
+	else
+		data->heap.Free(addr);
+}
+
+bool RemoteMemoryManager::EnableSharedRegion(unsigned size)
+{
+	if(data->shared)
+		return true;
+
+	try
+	{
+		data->shared = new SharedRegion(data->procId, size);
+	}
+	catch(...)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+void *RemoteMemoryManager::AllocateShared(unsigned size)
+{
+	if(!data->shared)
+		return nullptr;
+
+	return data->shared->Allocate(size);
+}
+
+void *RemoteMemoryManager::GetLocalAddr(const void *addr) const
+{
+	if(!data->shared)
+		return nullptr;
+
+	return data->shared->GetLocalAddr(addr);
 }
 
 CodeBuffer &RemoteMemoryManager::GetCodeBuffer()
 {
 	return data->code;
 }
+
+RemoteArena &RemoteMemoryManager::GetStagingArena()
+{
+	return data->staging;
+}
\ No newline at end of file
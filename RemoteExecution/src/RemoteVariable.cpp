@@ -15,6 +15,8 @@
 #include "ProcessHandleManager.h"
 #include "privateInc/RemoteMemoryManager.h"
 #include "ProcessMemory.h"
+#include <atomic>
+#include <cstring>
 
 #ifdef WIN32
 # define WIN32_LEAN_AND_MEAN
@@ -28,15 +30,25 @@ struct RemoteVariableData
 	ProcessHandle procHandle;
 	RemoteMemoryManager heap;
 	void *varAddr;
+	uint8_t *localAddr;   //!< Where varAddr is mapped here, if it's shared.
 	unsigned size;
 	ProcessMemory memory;
 
 	RemoteVariableData(unsigned procId, unsigned size) : procHandle(ProcessHandleManager::Get()->GetHandle(procId)),
 		                                                 heap(RemoteMemoryManager::Get(procId)), 
-		                                                 varAddr(nullptr), size(size), memory(procId)
+		                                                 varAddr(nullptr), localAddr(nullptr), size(size), memory(procId)
 	{
 	}
 
+	void Allocate(unsigned bytes)
+	{
+		varAddr = heap.AllocateShared(bytes);
+		if(!varAddr)
+			varAddr = heap.Allocate(bytes);
+
+		localAddr = static_cast<uint8_t*>(heap.GetLocalAddr(varAddr));
+	}
+
   ~RemoteVariableData()
   {
     heap.Free(varAddr);
@@ -49,7 +61,7 @@ RemoteVariable::RemoteVariable(unsigned procId, unsigned size) : data(new Remote
 {
 	*refs = 1;
 
-	data->varAddr = data->heap.Allocate(size);
+	data->Allocate(size);
 }
 
 RemoteVariable::RemoteVariable(unsigned procId, unsigned size, const void *varAddr) : data(new RemoteVariableData(procId, size)), 
@@ -58,6 +70,7 @@ RemoteVariable::RemoteVariable(unsigned procId, unsigned size, const void *varAd
 	*refs = 1;
 
 	data->varAddr = const_cast<void*>(varAddr);
+	data->localAddr = static_cast<uint8_t*>(data->heap.GetLocalAddr(varAddr));
 }
 
 RemoteVariable::RemoteVariable(const RemoteVariable& rhs) : data(rhs.data), refs(rhs.refs)
@@ -127,7 +140,7 @@ void RemoteVariable::Destroy()
 void RemoteVariable::NewVarAddr(unsigned size)
 {
 	data->heap.Free(data->varAddr);
-	data->varAddr = data->heap.Allocate(size);
+	data->Allocate(size);
 	data->size = size;
 }
 
@@ -136,8 +149,37 @@ void *RemoteVariable::GetVarAddr() const
 	return data->varAddr;
 }
 
+bool RemoteVariable::IsShared() const
+{
+	return data->localAddr != nullptr;
+}
+
+// Shared variables are written by the other process while this one reads them, as flags are
+// polled. Words are loaded and stored whole, and ordered with what's around them.
 void RemoteVariable::Write(const void *mem, unsigned size)
 {
+	if(data->localAddr)
+	{
+		if(size == sizeof(uint32_t) && !(reinterpret_cast<uintptr_t>(data->localAddr) % sizeof(uint32_t)))
+		{
+			uint32_t value;
+			std::memcpy(&value, mem, sizeof(value));
+			reinterpret_cast<std::atomic<uint32_t>*>(data->localAddr)->store(value, std::memory_order_release);
+		}
+		else if(size == sizeof(uint64_t) && !(reinterpret_cast<uintptr_t>(data->localAddr) % sizeof(uint64_t)))
+		{
+			uint64_t value;
+			std::memcpy(&value, mem, sizeof(value));
+			reinterpret_cast<std::atomic<uint64_t>*>(data->localAddr)->store(value, std::memory_order_release);
+		}
+		else
+		{
+			std::memcpy(data->localAddr, mem, size);
+			std::atomic_thread_fence(std::memory_order_release);
+		}
+		return;
+	}
+
 #ifdef WIN32
 	data->memory.Write(GetVarAddr(), mem, size);
 #else
@@ -146,6 +188,26 @@ void RemoteVariable::Write(const void *mem, unsigned size)
 
 void RemoteVariable::Read(void *mem, unsigned size) const
 {
+	if(data->localAddr)
+	{
+		if(size == sizeof(uint32_t) && !(reinterpret_cast<uintptr_t>(data->localAddr) % sizeof(uint32_t)))
+		{
+			uint32_t value = reinterpret_cast<std::atomic<uint32_t>*>(data->localAddr)->load(std::memory_order_acquire);
+			std::memcpy(mem, &value, sizeof(value));
+		}
+		else if(size == sizeof(uint64_t) && !(reinterpret_cast<uintptr_t>(data->localAddr) % sizeof(uint64_t)))
+		{
+			uint64_t value = reinterpret_cast<std::atomic<uint64_t>*>(data->localAddr)->load(std::memory_order_acquire);
+			std::memcpy(mem, &value, sizeof(value));
+		}
+		else
+		{
+			std::atomic_thread_fence(std::memory_order_acquire);
+			std::memcpy(mem, data->localAddr, size);
+		}
+		return;
+	}
+
 #ifdef WIN32
 	data->memory.Read(GetVarAddr(), mem, size);
 #else
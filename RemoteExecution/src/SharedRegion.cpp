@@ -0,0 +1,148 @@
+/************************************************************************************\
+ * RemoteExecution - An Andrew Shurney Production                                   *
+\************************************************************************************/
+
+/*! \file		SharedRegion.cpp
+ *  \author		Andrew Shurney
+ *  \brief		Memory mapped into both this and another process
+ */
+
+#include "privateInc/SharedRegion.h"
+#include "ProcessHandleManager.h"
+#include "PageManager.h"
+#include <exception>
+
+#ifdef WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+#else
+# error Unimplemented
+#endif
+
+namespace
+{
+	// Mapping a view into another process needs the native call; MapViewOfFile only maps into
+	// this one.
+	const ULONG VIEW_UNMAP = 2;
+
+	typedef LONG (NTAPI *NtMapViewOfSectionPtr)(HANDLE section, HANDLE process, PVOID *base, ULONG_PTR zeroBits, SIZE_T commitSize,
+	                                            PLARGE_INTEGER offset, PSIZE_T viewSize, ULONG inherit, ULONG allocationType, ULONG protect);
+	typedef LONG (NTAPI *NtUnmapViewOfSectionPtr)(HANDLE process, PVOID base);
+
+	unsigned RoundUp(unsigned x, unsigned align)
+	{
+		return (x + (align - 1)) & ~(align - 1);
+	}
+}
+
+SharedRegion::SharedRegion(unsigned procId, unsigned size) : procHandle(ProcessHandleManager::Get()->GetHandle(procId)),
+	                                                         section(nullptr), local(nullptr), remote(nullptr),
+	                                                         size(RoundUp(size, PageManager::GetSysPageSize())), used(0),
+	                                                         sizeClasses(this->size >> MIN_CLASS_SHIFT)
+{
+	if(!procHandle.EnsureRights(PROCESS_VM_OPERATION))
+		throw std::exception();
+
+	HMODULE ntdll = GetModuleHandleA("ntdll.dll");
+	NtMapViewOfSectionPtr mapViewOfSection = reinterpret_cast<NtMapViewOfSectionPtr>(GetProcAddress(ntdll, "NtMapViewOfSection"));
+	if(!mapViewOfSection)
+		throw std::exception();
+
+	section = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, this->size, NULL);
+	if(!section)
+		throw std::exception();
+
+	local = static_cast<uint8_t*>(MapViewOfFile(section, FILE_MAP_ALL_ACCESS, 0, 0, this->size));
+
+	PVOID remoteBase = nullptr;
+	SIZE_T viewSize = this->size;
+	if(!local || mapViewOfSection(section, procHandle.GetHandle(), &remoteBase, 0, 0, NULL, &viewSize, VIEW_UNMAP, 0, PAGE_READWRITE) < 0)
+	{
+		Release();
+		throw std::exception();
+	}
+
+	remote = static_cast<uint8_t*>(remoteBase);
+}
+
+SharedRegion::~SharedRegion()
+{
+	Release();
+}
+
+void SharedRegion::Release()
+{
+	if(remote)
+	{
+		HMODULE ntdll = GetModuleHandleA("ntdll.dll");
+		NtUnmapViewOfSectionPtr unmapViewOfSection = reinterpret_cast<NtUnmapViewOfSectionPtr>(GetProcAddress(ntdll, "NtUnmapViewOfSection"));
+		if(unmapViewOfSection)
+			unmapViewOfSection(procHandle.GetHandle(), remote);
+		remote = nullptr;
+	}
+
+	if(local)
+	{
+		UnmapViewOfFile(local);
+		local = nullptr;
+	}
+
+	if(section)
+	{
+		CloseHandle(section);
+		section = nullptr;
+	}
+}
+
+void *SharedRegion::Allocate(unsigned objSize)
+{
+	if(objSize > MAX_SIZE)
+		return nullptr;
+
+	unsigned sizeClass = 0;
+	while((static_cast<unsigned>(1 << MIN_CLASS_SHIFT) << sizeClass) < objSize)
+		++sizeClass;
+
+	unsigned offset;
+	if(!freeObjects[sizeClass].empty())
+	{
+		offset = freeObjects[sizeClass].back();
+		freeObjects[sizeClass].pop_back();
+	}
+	else
+	{
+		// Objects are aligned to their size, so no object straddles a cache line it doesn't have to.
+		unsigned classSize = 1 << (sizeClass + MIN_CLASS_SHIFT);
+		offset = RoundUp(used, classSize);
+		if(offset + classSize > size)
+			return nullptr;
+
+		used = offset + classSize;
+	}
+
+	sizeClasses[offset >> MIN_CLASS_SHIFT] = static_cast<uint8_t>(sizeClass);
+	return remote + offset;
+}
+
+void SharedRegion::Free(void *addr)
+{
+	if(!Contains(addr))
+		return;
+
+	unsigned offset = static_cast<unsigned>(static_cast<uint8_t*>(addr) - remote);
+	freeObjects[sizeClasses[offset >> MIN_CLASS_SHIFT]].push_back(offset);
+}
+
+bool SharedRegion::Contains(const void *addr) const
+{
+	const uint8_t *mem = static_cast<const uint8_t*>(addr);
+	return remote && mem >= remote && mem < remote + size;
+}
+
+void *SharedRegion::GetLocalAddr(const void *addr) const
+{
+	if(!Contains(addr))
+		return nullptr;
+
+	return local + (static_cast<const uint8_t*>(addr) - remote);
+}
@@ -0,0 +1,25 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <chrono>
+
+typedef std::chrono::high_resolution_clock BenchClock;
+
+inline double ElapsedMs(BenchClock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+}
+
+void BenchRemoteVariables();
+void BenchHookFootprint();
+void BenchPauseLatency();
+void BenchBoundedInstall();
+void BenchSymbolization();
+void BenchSymbolSearch();
+void BenchSignatureScan();
+void BenchSharedVariables();
+void BenchMemoryScan();
+void BenchMemorySnapshot();
+void BenchRemoteGraph();
+
+#endif
@@ -0,0 +1,136 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <Windows.h>
+#include "FuncHooker.h"
+#include "Benchmarks.h"
+
+static const unsigned hookCount = 20000;
+static const unsigned funcStride = 32;
+static const unsigned singleCount = 2000;
+static const unsigned workerCount = 64;
+static const unsigned pauseBudgets[] = { 100, 200, 1000 };
+
+static int Injector()
+{
+	return -1;
+}
+
+static void IdleWorker(const std::atomic<bool> *stop)
+{
+	while(!*stop)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+}
+
+// Same layout as the footprint benchmark: "mov eax, i; ret" with int 3 padding either side.
+static uint8_t *GenerateFunctions()
+{
+	uint8_t *code = static_cast<uint8_t*>(VirtualAlloc(NULL, hookCount * funcStride, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE));
+	if(!code)
+		return NULL;
+
+	std::memset(code, 0xCC, hookCount * funcStride);
+	for(unsigned i=0; i<hookCount; ++i)
+	{
+		uint8_t *func = code + i*funcStride + funcStride/2;
+		func[0] = 0xB8; // mov eax, imm32
+		std::memcpy(func + 1, &i, sizeof(i));
+		func[5] = 0xC3; // ret
+	}
+
+	return code;
+}
+
+static void PrintHistogram(const FuncHookerPauseStats& stats)
+{
+	for(unsigned i=0; i<FUNCHOOKER_PAUSE_BUCKETS; ++i)
+	{
+		if(!stats.histogram[i])
+			continue;
+
+		std::cout << "  ";
+		if(!i)
+			std::cout << "<1us";
+		else if(i + 1 == FUNCHOOKER_PAUSE_BUCKETS)
+			std::cout << ">=" << (1u << (i - 1)) << "us";
+		else
+			std::cout << (1u << (i - 1)) << "-" << (1u << i) << "us";
+		std::cout << ": " << stats.histogram[i] << std::endl;
+	}
+}
+
+void BenchBoundedInstall()
+{
+	uint8_t *code = GenerateFunctions();
+	if(!code)
+	{
+		std::cout << "Bounded install: failed to allocate functions" << std::endl;
+		return;
+	}
+
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> workers;
+	for(unsigned t=0; t<workerCount; ++t)
+		workers.push_back(std::thread(IdleWorker, &stop));
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+	for(unsigned b=0; b<sizeof(pauseBudgets)/sizeof(pauseBudgets[0]); ++b)
+	{
+		std::vector<FuncHooker*> hooks;
+		hooks.reserve(hookCount);
+		for(unsigned i=0; i<hookCount; ++i)
+			hooks.push_back(CreateFuncHooker(code + i*funcStride + funcStride/2, reinterpret_cast<void*>(&Injector)));
+
+		FuncHookerPauseStats stats;
+		BenchClock::time_point start = BenchClock::now();
+		unsigned installed = InstallHooksBounded(&hooks[0], hookCount, pauseBudgets[b], &stats);
+		double installMs = ElapsedMs(start);
+
+		std::cout << "Bounded install of " << installed << " hooks with " << workerCount << " threads, " << pauseBudgets[b] << "us budget: "
+		          << installMs << "ms, " << stats.pauses << " pauses (" << stats.overBudget << " over), mean "
+		          << stats.totalPauseMicroseconds / stats.pauses << "us, max " << stats.maxPauseMicroseconds << "us" << std::endl;
+
+		PrintHistogram(stats);
+
+		for(std::vector<FuncHooker*>::iterator hookIt = hooks.begin(); hookIt != hooks.end(); ++hookIt)
+			DestroyFuncHooker(*hookIt);
+		ReclaimFuncHookerMemory();
+	}
+
+	// The same hooks installed one at a time, for comparison.
+	{
+		std::vector<FuncHooker*> hooks;
+		hooks.reserve(singleCount);
+		for(unsigned i=0; i<singleCount; ++i)
+			hooks.push_back(CreateFuncHooker(code + i*funcStride + funcStride/2, reinterpret_cast<void*>(&Injector)));
+
+		ResetFuncHookerPauseStats();
+		BenchClock::time_point start = BenchClock::now();
+		for(std::vector<FuncHooker*>::iterator hookIt = hooks.begin(); hookIt != hooks.end(); ++hookIt)
+			InstallHook(*hookIt);
+		double installMs = ElapsedMs(start);
+
+		FuncHookerPauseStats stats;
+		GetFuncHookerPauseStats(&stats);
+
+		std::cout << "Single installs of " << singleCount << " hooks with " << workerCount << " threads: " << installMs << "ms, "
+		          << stats.pauses << " pauses, mean " << stats.totalPauseMicroseconds / stats.pauses << "us, max "
+		          << stats.maxPauseMicroseconds << "us" << std::endl;
+		PrintHistogram(stats);
+
+		for(std::vector<FuncHooker*>::iterator hookIt = hooks.begin(); hookIt != hooks.end(); ++hookIt)
+			DestroyFuncHooker(*hookIt);
+		ReclaimFuncHookerMemory();
+	}
+
+	stop = true;
+	for(auto it = workers.begin(); it != workers.end(); ++it)
+		it->join();
+
+	VirtualFree(code, 0, MEM_RELEASE);
+}
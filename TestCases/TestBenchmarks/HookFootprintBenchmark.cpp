@@ -0,0 +1,141 @@
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <malloc.h>
+#include <Windows.h>
+#include "FuncHookerFactory.h"
+#include "Benchmarks.h"
+
+static const unsigned hookCount = 100000;
+static const unsigned funcStride = 32;
+
+// Counts the heap bytes allocated while it's alive, by hooking malloc and free. operator new and
+// delete go through them, and nothing outside this benchmark is counted.
+class HeapCounter
+{
+	private:
+		typedef void *(__cdecl *MallocPtr)(size_t);
+		typedef void (__cdecl *FreePtr)(void*);
+
+		static HeapCounter *current;
+
+		std::atomic<ptrdiff_t> bytes;
+		FuncHookerImpl<MallocPtr> *mallocHook;
+		FuncHookerImpl<FreePtr> *freeHook;
+
+		static void *__cdecl CountingMalloc(size_t size)
+		{
+			void *mem = current->mallocHook->CallInjectee(size);
+			if(mem)
+				current->bytes += _msize(mem);
+			return mem;
+		}
+
+		static void __cdecl CountingFree(void *mem)
+		{
+			if(mem)
+				current->bytes -= _msize(mem);
+			current->freeHook->CallInjectee(mem);
+		}
+
+		HeapCounter(const HeapCounter&);            // Do not implement
+		HeapCounter& operator=(const HeapCounter&); // Do not implement
+
+	public:
+		HeapCounter() : bytes(0), mallocHook(CreateFuncHooker(static_cast<MallocPtr>(&malloc), &CountingMalloc)),
+		                freeHook(CreateFuncHooker(static_cast<FreePtr>(&free), &CountingFree))
+		{
+			current = this;
+			mallocHook->InstallHook();
+			freeHook->InstallHook();
+		}
+
+		~HeapCounter()
+		{
+			freeHook->RemoveHook();
+			mallocHook->RemoveHook();
+			delete freeHook;
+			delete mallocHook;
+			current = nullptr;
+		}
+
+		// Bytes allocated and not yet freed since the counter was made, as _msize reports them.
+		// Frees of older blocks take away from it too.
+		ptrdiff_t GetBytes() const
+		{
+			return bytes;
+		}
+};
+
+HeapCounter *HeapCounter::current = nullptr;
+
+static int Injector()
+{
+	return -1;
+}
+
+// Builds hookCount distinct functions, each "mov eax, i; ret" preceded by int 3 padding so the
+// hooker can find a dead zone for its proxy jump, as it would before most compiled functions.
+static uint8_t *GenerateFunctions()
+{
+	uint8_t *code = static_cast<uint8_t*>(VirtualAlloc(NULL, hookCount * funcStride, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE));
+	if(!code)
+		return NULL;
+
+	std::memset(code, 0xCC, hookCount * funcStride);
+	for(unsigned i=0; i<hookCount; ++i)
+	{
+		uint8_t *func = code + i*funcStride + funcStride/2;
+		func[0] = 0xB8; // mov eax, imm32
+		std::memcpy(func + 1, &i, sizeof(i));
+		func[5] = 0xC3; // ret
+	}
+
+	return code;
+}
+
+void BenchHookFootprint()
+{
+	typedef int (*FuncType)();
+	typedef std::vector<FuncHookerImpl<FuncType>*> Hooks;
+
+	uint8_t *code = GenerateFunctions();
+	if(!code)
+	{
+		std::cout << "Hook footprint: failed to allocate functions" << std::endl;
+		return;
+	}
+
+	Hooks hooks;
+	hooks.reserve(hookCount);
+
+	HeapCounter heap;
+	ptrdiff_t baseline = heap.GetBytes();
+
+	BenchClock::time_point start = BenchClock::now();
+	for(unsigned i=0; i<hookCount; ++i)
+		hooks.push_back(CreateFuncHooker(reinterpret_cast<void*>(code + i*funcStride + funcStride/2), &Injector));
+	double createMs = ElapsedMs(start);
+	ptrdiff_t created = heap.GetBytes();
+
+	start = BenchClock::now();
+	for(Hooks::iterator hookIt = hooks.begin(); hookIt != hooks.end(); ++hookIt)
+		(*hookIt)->InstallHook();
+	double installMs = ElapsedMs(start);
+	ptrdiff_t installed = heap.GetBytes();
+
+	std::cout << "Hook footprint over " << hookCount << " hooks:" << std::endl
+	          << "  created:   " << static_cast<double>(created - baseline) / hookCount << " heap bytes/hook (" << createMs << "ms)" << std::endl
+	          << "  installed: " << static_cast<double>(installed - baseline) / hookCount << " heap bytes/hook (" << installMs << "ms)" << std::endl
+	          << "  Each hook also uses one trampoline in the shared executable stub area." << std::endl;
+
+	for(Hooks::iterator hookIt = hooks.begin(); hookIt != hooks.end(); ++hookIt)
+		delete *hookIt;
+
+	std::cout << "  destroyed: " << static_cast<double>(heap.GetBytes() - baseline) / hookCount << " heap bytes/hook retained by pools" << std::endl;
+
+	VirtualFree(code, 0, MEM_RELEASE);
+}
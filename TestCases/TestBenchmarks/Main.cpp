@@ -0,0 +1,20 @@
+#include "Benchmarks.h"
+
+int main()
+{
+	BenchRemoteVariables();
+	BenchHookFootprint();
+	BenchBoundedInstall();
+	BenchSymbolization();
+	BenchSymbolSearch();
+	BenchSignatureScan();
+	BenchSharedVariables();
+	BenchMemoryScan();
+	BenchMemorySnapshot();
+	BenchRemoteGraph();
+
+	// Leaves the ThreadRegistry enabled, which would change how everything after it pauses.
+	BenchPauseLatency();
+
+	return 0;
+}
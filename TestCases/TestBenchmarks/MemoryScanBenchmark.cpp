@@ -0,0 +1,60 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include "MemoryScanner.h"
+#include "Benchmarks.h"
+
+static const size_t heapSize = 64 << 20;
+static const unsigned planted = 1000;
+static const uint32_t plantedValue = 0x5CA77E2D;
+
+void BenchMemoryScan()
+{
+	// A heap full of values that aren't the one looked for, with a few that are.
+	std::vector<uint32_t> heap(heapSize / sizeof(uint32_t));
+	for(size_t i=0; i<heap.size(); ++i)
+		heap[i] = static_cast<uint32_t>(i * 2654435761u) | 1;
+	for(unsigned i=0; i<planted; ++i)
+		heap[i * (heap.size() / planted)] = plantedValue;
+
+	MemoryScanner scanner;
+	std::cout << "MemoryScanner over " << heapSize / (1 << 20) << "MB of heap and the rest of this process:" << std::endl;
+
+	const char *simdNames[] = { "scalar", "SSE4.2", "AVX2" };
+	unsigned threadCounts[] = { 1, std::max(1u, std::thread::hardware_concurrency()) };
+	MemoryScanner::Hits hits;
+	for(size_t t=0; t<sizeof(threadCounts)/sizeof(threadCounts[0]); ++t)
+	{
+		scanner.SetThreadCount(threadCounts[t]);
+
+		std::cout << "  " << threadCounts[t] << " threads:";
+		for(int level = SignatureScanner::SIMD_NONE; level <= SignatureScanner::GetSupportedSimd(); ++level)
+		{
+			scanner.SetSimd(static_cast<SignatureScanner::SimdLevel>(level));
+
+			// The last scan's hits hold the value too, so they're let go of first.
+			MemoryScanner::Hits().swap(hits);
+
+			BenchClock::time_point start = BenchClock::now();
+			scanner.Scan(MemoryScanner::Query::Exact(plantedValue), hits);
+			double ms = ElapsedMs(start);
+
+			std::cout << " " << simdNames[level] << " " << scanner.GetStats().bytesRead / (ms * 1e6) << "GB/s";
+		}
+		std::cout << std::endl;
+	}
+
+	// Half the values change, and a rescan finds which.
+	for(unsigned i=0; i<planted; i+=2)
+		++heap[i * (heap.size() / planted)];
+
+	size_t found = hits.size();
+	BenchClock::time_point start = BenchClock::now();
+	scanner.Rescan(MemoryScanner::Query::Compared<uint32_t>(MemoryScanner::CHANGED), hits);
+	double ms = ElapsedMs(start);
+
+	std::cout << "  Rescan of " << found << " hits: " << hits.size() << " changed, " << scanner.GetStats().bytesRead << " bytes read in "
+	          << ms << "ms" << std::endl;
+}
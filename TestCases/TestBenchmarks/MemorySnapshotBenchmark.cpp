@@ -0,0 +1,72 @@
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include "MemorySnapshot.h"
+#include "Benchmarks.h"
+
+static const size_t bufferSize = 64 << 20;
+
+// Writes that are far enough apart to be reported separately. The last crosses a page boundary.
+static const MemorySnapshot::Change written[] = { { 3 * 4096 + 100, 4 }, { 1000 * 4096, 1 }, { 9000 * 4096 + 4000, 200 } };
+static const size_t writtenCount = sizeof(written) / sizeof(written[0]);
+
+static bool CheckChanges(const MemorySnapshot& snapshot, const MemorySnapshot::Change *expected, size_t count)
+{
+	const MemorySnapshot::Changes& changes = snapshot.GetChanges(0);
+	if(changes.size() != count)
+		return false;
+
+	for(size_t i=0; i<count; ++i)
+		if(changes[i].offset != expected[i].offset || changes[i].size != expected[i].size)
+			return false;
+
+	return true;
+}
+
+void BenchMemorySnapshot()
+{
+	std::vector<uint8_t> buffer(bufferSize);
+	for(size_t i=0; i<buffer.size(); ++i)
+		buffer[i] = static_cast<uint8_t>(i * 2654435761u >> 24);
+
+	MemorySnapshot snapshot;
+	snapshot.AddRange(&buffer[0], buffer.size());
+
+	BenchClock::time_point start = BenchClock::now();
+	snapshot.Take();
+	double firstMs = ElapsedMs(start);
+
+	std::cout << "MemorySnapshot of " << bufferSize / (1 << 20) << "MB of heap, " << (snapshot.UsesSoftDirty() ? "with" : "without")
+	          << " soft-dirty bits:" << std::endl;
+	std::cout << "  First take: " << snapshot.GetPagesRead() << " pages read in " << firstMs << "ms" << std::endl;
+
+	// Every byte written is flipped, so each write is a change of exactly its own size.
+	for(size_t i=0; i<writtenCount; ++i)
+		for(size_t j=0; j<written[i].size; ++j)
+			buffer[written[i].offset + j] = static_cast<uint8_t>(~buffer[written[i].offset + j]);
+
+	start = BenchClock::now();
+	snapshot.Take();
+	double ms = ElapsedMs(start);
+
+	std::cout << "  After " << writtenCount << " writes: " << snapshot.GetChanges(0).size() << " changes, " << snapshot.GetPagesRead()
+	          << " pages read in " << ms << "ms" << std::endl;
+	if(!CheckChanges(snapshot, written, writtenCount))
+	{
+		std::cout << "  The changes found don't match what was written" << std::endl;
+		std::abort();
+	}
+
+	start = BenchClock::now();
+	snapshot.Take();
+	ms = ElapsedMs(start);
+
+	std::cout << "  With nothing written: " << snapshot.GetChanges(0).size() << " changes, " << snapshot.GetPagesRead() << " pages read in "
+	          << ms << "ms" << std::endl;
+	if(!CheckChanges(snapshot, nullptr, 0))
+	{
+		std::cout << "  Changes were found where nothing was written" << std::endl;
+		std::abort();
+	}
+}
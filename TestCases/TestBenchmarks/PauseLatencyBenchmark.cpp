@@ -0,0 +1,65 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include "SingleThreadBlock.h"
+#include "ThreadRegistry.h"
+#include "Benchmarks.h"
+
+static const unsigned threadCounts[] = { 1, 16, 64, 256, 512 };
+static const unsigned pausesPerCount = 200;
+
+// Idle workers waking every 10 milliseconds, which is what most of the threads in a server look like.
+static void IdleWorker(const std::atomic<bool> *stop)
+{
+	while(!*stop)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+}
+
+static void BenchPauses(const char *method)
+{
+	for(unsigned i=0; i<sizeof(threadCounts)/sizeof(threadCounts[0]); ++i)
+	{
+		std::atomic<bool> stop(false);
+		std::vector<std::thread> workers;
+		for(unsigned t=0; t<threadCounts[i]; ++t)
+			workers.push_back(std::thread(IdleWorker, &stop));
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+		std::vector<double> pauses;
+		pauses.reserve(pausesPerCount);
+		for(unsigned p=0; p<pausesPerCount; ++p)
+		{
+			BenchClock::time_point start = BenchClock::now();
+			{
+				SingleThreadBlock pauseThreads;
+			}
+			pauses.push_back(ElapsedMs(start) * 1000.0);
+		}
+
+		stop = true;
+		for(auto it = workers.begin(); it != workers.end(); ++it)
+			it->join();
+
+		std::sort(pauses.begin(), pauses.end());
+		double total = 0;
+		for(auto it = pauses.begin(); it != pauses.end(); ++it)
+			total += *it;
+
+		std::cout << "Pause and resume (" << method << ") with " << threadCounts[i] << " threads: mean " << total / pauses.size()
+		          << "us, p50 " << pauses[pauses.size() / 2] << "us, p99 " << pauses[pauses.size() * 99 / 100]
+		          << "us, max " << pauses.back() << "us" << std::endl;
+	}
+}
+
+void BenchPauseLatency()
+{
+	BenchPauses("enumerated");
+
+	// Tracking can't be turned back off, so Main runs this last.
+	ThreadRegistry::Get()->Enable();
+	BenchPauses("registry");
+}
@@ -0,0 +1,52 @@
+#include <iostream>
+#include <vector>
+#include <cstddef>
+#include "RemoteGraph.h"
+#include "Benchmarks.h"
+
+static const unsigned treeSize = 10000;
+
+struct TreeNode
+{
+	int value;
+	RemotePtr<TreeNode> left;
+	RemotePtr<TreeNode> right;
+};
+
+void BenchRemoteGraph()
+{
+	std::vector<TreeNode> tree(treeSize);
+	for(unsigned i=0; i<treeSize; ++i)
+	{
+		tree[i].value = i;
+		tree[i].left  = 2*i + 1 < treeSize ? &tree[2*i + 1] : nullptr;
+		tree[i].right = 2*i + 2 < treeSize ? &tree[2*i + 2] : nullptr;
+	}
+
+	std::cout << "Walking a tree of " << treeSize << " nodes:" << std::endl;
+
+	// A read per node, following each pointer as it's found.
+	ProcessMemory memory(0, true);
+	std::vector<RemotePtr<TreeNode>> queue(1, RemotePtr<TreeNode>(tree.data()));
+	BenchClock::time_point start = BenchClock::now();
+	for(size_t i=0; i<queue.size(); ++i)
+	{
+		TreeNode node = queue[i].Read(memory);
+		if(!node.left.IsNull())
+			queue.push_back(node.left);
+		if(!node.right.IsNull())
+			queue.push_back(node.right);
+	}
+	double ms = ElapsedMs(start);
+	std::cout << "  Read per node: " << queue.size() << " reads in " << ms << "ms" << std::endl;
+
+	RemoteGraph graph;
+	unsigned type = graph.AddType<TreeNode>();
+	graph.AddEdge(type, offsetof(TreeNode, left), type);
+	graph.AddEdge(type, offsetof(TreeNode, right), type);
+
+	start = BenchClock::now();
+	graph.Walk(tree.data(), type);
+	ms = ElapsedMs(start);
+	std::cout << "  RemoteGraph: " << graph.GetStats().reads << " reads of " << graph.GetStats().levels << " levels in " << ms << "ms" << std::endl;
+}
@@ -0,0 +1,45 @@
+#include <iostream>
+#include <vector>
+#include <Windows.h>
+#include "RemoteVariable.h"
+#include "Benchmarks.h"
+
+static const unsigned cycles = 1000000;
+
+void BenchRemoteVariables()
+{
+	unsigned procId = GetCurrentProcessId();
+
+	// Warm up the per process memory manager so its creation isn't timed.
+	{
+		RemoteU32 warmUp(procId, 0u);
+	}
+
+	BenchClock::time_point start = BenchClock::now();
+	for(unsigned i=0; i<cycles; ++i)
+	{
+		RemoteU32 var(procId, i);
+	}
+	double singleMs = ElapsedMs(start);
+
+	std::cout << "RemoteVariable create/destroy: " << cycles << " cycles in " << singleMs << "ms ("
+	          << singleMs * 1000000.0 / cycles << "ns/cycle)" << std::endl;
+
+	// Same again with many variables alive, so free lists have real depth to them.
+	std::vector<RemoteU32> live;
+	live.reserve(cycles / 100);
+
+	start = BenchClock::now();
+	for(unsigned i=0; i<cycles; ++i)
+	{
+		if(live.size() == cycles / 100)
+			live.clear();
+
+		live.push_back(RemoteU32(procId, i));
+	}
+	live.clear();
+	double batchMs = ElapsedMs(start);
+
+	std::cout << "RemoteVariable create/destroy with " << cycles / 100 << " live: " << cycles << " cycles in " << batchMs << "ms ("
+	          << batchMs * 1000000.0 / cycles << "ns/cycle)" << std::endl;
+}
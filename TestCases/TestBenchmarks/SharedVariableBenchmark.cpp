@@ -0,0 +1,53 @@
+#include <iostream>
+#include <cstdint>
+#include <Windows.h>
+#include "RemoteCode.h"
+#include "RemoteVariable.h"
+#include "Benchmarks.h"
+
+static const unsigned reads = 1000000;
+
+// Reading a variable shared with a process against copying it out with ReadProcessMemory, the
+// cost every read of an unshared remote variable has. This process stands in for the remote
+// one; ReadProcessMemory goes through the kernel just the same.
+void BenchSharedVariables()
+{
+	unsigned procId = GetCurrentProcessId();
+
+	RemoteCode code(procId);
+	if(!code.ShareVariables())
+	{
+		std::cout << "Shared variables: couldn't map shared memory" << std::endl;
+		return;
+	}
+
+	RemoteU32 flag(procId, 1u);
+	if(!flag.IsShared())
+		return;
+
+	HANDLE process = OpenProcess(PROCESS_VM_READ, FALSE, procId);
+	if(!process)
+		return;
+
+	volatile uint32_t value = 1;
+	uint32_t sum = 0;
+
+	BenchClock::time_point start = BenchClock::now();
+	for(unsigned i=0; i<reads; ++i)
+		sum += (uint32_t)flag;
+	double sharedMs = ElapsedMs(start);
+
+	start = BenchClock::now();
+	for(unsigned i=0; i<reads; ++i)
+	{
+		uint32_t copy = 0;
+		ReadProcessMemory(process, const_cast<uint32_t*>(&value), &copy, sizeof(copy), NULL);
+		sum += copy;
+	}
+	double copyMs = ElapsedMs(start);
+
+	CloseHandle(process);
+
+	std::cout << "Shared variable read: " << sharedMs * 1000000.0 / reads << "ns, ReadProcessMemory: "
+	          << copyMs * 1000000.0 / reads << "ns (" << sum << ")" << std::endl;
+}
@@ -0,0 +1,87 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cstdint>
+#include "ModuleExplorer.h"
+#include "SignatureScanner.h"
+#include "Benchmarks.h"
+
+static const unsigned scanRepeats = 10;
+static const unsigned signatureCounts[] = { 1, 16, 256 };
+
+// Signatures cut from the code itself, with every fourth byte or so a wildcard, as where an
+// address or offset would be.
+static void AddSignatures(SignatureScanner& scanner, const uint8_t *code, size_t size, unsigned count)
+{
+	std::mt19937 rng(1);
+	while(scanner.GetCount() < count)
+	{
+		size_t length = 12 + rng() % 20;
+		const uint8_t *start = code + rng() % (size - length);
+
+		std::vector<uint8_t> mask(length, 0xFF);
+		for(size_t i=0; i<length; ++i)
+			if(rng() % 4 == 0)
+				mask[i] = 0;
+
+		try
+		{
+			scanner.Add(start, mask.data(), length);
+		}
+		catch(...)
+		{
+		}
+	}
+}
+
+void BenchSignatureScan()
+{
+	ModuleExplorer explorer;
+	ModuleExplorer::Modules modules = explorer.GetModules();
+
+	// The module with the largest executable section.
+	const uint8_t *code = nullptr;
+	size_t size = 0;
+	for(ModuleExplorer::Modules::iterator modIt = modules.begin(); modIt != modules.end(); ++modIt)
+	{
+		Module::Ranges ranges = modIt->GetCodeRanges();
+		for(Module::Ranges::iterator it = ranges.begin(); it != ranges.end(); ++it)
+		{
+			if(it->second > size)
+			{
+				code = static_cast<const uint8_t*>(it->first);
+				size = it->second;
+			}
+		}
+	}
+
+	if(!code)
+		return;
+
+	std::cout << "SignatureScanner over " << size / 1024 << "KB of code:" << std::endl;
+
+	const char *simdNames[] = { "scalar", "SSE4.2", "AVX2" };
+	for(size_t c=0; c<sizeof(signatureCounts)/sizeof(signatureCounts[0]); ++c)
+	{
+		SignatureScanner scanner;
+		AddSignatures(scanner, code, size, signatureCounts[c]);
+
+		std::cout << "  " << signatureCounts[c] << " signatures:";
+		for(int level = SignatureScanner::SIMD_NONE; level <= SignatureScanner::GetSupportedSimd(); ++level)
+		{
+			scanner.SetSimd(static_cast<SignatureScanner::SimdLevel>(level));
+
+			SignatureScanner::Matches matches;
+			BenchClock::time_point start = BenchClock::now();
+			for(unsigned r=0; r<scanRepeats; ++r)
+			{
+				matches.clear();
+				scanner.Scan(code, size, matches);
+			}
+			double ms = ElapsedMs(start) / scanRepeats;
+
+			std::cout << " " << simdNames[level] << " " << size / (ms * 1e6) << "GB/s";
+		}
+		std::cout << std::endl;
+	}
+}
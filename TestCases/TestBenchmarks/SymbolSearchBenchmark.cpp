@@ -0,0 +1,78 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "SymbolFinder.h"
+#include "SymbolSearch.h"
+#include "Benchmarks.h"
+
+static const unsigned symbolCount = 500000;
+static const unsigned queryRepeats = 100;
+
+static const char *const methods[] = { "Allocate", "Free", "Update", "Render", "Resize", "Flush", "Find", "Insert" };
+
+// C++ method names, mangled the way this compiler would, spread over many namespaces and classes.
+static std::vector<std::string> MakeNames()
+{
+	std::vector<std::string> names;
+	names.reserve(symbolCount);
+
+	for(unsigned i=0; i<symbolCount; ++i)
+	{
+		std::ostringstream nsName, className, methodName;
+		nsName << "ns" << i % 97;
+		className << "Class" << i / 8 % 5003;
+		methodName << methods[i % 8] << i / 40000;
+
+		std::ostringstream name;
+#ifdef _MSC_VER
+		name << '?' << methodName.str() << '@' << className.str() << '@' << nsName.str() << "@@QEAAPEAX" << (i % 3 ? "I" : "H") << "@Z";
+#else
+		name << "_ZN" << nsName.str().size() << nsName.str() << className.str().size() << className.str()
+		     << methodName.str().size() << methodName.str() << 'E' << (i % 3 ? "j" : "i");
+#endif
+		names.push_back(name.str());
+	}
+
+	return names;
+}
+
+void BenchSymbolSearch()
+{
+	std::vector<std::string> names = MakeNames();
+
+	SymbolSearch::Symbols symbols;
+	symbols.reserve(names.size());
+	for(size_t i=0; i<names.size(); ++i)
+		symbols.push_back(std::make_pair(names[i].c_str(), reinterpret_cast<const void*>(i * 16)));
+
+	BenchClock::time_point start = BenchClock::now();
+	SymbolSearch search(symbols);
+	double buildMs = ElapsedMs(start);
+
+	std::cout << "SymbolSearch over " << search.GetCount() << " symbols: built in " << buildMs << "ms" << std::endl;
+
+	const char *patterns[] = { "*::Class42::Allocate*(unsigned*", "ns3::Class17*", "*Resize7*", "*Class4999*", "_ZN4ns12*" };
+	for(size_t p=0; p<sizeof(patterns)/sizeof(patterns[0]); ++p)
+	{
+		std::vector<unsigned> matches;
+		start = BenchClock::now();
+		for(unsigned r=0; r<queryRepeats; ++r)
+		{
+			matches.clear();
+			search.Find(patterns[p], matches);
+		}
+		double indexedUs = ElapsedMs(start) * 1000.0 / queryRepeats;
+
+		// What a query costs without the index: every name and its demangled form compared.
+		size_t scanned = 0;
+		start = BenchClock::now();
+		for(unsigned i=0; i<search.GetCount(); ++i)
+			if(SymbolFinder::MatchesPattern(patterns[p], search.GetName(i)) || SymbolFinder::MatchesPattern(patterns[p], search.GetDemangledName(i)))
+				++scanned;
+		double scanUs = ElapsedMs(start) * 1000.0;
+
+		std::cout << "  \"" << patterns[p] << "\": " << matches.size() << " matches in " << indexedUs << "us (" << scanned
+		          << " in " << scanUs << "us scanning every name)" << std::endl;
+	}
+}
@@ -0,0 +1,87 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cstddef>
+#include "ModuleExplorer.h"
+#include "SymbolFinder.h"
+#include "SymbolFinderManager.h"
+#include "Benchmarks.h"
+
+#ifndef WIN32
+# include "SymbolIndex.h"
+#endif
+
+static const unsigned addressCount = 1000000;
+
+// Addresses spread evenly over every module, like the samples of a profiler.
+static std::vector<const void*> SampleAddresses(const ModuleExplorer::Modules& modules)
+{
+	std::vector<const void*> addrs;
+	addrs.reserve(addressCount);
+
+	std::mt19937 rng(1);
+	for(unsigned i=0; i<addressCount; ++i)
+	{
+		const Module& mod = modules[rng() % modules.size()];
+		addrs.push_back(static_cast<const unsigned char*>(mod.GetAddress()) + rng() % mod.GetSize());
+	}
+
+	return addrs;
+}
+
+void BenchSymbolization()
+{
+	const SymbolFinder *finder = SymbolFinderManager::Get();
+
+	ModuleExplorer explorer;
+	ModuleExplorer::Modules modules = explorer.GetModules();
+	if(modules.empty())
+	{
+		std::cout << "Symbolization: no modules found" << std::endl;
+		return;
+	}
+
+	std::vector<const void*> addrs = SampleAddresses(modules);
+
+	// The first lookup in each module builds its index. Time that on its own.
+	BenchClock::time_point start = BenchClock::now();
+	for(ModuleExplorer::Modules::iterator modIt = modules.begin(); modIt != modules.end(); ++modIt)
+		finder->GetSymbolName(modIt->GetAddress());
+	double buildMs = ElapsedMs(start);
+
+	unsigned found = 0;
+	start = BenchClock::now();
+	for(std::vector<const void*>::iterator addrIt = addrs.begin(); addrIt != addrs.end(); ++addrIt)
+		if(!finder->GetSymbolName(*addrIt).empty())
+			++found;
+	double lookupMs = ElapsedMs(start);
+
+	std::cout << "Symbolization over " << modules.size() << " modules: first lookups " << buildMs << "ms, then "
+	          << addrs.size() / lookupMs / 1000.0 << "M addresses/s through GetSymbolName (" << found << " in a function)" << std::endl;
+
+#ifndef WIN32
+	// Straight to each module's index, without building a std::string per address.
+	std::vector<const SymbolIndex*> indices;
+	for(ModuleExplorer::Modules::iterator modIt = modules.begin(); modIt != modules.end(); ++modIt)
+		indices.push_back(modIt->GetSymbolIndex());
+
+	found = 0;
+	start = BenchClock::now();
+	for(std::vector<const void*>::iterator addrIt = addrs.begin(); addrIt != addrs.end(); ++addrIt)
+	{
+		for(size_t i=0; i<modules.size(); ++i)
+		{
+			if(!modules[i].Contains(*addrIt))
+				continue;
+
+			size_t offset;
+			if(indices[i] && indices[i]->Find(*addrIt, &offset))
+				++found;
+			break;
+		}
+	}
+	lookupMs = ElapsedMs(start);
+
+	std::cout << "  SymbolIndex::Find: " << addrs.size() / lookupMs / 1000.0 << "M addresses/s (" << found << " in a function)" << std::endl;
+#endif
+}